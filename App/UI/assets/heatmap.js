@@ -0,0 +1,271 @@
+// Heat map renderer for the temperature matrix.
+//
+// Draws a frame into a <canvas> by writing an ImageData through a
+// 256-entry colour table (HEATMAP_PALETTE), optionally upscaled with
+// bilinear interpolation, instead of building one <div> per cell. A frame
+// is only drawn when its version differs from the one on screen.
+//
+// Everything but HeatmapRenderer works without the DOM and is loaded into
+// heatmap_worker.js with importScripts(), which decodes binary frames
+// (heatmapDecode) and rasterises them off the main thread.
+
+// Pixel value of a missing ("ERR") cell in int16 frames
+const HEATMAP_MISSING = -32768;
+
+// Palette index of a missing cell; the others scale from min (0) to max (254)
+const HEATMAP_MISSING_INDEX = 255;
+
+// Frame times kept for HeatmapRenderer.stats()
+const HEATMAP_STATS_FRAMES = 240;
+
+// Binary frames (/api/frame.bin, "frame" events of /api/stream?frames=binary):
+// a little-endian header of uint32 version, float64 time, uint8 rows,
+// uint8 cols, uint8 decimals and 1 byte padding, then rows * cols int16
+// pixels in row order, in 10^-decimals degrees
+const HEATMAP_FRAME_HEADER_BYTES = 16;
+
+const HEATMAP_LITTLE_ENDIAN = new Uint8Array(new Uint32Array([1]).buffer)[0] === 1;
+
+// Blue (cold) to red (hot) like the hsl(240..0, 100%, 50%) cells before,
+// as ImageData pixels in the platform's byte order, grey for missing cells
+function heatmapPalette() {
+    const palette = new Uint32Array(256);
+    const pack = (r, g, b) => HEATMAP_LITTLE_ENDIAN
+        ? ((255 << 24) | (b << 16) | (g << 8) | r) >>> 0
+        : ((r << 24) | (g << 16) | (b << 8) | 255) >>> 0;
+    for (let i = 0; i < HEATMAP_MISSING_INDEX; i++) {
+        const hue = (1 - i / (HEATMAP_MISSING_INDEX - 1)) * 240;
+        // hsl(hue, 100%, 50%)
+        const channel = (n) => {
+            const k = (n + hue / 30) % 12;
+            return Math.round(255 * (0.5 - 0.5 * Math.max(-1, Math.min(k - 3, 9 - k, 1))));
+        };
+        palette[i] = pack(channel(0), channel(8), channel(4));
+    }
+    palette[HEATMAP_MISSING_INDEX] = pack(0x44, 0x44, 0x44);
+    return palette;
+}
+
+// Scale a frame's values (null or HEATMAP_MISSING for missing cells) to
+// palette indices between its own min and max. Returns {indices, min, max}.
+function heatmapIndices(values, out) {
+    const count = values.length;
+    const indices = out && out.length === count ? out : new Uint8Array(count);
+    let min = Infinity, max = -Infinity;
+    for (let i = 0; i < count; i++) {
+        const v = values[i];
+        if (v === null || v === HEATMAP_MISSING) continue;
+        if (v < min) min = v;
+        if (v > max) max = v;
+    }
+    // A flat frame shows as all cold, like an empty range did before
+    const scale = max > min ? (HEATMAP_MISSING_INDEX - 1) / (max - min) : 0;
+    for (let i = 0; i < count; i++) {
+        const v = values[i];
+        indices[i] = v === null || v === HEATMAP_MISSING
+            ? HEATMAP_MISSING_INDEX
+            : Math.round((v - min) * scale);
+    }
+    return { indices, min, max };
+}
+
+// A binary frame (ArrayBuffer) as {version, time, rows, cols, scale, values},
+// values an Int16Array over the buffer, scale what they are divided by to
+// get degrees; null if it is cut short
+function heatmapDecode(buffer) {
+    if (buffer.byteLength < HEATMAP_FRAME_HEADER_BYTES) return null;
+    const header = new DataView(buffer, 0, HEATMAP_FRAME_HEADER_BYTES);
+    const rows = header.getUint8(12), cols = header.getUint8(13);
+    if (buffer.byteLength < HEATMAP_FRAME_HEADER_BYTES + rows * cols * 2) return null;
+    let values;
+    if (HEATMAP_LITTLE_ENDIAN) {
+        values = new Int16Array(buffer, HEATMAP_FRAME_HEADER_BYTES, rows * cols);
+    } else {
+        const data = new DataView(buffer, HEATMAP_FRAME_HEADER_BYTES);
+        values = Int16Array.from({ length: rows * cols }, (_, i) => data.getInt16(2 * i, true));
+    }
+    return {
+        version: header.getUint32(0, true),
+        time: header.getFloat64(4, true),
+        rows, cols, values,
+        scale: 10 ** header.getUint8(14),
+    };
+}
+
+// A binary frame sent as base64 text, e.g. in a Server-Sent Event
+function heatmapDecodeBase64(text) {
+    const bytes = atob(text);
+    const buffer = new Uint8Array(bytes.length);
+    for (let i = 0; i < bytes.length; i++) buffer[i] = bytes.charCodeAt(i);
+    return heatmapDecode(buffer.buffer);
+}
+
+// Turns palette indices into ImageData pixels, upscaled by upscale canvas
+// pixels per cell; the part of HeatmapRenderer a worker can run
+class HeatmapRaster {
+    constructor(options = {}) {
+        this.upscale = Math.max(1, Math.floor(options.upscale || 1));
+        this.palette = options.palette || HEATMAP_PALETTE;
+        this.rows = 0;
+        this.cols = 0;
+        this.width = 0;
+        this.height = 0;
+    }
+
+    resize(rows, cols) {
+        if (rows === this.rows && cols === this.cols) return false;
+        this.rows = rows;
+        this.cols = cols;
+        this.width = cols * this.upscale;
+        this.height = rows * this.upscale;
+
+        // Source cells and weights of every output column and row
+        const axis = (cells, size) => {
+            const first = new Uint16Array(size), second = new Uint16Array(size);
+            const weight = new Float32Array(size);
+            for (let o = 0; o < size; o++) {
+                const s = Math.min(Math.max((o + 0.5) / this.upscale - 0.5, 0), cells - 1);
+                first[o] = Math.floor(s);
+                second[o] = Math.min(first[o] + 1, cells - 1);
+                weight[o] = s - first[o];
+            }
+            return { first, second, weight };
+        };
+        this.xs = axis(cols, this.width);
+        this.ys = axis(rows, this.height);
+        return true;
+    }
+
+    // Fill pixels (a Uint32Array of width * height) from a frame's indices
+    render(indices, pixels) {
+        if (this.upscale === 1) {
+            const palette = this.palette;
+            for (let i = 0; i < indices.length; i++) {
+                pixels[i] = palette[indices[i]];
+            }
+        } else {
+            this.interpolate(indices, pixels);
+        }
+        return pixels;
+    }
+
+    // Bilinear upscale in palette index space, which is linear in
+    // temperature; next to a missing cell the nearest cell is used
+    interpolate(indices, pixels) {
+        const { first: x0s, second: x1s, weight: wxs } = this.xs;
+        const { first: y0s, second: y1s, weight: wys } = this.ys;
+        const palette = this.palette, cols = this.cols;
+        const width = x0s.length;
+        let out = 0;
+        for (let y = 0; y < y0s.length; y++) {
+            const row0 = y0s[y] * cols, row1 = y1s[y] * cols, wy = wys[y];
+            for (let x = 0; x < width; x++, out++) {
+                const x0 = x0s[x], x1 = x1s[x], wx = wxs[x];
+                const a = indices[row0 + x0], b = indices[row0 + x1];
+                const c = indices[row1 + x0], d = indices[row1 + x1];
+                if (a === HEATMAP_MISSING_INDEX || b === HEATMAP_MISSING_INDEX
+                    || c === HEATMAP_MISSING_INDEX || d === HEATMAP_MISSING_INDEX) {
+                    pixels[out] = palette[indices[(wy < 0.5 ? row0 : row1) + (wx < 0.5 ? x0 : x1)]];
+                    continue;
+                }
+                const top = a + (b - a) * wx, bottom = c + (d - c) * wx;
+                pixels[out] = palette[(top + (bottom - top) * wy + 0.5) | 0];
+            }
+        }
+    }
+}
+
+class HeatmapRenderer {
+    // upscale: canvas pixels per cell, interpolated bilinearly when above 1
+    constructor(canvas, options = {}) {
+        this.canvas = canvas;
+        this.context = canvas.getContext('2d');
+        this.raster = new HeatmapRaster(options);
+        this.version = undefined;
+        this.image = null;
+        this.indices = null;
+        this.times = [];
+        this.drawn = 0;
+        this.skipped = 0;
+    }
+
+    get upscale() {
+        return this.raster.upscale;
+    }
+
+    // Draw {version, rows, cols} with either values (flat, in row order) or
+    // indices (already scaled). Returns whether it drew.
+    draw(frame) {
+        if (this.isShown(frame)) return false;
+        const start = performance.now();
+        this.resize(frame.rows, frame.cols);
+        const indices = frame.indices || heatmapIndices(frame.values, this.indices).indices;
+        this.indices = indices;
+        this.raster.render(indices, this.pixels);
+        this.context.putImageData(this.image, 0, 0);
+        this.shown(frame, start);
+        return true;
+    }
+
+    // Draw a matrix as parsed by the server (rows of numbers and nulls)
+    drawMatrix(matrix, version) {
+        if (!matrix || !matrix.length || !matrix[0].length) return false;
+        return this.draw({ version, rows: matrix.length, cols: matrix[0].length, values: matrix.flat() });
+    }
+
+    // Draw {version, width, height, buffer} with the ImageData pixels
+    // already rendered, by heatmap_worker.js. Returns whether it drew.
+    drawPixels(frame) {
+        if (this.isShown(frame)) return false;
+        const start = performance.now();
+        if (this.canvas.width !== frame.width || this.canvas.height !== frame.height) {
+            this.canvas.width = frame.width;
+            this.canvas.height = frame.height;
+            this.image = null;
+        }
+        const image = new ImageData(new Uint8ClampedArray(frame.buffer), frame.width, frame.height);
+        this.context.putImageData(image, 0, 0);
+        this.shown(frame, start);
+        return true;
+    }
+
+    isShown(frame) {
+        if (frame.version !== undefined && frame.version === this.version) {
+            this.skipped++;
+            return true;
+        }
+        return false;
+    }
+
+    shown(frame, start) {
+        this.version = frame.version;
+        this.drawn++;
+        this.times.push(performance.now() - start);
+        if (this.times.length > HEATMAP_STATS_FRAMES) this.times.shift();
+    }
+
+    resize(rows, cols) {
+        if (!this.raster.resize(rows, cols) && this.image) return;
+        this.canvas.width = this.raster.width;
+        this.canvas.height = this.raster.height;
+        this.image = this.context.createImageData(this.raster.width, this.raster.height);
+        this.pixels = new Uint32Array(this.image.data.buffer);
+        this.indices = null;
+    }
+
+    // Draw times of the last HEATMAP_STATS_FRAMES frames in milliseconds
+    stats() {
+        const sorted = [...this.times].sort((a, b) => a - b);
+        const at = (q) => sorted.length ? sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * q))] : 0;
+        return {
+            drawn: this.drawn,
+            skipped: this.skipped,
+            avg_ms: sorted.length ? sorted.reduce((a, b) => a + b, 0) / sorted.length : 0,
+            p50_ms: at(0.5),
+            p95_ms: at(0.95),
+            max_ms: sorted.length ? sorted[sorted.length - 1] : 0,
+        };
+    }
+}
+
+const HEATMAP_PALETTE = heatmapPalette();
@@ -0,0 +1,77 @@
+// Decodes binary frames and rasterises them off the main thread.
+//
+// Messages in:
+//   {type: 'init', upscale}           canvas pixels per cell, as HeatmapRenderer
+//   {type: 'base64', data}            a frame event of /api/stream?frames=binary
+//   {type: 'fetch', url}              GET a /api/frame.bin URL; ?since= is added
+//   {type: 'release', buffer}         a pixel buffer the page is done with
+// Messages out:
+//   {type: 'frame', version, time, rows, cols, min, max, width, height, buffer}
+//       min and max in degrees
+//       buffer holds the ImageData pixels and is transferred, not copied;
+//       send it back with 'release' once drawn so it is reused
+//   {type: 'error', message}
+
+importScripts('heatmap.js');
+
+let raster = new HeatmapRaster();
+let indices = null;
+let version = -1;       // Newest frame rendered, older ones are dropped
+const spare = [];       // Returned pixel buffers of the current size
+
+function render(frame) {
+    if (!frame) {
+        postMessage({ type: 'error', message: 'Truncated frame' });
+        return;
+    }
+    if (frame.version <= version) return;
+    version = frame.version;
+    // No matrix yet, or it was reset
+    if (!frame.rows || !frame.cols) return;
+
+    if (raster.resize(frame.rows, frame.cols)) spare.length = 0;
+    const scaled = heatmapIndices(frame.values, indices);
+    indices = scaled.indices;
+    const bytes = raster.width * raster.height * 4;
+    const buffer = spare.pop() || new ArrayBuffer(bytes);
+    raster.render(indices, new Uint32Array(buffer));
+
+    postMessage({
+        type: 'frame', version: frame.version, time: frame.time,
+        rows: frame.rows, cols: frame.cols, min: scaled.min / frame.scale, max: scaled.max / frame.scale,
+        width: raster.width, height: raster.height, buffer,
+    }, [buffer]);
+}
+
+async function fetchFrame(url) {
+    try {
+        // 204 means the frame we have is still the newest
+        const separator = url.includes('?') ? '&' : '?';
+        const response = await fetch(`${url}${separator}since=${Math.max(version, 0)}`);
+        if (response.status === 204) return;
+        if (!response.ok) throw new Error(`HTTP ${response.status}`);
+        render(heatmapDecode(await response.arrayBuffer()));
+    } catch (error) {
+        postMessage({ type: 'error', message: `Error fetching frame: ${error.message}` });
+    }
+}
+
+onmessage = (event) => {
+    const message = event.data;
+    switch (message.type) {
+    case 'init':
+        raster = new HeatmapRaster({ upscale: message.upscale });
+        spare.length = 0;
+        version = -1;
+        break;
+    case 'base64':
+        render(heatmapDecodeBase64(message.data));
+        break;
+    case 'fetch':
+        fetchFrame(message.url);
+        break;
+    case 'release':
+        if (message.buffer.byteLength === raster.width * raster.height * 4) spare.push(message.buffer);
+        break;
+    }
+};
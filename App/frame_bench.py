@@ -0,0 +1,135 @@
+"""Benchmark of the frame history (frame_store.py).
+
+Fills a store with days of 15x16 frames at 4 Hz, then measures range
+queries over it, live ingest through append() and a compaction run:
+
+    python frame_bench.py                       # 14 days in a temporary directory
+    python frame_bench.py --days 30 --dir /var/tmp/frames
+
+It prints
+
+    FRAMES fill days=<n> frames=<n> segments=<n> mb=<n> open_ms=<n>
+    FRAMES query span=<1h|1d|7d|all> limit=<n> returned=<n> p50_ms=<n> p99_ms=<n>
+    FRAMES count span=<...> p50_ms=<n>
+    FRAMES ingest frames=<n> frames_s=<n> append_us_p50=<n> append_us_p99=<n> dropped=<n>
+    FRAMES compact seconds=<n> frames_before=<n> frames_after=<n> mb_after=<n>
+
+Queries pick random ranges of the span and ask for at most limit evenly
+spaced frames, the way the history view does.
+"""
+import argparse
+import array
+import random
+import shutil
+import sys
+import tempfile
+import time
+
+import frame_store
+from serial_bench import percentile
+
+ROWS, COLS = 15, 16
+RATE = 4.0                  # Frames per second of a unit in alert mode
+QUERIES = 200
+
+def make_frames(count):
+    """A few different frames: a room with a hot spot that wanders"""
+    frames = []
+    for k in range(count):
+        hot = (k * 3 % ROWS, k * 5 % COLS)
+        frames.append([[65 if (i, j) == hot else 22 + (i + j + k) % 5 for j in range(COLS)]
+                       for i in range(ROWS)])
+    return frames
+
+def fill(directory, start, days):
+    """Write days of frames straight to segment files, the way the writer
+    thread lays them out"""
+    records = []
+    for k, matrix in enumerate(make_frames(64)):
+        flags = frame_store.FLAG_ALERT if k % 16 == 0 else 0
+        records.append(array.array("h", [flags]).tobytes() + frame_store.to_pixels(matrix).tobytes())
+    total = int(days * frame_store.DAY * RATE)
+    step = 1000 / RATE
+    for first in range(0, total, frame_store.SEGMENT_FRAMES):
+        count = min(frame_store.SEGMENT_FRAMES, total - first)
+        segment = frame_store.Segment(directory, int(start * 1000 + first * step), ROWS, COLS)
+        segment.create()
+        with open(segment.data_path, "ab") as data:
+            data.write(b"".join(records[(first + i) % len(records)] for i in range(count)))
+        times = array.array("q", (int(start * 1000 + (first + i) * step) for i in range(count)))
+        with open(segment.index_path, "ab") as index:
+            index.write(times.tobytes())
+    return total
+
+def timed(function, *args):
+    started = time.perf_counter()
+    result = function(*args)
+    return time.perf_counter() - started, result
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard frame history benchmark")
+    parser.add_argument("--days", type=float, default=14.0, help="days of 4 Hz frames to fill in")
+    parser.add_argument("--dir", help="store directory (default: a temporary one, removed after)")
+    parser.add_argument("--limit", type=int, default=500, help="frames per query")
+    parser.add_argument("--ingest", type=int, default=50000, help="frames to append live")
+    args = parser.parse_args()
+
+    directory = args.dir or tempfile.mkdtemp(prefix="fireguard_frames_")
+    try:
+        now = time.time()
+        start = now - args.days * frame_store.DAY
+        total = fill(directory, start, args.days)
+
+        opened, store = timed(frame_store.FrameStore, directory)
+        stats = store.stats()
+        print(f"FRAMES fill days={args.days:g} frames={total} segments={stats['segments']} "
+              f"mb={stats['bytes'] / 1e6:.0f} open_ms={opened * 1000:.1f}")
+
+        rng = random.Random(1)
+        spans = [("1h", 3600.0), ("1d", frame_store.DAY), ("7d", 7 * frame_store.DAY),
+                 ("all", args.days * frame_store.DAY)]
+        for name, span in spans:
+            if span > args.days * frame_store.DAY:
+                continue
+            query_times, count_times, returned = [], [], 0
+            for _ in range(QUERIES):
+                begin = start + rng.random() * (args.days * frame_store.DAY - span)
+                elapsed, frames = timed(store.range, begin, begin + span, args.limit)
+                query_times.append(elapsed)
+                returned = max(returned, len(frames))
+                count_times.append(timed(store.count, begin, begin + span)[0])
+            print(f"FRAMES query span={name} limit={args.limit} returned={returned} "
+                  f"p50_ms={percentile(query_times, 0.5) * 1000:.2f} "
+                  f"p99_ms={percentile(query_times, 0.99) * 1000:.2f}")
+            print(f"FRAMES count span={name} p50_ms={percentile(count_times, 0.5) * 1000:.3f}")
+
+        # Live frames in bursts of half the queue, so none are dropped: the
+        # writer's throughput, and how long append() keeps the caller
+        frames = make_frames(16)
+        append_times = []
+        started = time.perf_counter()
+        for i in range(args.ingest):
+            call = time.perf_counter()
+            store.append(now + i / RATE, frames[i % len(frames)])
+            append_times.append(time.perf_counter() - call)
+            if i % (frame_store.QUEUE_SIZE // 2) == 0:
+                store.flush()
+        store.flush()
+        elapsed = time.perf_counter() - started
+        print(f"FRAMES ingest frames={store.written} frames_s={store.written / elapsed:.0f} "
+              f"append_us_p50={percentile(append_times, 0.5) * 1e6:.1f} "
+              f"append_us_p99={percentile(append_times, 0.99) * 1e6:.1f} dropped={store.dropped}")
+
+        before = store.stats()["frames"]
+        elapsed, _ = timed(store.maintain, now + args.ingest / RATE)
+        after = store.stats()
+        print(f"FRAMES compact seconds={elapsed:.2f} frames_before={before} "
+              f"frames_after={after['frames']} mb_after={after['bytes'] / 1e6:.0f}")
+        store.close()
+    finally:
+        if not args.dir:
+            shutil.rmtree(directory, ignore_errors=True)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,441 @@
+"""Append-only on-disk history of temperature frames.
+
+A store is a directory of segments, each a pair of files named after the
+time of its first frame in milliseconds:
+
+    <start>.frm     FRAME_MAGIC, rows, cols, whether it was compacted and
+                    the pixels' decimals (SEGMENT_HEADER), then one record
+                    per frame: an int16 flags word and rows * cols int16
+                    pixels in 10^-decimals degrees
+    <start>.idx     the frames' times, int64 milliseconds, in order
+
+Records have a fixed size, so frame i of a segment sits at a known offset
+and a time range is found by binary search in the index. Sealed segments
+are memory-mapped for reads; the open one is mapped again when it grew.
+
+append() only queues the frame. A writer thread writes the queue out and
+starts a new segment after SEGMENT_FRAMES frames or SEGMENT_SECONDS, or
+when the frame shape or decimals change (whole degrees from the unit,
+two decimals for calibrated frames). It also deletes segments past the retention
+and compacts old ones: frames older than compact_after are thinned to one
+per compact_interval, keeping every frame flagged FLAG_ALERT, and
+neighbouring small segments are merged. When the writer falls behind,
+frames are dropped and counted rather than making the caller wait.
+"""
+import array
+import bisect
+import mmap
+import os
+import queue
+import struct
+import sys
+import threading
+import time
+
+FRAME_MAGIC = b"FGFRM1\n\0"
+SEGMENT_HEADER = struct.Struct("<8sBBBB4x") # magic, rows, cols, compacted, decimals
+MISSING = -32768                            # Pixel value stored for "ERR" (None)
+FLAG_ALERT = 1                              # Frame was taken during a fire alert
+
+SEGMENT_FRAMES = 14400          # Frames per segment, an hour at 4 Hz...
+SEGMENT_SECONDS = 3600.0        # ...or the frames of an hour, whichever is less
+QUEUE_SIZE = 1024               # Frames append() may get ahead of the writer
+MAINTENANCE_INTERVAL = 600.0    # Seconds between retention and compaction runs
+RETENTION_DAYS = 30.0
+COMPACT_AFTER_DAYS = 1.0        # Frames older than this are thinned...
+COMPACT_INTERVAL = 10.0         # ...to one per this many seconds
+
+DAY = 86400.0
+
+def to_pixels(matrix, scale=1):
+    """A matrix (list of rows, None for missing pixels) as an int16 array,
+    in 1/scale degrees"""
+    if scale != 1:
+        return array.array("h", [MISSING if v is None else max(-32767, min(32767, round(v * scale)))
+                                 for row in matrix for v in row])
+    return array.array("h", [MISSING if v is None else max(-32767, min(32767, int(v)))
+                             for row in matrix for v in row])
+
+def decimals(matrix):
+    """Decimals a matrix needs: 2 for calibrated float values, 0 for the
+    unit's whole degrees"""
+    return 2 if any(isinstance(v, float) for row in matrix for v in row) else 0
+
+def to_matrix(pixels, cols, decimals=0):
+    if decimals:
+        scale = 10 ** decimals
+        values = [None if v == MISSING else v / scale for v in pixels.tolist()]
+    else:
+        values = [None if v == MISSING else v for v in pixels.tolist()]
+    return [values[i:i + cols] for i in range(0, len(values), cols)]
+
+class Segment:
+    """One pair of segment files; holds maps of them while in use"""
+
+    def __init__(self, directory, start, rows, cols, compacted=False, decimals=0):
+        self.start = start
+        self.rows = rows
+        self.cols = cols
+        self.compacted = compacted
+        self.decimals = decimals
+        self.record = 2 * (1 + rows * cols)
+        self.data_path = os.path.join(directory, f"{start:013d}.frm")
+        self.index_path = os.path.join(directory, f"{start:013d}.idx")
+        self.count = 0
+        self.end = start
+        self.sealed = False
+        self.maps = None
+
+    @classmethod
+    def load(cls, directory, name):
+        """An existing segment, cut back to its last complete frame"""
+        start = int(name.split(".")[0])
+        data_path = os.path.join(directory, name)
+        with open(data_path, "rb") as f:
+            magic, rows, cols, compacted, decimals = SEGMENT_HEADER.unpack(f.read(SEGMENT_HEADER.size))
+        if magic != FRAME_MAGIC:
+            raise ValueError(f"{data_path} is not a frame segment")
+        segment = cls(directory, start, rows, cols, bool(compacted), decimals)
+        count = min((os.path.getsize(data_path) - SEGMENT_HEADER.size) // segment.record,
+                    os.path.getsize(segment.index_path) // 8)
+        # A crash can leave one file a frame ahead of the other
+        os.truncate(data_path, SEGMENT_HEADER.size + count * segment.record)
+        os.truncate(segment.index_path, count * 8)
+        segment.count = count
+        if count:
+            segment.end = segment.times()[count - 1]
+        segment.sealed = True
+        return segment
+
+    def create(self):
+        with open(self.data_path, "wb") as f:
+            f.write(SEGMENT_HEADER.pack(FRAME_MAGIC, self.rows, self.cols, self.compacted, self.decimals))
+        open(self.index_path, "wb").close()
+
+    def open_maps(self):
+        """Maps of the data and index, again if the segment grew since"""
+        maps = self.maps
+        if maps is None or maps[2] != self.count:
+            if self.count == 0:
+                return None
+            with open(self.data_path, "rb") as data, open(self.index_path, "rb") as index:
+                data_map = mmap.mmap(data.fileno(), 0, access=mmap.ACCESS_READ)
+                index_map = mmap.mmap(index.fileno(), 0, access=mmap.ACCESS_READ)
+            maps = (data_map, index_map, self.count)
+            self.maps = maps
+        return maps
+
+    def times(self):
+        """The index as a sequence of int64 milliseconds"""
+        maps = self.open_maps()
+        return memoryview(maps[1]).cast("q")[:maps[2]] if maps else []
+
+    def find(self, start, end):
+        """Maps and range [first, last) of the frames with start <= time <= end"""
+        maps = self.open_maps()
+        if maps is None:
+            return None, 0, 0
+        times = memoryview(maps[1]).cast("q")[:maps[2]]
+        return maps, bisect.bisect_left(times, start), bisect.bisect_right(times, end)
+
+    def frame(self, maps, i):
+        """(time ms, flags, pixels) of frame i, from maps returned by find()"""
+        data_map, index_map, _ = maps
+        offset = SEGMENT_HEADER.size + i * self.record
+        record = memoryview(data_map)[offset:offset + self.record].cast("h")
+        when = memoryview(index_map).cast("q")[i]
+        return when, record[0], record[1:]
+
+    def size(self):
+        return SEGMENT_HEADER.size + self.count * (self.record + 8)
+
+class FrameStore:
+    """Frame history of one unit in a directory (see the module doc)"""
+
+    def __init__(self, directory, retention_days=RETENTION_DAYS,
+                 compact_after_days=COMPACT_AFTER_DAYS, compact_interval=COMPACT_INTERVAL):
+        self.directory = directory
+        self.retention = retention_days * DAY
+        self.compact_after = compact_after_days * DAY
+        self.compact_interval = compact_interval
+        os.makedirs(directory, exist_ok=True)
+
+        self.lock = threading.Lock()    # Guards segments, held briefly
+        self.segments = []
+        for name in sorted(os.listdir(directory)):
+            if name.endswith(".tmp"):
+                # Left over from a compaction that did not finish
+                os.remove(os.path.join(directory, name))
+            elif name.endswith(".frm"):
+                try:
+                    self.segments.append(Segment.load(directory, name))
+                except (OSError, ValueError, struct.error) as e:
+                    print(f"Skipping frame segment {name}: {e}")
+        self.active = None
+        self.data_file = None
+        self.index_file = None
+        self.last_time = self.segments[-1].end if self.segments else 0
+
+        self.queue = queue.Queue(QUEUE_SIZE)
+        self.dropped = 0
+        self.written = 0
+        self.last_maintenance = time.monotonic()
+        self.stopped = threading.Event()
+        self.thread = threading.Thread(target=self.run, daemon=True, name="frame_store")
+        self.thread.start()
+
+    def append(self, when, matrix, flags=0):
+        """Queue a frame taken at when (epoch seconds). Never blocks; returns
+        False when the frame had to be dropped."""
+        try:
+            self.queue.put_nowait((when, matrix, flags))
+            return True
+        except queue.Full:
+            self.dropped += 1
+            return False
+
+    def flush(self, timeout=None):
+        """Wait until everything appended so far is written"""
+        done = threading.Event()
+        self.queue.put(done, timeout=timeout)
+        return done.wait(timeout)
+
+    def close(self):
+        self.stopped.set()
+        self.queue.put(None)
+        self.thread.join()
+
+    def run(self):
+        while True:
+            try:
+                item = self.queue.get(timeout=1.0)
+            except queue.Empty:
+                item = False
+            batch = [] if item is False else [item]
+            # Take whatever else is waiting so it is flushed in one go
+            while item is not None and len(batch) < QUEUE_SIZE:
+                try:
+                    item = self.queue.get_nowait()
+                except queue.Empty:
+                    break
+                batch.append(item)
+
+            try:
+                self.write(batch)
+            except OSError as e:
+                print(f"Error writing frames to {self.directory}: {e}")
+            for item in batch:
+                if isinstance(item, threading.Event):
+                    item.set()
+            if None in batch:
+                self.seal()
+                return
+
+            if time.monotonic() - self.last_maintenance >= MAINTENANCE_INTERVAL:
+                self.last_maintenance = time.monotonic()
+                self.maintain(time.time())
+
+    def write(self, batch):
+        written = []
+        for item in batch:
+            if not isinstance(item, tuple):
+                continue
+            when, matrix, flags = item
+            if not matrix or not matrix[0]:
+                continue
+            rows, cols = len(matrix), len(matrix[0])
+            if any(len(row) != cols for row in matrix) or rows > 255 or cols > 255:
+                continue
+            places = decimals(matrix)
+            # Times only move forward within the store, whatever the clock does
+            ms = max(int(when * 1000), self.last_time)
+            segment = self.active
+            if segment is None or segment.count + len(written) >= SEGMENT_FRAMES \
+                    or ms - segment.start >= SEGMENT_SECONDS * 1000 \
+                    or (segment.rows, segment.cols, segment.decimals) != (rows, cols, places):
+                self.publish(written)
+                written = []
+                self.seal()
+                segment = self.open_segment(ms, rows, cols, places)
+            self.data_file.write(struct.pack("<h", flags))
+            self.data_file.write(to_pixels(matrix, 10 ** places))
+            self.index_file.write(struct.pack("<q", ms))
+            self.last_time = ms
+            written.append(ms)
+        self.publish(written)
+
+    def publish(self, written):
+        """Flush the frames just written and let readers see them"""
+        if not written:
+            return
+        self.data_file.flush()
+        self.index_file.flush()
+        with self.lock:
+            self.active.count += len(written)
+            self.active.end = written[-1]
+        self.written += len(written)
+
+    def open_segment(self, ms, rows, cols, decimals=0):
+        segment = Segment(self.directory, ms, rows, cols, decimals=decimals)
+        while os.path.exists(segment.data_path):
+            ms += 1
+            segment = Segment(self.directory, ms, rows, cols, decimals=decimals)
+        segment.create()
+        self.data_file = open(segment.data_path, "ab")
+        self.index_file = open(segment.index_path, "ab")
+        self.active = segment
+        with self.lock:
+            self.segments.append(segment)
+        return segment
+
+    def seal(self):
+        if self.active is None:
+            return
+        self.data_file.close()
+        self.index_file.close()
+        self.data_file = self.index_file = None
+        self.active.sealed = True
+        if self.active.count == 0:
+            self.delete([self.active])
+        self.active = None
+
+    def delete(self, segments):
+        with self.lock:
+            self.segments = [s for s in self.segments if s not in segments]
+        for segment in segments:
+            for path in (segment.data_path, segment.index_path):
+                try:
+                    os.remove(path)
+                except OSError:
+                    pass
+
+    # Reads, safe from any thread
+
+    def range(self, start, end, limit=None):
+        """Frames with start <= time <= end (epoch seconds), oldest first, as
+        dicts with time, alert and matrix. With limit, evenly spaced ones."""
+        spans = self.spans(start, end)
+        total = sum(last - first for _, _, first, last in spans)
+        wanted = min(total, limit) if limit else total
+
+        frames = []
+        taken = 0           # Frames taken so far, the next one is at taken * total // wanted
+        skipped = 0         # Frames in the spans already passed
+        for segment, maps, first, last in spans:
+            while taken < wanted and taken * total // wanted < skipped + last - first:
+                i = first + taken * total // wanted - skipped
+                when, flags, pixels = segment.frame(maps, i)
+                frames.append({"time": when / 1000, "alert": bool(flags & FLAG_ALERT),
+                               "matrix": to_matrix(pixels, segment.cols, segment.decimals)})
+                taken += 1
+            skipped += last - first
+        return frames
+
+    def count(self, start, end):
+        return sum(last - first for _, _, first, last in self.spans(start, end))
+
+    def spans(self, start, end):
+        """(segment, maps, first, last) of every segment with frames in the range.
+        The maps are taken under the lock, so compaction can't swap the files
+        underneath a reader."""
+        start_ms, end_ms = int(start * 1000), int(end * 1000)
+        with self.lock:
+            return [(segment,) + segment.find(start_ms, end_ms) for segment in self.segments
+                    if segment.count and segment.start <= end_ms and segment.end >= start_ms]
+
+    def stats(self):
+        with self.lock:
+            segments = list(self.segments)
+        return {
+            "segments": len(segments),
+            "frames": sum(s.count for s in segments),
+            "bytes": sum(s.size() for s in segments),
+            "first": segments[0].start / 1000 if segments else None,
+            "last": segments[-1].end / 1000 if segments else None,
+            "written": self.written,
+            "dropped": self.dropped,
+        }
+
+    # Retention and compaction, run by the writer thread
+
+    def maintain(self, now):
+        """Delete segments past the retention, compact the old ones"""
+        try:
+            cutoff = (now - self.retention) * 1000
+            with self.lock:
+                expired = [s for s in self.segments if s.sealed and s.end < cutoff]
+            if expired:
+                self.delete(expired)
+            self.compact(now)
+        except OSError as e:
+            print(f"Error maintaining frames in {self.directory}: {e}")
+
+    def compact(self, now):
+        """Thin sealed segments older than compact_after into merged ones"""
+        cutoff = (now - self.compact_after) * 1000
+        with self.lock:
+            old = [s for s in self.segments if s.sealed and s.end < cutoff]
+        # Runs of neighbouring segments with the same shape and decimals that
+        # still have uncompacted frames or would merge into fewer segments
+        groups, group = [], []
+        for segment in old:
+            if group and ((segment.rows, segment.cols, segment.decimals)
+                          != (group[0].rows, group[0].cols, group[0].decimals)
+                          or sum(s.count for s in group) + segment.count > SEGMENT_FRAMES):
+                groups.append(group)
+                group = []
+            group.append(segment)
+        if group:
+            groups.append(group)
+
+        for group in groups:
+            if len(group) == 1 and group[0].compacted:
+                continue
+            self.merge(group)
+
+    def merge(self, group):
+        first = group[0]
+        merged = Segment(self.directory, first.start, first.rows, first.cols, compacted=True,
+                         decimals=first.decimals)
+        temporary = Segment(self.directory, first.start, first.rows, first.cols, compacted=True,
+                            decimals=first.decimals)
+        temporary.data_path += ".tmp"
+        temporary.index_path += ".tmp"
+        temporary.create()
+        interval = int(self.compact_interval * 1000)
+        bucket = None
+        with open(temporary.data_path, "ab") as data, open(temporary.index_path, "ab") as index:
+            for segment in group:
+                data_map, index_map, count = segment.open_maps()
+                times = memoryview(index_map).cast("q")
+                for i in range(count):
+                    offset = SEGMENT_HEADER.size + i * segment.record
+                    record = data_map[offset:offset + segment.record]
+                    flags, = struct.unpack_from("<h", record)
+                    when = times[i]
+                    if not (flags & FLAG_ALERT) and when // interval == bucket:
+                        continue
+                    bucket = when // interval
+                    data.write(record)
+                    index.write(struct.pack("<q", when))
+                    merged.count += 1
+                    merged.end = when
+        merged.sealed = True
+        # Readers map the files under the lock, swap them under it too. Maps
+        # already taken keep the old files readable until they are dropped.
+        with self.lock:
+            os.replace(temporary.data_path, merged.data_path)
+            os.replace(temporary.index_path, merged.index_path)
+            # The first segment's files were replaced by the merged ones
+            for segment in group[1:]:
+                for path in (segment.data_path, segment.index_path):
+                    os.remove(path)
+            position = self.segments.index(first)
+            self.segments = [s for s in self.segments if s not in group]
+            self.segments.insert(position, merged)
+
+if __name__ == "__main__":
+    # Summary of a store: python frame_store.py <directory>
+    store = FrameStore(sys.argv[1])
+    print(store.stats())
+    store.close()
@@ -0,0 +1,230 @@
+"""Downsampled history of a unit, kept up to date as readings arrive.
+
+Every reading updates one bucket per resolution (minute, hour, day):
+
+    peak        min/max/mean of the peak temperature, from patrol lines and alerts
+    distance    min/max/mean/count of the measured distance to the fire
+    hotspots    matrices with pixels at or above the hotspot threshold
+    detections  FIRE DETECTED events
+    alert_s     seconds spent in fire alert, split across buckets as they pass
+
+so a chart over any range is served from at most a few thousand buckets,
+never from raw frames. A changed bucket is appended to <resolution>.jsonl
+in the unit's directory once a later bucket is touched, and the buckets
+are loaded back at start, as far as each resolution's retention reaches.
+"""
+import json
+import os
+import threading
+import time
+
+# Name, seconds per bucket, buckets kept
+RESOLUTIONS = (
+    ("minute", 60, 7 * 24 * 60),
+    ("hour", 3600, 366 * 24),
+    ("day", 86400, 10 * 366),
+)
+MAX_POINTS = 1500           # Buckets a query returns before it moves to a coarser resolution
+
+class Bucket:
+    __slots__ = ("start", "peak_min", "peak_max", "peak_sum", "peak_count",
+                 "distance_min", "distance_max", "distance_sum", "distance_count",
+                 "hotspots", "detections", "alert_s")
+
+    def __init__(self, start):
+        self.start = start
+        self.peak_min = self.peak_max = None
+        self.peak_sum = 0.0
+        self.peak_count = 0
+        self.distance_min = self.distance_max = None
+        self.distance_sum = 0.0
+        self.distance_count = 0
+        self.hotspots = 0
+        self.detections = 0
+        self.alert_s = 0.0
+
+    def to_dict(self):
+        return {
+            "time": self.start,
+            "samples": self.peak_count,
+            "peak": None if not self.peak_count else {
+                "min": self.peak_min, "max": self.peak_max,
+                "mean": round(self.peak_sum / self.peak_count, 2)},
+            "distance": None if not self.distance_count else {
+                "min": self.distance_min, "max": self.distance_max,
+                "mean": round(self.distance_sum / self.distance_count, 2),
+                "count": self.distance_count},
+            "hotspots": self.hotspots,
+            "detections": self.detections,
+            "alert_s": round(self.alert_s, 1),
+        }
+
+    @classmethod
+    def from_dict(cls, data):
+        bucket = cls(data["time"])
+        if data["peak"]:
+            bucket.peak_min, bucket.peak_max = data["peak"]["min"], data["peak"]["max"]
+            bucket.peak_count = data["samples"]
+            bucket.peak_sum = data["peak"]["mean"] * data["samples"]
+        if data["distance"]:
+            bucket.distance_min, bucket.distance_max = data["distance"]["min"], data["distance"]["max"]
+            bucket.distance_count = data["distance"]["count"]
+            bucket.distance_sum = data["distance"]["mean"] * data["distance"]["count"]
+        bucket.hotspots = data["hotspots"]
+        bucket.detections = data["detections"]
+        bucket.alert_s = data["alert_s"]
+        return bucket
+
+class Series:
+    """The buckets of one resolution, oldest first"""
+
+    def __init__(self, name, seconds, keep, directory):
+        self.name = name
+        self.seconds = seconds
+        self.keep = keep
+        self.buckets = {}
+        self.dirty = set()  # Starts of buckets changed since they were written out
+        self.path = os.path.join(directory, f"{name}.jsonl") if directory else None
+        if self.path:
+            self.load()
+
+    def load(self):
+        """Read the written buckets back; a bucket written again replaces the
+        earlier line"""
+        if not os.path.exists(self.path):
+            return
+        horizon = time.time() - self.keep * self.seconds
+        lines = 0
+        with open(self.path) as f:
+            for line in f:
+                lines += 1
+                try:
+                    bucket = Bucket.from_dict(json.loads(line))
+                except (ValueError, KeyError, TypeError):
+                    continue
+                if bucket.start >= horizon:
+                    self.buckets[bucket.start] = bucket
+        # Drop what fell out of the retention once the file doubled
+        if lines > 2 * max(len(self.buckets), 1):
+            with open(self.path + ".tmp", "w") as f:
+                for bucket in self.buckets.values():
+                    f.write(json.dumps(bucket.to_dict()) + "\n")
+            os.replace(self.path + ".tmp", self.path)
+
+    def bucket(self, when):
+        start = int(when // self.seconds * self.seconds)
+        bucket = self.buckets.get(start)
+        if bucket is None:
+            bucket = self.buckets[start] = Bucket(start)
+        if start not in self.dirty:
+            self.dirty.add(start)
+            self.close_before(start)
+        return bucket
+
+    def close_before(self, start):
+        """Write out the changed buckets older than start and drop the expired"""
+        closed = sorted(s for s in self.dirty if s < start)
+        if not closed:
+            return
+        self.dirty.difference_update(closed)
+        if self.path:
+            try:
+                with open(self.path, "a") as f:
+                    for s in closed:
+                        f.write(json.dumps(self.buckets[s].to_dict()) + "\n")
+            except OSError as e:
+                print(f"Error writing history to {self.path}: {e}")
+        while len(self.buckets) > self.keep:
+            del self.buckets[next(iter(self.buckets))]
+
+    def range(self, start, end):
+        return [bucket.to_dict() for s, bucket in self.buckets.items()
+                if start - self.seconds < s <= end]
+
+class History:
+    """Minute, hour and day rollups of one unit (see the module doc). Safe to
+    update from the reader thread while requests read it."""
+
+    def __init__(self, directory=None):
+        if directory:
+            os.makedirs(directory, exist_ok=True)
+        self.directory = directory
+        self.lock = threading.Lock()
+        self.series = [Series(name, seconds, keep, directory) for name, seconds, keep in RESOLUTIONS]
+        self.alert_since = None
+
+    def close(self):
+        """Write out every changed bucket, e.g. before the server stops"""
+        with self.lock:
+            for series in self.series:
+                series.close_before(float("inf"))
+
+    def buckets(self, when):
+        self.accrue(when)
+        return [series.bucket(when) for series in self.series]
+
+    def accrue(self, when):
+        """Count the time in alert up to when into the buckets it fell in"""
+        since = self.alert_since
+        if since is None or when <= since:
+            return
+        for series in self.series:
+            t = since
+            while t < when:
+                boundary = min((t // series.seconds + 1) * series.seconds, when)
+                series.bucket(t).alert_s += boundary - t
+                t = boundary
+        self.alert_since = when
+
+    def peak(self, when, value):
+        with self.lock:
+            for bucket in self.buckets(when):
+                bucket.peak_min = value if bucket.peak_min is None else min(bucket.peak_min, value)
+                bucket.peak_max = value if bucket.peak_max is None else max(bucket.peak_max, value)
+                bucket.peak_sum += value
+                bucket.peak_count += 1
+
+    def distance(self, when, value):
+        with self.lock:
+            for bucket in self.buckets(when):
+                bucket.distance_min = value if bucket.distance_min is None else min(bucket.distance_min, value)
+                bucket.distance_max = value if bucket.distance_max is None else max(bucket.distance_max, value)
+                bucket.distance_sum += value
+                bucket.distance_count += 1
+
+    def hotspot(self, when):
+        with self.lock:
+            for bucket in self.buckets(when):
+                bucket.hotspots += 1
+
+    def detection(self, when):
+        with self.lock:
+            for bucket in self.buckets(when):
+                bucket.detections += 1
+
+    def alert(self, when, active):
+        """The unit entered (active) or left fire alert"""
+        with self.lock:
+            self.accrue(when)
+            if active and self.alert_since is None:
+                self.alert_since = when
+            elif not active:
+                self.alert_since = None
+
+    def resolution(self, start, end):
+        """The finest resolution that covers start and answers in MAX_POINTS"""
+        now = time.time()
+        for series in self.series:
+            if (end - start) / series.seconds <= MAX_POINTS and start >= now - series.keep * series.seconds:
+                return series
+        return self.series[-1]
+
+    def query(self, start, end, resolution=None):
+        """Buckets overlapping [start, end], with the resolution picked from
+        the range unless given by name"""
+        with self.lock:
+            self.accrue(time.time())
+            series = next((s for s in self.series if s.name == resolution), None) \
+                or self.resolution(start, end)
+            return {"resolution": series.name, "seconds": series.seconds,
+                    "buckets": series.range(start, end)}
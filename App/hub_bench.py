@@ -0,0 +1,194 @@
+"""Load benchmark for a server supervising many units (Device and
+DeviceRegistry in server.py).
+
+Registers N units on pseudo terminals, lets the hub connect to all of them
+the way it connects to real ports, then plays device output into every
+one at a given baud rate from a separate writer process, so the CPU time
+measured is the hub's alone:
+
+    python hub_bench.py                         # 16 units of synthetic patrol at 230400 baud
+    python hub_bench.py --units 32 --frames 600
+    python hub_bench.py --baud 0                # unpaced, every unit as fast as it will go
+
+It prints one line per unit
+
+    HUB UNIT id=<id> lines=<n> latency_p50_ms=<n> latency_p99_ms=<n> latency_max_ms=<n>
+
+and the totals
+
+    HUB units=<n> baud=<n> seconds=<n> bytes=<n> cpu_pct=<n> cpu_idle_pct=<n>
+        latency_p50_ms=<n> latency_p99_ms=<n> latency_max_ms=<n>
+        worst_unit_p99_ms=<n> site_ms=<n> kept_up=<0|1>
+
+cpu_pct is the hub's CPU time over the run as a share of one core,
+cpu_idle_pct the same with every unit connected but silent. Latency runs
+from a marker line being written to the unit's reader handling it; site_ms
+is the median time to answer /api/site while the units are busy.
+"""
+import argparse
+import contextlib
+import heapq
+import os
+import pty
+import sys
+import threading
+import time
+import tty
+
+import server
+from serial_bench import END_MARKER, LINK_BAUD, MARKER_EVERY, percentile, synthetic_capture
+
+IDLE_SECONDS = 2.0          # Length of the idle CPU measurement
+SITE_INTERVAL = 0.25        # Seconds between /api/site requests during the run
+
+class HubParser(server.SerialParser):
+    """SerialParser that also times the marker lines, per unit"""
+
+    latencies = {}
+    done = {}
+
+    def handle_line(self, line):
+        if line.startswith("BENCH "):
+            if line == END_MARKER:
+                HubParser.done[self.device.id].set()
+            else:
+                # "BENCH <seq> <monotonic time written>"
+                HubParser.latencies[self.device.id].append(time.monotonic() - float(line.split()[2]))
+            return
+        super().handle_line(line)
+
+def segments(lines):
+    """The lines in chunks of MARKER_EVERY, each to be followed by a marker"""
+    return [("".join(line + "\r\n" for line in lines[start:start + MARKER_EVERY])).encode("utf-8")
+            for start in range(0, len(lines), MARKER_EVERY)]
+
+def write_units(fds, chunks, baud, go):
+    """Writer process: the same output into every unit, each paced to baud
+    (0: unpaced) and started a little apart so they don't run in lockstep"""
+    os.read(go, 1)
+    started = time.monotonic()
+    spacing = 0.05 / len(fds)
+    # (due, unit, next chunk, bytes sent so far)
+    queue = [(started + unit * spacing, unit, 0, 0) for unit in range(len(fds))]
+    while queue:
+        due, unit, index, sent = heapq.heappop(queue)
+        delay = due - time.monotonic()
+        if baud and delay > 0:
+            time.sleep(delay)
+        if index < len(chunks):
+            data = chunks[index] + f"BENCH {index} {time.monotonic():.6f}\r\n".encode("ascii")
+        else:
+            data = (END_MARKER + "\r\n").encode("ascii")
+        view = memoryview(data)
+        while view:
+            view = view[os.write(fds[unit], view):]
+        sent += len(data)
+        if index < len(chunks):
+            # 10 bits per byte on the wire
+            heapq.heappush(queue, (started + unit * spacing + sent * 10 / max(baud, 1), unit, index + 1, sent))
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard multi-device hub benchmark")
+    parser.add_argument("--units", type=int, default=16, help="simulated units")
+    parser.add_argument("--frames", type=int, default=300, help="frames of synthetic patrol per unit")
+    parser.add_argument("--baud", type=int, default=LINK_BAUD, help="pace of every unit, 0 for unpaced")
+    parser.add_argument("--timeout", type=float, default=300.0, help="give up after this many seconds")
+    args = parser.parse_args()
+
+    lines = synthetic_capture(args.frames)
+    chunks = segments(lines)
+    per_unit = sum(len(chunk) for chunk in chunks) + len(chunks) * len("BENCH 0 0.000000\r\n")
+
+    # Stand-ins for the units' serial ports
+    masters, ports = [], []
+    for _ in range(args.units):
+        master, slave = pty.openpty()
+        tty.setraw(slave)
+        masters.append(master)
+        ports.append(os.ttyname(slave))
+
+    go_read, go_write = os.pipe()
+    writer = os.fork()
+    if writer == 0:
+        os.close(go_write)
+        try:
+            write_units(masters, chunks, args.baud, go_read)
+        finally:
+            os._exit(0)
+    os.close(go_read)
+
+    for device in server.devices.all():
+        server.devices.remove(device.id)
+    server.Device.parser_class = HubParser
+    server.FRAMES_ENABLED = False
+    server.HISTORY_ENABLED = False
+    client = server.app.test_client()
+    site_times = []
+    stop_site = threading.Event()
+
+    def poll_site():
+        while not stop_site.wait(SITE_INTERVAL):
+            started = time.perf_counter()
+            client.get("/api/site")
+            site_times.append(time.perf_counter() - started)
+
+    # The units log with print(); keep them out of the results
+    with open(os.devnull, "w") as devnull, contextlib.redirect_stdout(devnull):
+        for index, port in enumerate(ports):
+            unit = f"unit{index:02d}"
+            HubParser.latencies[unit] = []
+            HubParser.done[unit] = threading.Event()
+            server.devices.add(unit, port).start()
+
+        deadline = time.monotonic() + 10
+        while server.site_summary()["connected"] < args.units and time.monotonic() < deadline:
+            time.sleep(0.05)
+
+        # Connected and silent: the readers should only wake on their timeouts
+        cpu = time.process_time()
+        time.sleep(IDLE_SECONDS)
+        cpu_idle = (time.process_time() - cpu) / IDLE_SECONDS
+
+        site = threading.Thread(target=poll_site, daemon=True)
+        site.start()
+        cpu = time.process_time()
+        started = time.monotonic()
+        os.write(go_write, b"g")
+        finished = all(event.wait(max(0, started + args.timeout - time.monotonic()))
+                       for event in HubParser.done.values())
+        elapsed = time.monotonic() - started
+        cpu_run = (time.process_time() - cpu) / elapsed
+        stop_site.set()
+
+        for device in server.devices.all():
+            device.stop()
+    os.waitpid(writer, 0)
+
+    if not finished:
+        print(f"Units did not finish within {args.timeout:.0f} s", file=sys.stderr)
+
+    every = []
+    worst = 0.0
+    for unit, latencies in HubParser.latencies.items():
+        every.extend(latencies)
+        worst = max(worst, percentile(latencies, 0.99))
+        print(f"HUB UNIT id={unit} lines={len(lines) + len(latencies) + 1} "
+              f"latency_p50_ms={percentile(latencies, 0.5) * 1000:.2f} "
+              f"latency_p99_ms={percentile(latencies, 0.99) * 1000:.2f} "
+              f"latency_max_ms={max(latencies, default=0) * 1000:.2f}")
+
+    total = per_unit * args.units
+    # Kept up when it took no longer than the links need, plus the worst marker's latency
+    needed = per_unit * 10 / args.baud if args.baud else 0
+    kept_up = finished and (not args.baud or elapsed <= needed + max(every, default=0) + 0.1)
+    print(f"HUB units={args.units} baud={args.baud} seconds={elapsed:.2f} bytes={total} "
+          f"cpu_pct={cpu_run * 100:.1f} cpu_idle_pct={cpu_idle * 100:.1f} "
+          f"latency_p50_ms={percentile(every, 0.5) * 1000:.2f} "
+          f"latency_p99_ms={percentile(every, 0.99) * 1000:.2f} "
+          f"latency_max_ms={max(every, default=0) * 1000:.2f} "
+          f"worst_unit_p99_ms={worst * 1000:.2f} "
+          f"site_ms={percentile(site_times, 0.5) * 1000:.2f} kept_up={int(bool(kept_up))}")
+    return 0 if finished else 1
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,255 @@
+"""Where the time goes between the sensor and the screen, frame by frame.
+
+The firmware stamps every matrix it prints with the number of frames read
+so far (the patrol reads more than it prints) and two readings of its tick
+counter (Firmware/src/tick.h):
+
+    Center Matrix Data (abnormal row removed): seq=12 acquired=316072 sent=379858 rows=15
+
+The server stamps the frame again when its last row arrives, when it is
+parsed and when it goes out to the streams, and the page when it is on the
+canvas. Lined up on one clock that makes the stages
+
+    acquire     data ready on the sensor -> the unit starts printing it
+    uart        printing starts -> the last row reaches the server
+    parse       last row received -> matrix parsed and analysed
+    publish     parsed -> sent to the streams (the live stage)
+    render      sent -> drawn on a page, as the page reports it
+
+Ticks are put on the server's clock by asking the unit for its tick count
+(the TIME command) a few times in a row every CLOCK_SYNC_INTERVAL and
+taking the answer with the shortest round trip, as NTP does; half that
+round trip bounds the error. Pages line their clock up with the server's
+the same way (/api/clock). Without stamps (older firmware, replays of old
+captures) only parse and publish are known.
+"""
+import collections
+import re
+import threading
+import time
+
+TICK_SECONDS = 625 / 72 / 1e6   # 64 cycles at 7.3728MHz, TICKS_TO_US in tick.h
+TICK_WRAP = 1 << 32             # The tick counter wraps after about ten hours
+
+CLOCK_SYNC_INTERVAL = 10.0      # Seconds between rounds of TIME commands
+CLOCK_PINGS = 5                 # TIME commands per round, the fastest answer counts
+CLOCK_PING_SPACING = 0.05       # Seconds between them, to land at different points of the unit's loop
+CLOCK_PING_TIMEOUT = 1.0        # Seconds before an unanswered TIME is given up
+# A stamp mapped further into the future than this, or further into the
+# past than CLOCK_STALE, means the unit restarted since the last sync
+CLOCK_TOLERANCE = 0.05
+CLOCK_STALE = 60.0
+
+STAGES = ("acquire", "uart", "parse", "publish", "render")
+TRACE_HISTORY = 128             # Frames kept for /api/latency
+
+FRAME_STAMP = re.compile(r"seq=(\d+) acquired=(\d+) sent=(\d+)(?: rows=(\d+))?(?: pan=(-?\d+))?")
+
+def parse_frame_stamp(line):
+    """{"seq", "acquired", "sent", "rows", "pan"} from a matrix header, or
+    None; rows and pan (steps, see panorama.py) are None from older firmware"""
+    match = FRAME_STAMP.search(line)
+    if not match:
+        return None
+    seq, acquired, sent, rows, pan = match.groups()
+    return {"seq": int(seq), "acquired": int(acquired), "sent": int(sent),
+            "rows": int(rows) if rows else None, "pan": int(pan) if pan else None}
+
+def tick_diff(a, b):
+    """Ticks from b to a, across a wrap of the counter"""
+    diff = (a - b) % TICK_WRAP
+    return diff - TICK_WRAP if diff >= TICK_WRAP // 2 else diff
+
+def ms(seconds):
+    return None if seconds is None else round(seconds * 1000, 3)
+
+class DeviceClock:
+    """The unit's tick counter on the server's time.perf_counter() clock.
+
+    The server sends TIME when due() says so, reports it with sent() and
+    the answer with answered(); to_host() maps ticks once a round trip has
+    been measured."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.reference = None       # (perf_counter, ticks) of the best answer adopted
+        self.round_trip = None      # Its round trip, seconds
+        self.synced = None          # When it was adopted (perf_counter)
+        self.best = None            # (round trip, perf_counter, ticks) of this round
+        self.pings_left = 0
+        self.next_round = 0.0
+        self.last_ping = 0.0
+        self.pending = {}           # seq -> perf_counter when sent
+        self.rounds = 0
+        # TIME unanswered in a row; the unit doesn't know it (older
+        # firmware, a replay) after CLOCK_PINGS of them or a NAK
+        self.unanswered = 0
+        self.unsupported = False
+
+    def due(self, now):
+        """Whether a TIME command should go out now"""
+        with self.lock:
+            if self.unsupported:
+                return False
+            waiting = {seq: sent for seq, sent in self.pending.items() if now - sent < CLOCK_PING_TIMEOUT}
+            self.unanswered += len(self.pending) - len(waiting)
+            self.pending = waiting
+            if self.unanswered >= CLOCK_PINGS:
+                self.unsupported = True
+                return False
+            if self.pending:
+                return False
+            if self.pings_left == 0:
+                if now < self.next_round:
+                    return False
+                self.pings_left = CLOCK_PINGS
+                self.best = None
+            return now - self.last_ping >= CLOCK_PING_SPACING
+
+    def sent(self, seq, now):
+        with self.lock:
+            self.pending[seq] = now
+            self.last_ping = now
+
+    def answered(self, seq, ticks, received):
+        """A TIME answer that arrived at received (perf_counter), ticks None
+        for a NAK; False if it wasn't one of ours"""
+        with self.lock:
+            sent = self.pending.pop(seq, None)
+            if sent is None:
+                return False
+            if ticks is None:
+                self.unsupported = True
+                return True
+            self.unanswered = 0
+            round_trip = received - sent
+            if self.best is None or round_trip < self.best[0]:
+                self.best = (round_trip, sent + round_trip / 2, ticks)
+            self.pings_left = max(self.pings_left - 1, 0)
+            # The first answer is used right away, later rounds once complete
+            if self.reference is None or self.pings_left == 0:
+                self.adopt(received)
+            return True
+
+    def adopt(self, now):
+        round_trip, host, ticks = self.best
+        self.reference = (host, ticks)
+        self.round_trip = round_trip
+        self.synced = now
+        if self.pings_left == 0:
+            self.rounds += 1
+            self.next_round = now + CLOCK_SYNC_INTERVAL
+
+    def reset(self):
+        """Forget the offset, e.g. when the unit restarted; resyncs right away"""
+        with self.lock:
+            self.reference = self.round_trip = self.synced = self.best = None
+            self.pings_left = 0
+            self.next_round = 0.0
+            self.pending.clear()
+            self.unanswered = 0
+            self.unsupported = False
+
+    def to_host(self, ticks):
+        """perf_counter time of a tick reading, None before the first sync"""
+        reference = self.reference
+        if reference is None:
+            return None
+        host, reference_ticks = reference
+        return host + tick_diff(ticks, reference_ticks) * TICK_SECONDS
+
+    def stats(self):
+        with self.lock:
+            return {
+                "synced": self.reference is not None,
+                "supported": not self.unsupported,
+                "uncertainty_ms": ms(self.round_trip / 2) if self.round_trip is not None else None,
+                "round_trip_ms": ms(self.round_trip),
+                "age_s": round(time.perf_counter() - self.synced, 1) if self.synced is not None else None,
+                "rounds": self.rounds,
+            }
+
+class FrameTracer:
+    """Latency traces of a unit's frames: built by the reader when a matrix
+    is parsed, finished by the live stage when it is published, and given
+    the render time by the pages"""
+
+    def __init__(self):
+        self.clock = DeviceClock()
+        self.lock = threading.Lock()
+        self.pending = None         # Parsed, not published yet
+        self.recent = collections.deque(maxlen=TRACE_HISTORY)
+
+    def parsed(self, stamp, received, parsed):
+        """A matrix whose last row arrived at received and that was parsed
+        by parsed (perf_counter); stamp is its header's, or None"""
+        trace = {"seq": None, "version": None, "time": None, "received": received,
+                 "acquire": None, "uart": None, "parse": parsed - received, "publish": None, "render": None}
+        if stamp is not None:
+            trace["seq"] = stamp["seq"]
+            trace["acquire"] = tick_diff(stamp["sent"], stamp["acquired"]) * TICK_SECONDS
+            sent = self.clock.to_host(stamp["sent"])
+            if sent is not None:
+                if sent > received + CLOCK_TOLERANCE or sent < received - CLOCK_STALE:
+                    self.clock.reset()
+                else:
+                    trace["uart"] = received - sent
+        self.pending = trace
+        return trace
+
+    def published(self, version, now):
+        """Finish the newest parsed frame, sent to the streams as version at
+        now (perf_counter). Returns its trace, None if there is none; frames
+        replaced before they went out are never finished."""
+        trace, self.pending = self.pending, None
+        if trace is None:
+            return None
+        trace["version"] = version
+        trace["publish"] = now - trace["received"] - trace["parse"]
+        # Wall clock time, for the pages
+        trace["time"] = time.time() - (time.perf_counter() - now)
+        with self.lock:
+            self.recent.append(trace)
+        return trace
+
+    def rendered(self, version, seconds):
+        """A page drew the frame of version seconds after it was published;
+        the first report counts. Returns the trace, None if it is gone."""
+        with self.lock:
+            for trace in reversed(self.recent):
+                if trace["version"] == version:
+                    if trace["render"] is None:
+                        trace["render"] = seconds
+                        return trace
+                    return None
+        return None
+
+    def report(self):
+        """Recent traces and per stage percentiles, for /api/latency"""
+        with self.lock:
+            traces = [trace_payload(trace) for trace in self.recent]
+        summary = {}
+        for stage in STAGES + ("total",):
+            values = sorted(trace[f"{stage}_ms"] for trace in traces if trace[f"{stage}_ms"] is not None)
+            if values:
+                summary[stage] = {
+                    "count": len(values),
+                    "p50_ms": values[len(values) // 2],
+                    "p99_ms": values[min(len(values) - 1, int(len(values) * 0.99))],
+                    "max_ms": values[-1],
+                }
+        return {"clock": self.clock.stats(), "summary": summary, "frames": traces}
+
+def trace_total(trace):
+    """Seconds from the data being ready to the frame going out to the
+    streams, None while a stage is unknown; pages add their render time"""
+    stages = [trace[stage] for stage in STAGES if stage != "render"]
+    return None if any(value is None for value in stages) else sum(stages)
+
+def trace_payload(trace):
+    """A trace as sent to the pages and /api/latency, in milliseconds"""
+    payload = {"seq": trace["seq"], "version": trace["version"], "time": trace["time"]}
+    for stage in STAGES:
+        payload[f"{stage}_ms"] = ms(trace[stage])
+    payload["total_ms"] = ms(trace_total(trace))
+    return payload
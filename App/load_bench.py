@@ -0,0 +1,191 @@
+"""Load test of the web server: hundreds of dashboards polling /api/status.
+
+Starts server.py on a free port with a unit replaying a synthetic patrol
+with alerts (a capture, see serial_bench.py), then polls it from many
+concurrent clients spread over a few processes, each keeping its
+connection open where the server allows it:
+
+    python load_bench.py                            # 400 pollers, waitress and the dev server
+    python load_bench.py --pollers 800 --server waitress
+    python load_bench.py --interval 0               # closed loop, the server's throughput
+    python load_bench.py --url http://host:3000     # a server that is already running
+
+It prints one line per server
+
+    LOAD server=<waitress|dev|url> pollers=<n> interval_s=<n> seconds=<n> requests=<n> rps=<n>
+         p50_ms=<n> p99_ms=<n> max_ms=<n> errors=<n> server_cpu_pct=<n>
+
+Latency runs from sending a request (connecting first, if needed) to
+having read the whole response. Pollers start at random points of their
+interval, and ask like the page does (--delta) or for the full state with
+gzip accepted. server_cpu_pct is the server process's CPU time over the
+run, 100 for one core, and only known for a server started here.
+"""
+import argparse
+import asyncio
+import concurrent.futures
+import os
+import random
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.parse
+import urllib.request
+
+import serial_bench
+from serial_bench import percentile
+
+CLIENT_PROCESSES = 4
+REPLAY_BAUD = 9600          # Pace of the replayed patrol, about 12 steps a second
+STARTUP_TIMEOUT = 15.0
+
+async def read_response(reader):
+    """(status, headers, body) of one HTTP response; headers lowercased"""
+    head = await reader.readuntil(b"\r\n\r\n")
+    lines = head.decode("latin-1").split("\r\n")
+    version, status = lines[0].split(" ", 2)[:2]
+    headers = {}
+    for line in lines[1:]:
+        name, _, value = line.partition(":")
+        if name:
+            headers[name.strip().lower()] = value.strip()
+    if status in ("204", "304"):
+        body = b""
+    elif "content-length" in headers:
+        body = await reader.readexactly(int(headers["content-length"]))
+    else:
+        body = await reader.read()
+        headers["connection"] = "close"
+    if version == "HTTP/1.0" and headers.get("connection", "").lower() != "keep-alive":
+        headers["connection"] = "close"
+    return int(status), headers, body
+
+async def poller(host, port, args, deadline, latencies, errors):
+    loop = asyncio.get_running_loop()
+    reader = writer = None
+    version = None
+    await asyncio.sleep(random.random() * args.interval)
+    due = loop.time()
+    while loop.time() < deadline:
+        path = "/api/status"
+        if args.delta and version is not None:
+            path += f"?since={version}&delta=1"
+        request = (f"GET {path} HTTP/1.1\r\nHost: {host}:{port}\r\n"
+                   f"Accept-Encoding: gzip\r\n\r\n").encode("ascii")
+        started = time.perf_counter()
+        try:
+            if writer is None:
+                reader, writer = await asyncio.open_connection(host, port)
+            writer.write(request)
+            status, headers, _ = await read_response(reader)
+            latencies.append(time.perf_counter() - started)
+            if status >= 400:
+                errors[0] += 1
+            elif "x-state-version" in headers:
+                version = int(headers["x-state-version"])
+            if headers.get("connection", "").lower() == "close":
+                writer.close()
+                writer = None
+        except (OSError, asyncio.IncompleteReadError, asyncio.LimitOverrunError, ValueError):
+            errors[0] += 1
+            if writer is not None:
+                writer.close()
+            writer = None
+            version = None
+        due += args.interval
+        await asyncio.sleep(max(0.0, due - loop.time()))
+    if writer is not None:
+        writer.close()
+
+def run_pollers(host, port, count, args, start_at):
+    """One client process: count pollers until start_at + args.seconds"""
+    async def main():
+        loop = asyncio.get_running_loop()
+        await asyncio.sleep(max(0.0, start_at - time.time()))
+        deadline = loop.time() + args.seconds
+        latencies, errors = [], [0]
+        await asyncio.gather(*(poller(host, port, args, deadline, latencies, errors) for _ in range(count)))
+        return latencies, errors[0]
+    return asyncio.run(main())
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+def cpu_seconds(pid):
+    """User and system CPU time of a process, from /proc (Linux)"""
+    try:
+        with open(f"/proc/{pid}/stat") as f:
+            fields = f.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+    except (OSError, IndexError, ValueError):
+        return None
+
+def start_server(kind, port, capture):
+    env = dict(os.environ, FIREGUARD_SERVER=kind, FIREGUARD_HTTP_PORT=str(port),
+               FIREGUARD_SERIAL_PORT=f"replay:{capture}@1", FIREGUARD_DEVICES="",
+               FIREGUARD_FRAMES="0", FIREGUARD_HISTORY="0", FIREGUARD_CAPTURE="0")
+    process = subprocess.Popen([sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), "server.py")],
+                               env=env, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    deadline = time.monotonic() + STARTUP_TIMEOUT
+    while time.monotonic() < deadline:
+        try:
+            urllib.request.urlopen(f"http://127.0.0.1:{port}/api/status", timeout=1).read()
+            return process
+        except OSError:
+            time.sleep(0.2)
+    process.kill()
+    raise RuntimeError(f"server ({kind}) did not start on port {port}")
+
+def load(name, host, port, args, pid=None):
+    start_at = time.time() + 1.0
+    shares = [args.pollers // CLIENT_PROCESSES + (i < args.pollers % CLIENT_PROCESSES)
+              for i in range(CLIENT_PROCESSES)]
+    cpu_before = cpu_seconds(pid) if pid else None
+    with concurrent.futures.ProcessPoolExecutor(CLIENT_PROCESSES) as pool:
+        results = list(pool.map(run_pollers, [host] * CLIENT_PROCESSES, [port] * CLIENT_PROCESSES,
+                                shares, [args] * CLIENT_PROCESSES, [start_at] * CLIENT_PROCESSES))
+    cpu_after = cpu_seconds(pid) if pid else None
+    latencies = [latency for result in results for latency in result[0]]
+    errors = sum(result[1] for result in results)
+    cpu = "-" if cpu_before is None or cpu_after is None \
+        else f"{100 * (cpu_after - cpu_before) / (args.seconds + 1.0):.0f}"
+    print(f"LOAD server={name} pollers={args.pollers} interval_s={args.interval:g} seconds={args.seconds} "
+          f"requests={len(latencies)} rps={len(latencies) / args.seconds:.0f} "
+          f"p50_ms={percentile(latencies, 0.5) * 1000:.2f} p99_ms={percentile(latencies, 0.99) * 1000:.2f} "
+          f"max_ms={max(latencies, default=0) * 1000:.1f} errors={errors} server_cpu_pct={cpu}", flush=True)
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard web server load test")
+    parser.add_argument("--pollers", type=int, default=400, help="concurrent dashboards")
+    parser.add_argument("--interval", type=float, default=1.0, help="seconds between a poller's requests (0: closed loop)")
+    parser.add_argument("--seconds", type=int, default=30, help="length of the run")
+    parser.add_argument("--server", choices=("waitress", "dev", "both"), default="both",
+                        help="web server to start (default: both, one after the other)")
+    parser.add_argument("--url", help="load an already running server instead")
+    parser.add_argument("--delta", action="store_true", help="poll with ?since=<version>&delta=1 like the page")
+    args = parser.parse_args()
+
+    if args.url:
+        url = urllib.parse.urlsplit(args.url)
+        load("url", url.hostname, url.port or 80, args)
+        return 0
+
+    with tempfile.TemporaryDirectory(prefix="fireguard_load_") as directory:
+        capture = os.path.join(directory, "patrol.fgcap")
+        serial_bench.record_capture(capture, serial_bench.synthetic_capture(2000), REPLAY_BAUD)
+        for kind in (("waitress", "dev") if args.server == "both" else (args.server,)):
+            port = free_port()
+            process = start_server(kind, port, capture)
+            try:
+                load(kind, "127.0.0.1", port, args, process.pid)
+            finally:
+                process.terminate()
+                process.wait()
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
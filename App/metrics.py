@@ -0,0 +1,200 @@
+"""Counters, gauges and histograms served in the Prometheus text format.
+
+A small stand-in for prometheus_client, enough for /metrics:
+
+    BYTES = REGISTRY.counter("fireguard_serial_bytes_total", "Bytes read", ("device",))
+    BYTES.inc(len(chunk), device="east")
+    east = BYTES.labels(device="east")      # bound once, for hot paths
+    east.inc(len(chunk))
+    PARSE = REGISTRY.histogram("fireguard_parse_seconds", "Parse time per chunk", ("device",))
+    PARSE.observe(0.0004, device="east")
+    REGISTRY.collector(lambda: [("fireguard_stream_clients", "gauge", "Open streams", {}, 3)])
+    REGISTRY.render()
+
+Metrics are safe to update from any thread. Rates (bytes per second etc.)
+are left to the scraper, from two readings of a counter. A collector is
+called at every render for values that are cheaper to read than to keep
+up to date, like queue depths.
+"""
+import bisect
+import math
+import threading
+
+# Seconds, from tens of microseconds (parsing a chunk) to seconds (a stuck link)
+DEFAULT_BUCKETS = (0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01,
+                   0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 5.0, 10.0)
+
+def format_value(value):
+    if value == math.inf:
+        return "+Inf"
+    if isinstance(value, float) and value.is_integer() and abs(value) < 1e15:
+        return str(int(value))
+    return repr(value)
+
+def format_labels(labels):
+    if not labels:
+        return ""
+    escaped = (str(value).replace("\\", "\\\\").replace("\n", "\\n").replace('"', '\\"')
+               for value in labels.values())
+    return "{" + ",".join(f'{name}="{value}"' for name, value in zip(labels, escaped)) + "}"
+
+class Metric:
+    kind = None
+
+    def __init__(self, name, help_text, label_names=()):
+        self.name = name
+        self.help = help_text
+        self.label_names = tuple(label_names)
+        self.lock = threading.Lock()
+        self.values = {}
+
+    def key(self, labels):
+        if set(labels) != set(self.label_names):
+            raise ValueError(f"{self.name} takes labels {self.label_names}, not {tuple(labels)}")
+        return tuple(str(labels[name]) for name in self.label_names)
+
+    def labels(self, **labels):
+        """The metric with these labels bound, skipping their lookup per update"""
+        return Bound(self, self.key(labels))
+
+    def remove(self, **labels):
+        """Forget one label set, e.g. of a unit that was removed"""
+        wanted = {self.label_names.index(name): str(value) for name, value in labels.items()}
+        with self.lock:
+            for key in [key for key in self.values if all(key[i] == v for i, v in wanted.items())]:
+                del self.values[key]
+
+    def header(self):
+        return [f"# HELP {self.name} {self.help}", f"# TYPE {self.name} {self.kind}"]
+
+    def samples(self):
+        with self.lock:
+            items = sorted(self.values.items())
+        return [(self.name, dict(zip(self.label_names, key)), value) for key, value in items]
+
+class Counter(Metric):
+    kind = "counter"
+
+    def inc(self, amount=1, **labels):
+        self.inc_key(self.key(labels), amount)
+
+    def inc_key(self, key, amount=1):
+        with self.lock:
+            self.values[key] = self.values.get(key, 0) + amount
+
+class Gauge(Metric):
+    kind = "gauge"
+
+    def set(self, value, **labels):
+        self.set_key(self.key(labels), value)
+
+    def set_key(self, key, value):
+        with self.lock:
+            self.values[key] = value
+
+    def inc(self, amount=1, **labels):
+        self.inc_key(self.key(labels), amount)
+
+    def inc_key(self, key, amount=1):
+        with self.lock:
+            self.values[key] = self.values.get(key, 0) + amount
+
+    def dec(self, amount=1, **labels):
+        self.inc(-amount, **labels)
+
+class Histogram(Metric):
+    kind = "histogram"
+
+    def __init__(self, name, help_text, label_names=(), buckets=DEFAULT_BUCKETS):
+        super().__init__(name, help_text, label_names)
+        self.buckets = tuple(sorted(buckets))
+
+    def observe(self, value, **labels):
+        self.observe_key(self.key(labels), value)
+
+    def observe_key(self, key, value):
+        index = bisect.bisect_left(self.buckets, value)
+        with self.lock:
+            entry = self.values.get(key)
+            if entry is None:
+                # Per bucket (not cumulative) counts, the last one for +Inf; sum
+                entry = self.values[key] = [[0] * (len(self.buckets) + 1), 0.0]
+            entry[0][index] += 1
+            entry[1] += value
+
+    def samples(self):
+        with self.lock:
+            items = sorted((key, (list(counts), total)) for key, (counts, total) in self.values.items())
+        samples = []
+        for key, (counts, total) in items:
+            labels = dict(zip(self.label_names, key))
+            cumulative = 0
+            for bound, count in zip(self.buckets + (math.inf,), counts):
+                cumulative += count
+                samples.append((self.name + "_bucket", dict(labels, le=format_value(float(bound))), cumulative))
+            samples.append((self.name + "_sum", labels, total))
+            samples.append((self.name + "_count", labels, cumulative))
+        return samples
+
+class Bound:
+    """A metric with its labels fixed (Metric.labels())"""
+
+    def __init__(self, metric, key):
+        self.metric = metric
+        self.key = key
+
+    def inc(self, amount=1):
+        self.metric.inc_key(self.key, amount)
+
+    def set(self, value):
+        self.metric.set_key(self.key, value)
+
+    def observe(self, value):
+        self.metric.observe_key(self.key, value)
+
+class Registry:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.metrics = []
+        self.collectors = []
+
+    def add(self, metric):
+        with self.lock:
+            self.metrics.append(metric)
+        return metric
+
+    def counter(self, name, help_text, label_names=()):
+        return self.add(Counter(name, help_text, label_names))
+
+    def gauge(self, name, help_text, label_names=()):
+        return self.add(Gauge(name, help_text, label_names))
+
+    def histogram(self, name, help_text, label_names=(), buckets=DEFAULT_BUCKETS):
+        return self.add(Histogram(name, help_text, label_names, buckets))
+
+    def collector(self, function):
+        """function() returns (name, kind, help, labels, value) tuples"""
+        with self.lock:
+            self.collectors.append(function)
+        return function
+
+    def render(self):
+        """Everything in the Prometheus text exposition format (0.0.4)"""
+        with self.lock:
+            metrics, collectors = list(self.metrics), list(self.collectors)
+        lines = []
+        for metric in metrics:
+            lines += metric.header()
+            lines += [f"{name}{format_labels(labels)} {format_value(value)}"
+                      for name, labels, value in metric.samples()]
+        # Collected samples, grouped by name so each gets one header
+        collected = {}
+        for function in collectors:
+            for name, kind, help_text, labels, value in function():
+                collected.setdefault(name, (kind, help_text, []))[2].append((labels, value))
+        for name, (kind, help_text, samples) in collected.items():
+            lines += [f"# HELP {name} {help_text}", f"# TYPE {name} {kind}"]
+            lines += [f"{name}{format_labels(labels)} {format_value(value)}" for labels, value in samples]
+        return "\n".join(lines) + "\n"
+
+REGISTRY = Registry()
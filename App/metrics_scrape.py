@@ -0,0 +1,136 @@
+"""Stand-in for a Prometheus scraper, to check /metrics by hand.
+
+Scrapes a server's /metrics twice, checks that the text parses the way a
+scraper reads it (every sample under a # TYPE, histogram buckets
+cumulative and ending in +Inf), then prints what changed in between:
+
+    python metrics_scrape.py                        # http://localhost:3000/metrics, 10 s apart
+    python metrics_scrape.py --url http://hub:3000/metrics --interval 30
+
+as one line per counter that moved and per histogram that saw samples
+
+    RATE <name>{<labels>} per_s=<n>
+    HIST <name>{<labels>} count=<n> per_s=<n> mean_ms=<n> p50_ms=<n> p99_ms=<n>
+    GAUGE <name>{<labels>} value=<n>
+
+with the percentiles interpolated within buckets, as histogram_quantile()
+does. It exits with 1 if the format is off.
+"""
+import argparse
+import math
+import re
+import sys
+import time
+import urllib.request
+
+SAMPLE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*)(\{(.*)\})? (\S+)$')
+LABEL = re.compile(r'([a-zA-Z_][a-zA-Z0-9_]*)="((?:[^"\\]|\\.)*)"')
+
+def parse(text):
+    """{(name, labels): value} and {family: type}; raises ValueError"""
+    samples, types = {}, {}
+    for number, line in enumerate(text.splitlines(), 1):
+        if not line or line.startswith("# HELP"):
+            continue
+        if line.startswith("# TYPE"):
+            _, _, family, kind = line.split(" ", 3)
+            types[family] = kind
+            continue
+        match = SAMPLE.match(line)
+        if not match:
+            raise ValueError(f"line {number}: not a sample: {line}")
+        name, _, labels, value = match.groups()
+        family = re.sub(r"_(bucket|sum|count)$", "", name) if name not in types else name
+        if family not in types:
+            raise ValueError(f"line {number}: {name} has no # TYPE")
+        samples[(name, tuple(LABEL.findall(labels or "")))] = float(value)
+    return samples, types
+
+def check_histograms(samples, types):
+    for family, kind in types.items():
+        if kind != "histogram":
+            continue
+        series = {}
+        for (name, labels), value in samples.items():
+            if name == family + "_bucket":
+                rest = tuple(label for label in labels if label[0] != "le")
+                le = dict(labels)["le"]
+                series.setdefault(rest, []).append((math.inf if le == "+Inf" else float(le), value))
+        for rest, buckets in series.items():
+            buckets.sort()
+            if buckets[-1][0] != math.inf:
+                raise ValueError(f"{family}{rest}: no +Inf bucket")
+            if any(a[1] > b[1] for a, b in zip(buckets, buckets[1:])):
+                raise ValueError(f"{family}{rest}: buckets not cumulative")
+            if samples.get((family + "_count", rest)) != buckets[-1][1]:
+                raise ValueError(f"{family}{rest}: _count differs from the +Inf bucket")
+
+def quantile(q, buckets):
+    """histogram_quantile() over (upper bound, cumulative count) pairs"""
+    total = buckets[-1][1]
+    if total <= 0:
+        return 0.0
+    rank = q * total
+    lower, below = 0.0, 0.0
+    for bound, count in buckets:
+        if count >= rank:
+            if bound == math.inf:
+                return lower
+            return lower + (bound - lower) * (rank - below) / max(count - below, 1e-12)
+        lower, below = bound, count
+    return lower
+
+def format_labels(labels):
+    return "{" + ",".join(f'{k}="{v}"' for k, v in labels) + "}" if labels else ""
+
+def scrape(url):
+    with urllib.request.urlopen(url, timeout=10) as response:
+        return response.read().decode("utf-8")
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard /metrics check")
+    parser.add_argument("--url", default="http://localhost:3000/metrics")
+    parser.add_argument("--interval", type=float, default=10.0, help="seconds between the two scrapes")
+    args = parser.parse_args()
+
+    try:
+        first_at = time.monotonic()
+        first, types = parse(scrape(args.url))
+        time.sleep(args.interval)
+        elapsed = time.monotonic() - first_at
+        second, types = parse(scrape(args.url))
+        check_histograms(second, types)
+    except ValueError as e:
+        print(f"metrics_scrape: bad exposition: {e}", file=sys.stderr)
+        return 1
+
+    histograms = {}
+    for (name, labels), value in sorted(second.items()):
+        family = re.sub(r"_(bucket|sum|count)$", "", name)
+        kind = types.get(name) or types.get(family)
+        delta = value - first.get((name, labels), 0.0)
+        if kind == "counter" and delta:
+            print(f"RATE {name}{format_labels(labels)} per_s={delta / elapsed:.2f}")
+        elif kind == "gauge":
+            print(f"GAUGE {name}{format_labels(labels)} value={value:g}")
+        elif kind == "histogram":
+            rest = tuple(label for label in labels if label[0] != "le")
+            entry = histograms.setdefault((family, rest), {"buckets": [], "sum": 0.0, "count": 0.0})
+            if name.endswith("_bucket"):
+                le = dict(labels)["le"]
+                entry["buckets"].append((math.inf if le == "+Inf" else float(le), delta))
+            elif name.endswith("_sum"):
+                entry["sum"] = delta
+            else:
+                entry["count"] = delta
+    for (family, labels), entry in histograms.items():
+        if entry["count"] <= 0:
+            continue
+        buckets = sorted(entry["buckets"])
+        print(f"HIST {family}{format_labels(labels)} count={entry['count']:.0f} "
+              f"per_s={entry['count'] / elapsed:.2f} mean_ms={entry['sum'] / entry['count'] * 1000:.3f} "
+              f"p50_ms={quantile(0.5, buckets) * 1000:.3f} p99_ms={quantile(0.99, buckets) * 1000:.3f}")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,230 @@
+"""Panorama of the patrolled arc, stitched from frames by the pan position.
+
+With FIREGUARD_PANORAMA=1 the server asks every unit to print the frame of
+each patrol check too (SCAN ON), and every frame's header says where the
+pan was when it was read, in steps, clockwise positive (Firmware/src/I2C.c):
+
+    Center Matrix Data (abnormal row removed): seq=12 acquired=316072 sent=379858 rows=15 pan=-120
+
+The sensor's columns look out at fixed angles off its axis, so a frame
+already is a strip of a cylinder around the pan axis: the unit's frame
+covers the 16 center columns of the sensor (55 degrees), a calibrated raw
+frame all 32 (110 degrees, see raw_frames.py). Each frame is resampled
+bilinearly onto a fixed grid of cells, RESOLUTION degrees of azimuth by
+RESOLUTION degrees of elevation all around the unit, at the azimuth its
+pan position points to, and blended into what is there:
+
+    value = (value * weight * MEMORY + frame * w) / (weight * MEMORY + w)
+
+w falls off from the frame's center to its edges, so overlapping frames
+fade into each other instead of leaving seams, and MEMORY lets every pass
+of the patrol replace most of the last one's picture. Stitching a frame
+touches only the cells it covers, whatever the size of the panorama.
+
+image() cuts the covered arc (or any range of azimuths, for tiles) out of
+the grid, and png() encodes it with the page's heat map colours.
+"""
+import math
+import struct
+import threading
+import time
+import zlib
+
+import raw_frames
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+# Field of view of the MLX90640BAA and its pixels
+SENSOR_FOV = (75.0, 110.0)      # Degrees, vertical and horizontal
+SENSOR_SHAPE = (24, 32)
+
+RESOLUTION = 1.0                # Degrees per panorama cell
+DEG_PER_STEP = 0.225            # Pan degrees per motor step: eighth steps of a 1.8 degree motor
+MEMORY = 0.5                    # Share of a cell's weight kept when a new frame covers it
+EDGE_WEIGHT = 0.05              # Weight of a frame's outermost pixels, relative to its center
+
+PNG_SIGNATURE = b"\x89PNG\r\n\x1a\n"
+MISSING_COLOR = (0x44, 0x44, 0x44)
+
+def available():
+    return numpy is not None
+
+def heatmap_palette():
+    """255 colours from blue (cold) to red (hot), as the page's
+    heatmapPalette() (assets/heatmap.js), then grey for missing cells"""
+    palette = numpy.empty((256, 3), dtype=numpy.uint8)
+    hue = (1 - numpy.arange(255) / 254) * 240
+    for channel, n in enumerate((0, 8, 4)):
+        k = (n + hue / 30) % 12
+        palette[:255, channel] = numpy.round(255 * (0.5 - 0.5 * numpy.clip(numpy.minimum(k - 3, 9 - k), -1, 1)))
+    palette[255] = MISSING_COLOR
+    return palette
+
+def png(rgb):
+    """An 8-bit RGB PNG of an (rows, cols, 3) uint8 array"""
+    rows, cols = rgb.shape[:2]
+    scanlines = numpy.zeros((rows, cols * 3 + 1), dtype=numpy.uint8)    # Filter byte 0 (none) per row
+    scanlines[:, 1:] = rgb.reshape(rows, cols * 3)
+
+    def chunk(kind, data):
+        return struct.pack(">I", len(data)) + kind + data + struct.pack(">I", zlib.crc32(kind + data))
+
+    return (PNG_SIGNATURE
+            + chunk(b"IHDR", struct.pack(">IIBBBBB", cols, rows, 8, 2, 0, 0, 0))
+            + chunk(b"IDAT", zlib.compress(scanlines.tobytes(), 6))
+            + chunk(b"IEND", b""))
+
+class Panorama:
+    """A unit's panorama: frames go in with add(), image() and png() take
+    the picture out. Safe to use from several threads."""
+
+    def __init__(self, resolution=RESOLUTION, deg_per_step=DEG_PER_STEP, memory=MEMORY):
+        self.resolution = resolution
+        self.deg_per_step = deg_per_step
+        self.memory = memory
+        self.rows = math.ceil(SENSOR_FOV[0] / resolution)
+        self.cols = round(360 / resolution)
+        self.lock = threading.Lock()
+        self.value = numpy.full((self.rows, self.cols), numpy.nan, dtype=numpy.float32)
+        self.weight = numpy.zeros((self.rows, self.cols), dtype=numpy.float32)
+        self.updated = numpy.zeros(self.cols)      # time.time() a column last got a pixel, 0 never
+        self.frames = 0
+        self.version = 0
+        self.palette = heatmap_palette()
+        # Elevation of the center of each row, top row first
+        self.elevation = SENSOR_FOV[0] / 2 - (numpy.arange(self.rows) + 0.5) * resolution
+
+    def add(self, matrix, pan, zoom=1, now=None):
+        """Stitch in a frame (rows of degrees, None for missing pixels) read
+        at pan steps; zoom is its cells per sensor pixel (an upscaled raw
+        frame's RAW_UPSCALE). Returns whether it covered anything."""
+        frame = raw_frames.frame_array(matrix)
+        if frame.ndim != 2 or not frame.size:
+            return False
+        rows, cols = frame.shape
+        pitch_row = SENSOR_FOV[0] / SENSOR_SHAPE[0] / zoom
+        pitch_col = SENSOR_FOV[1] / SENSOR_SHAPE[1] / zoom
+        azimuth = pan * self.deg_per_step
+
+        # Panorama columns and rows under the frame, and where each falls
+        # in it (fractional pixel indices)
+        half = cols * pitch_col / 2
+        first = math.floor((azimuth - half) / self.resolution)
+        columns = numpy.arange(first, math.ceil((azimuth + half) / self.resolution))
+        source_col = ((columns + 0.5) * self.resolution - azimuth) / pitch_col + (cols - 1) / 2
+        inside = (source_col >= -0.5) & (source_col <= cols - 0.5)
+        columns, source_col = columns[inside] % self.cols, source_col[inside]
+        source_row = (rows - 1) / 2 - self.elevation / pitch_row
+        inside = (source_row >= -0.5) & (source_row <= rows - 0.5)
+        lines, source_row = numpy.nonzero(inside)[0], source_row[inside]
+        if not len(columns) or not len(lines):
+            return False
+
+        sample = bilinear(frame, source_row, source_col)
+        weight = numpy.outer(feather(source_row, rows), feather(source_col, cols))
+        weight[numpy.isnan(sample)] = 0
+        sample = numpy.nan_to_num(sample)
+
+        cells = numpy.ix_(lines, columns)
+        with self.lock:
+            kept = self.weight[cells] * self.memory
+            total = kept + weight
+            old = self.value[cells]
+            blended = (numpy.nan_to_num(old) * kept + sample * weight) / numpy.maximum(total, 1e-9)
+            self.value[cells] = numpy.where(total > 0, blended, old)
+            self.weight[cells] = total
+            seen = weight.any(axis=0)
+            self.updated[columns[seen]] = time.time() if now is None else now
+            self.frames += 1
+            self.version += 1
+        return bool(seen.any())
+
+    def covered(self):
+        """(first column, count) of the arc the frames covered: everything
+        but the widest stretch of columns no frame reached; (0, 0) before
+        the first frame"""
+        seen = self.updated > 0
+        if not seen.any():
+            return 0, 0
+        if seen.all():
+            return 0, self.cols
+        # The widest gap, going round from a covered column
+        start = int(numpy.argmax(seen))
+        ring = numpy.roll(seen, -start)
+        best_gap, best_end, gap = 0, 0, 0
+        for index, covered in enumerate(ring):
+            gap = 0 if covered else gap + 1
+            if gap > best_gap:
+                best_gap, best_end = gap, index
+        return (start + best_end + 1) % self.cols, self.cols - best_gap
+
+    def image(self, start=None, end=None):
+        """(values, ages, first azimuth) of the columns from azimuth start
+        to end (degrees, the covered arc by default), rows no frame
+        reached left out; values in degrees, NaN where nothing was seen,
+        ages in seconds per column (None for never)"""
+        with self.lock:
+            if start is None or end is None:
+                first, count = self.covered()
+            else:
+                first = math.floor(start / self.resolution)
+                count = max(0, min(math.ceil(end / self.resolution) - first, self.cols))
+            columns = (first + numpy.arange(count)) % self.cols
+            values = self.value[:, columns]
+            seen_rows = self.weight[:, columns].any(axis=1) if count else numpy.zeros(self.rows, bool)
+            updated = self.updated[columns]
+        if seen_rows.any():
+            top, bottom = numpy.nonzero(seen_rows)[0][[0, -1]]
+            values = values[top:bottom + 1]
+        else:
+            values = values[:0]
+        now = time.time()
+        ages = [round(now - t, 1) if t else None for t in updated.tolist()]
+        return values, ages, (first * self.resolution) % 360
+
+    def png(self, values, low=None, high=None):
+        """An image() as PNG, coloured from low to high degrees (its own
+        range by default)"""
+        known = values[~numpy.isnan(values)]
+        if low is None:
+            low = float(known.min()) if known.size else 0.0
+        if high is None:
+            high = float(known.max()) if known.size else 0.0
+        scale = 254 / (high - low) if high > low else 0.0
+        indices = numpy.clip(numpy.round((numpy.nan_to_num(values, nan=low) - low) * scale), 0, 254)
+        indices = indices.astype(numpy.uint8)
+        indices[numpy.isnan(values)] = 255
+        return png(self.palette[indices])
+
+    def stats(self):
+        first, count = self.covered()
+        return {
+            "frames": self.frames,
+            "version": self.version,
+            "resolution": self.resolution,
+            "deg_per_step": self.deg_per_step,
+            "start": (first * self.resolution) % 360,
+            "width": count * self.resolution,
+        }
+
+def bilinear(frame, source_row, source_col):
+    """frame sampled at every (row, col) of the grid of fractional indices"""
+    rows, cols = frame.shape
+    row = numpy.clip(source_row, 0, rows - 1)
+    col = numpy.clip(source_col, 0, cols - 1)
+    r0 = numpy.minimum(row.astype(int), rows - 2) if rows > 1 else numpy.zeros(len(row), int)
+    c0 = numpy.minimum(col.astype(int), cols - 2) if cols > 1 else numpy.zeros(len(col), int)
+    r1, c1 = numpy.minimum(r0 + 1, rows - 1), numpy.minimum(c0 + 1, cols - 1)
+    fr, fc = (row - r0)[:, None], (col - c0)[None, :]
+    top = frame[numpy.ix_(r0, c0)] * (1 - fc) + frame[numpy.ix_(r0, c1)] * fc
+    bottom = frame[numpy.ix_(r1, c0)] * (1 - fc) + frame[numpy.ix_(r1, c1)] * fc
+    return top * (1 - fr) + bottom * fr
+
+def feather(source, size):
+    """Blending weight of fractional pixel indices: 1 at the frame's
+    center down to EDGE_WEIGHT at its edges"""
+    distance = numpy.abs(source - (size - 1) / 2) / (size / 2)
+    return numpy.clip(1 - distance, EDGE_WEIGHT, 1)
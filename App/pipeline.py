@@ -0,0 +1,134 @@
+"""Hand-over between a unit's serial reader and the consumers of its data.
+
+The reader thread only reads, parses and swaps in the new state; what may
+be slow runs on a stage's own thread, and every stage has a policy for
+what happens when it falls behind:
+
+    lossless   a bounded queue; when it is full the producer waits for
+               room (backpressure), and the waits and time waited count
+    latest     a single slot; a new item replaces one not taken yet
+               (counted as coalesced), so a slow consumer only ever
+               handles the newest
+
+A lossless stage can also hand its consumer everything queued at once
+(batch=n, up to n items per call), for work that is cheaper done on many
+items together.
+
+Each stage reports its depth, high-water mark, items handled, waits,
+coalesced items and busy time (stats()), served as /api/pipeline.
+"""
+import collections
+import threading
+import time
+
+LOSSLESS = "lossless"
+LATEST = "latest"
+QUEUE_SIZE = 4096           # Items a lossless stage holds before the producer waits
+
+class Stage:
+    """A consumer thread fed by put(); handler(item) is called for every
+    item taken, in order, or handler(items) with up to batch of them"""
+
+    def __init__(self, name, handler, policy=LOSSLESS, size=QUEUE_SIZE, batch=None):
+        self.name = name
+        self.handler = handler
+        self.policy = policy
+        self.size = size if policy == LOSSLESS else 1
+        self.batch = batch
+        self.items = collections.deque()
+        self.lock = threading.Lock()
+        self.changed = threading.Condition(self.lock)
+        self.busy = False
+        self.closed = False
+        self.put_count = 0
+        self.handled = 0
+        self.coalesced = 0
+        self.waits = 0
+        self.wait_s = 0.0
+        self.busy_s = 0.0
+        self.errors = 0
+        self.high_water = 0
+        self.thread = threading.Thread(target=self.run, daemon=True, name=f"stage_{name}")
+        self.thread.start()
+
+    def put(self, item):
+        """Queue item under the stage's policy; False once closed"""
+        with self.lock:
+            if self.closed:
+                return False
+            if self.policy == LATEST:
+                if self.items:
+                    self.items.clear()
+                    self.coalesced += 1
+            elif len(self.items) >= self.size:
+                self.waits += 1
+                started = time.perf_counter()
+                while len(self.items) >= self.size and not self.closed:
+                    self.changed.wait()
+                self.wait_s += time.perf_counter() - started
+                if self.closed:
+                    return False
+            self.items.append(item)
+            self.put_count += 1
+            self.high_water = max(self.high_water, len(self.items))
+            self.changed.notify_all()
+        return True
+
+    def run(self):
+        while True:
+            with self.lock:
+                while not self.items and not self.closed:
+                    self.changed.wait()
+                if not self.items:
+                    return
+                if self.batch:
+                    item = [self.items.popleft() for _ in range(min(self.batch, len(self.items)))]
+                else:
+                    item = self.items.popleft()
+                self.busy = True
+                self.changed.notify_all()
+            started = time.perf_counter()
+            try:
+                self.handler(item)
+            except Exception as e:
+                self.errors += 1
+                print(f"Error in {self.name} stage: {e}")
+            with self.lock:
+                self.busy_s += time.perf_counter() - started
+                self.handled += len(item) if self.batch else 1
+                self.busy = False
+                self.changed.notify_all()
+
+    def flush(self, timeout=None):
+        """Wait until everything put so far is handled; False on timeout"""
+        deadline = None if timeout is None else time.monotonic() + timeout
+        with self.lock:
+            while (self.items or self.busy) and self.thread.is_alive():
+                remaining = None if deadline is None else deadline - time.monotonic()
+                if remaining is not None and remaining <= 0:
+                    return False
+                self.changed.wait(remaining)
+        return True
+
+    def close(self, timeout=5.0):
+        """Handle what is queued, then end the thread; puts fail from now on"""
+        with self.lock:
+            self.closed = True
+            self.changed.notify_all()
+        self.thread.join(timeout)
+
+    def stats(self):
+        with self.lock:
+            return {
+                "policy": self.policy,
+                "depth": len(self.items),
+                "capacity": self.size,
+                "high_water": self.high_water,
+                "put": self.put_count,
+                "handled": self.handled,
+                "coalesced": self.coalesced,
+                "waits": self.waits,
+                "wait_ms": round(self.wait_s * 1000, 1),
+                "busy_ms": round(self.busy_s * 1000, 1),
+                "errors": self.errors,
+            }
@@ -0,0 +1,138 @@
+"""Early warning of a fire from how fast pixels warm up, before they are hot.
+
+The firmware raises FIRE DETECTED once a pixel passes FIRE_THRESHOLD
+(50C by default) in its target columns; a smouldering fire can take
+minutes to get there. With FIREGUARD_RISE=1 the server follows every
+pixel of every frame instead and warns while it is still warming up.
+
+The sensor pans, so a pixel only means the same spot of the room at the
+same pan position: every frame header carries it (pan=<steps>, see
+panorama.py), and the state is kept per view, one per pan position the
+unit stops at (the patrol checks the same ones on every sweep). Per pixel
+of a view, updated in place for each frame whatever the time since the
+last one (alpha = 1 - exp(-dt / tau)):
+
+    level       the reading, smoothed over TAU_LEVEL
+    trend       how fast level moves, C/min, smoothed over TAU_TREND
+    baseline    what the spot normally reads, over TAU_BASELINE; it
+                does not learn from pixels above it by RISE_DELTA, so a
+                slow fire is not taken for the new normal
+    rising      since when trend has been at least RISE_RATE with level
+                RISE_DELTA above the baseline, without a break
+
+A pixel is warming once it has been rising for PERSISTENCE seconds, which
+a person walking through or the sensor's noise are not. MIN_PIXELS of a
+view warming at once raise the warning; it ends when no view has had a
+warming pixel for CLEAR_AFTER seconds. Each frame costs a few array
+operations over its pixels, whatever the number of views.
+"""
+import collections
+import math
+import time
+
+import raw_frames
+
+numpy = raw_frames.numpy
+
+TAU_LEVEL = 10.0            # Seconds, smoothing of the readings
+TAU_TREND = 20.0            # Seconds, smoothing of the rate of rise
+TAU_BASELINE = 600.0        # Seconds, what a spot normally reads
+RISE_RATE = 4.0             # C/min a pixel has to warm by...
+RISE_DELTA = 4.0            # ...while this many degrees above its baseline...
+PERSISTENCE = 20.0          # ...for this many seconds
+MIN_PIXELS = 2              # Warming pixels of a view that raise the warning
+WARMUP = 3                  # Frames of a view before it can warn
+STALE = 300.0               # Seconds without a frame after which a view starts over
+CLEAR_AFTER = 180.0         # Seconds without warming pixels that end the warning, past a patrol's round trip
+MAX_VIEWS = 512             # Views kept per unit, the least recently seen go first
+
+def available():
+    return numpy is not None
+
+class View:
+    """Per pixel state of one pan position"""
+
+    def __init__(self, frame, now):
+        self.level = frame.copy()
+        self.trend = numpy.zeros_like(frame)
+        self.baseline = frame.copy()
+        self.rising = numpy.full(frame.shape, numpy.nan)   # time.time() rising since, NaN if not
+        self.time = now
+        self.frames = 1
+
+class RiseDetector:
+    """A unit's rate of rise analysis: update() with every frame, which
+    returns the warning (a dict for the state's "early_warning") or None"""
+
+    def __init__(self, rate=RISE_RATE, delta=RISE_DELTA, persistence=PERSISTENCE):
+        self.rate = rate
+        self.delta = delta
+        self.persistence = persistence
+        self.views = collections.OrderedDict()
+        self.warning = None
+        self.last_warming = None     # time.time() a pixel was last warming
+        self.warnings = 0            # Warnings raised
+
+    def update(self, frame, pan, now=None):
+        """A frame (float array of degrees, NaN for missing pixels) read at
+        pan steps (None from older firmware)"""
+        now = time.time() if now is None else now
+        view = self.views.get(pan)
+        if view is None or view.level.shape != frame.shape or now - view.time > STALE:
+            self.views[pan] = View(numpy.where(numpy.isnan(frame), numpy.nanmean(frame), frame), now)
+            self.views.move_to_end(pan)
+            while len(self.views) > MAX_VIEWS:
+                self.views.popitem(last=False)
+            return self.expire(now)
+        self.views.move_to_end(pan)
+        dt = now - view.time
+        if dt <= 0:
+            return self.warning
+        view.time = now
+        view.frames += 1
+
+        reading = numpy.where(numpy.isnan(frame), view.level, frame)
+        previous = view.level.copy()
+        view.level += (1 - math.exp(-dt / TAU_LEVEL)) * (reading - view.level)
+        view.trend += (1 - math.exp(-dt / TAU_TREND)) * ((view.level - previous) * (60 / dt) - view.trend)
+        excess = view.level - view.baseline
+        above = excess >= self.delta
+        # The baseline follows the spot, but not a fire warming it up
+        numpy.add(view.baseline, (1 - math.exp(-dt / TAU_BASELINE)) * (reading - view.baseline),
+                  out=view.baseline, where=~above)
+
+        rising = above & (view.trend >= self.rate)
+        view.rising = numpy.where(rising, numpy.fmin(view.rising, now), numpy.nan)
+        if view.frames < WARMUP:
+            return self.expire(now)
+        with numpy.errstate(invalid="ignore"):
+            warming = now - view.rising >= self.persistence
+        count = int(warming.sum())
+        if count < MIN_PIXELS:
+            return self.expire(now)
+
+        peak = numpy.unravel_index(numpy.argmax(numpy.where(warming, view.trend, -numpy.inf)), frame.shape)
+        if self.warning is None:
+            self.warnings += 1
+            started = {"since": time.strftime("%H:%M:%S", time.localtime(now)), "time": now}
+        else:
+            started = {"since": self.warning["since"], "time": self.warning["time"]}
+        self.last_warming = now
+        # A new dict every time, the state store tells changes by identity
+        self.warning = dict(
+            started,
+            pixels=count,
+            rate=round(float(view.trend[peak]), 1),
+            temp=round(float(view.level[peak]), 1),
+            baseline=round(float(view.baseline[peak]), 1),
+            persistence=round(float(now - view.rising[peak]), 1),
+            position=[int(peak[0]), int(peak[1])],
+            pan=pan,
+        )
+        return self.warning
+
+    def expire(self, now):
+        """The warning, ended once nothing warmed for CLEAR_AFTER"""
+        if self.warning is not None and now - self.last_warming > CLEAR_AFTER:
+            self.warning = None
+        return self.warning
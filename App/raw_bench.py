@@ -0,0 +1,123 @@
+"""Benchmark of the raw frame calibration (raw_frames.py).
+
+Calibrates synthetic raw frames from several units in batches of
+different sizes, the way the server's calibration stage gets them, and
+times each step of its work:
+
+    python raw_bench.py                         # 1, 4 and 16 units, batches of 1 to 256
+    python raw_bench.py --units 8 --batch 64 --frames 20000 --upscale 4
+
+It prints one line per combination
+
+    RAW units=<n> batch=<n> upscale=<n> frames=<n> calibrate_fps=<n> upscale_fps=<n>
+        analyze_fps=<n> matrix_fps=<n> total_fps=<n>
+
+calibrate is the temperature of every pixel from the words, upscale the
+filling of bad pixels and the bicubic interpolation, analyze the thermal
+core's hotspot search on the result (0 without libthermal.so) and matrix
+the conversion to the lists that are published; total is all of them.
+"""
+import argparse
+import sys
+import time
+
+import raw_frames
+import thermal_core
+
+def put(word, value, bits, shift):
+    return word | ((value & ((1 << bits) - 1)) << shift)
+
+def synthetic_eeprom(seed):
+    """An EEPROM dump with every calibration term in use, a little
+    different per unit"""
+    numpy = raw_frames.numpy
+    rng = numpy.random.default_rng(seed)
+    ee = [0] * 832
+    ee[16] = (9 << 12) | (2 << 8) | (2 << 4)
+    ee[17] = 400
+    ee[32] = (8 << 12) | (6 << 8) | (6 << 4) | 4
+    ee[33] = 27000
+    for i in range(24):
+        ee[18 + i // 4] = put(ee[18 + i // 4], int(rng.integers(-3, 4)), 4, 4 * (i % 4))
+        ee[34 + i // 4] = put(ee[34 + i // 4], int(rng.integers(-2, 3)), 4, 4 * (i % 4))
+    for j in range(32):
+        ee[24 + j // 4] = put(ee[24 + j // 4], int(rng.integers(-2, 3)), 4, 4 * (j % 4))
+        ee[40 + j // 4] = put(ee[40 + j // 4], int(rng.integers(-1, 2)), 4, 4 * (j % 4))
+    ee[48], ee[49], ee[50] = 6000, 12200, 336
+    ee[51] = ((-99 & 0xFF) << 8) | 0x5D
+    ee[52], ee[53], ee[54], ee[55] = 0x1234, 0x0843, 0x0A0B, 0x0C0D
+    ee[56] = (2 << 12) | (3 << 8) | (4 << 4) | 1
+    ee[57], ee[58], ee[59] = 0x0400 | 300, 0x0800 | 20, 0x0203
+    ee[60], ee[61], ee[62], ee[63] = 0x0305, 0x0102, 0x0304, 0x2134
+    for p in range(768):
+        word = put(0, int(rng.integers(-10, 11)), 6, 10)
+        word = put(word, int(rng.integers(1, 5)), 6, 4)
+        ee[64 + p] = put(word, int(rng.integers(-2, 3)), 3, 1)
+    return numpy.array(ee, dtype=numpy.uint16)
+
+def synthetic_frames(count, seed):
+    """frameData of count frames: a room around 22C with a hot spot,
+    alternating subpages in chess mode"""
+    numpy = raw_frames.numpy
+    rng = numpy.random.default_rng(seed)
+    frames = numpy.zeros((count, raw_frames.FRAME_WORDS), dtype=numpy.uint16)
+    frames[:, :768] = rng.integers(330, 360, (count, 768))
+    frames[:, rng.integers(0, 768, count)] = 1400
+    frames[:, raw_frames.VBE] = 16311
+    frames[:, raw_frames.GAIN] = 6000
+    frames[:, raw_frames.PTAT] = 1500
+    frames[:, raw_frames.VDD] = -13408 & 0xFFFF
+    frames[:, raw_frames.CP_SUBPAGE[0]] = 40
+    frames[:, raw_frames.CP_SUBPAGE[1]] = 42
+    frames[:, raw_frames.CONTROL] = 0x1981
+    frames[:, raw_frames.SUBPAGE] = numpy.arange(count) % 2
+    return frames
+
+def run(units, batch, upscale, count):
+    calibrator = raw_frames.Calibrator()
+    for unit in range(units):
+        calibrator.set_eeprom(unit, synthetic_eeprom(unit))
+    upsample = raw_frames.Upsampler(upscale)
+    frames = synthetic_frames(count, units)
+    names = [k % units for k in range(count)]
+    times = {"calibrate": 0.0, "upscale": 0.0, "analyze": 0.0, "matrix": 0.0}
+    for start in range(0, count, batch):
+        t0 = time.perf_counter()
+        temperatures = calibrator.calibrate(names[start:start + batch], frames[start:start + batch])
+        t1 = time.perf_counter()
+        pixels = upsample(raw_frames.fill_missing(temperatures))
+        t2 = time.perf_counter()
+        if thermal_core.available():
+            rows, cols = pixels.shape[1:]
+            thermal_core.analyze(raw_frames.centidegrees(pixels), rows, cols)
+        t3 = time.perf_counter()
+        raw_frames.matrices(pixels)
+        t4 = time.perf_counter()
+        times["calibrate"] += t1 - t0
+        times["upscale"] += t2 - t1
+        times["analyze"] += t3 - t2
+        times["matrix"] += t4 - t3
+    rate = lambda seconds: f"{count / seconds:.0f}" if seconds > 0 else "0"
+    print(f"RAW units={units} batch={batch} upscale={upscale} frames={count} "
+          f"calibrate_fps={rate(times['calibrate'])} upscale_fps={rate(times['upscale'])} "
+          f"analyze_fps={rate(times['analyze']) if thermal_core.available() else 0} "
+          f"matrix_fps={rate(times['matrix'])} total_fps={rate(sum(times.values()))}", flush=True)
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard raw frame calibration benchmark")
+    parser.add_argument("--units", type=int, action="append", help="units sending frames (repeatable)")
+    parser.add_argument("--batch", type=int, action="append", help="frames per batch (repeatable)")
+    parser.add_argument("--upscale", type=int, default=2, help="interpolation factor")
+    parser.add_argument("--frames", type=int, default=4096, help="frames per run")
+    args = parser.parse_args()
+
+    if not raw_frames.available():
+        print("raw_bench: numpy is not installed (pip install -r requirements.txt)", file=sys.stderr)
+        return 1
+    for units in args.units or [1, 4, 16]:
+        for batch in args.batch or [1, 16, 64, 256]:
+            run(units, batch, args.upscale, args.frames)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,438 @@
+"""Raw frames: the MLX90640's own words, calibrated on the server with numpy.
+
+With FIREGUARD_RAW=1 the server asks every unit for its sensor's
+calibration EEPROM (EEPROM) and to send frames as the sensor's RAM (RAW
+ON) instead of the converted center matrix (Firmware/src/I2C.c):
+
+    Raw Frame Data: seq=12 acquired=316072 sent=379858 rows=26 pan=-120 status=0009 control=1901
+    RAW 0 AR8BJQEsATMB...
+    ...
+    RAW 25 BdwAAAAA...
+
+26 lines of 32 big endian words in base64, pixels then the auxiliary
+data, as frameData[0..831] of the Melexis driver. The whole 24x32 frame
+is then turned into temperatures as the datasheet (and the driver's
+MLX90640_ExtractParameters / MLX90640_CalculateTo) does it: supply
+voltage and ambient from the auxiliary words, per pixel gain, offset with
+its Ta/Vdd drift, the compensation pixel, emissivity and the per pixel
+sensitivity, with the KsTo range correction. Only the pixels of the
+subpage in the frame are new (chess or interleaved pattern); the others
+keep their value from the unit's previous frame.
+
+Frames are calibrated in batches from every unit at once: the parameters
+of each unit are stacked into arrays with one row per unit (Calibrator),
+so a batch is a handful of array operations however many frames and
+units it holds. Upsampler then interpolates the batch bicubically to a
+multiple of the resolution (FIREGUARD_RAW_UPSCALE), and the server
+publishes it in place of the matrix.
+
+A unit whose EEPROM is blank or hasn't been read yet gets the firmware's
+linear approximation (raw * 10 - 1000 centidegrees) instead.
+"""
+import base64
+import threading
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+ROWS, COLS = 24, 32
+PIXELS = ROWS * COLS
+LINE_WORDS = 32             # Words per RAW/EE line
+LINES = 26                  # Lines of a frame and of the EEPROM, 832 words each
+
+EMISSIVITY = 0.95
+TA_SHIFT = 8.0              # Reflected temperature is Ta - 8 in open air, as in the Melexis examples
+TEMPERATURE_RANGE = (-40.0, 300.0)   # What the sensor is calibrated for, C
+
+# Auxiliary words, as indices into frameData (0x0400 + index)
+VBE = 768
+CP_SUBPAGE = (776, 808)     # Compensation pixel of subpage 0 and 1
+GAIN = 778
+PTAT = 800
+VDD = 810
+CONTROL = 832               # Appended: control register 0x800D
+SUBPAGE = 833               # Appended: subpage, status register bit 0
+FRAME_WORDS = 834
+
+CONTROL_CHESS = 0x1000
+RESOLUTION_SHIFT = 10
+
+def available():
+    return numpy is not None
+
+def decode_line(text):
+    """The words of a RAW/EE line's base64, or None if it isn't one line's worth"""
+    try:
+        data = base64.b64decode(text, validate=True)
+    except (ValueError, TypeError):
+        return None
+    if len(data) != LINE_WORDS * 2:
+        return None
+    return data
+
+def parse_registers(line):
+    """(status, control) from a raw frame header, None if they are missing"""
+    values = {}
+    for part in line.split():
+        key, _, value = part.partition("=")
+        if key in ("status", "control"):
+            try:
+                values[key] = int(value, 16)
+            except ValueError:
+                return None
+    if len(values) != 2:
+        return None
+    return values["status"], values["control"]
+
+class LineAssembler:
+    """Collects the numbered lines of one dump (RAW or EE) into words"""
+
+    def __init__(self):
+        self.lines = [None] * LINES
+        self.count = 0
+
+    def add(self, text):
+        """Take "<line> <base64>" (the tag stripped), returns False if it is
+        malformed; complete() says when all lines are in"""
+        index, _, data = text.partition(" ")
+        try:
+            index = int(index)
+        except ValueError:
+            return False
+        data = decode_line(data)
+        if data is None or not 0 <= index < LINES:
+            return False
+        if self.lines[index] is None:
+            self.count += 1
+        self.lines[index] = data
+        return True
+
+    def complete(self):
+        return self.count == LINES
+
+    def words(self):
+        """The dump as 832 uint16"""
+        return numpy.frombuffer(b"".join(self.lines), dtype=">u2").astype(numpy.uint16)
+
+def frame_words(ram, status, control):
+    """frameData as the Melexis driver has it: the RAM, control, subpage"""
+    frame = numpy.empty(FRAME_WORDS, dtype=numpy.uint16)
+    frame[:LINES * LINE_WORDS] = ram
+    frame[CONTROL] = control
+    frame[SUBPAGE] = status & 0x0001
+    return frame
+
+def signed(value, bits):
+    """Two's complement of a field of bits, works on arrays"""
+    value = numpy.asarray(value, dtype=numpy.int32)
+    return numpy.where(value >= 1 << (bits - 1), value - (1 << bits), value)
+
+def nibbles(words, count):
+    """count signed 4 bit fields, least significant first, from words"""
+    words = numpy.asarray(words, dtype=numpy.int32)
+    fields = (words[:, None] >> numpy.arange(0, 16, 4)) & 0x0F
+    return signed(fields.reshape(-1)[:count], 4)
+
+def extract_parameters(ee):
+    """The calibration in an EEPROM dump (832 words from 0x2400) as floats,
+    following MLX90640_ExtractParameters. None for a blank EEPROM."""
+    ee = numpy.asarray(ee, dtype=numpy.int32)
+    if ee[48] == 0 or (ee[51] & 0xFF00) == 0:
+        return None
+    p = {}
+    pixel = ee[64:64 + PIXELS]
+    row = numpy.repeat(numpy.arange(ROWS), COLS)
+    col = numpy.tile(numpy.arange(COLS), ROWS)
+
+    # Supply voltage and ambient sensor
+    p["kVdd"] = float(signed(ee[51] >> 8, 8) * 32)
+    p["vdd25"] = float(((ee[51] & 0xFF) - 256) * 32 - 8192)
+    p["KvPTAT"] = float(signed(ee[50] >> 10, 6)) / 4096
+    p["KtPTAT"] = float(signed(ee[50] & 0x03FF, 10)) / 8
+    p["vPTAT25"] = float(ee[49])
+    p["alphaPTAT"] = (ee[16] >> 12) / 4 + 8.0
+    p["gainEE"] = float(signed(ee[48], 16))
+    p["tgc"] = float(signed(ee[60] & 0xFF, 8)) / 32
+    p["KsTa"] = float(signed(ee[60] >> 8, 8)) / 8192
+    p["resolutionEE"] = int((ee[56] >> 12) & 0x03)
+
+    # Temperature ranges of the KsTo correction
+    step = ((ee[63] >> 12) & 0x03) * 10
+    ct2 = ((ee[63] >> 4) & 0x0F) * step
+    ct3 = ct2 + ((ee[63] >> 8) & 0x0F) * step
+    ks_to_scale = float(1 << ((ee[63] & 0x0F) + 8))
+    p["ct"] = numpy.array([-40.0, 0.0, ct2, ct3])
+    p["ksTo"] = signed([ee[61] & 0xFF, ee[61] >> 8, ee[62] & 0xFF, ee[62] >> 8], 8) / ks_to_scale
+
+    # Sensitivity
+    alpha_scale = (ee[32] >> 12) + 30
+    acc_row = nibbles(ee[34:40], ROWS)
+    acc_col = nibbles(ee[40:48], COLS)
+    alpha = signed((pixel & 0x03F0) >> 4, 6) * float(1 << (ee[32] & 0x0F))
+    alpha += ee[33] + (acc_row[row] << ((ee[32] >> 8) & 0x0F)) + (acc_col[col] << ((ee[32] >> 4) & 0x0F))
+    p["alpha"] = alpha / 2.0 ** alpha_scale
+
+    # Offset
+    occ_row = nibbles(ee[18:24], ROWS)
+    occ_col = nibbles(ee[24:32], COLS)
+    offset = signed((pixel & 0xFC00) >> 10, 6) * float(1 << (ee[16] & 0x0F))
+    offset += signed(ee[17], 16) + (occ_row[row] << ((ee[16] >> 8) & 0x0F)) \
+        + (occ_col[col] << ((ee[16] >> 4) & 0x0F))
+    p["offset"] = offset.astype(numpy.float64)
+
+    # Drift of the offset with Ta and Vdd, by position in the 2x2 pattern
+    split = 2 * (row % 2) + col % 2
+    kta_rc = signed([ee[54] >> 8, ee[55] >> 8, ee[54] & 0xFF, ee[55] & 0xFF], 8)
+    kta_scale1 = ((ee[56] >> 4) & 0x0F) + 8
+    kta = signed((pixel & 0x000E) >> 1, 3) * float(1 << (ee[56] & 0x0F))
+    p["kta"] = (kta_rc[split] + kta) / 2.0 ** kta_scale1
+    kv_t = signed([ee[52] >> 12, (ee[52] >> 4) & 0x0F, (ee[52] >> 8) & 0x0F, ee[52] & 0x0F], 4)
+    kv_scale = (ee[56] >> 8) & 0x0F
+    p["kv"] = kv_t[split] / 2.0 ** kv_scale
+
+    # Compensation pixel
+    alpha_cp0 = signed(ee[57] & 0x03FF, 10) / 2.0 ** ((ee[32] >> 12) + 27)
+    p["cpAlpha"] = numpy.array([alpha_cp0, (1 + signed(ee[57] >> 10, 6) / 128) * alpha_cp0])
+    offset_cp0 = signed(ee[58] & 0x03FF, 10)
+    p["cpOffset"] = numpy.array([offset_cp0, offset_cp0 + signed(ee[58] >> 10, 6)], dtype=numpy.float64)
+    p["cpKta"] = float(signed(ee[59] & 0xFF, 8)) / 2.0 ** kta_scale1
+    p["cpKv"] = float(signed(ee[59] >> 8, 8)) / 2.0 ** kv_scale
+
+    # Chess pattern corrections, for frames not taken in the calibration mode
+    p["calibrationModeEE"] = int(((ee[10] & 0x0800) >> 4) ^ 0x80)
+    p["ilChessC"] = numpy.array([signed(ee[53] & 0x003F, 6) / 16,
+                                 signed((ee[53] & 0x07C0) >> 6, 5) / 2,
+                                 signed((ee[53] & 0xF800) >> 11, 5) / 8])
+
+    # Broken (all zero) and outlier (bit 0) pixels give no reading
+    p["bad"] = (pixel == 0) | ((pixel & 0x0001) != 0)
+    return p
+
+# Per unit parameters, stacked a unit per row by Calibrator
+SCALARS = ("kVdd", "vdd25", "KvPTAT", "KtPTAT", "vPTAT25", "alphaPTAT", "gainEE", "tgc", "KsTa",
+           "resolutionEE", "cpKta", "cpKv", "calibrationModeEE")
+VECTORS = ("ct", "ksTo", "cpAlpha", "cpOffset", "ilChessC")
+PER_PIXEL = ("alpha", "offset", "kta", "kv", "bad")
+
+def pixel_patterns():
+    """Per pixel: the interleaved (row) pattern, the chess pattern and the
+    conversion pattern of the chess correction, as CalculateTo has them"""
+    n = numpy.arange(PIXELS)
+    il = (n // 32) % 2
+    chess = il ^ (n % 2)
+    conversion = ((n + 2) // 4 - (n + 3) // 4 + (n + 1) // 4 - n // 4) * (1 - 2 * il)
+    return il, chess, conversion
+
+class Calibrator:
+    """Turns raw frames of many units into temperatures, a batch at a time.
+
+    set_eeprom() registers a unit's calibration; calibrate() takes the
+    frames of a batch with the unit each came from, in arrival order. Safe
+    to call from several threads, but frames are meant to come through one
+    (the server's calibration stage), which keeps each unit's in order."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.slots = {}         # Unit -> row in the stacked parameters
+        self.params = {}        # Name -> array, a row per slot
+        self.calibrated = numpy.zeros(0, dtype=bool)    # Slots with an EEPROM
+        self.previous = {}      # Unit -> its last temperatures, for the other subpage
+        self.il, self.chess, self.conversion = pixel_patterns()
+
+    def slot(self, unit):
+        """The unit's row in the stacked parameters, added if it is new"""
+        with self.lock:
+            if unit not in self.slots:
+                self.slots[unit] = len(self.slots)
+                self.calibrated = numpy.append(self.calibrated, False)
+                for name, values in self.params.items():
+                    self.params[name] = numpy.concatenate([values, values[-1:]])
+            return self.slots[unit]
+
+    def set_eeprom(self, unit, ee):
+        """Calibrate the unit's frames with its EEPROM dump from now on;
+        False if the EEPROM is blank (the linear fallback stays)"""
+        params = extract_parameters(ee)
+        slot = self.slot(unit)
+        if params is None:
+            return False
+        with self.lock:
+            params = {name: numpy.asarray(value, dtype=numpy.float64) for name, value in params.items()}
+            params["bad"] = params["bad"].astype(bool)
+            for name, value in params.items():
+                stacked = self.params.get(name)
+                if stacked is None:
+                    stacked = numpy.repeat(value[None, ...], len(self.slots), axis=0)
+                stacked[slot] = value
+                self.params[name] = stacked
+            self.calibrated[slot] = True
+            self.previous.pop(unit, None)
+        return True
+
+    def forget(self, unit):
+        with self.lock:
+            self.previous.pop(unit, None)
+            slot = self.slots.get(unit)
+            if slot is not None:
+                self.calibrated[slot] = False
+
+    def calibrate(self, units, frames):
+        """Temperatures (C, float32, NaN for bad pixels) of frames, an (N, 834)
+        array of frameData, as an (N, 24, 32) array; units[i] sent frames[i]"""
+        frames = numpy.asarray(frames)
+        slots = numpy.array([self.slot(unit) for unit in units])
+        with self.lock:
+            calibrated = self.calibrated[slots]
+            params = {name: values[slots[calibrated]] for name, values in self.params.items()}
+        temperatures = numpy.empty((len(frames), PIXELS), dtype=numpy.float64)
+        if calibrated.any():
+            temperatures[calibrated] = calculate_to(frames[calibrated], params, self)
+        if not calibrated.all():
+            raw = signed(frames[~calibrated, :PIXELS], 16)
+            temperatures[~calibrated] = raw * 0.1 - 10.0
+        temperatures = numpy.clip(temperatures, *TEMPERATURE_RANGE)
+        return self.merge_subpages(units, frames, temperatures).reshape(-1, ROWS, COLS).astype(numpy.float32)
+
+    def merge_subpages(self, units, frames, temperatures):
+        """Keep the pixels of the other subpage from each unit's previous
+        frame; a unit's first frame is used whole"""
+        chess = (frames[:, CONTROL] & CONTROL_CHESS) != 0
+        pattern = numpy.where(chess[:, None], self.chess, self.il)
+        current = pattern == frames[:, SUBPAGE, None]
+        for i, unit in enumerate(units):
+            previous = self.previous.get(unit)
+            if previous is not None:
+                temperatures[i] = numpy.where(current[i], temperatures[i], previous)
+            self.previous[unit] = temperatures[i].copy()
+        return temperatures
+
+def calculate_to(frames, p, patterns):
+    """MLX90640_CalculateTo for every pixel of every frame at once: frames is
+    (N, 834), p the parameters of each frame's unit stacked (N, ...)"""
+    data = signed(frames, 16).astype(numpy.float64)
+    column = lambda name: p[name][:, None]
+
+    # Supply voltage, corrected for the ADC resolution the frame was taken at
+    resolution_ram = (frames[:, CONTROL] >> RESOLUTION_SHIFT) & 0x03
+    resolution = 2.0 ** p["resolutionEE"] / 2.0 ** resolution_ram
+    vdd = (resolution * data[:, VDD] - p["vdd25"]) / p["kVdd"] + 3.3
+
+    # Ambient (die) temperature
+    ptat = data[:, PTAT]
+    ptat_art = ptat / (ptat * p["alphaPTAT"] + data[:, VBE]) * 2.0 ** 18
+    ta = (ptat_art / (1 + p["KvPTAT"] * (vdd - 3.3)) - p["vPTAT25"]) / p["KtPTAT"] + 25
+    ta4 = (ta + 273.15) ** 4
+    tr4 = (ta - TA_SHIFT + 273.15) ** 4
+    ta_tr = (tr4 - (tr4 - ta4) / EMISSIVITY)[:, None]
+
+    gain = p["gainEE"] / data[:, GAIN]
+    dta, dvdd = (ta - 25)[:, None], (vdd - 3.3)[:, None]
+
+    # Compensation pixel of the frame's subpage
+    subpage = frames[:, SUBPAGE].astype(numpy.intp)
+    chess = (frames[:, CONTROL] & CONTROL_CHESS) != 0
+    mode = numpy.where(chess, 0x80, 0)
+    index = numpy.arange(len(frames))
+    cp = data[index, numpy.where(subpage == 0, CP_SUBPAGE[0], CP_SUBPAGE[1])] * gain
+    cp_offset = p["cpOffset"][index, subpage]
+    cp_offset = cp_offset + numpy.where((subpage == 1) & (mode != p["calibrationModeEE"]), p["ilChessC"][:, 0], 0)
+    cp = cp - cp_offset * (1 + p["cpKta"] * (ta - 25)) * (1 + p["cpKv"] * (vdd - 3.3))
+
+    # Pixels: gain, offset with its drift, chess correction, compensation
+    ir = data[:, :PIXELS] * gain[:, None]
+    ir -= p["offset"] * (1 + p["kta"] * dta) * (1 + p["kv"] * dvdd)
+    chess_correction = mode != p["calibrationModeEE"]
+    if chess_correction.any():
+        il_chess = p["ilChessC"][:, None, :]
+        correction = il_chess[..., 2] * (2 * patterns.il - 1) - il_chess[..., 1] * patterns.conversion
+        ir += numpy.where(chess_correction[:, None], correction, 0)
+    ir -= column("tgc") * cp[:, None]
+    ir /= EMISSIVITY
+
+    alpha = (p["alpha"] - column("tgc") * p["cpAlpha"][index, subpage][:, None]) * (1 + column("KsTa") * dta)
+    ks_to = p["ksTo"]
+    with numpy.errstate(invalid="ignore", divide="ignore"):
+        sx = numpy.sqrt(numpy.sqrt(alpha ** 3 * (ir + alpha * ta_tr))) * ks_to[:, 1, None]
+        to = numpy.sqrt(numpy.sqrt(ir / (alpha * (1 - ks_to[:, 1, None] * 273.15) + sx) + ta_tr)) - 273.15
+
+        # Second pass in the KsTo range the first one landed in
+        ct = p["ct"]
+        alpha_corr = numpy.stack([1 / (1 + ks_to[:, 0] * 40), numpy.ones(len(frames)),
+                                  1 + ks_to[:, 1] * ct[:, 2]], axis=1)
+        alpha_corr = numpy.concatenate([alpha_corr, (alpha_corr[:, 2] * (1 + ks_to[:, 2] * (ct[:, 3] - ct[:, 2])))[:, None]],
+                                       axis=1)
+        band = (to >= ct[:, 1, None]).astype(numpy.intp) + (to >= ct[:, 2, None]) + (to >= ct[:, 3, None])
+        rows = index[:, None]
+        to = numpy.sqrt(numpy.sqrt(ir / (alpha * alpha_corr[rows, band] * (1 + ks_to[rows, band] * (to - ct[rows, band])))
+                                   + ta_tr)) - 273.15
+    to[p["bad"].astype(bool)] = numpy.nan
+    return to
+
+def fill_missing(frames):
+    """Replace NaN pixels of an (N, rows, cols) stack with the mean of their
+    valid neighbours, or the frame's mean where there are none"""
+    missing = numpy.isnan(frames)
+    if not missing.any():
+        return frames
+    padded = numpy.pad(frames, ((0, 0), (1, 1), (1, 1)), constant_values=numpy.nan)
+    neighbours = numpy.stack([padded[:, :-2, 1:-1], padded[:, 2:, 1:-1], padded[:, 1:-1, :-2], padded[:, 1:-1, 2:]])
+    valid = ~numpy.isnan(neighbours)
+    total = numpy.where(valid, neighbours, 0).sum(axis=0)
+    count = valid.sum(axis=0)
+    with numpy.errstate(invalid="ignore"):
+        means = numpy.nanmean(frames.reshape(len(frames), -1), axis=1)
+        filled = numpy.where(count > 0, total / numpy.maximum(count, 1), means[:, None, None])
+    frames = numpy.where(missing, filled, frames)
+    return numpy.nan_to_num(frames, nan=0.0)
+
+def bicubic_weights(size, factor, a=-0.5):
+    """(size * factor, size) matrix interpolating a line of size samples to
+    size * factor with Keys' cubic convolution, edges repeated"""
+    out = numpy.arange(size * factor)
+    position = (out + 0.5) / factor - 0.5
+    base = numpy.floor(position).astype(int)
+    weights = numpy.zeros((size * factor, size))
+    for k in range(-1, 3):
+        x = numpy.abs(position - (base + k))
+        w = numpy.where(x <= 1, (a + 2) * x ** 3 - (a + 3) * x ** 2 + 1,
+                        numpy.where(x < 2, a * x ** 3 - 5 * a * x ** 2 + 8 * a * x - 4 * a, 0))
+        numpy.add.at(weights, (out, numpy.clip(base + k, 0, size - 1)), w)
+    return weights
+
+def centidegrees(frames):
+    """A stack of temperatures as int16 centidegrees, for the thermal core"""
+    return numpy.clip(numpy.rint(frames * 100), -32767, 32767).astype(numpy.int16)
+
+def matrices(frames):
+    """Each frame of a stack as a matrix (list of rows) to 0.01 C"""
+    return numpy.round(frames.astype(numpy.float64), 2).tolist()
+
+def frame_array(matrix):
+    """A matrix (list of rows, None for "ERR") as a float32 array, NaN for
+    the missing pixels"""
+    try:
+        return numpy.array(matrix, dtype=numpy.float32)
+    except TypeError:
+        return numpy.array([[numpy.nan if v is None else v for v in row] for row in matrix],
+                           dtype=numpy.float32)
+
+class Upsampler:
+    """Bicubic interpolation of (N, rows, cols) stacks to factor times the
+    resolution, as two matrix products over the whole stack"""
+
+    def __init__(self, factor):
+        self.factor = factor
+        self.weights = {}
+
+    def __call__(self, frames):
+        if self.factor <= 1:
+            return frames
+        rows, cols = frames.shape[1:]
+        key = (rows, cols)
+        if key not in self.weights:
+            self.weights[key] = (bicubic_weights(rows, self.factor).astype(numpy.float32),
+                                 bicubic_weights(cols, self.factor).T.astype(numpy.float32))
+        row_weights, col_weights = self.weights[key]
+        return row_weights @ frames @ col_weights
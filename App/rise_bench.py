@@ -0,0 +1,124 @@
+"""Benchmark of the rate of rise early warning (rate_of_rise.py).
+
+Feeds synthetic patrols of several units through their analysis, one
+frame at a time and converted from the published lists the way the
+server's rise stage gets them, and times it:
+
+    python rise_bench.py                        # 1 to 64 units, unit and raw frames
+    python rise_bench.py --units 16 --shape 48x64 --frames 1000
+
+It prints one line per combination
+
+    RISE units=<n> shape=<rows>x<cols> views=<n> frames=<n per unit> fps=<n> us_per_frame=<n>
+        units_at_full_rate=<n>
+
+units_at_full_rate is how many units one core keeps up with when each
+sends every frame the serial link can carry (FULL_RATE, text frames of
+the center region or calibrated raw frames). Then one line for a fire
+smouldering in one view of a patrol, the sensor's noise on every pixel:
+
+    RISE_LEAD rate=<C/min> warning_s=<n> threshold_s=<n> lead_s=<n> false_warnings=<n>
+
+warning_s is when the early warning came after the fire started,
+threshold_s when its hottest pixel passed FIRE_THRESHOLD, where the
+firmware would raise FIRE DETECTED; false_warnings the warnings of the
+views without the fire.
+"""
+import argparse
+import sys
+import time
+
+import rate_of_rise
+import raw_frames
+
+# Frames per second a unit's serial link carries at 115200 baud
+FULL_RATE = {(15, 16): 16.0, (48, 64): 2.3}
+FIRE_THRESHOLD = 50.0       # As the firmware's
+NOISE = 0.3                 # C, the sensor's noise
+
+def parse_shape(text):
+    rows, cols = text.lower().split("x")
+    return int(rows), int(cols)
+
+def patrol(views, shape, count, seed):
+    """count frames of a patrol stopping at views pan positions in turn, as
+    the lists the server publishes"""
+    numpy = raw_frames.numpy
+    rng = numpy.random.default_rng(seed)
+    room = rng.uniform(20, 26, (views,) + shape)
+    frames = []
+    for k in range(count):
+        view = k % views
+        frames.append((view * 40 - views * 20, (room[view] + rng.normal(0, NOISE, shape)).round(2).tolist()))
+    return frames
+
+def run(units, shape, views, count):
+    detectors = [rate_of_rise.RiseDetector() for _ in range(units)]
+    frames = patrol(views, shape, count * units, units)
+    period = 1 / FULL_RATE.get(shape, 16.0)
+    now = 1e6
+    elapsed = 0.0
+    for k, (pan, matrix) in enumerate(frames):
+        now += period / units
+        t0 = time.perf_counter()
+        frame = raw_frames.frame_array(matrix)
+        detectors[k % units].update(frame, pan, now)
+        elapsed += time.perf_counter() - t0
+    fps = count * units / elapsed
+    full_rate = FULL_RATE.get(shape, 16.0)
+    print(f"RISE units={units} shape={shape[0]}x{shape[1]} views={views} frames={count} "
+          f"fps={fps:.0f} us_per_frame={elapsed / (count * units) * 1e6:.0f} "
+          f"units_at_full_rate={fps / full_rate:.0f}", flush=True)
+
+def lead(rate, views, period):
+    """A fire warming a few pixels of one view by rate C/min from 22C,
+    the patrol coming back to it every views * period seconds"""
+    numpy = raw_frames.numpy
+    rng = numpy.random.default_rng(0)
+    detector = rate_of_rise.RiseDetector()
+    shape = (15, 16)
+    start = 3600.0          # The baselines settle first
+    warning = threshold = None
+    false_warnings = 0
+    t = 0.0
+    while threshold is None or t < start + 1800:
+        view = int(t / period) % views
+        frame = 22.0 + rng.normal(0, NOISE, shape)
+        if view == 0 and t >= start:
+            frame[6:8, 7:9] += rate * (t - start) / 60
+            if threshold is None and frame.max() >= FIRE_THRESHOLD:
+                threshold = t - start
+        result = detector.update(frame, view, t)
+        if result is not None:
+            if result["pan"] == 0 and t >= start:
+                if warning is None:
+                    warning = t - start
+            elif result["pan"] != 0:
+                false_warnings += 1
+        t += period
+    warning_text = f"{warning:.0f}" if warning is not None else "none"
+    lead_text = f"{threshold - warning:.0f}" if warning is not None else "none"
+    print(f"RISE_LEAD rate={rate} warning_s={warning_text} threshold_s={threshold:.0f} "
+          f"lead_s={lead_text} false_warnings={false_warnings}", flush=True)
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard rate of rise benchmark")
+    parser.add_argument("--units", type=int, action="append", help="units sending frames (repeatable)")
+    parser.add_argument("--shape", type=parse_shape, action="append", help="frame shape, rows x cols (repeatable)")
+    parser.add_argument("--views", type=int, default=40, help="pan positions of a patrol")
+    parser.add_argument("--frames", type=int, default=256, help="frames per unit and run")
+    parser.add_argument("--rate", type=float, action="append", help="fire warming, C/min (repeatable)")
+    args = parser.parse_args()
+
+    if not rate_of_rise.available():
+        print("rise_bench: numpy is not installed (pip install -r requirements.txt)", file=sys.stderr)
+        return 1
+    for shape in args.shape or [(15, 16), (48, 64)]:
+        for units in args.units or [1, 4, 16, 64]:
+            run(units, shape, args.views, args.frames)
+    for rate in args.rate or [5.0, 10.0, 20.0]:
+        lead(rate, args.views, 1 / FULL_RATE[(15, 16)])
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,305 @@
+"""Replay benchmark for the server's serial reader (SerialParser in server.py).
+
+Plays device output into a pseudo terminal at a given baud rate, or as fast
+as it will go, while the reader consumes it the way it consumes the real
+port, and reports whether it kept up:
+
+    python serial_bench.py                      # synthetic patrol with alerts at 230400 baud
+    python serial_bench.py --baud 0             # unpaced, the reader's maximum
+    python serial_bench.py --capture sim.log    # e.g. saved output of Firmware/host/fireguard_sim
+    python serial_bench.py --legacy             # the old in_waiting/readline/sleep loop
+
+It prints one line
+
+    SERIAL reader=<event|legacy> baud=<n> bytes=<n> bytes_s=<n> lines_s=<n> x_realtime=<n>
+           kept_up=<0|1> latency_p50_ms=<n> latency_p99_ms=<n> latency_max_ms=<n>
+
+x_realtime is the throughput over what a 230400 baud link can carry.
+Latency runs from a marker line being written to the reader handling it.
+
+Recorded captures (.fgcap, see CaptureWriter in server.py) are replayed
+straight into the parser, without a pseudo terminal in between:
+
+    python serial_bench.py --replay unit.fgcap             # as fast as possible
+    python serial_bench.py --replay unit.fgcap --speed 1   # at the recorded pace
+    python serial_bench.py --record synthetic.fgcap        # make one, paced to 230400 baud
+
+which prints
+
+    REPLAY speed=<n> seconds=<n> recorded_s=<n> bytes=<n> bytes_s=<n> lines_s=<n>
+           x_realtime=<n> matrices=<n> alerts=<n> parse_ms_max=<n>
+
+with x_realtime here the speed-up over the recorded time.
+
+The consumers after the reader (pipeline.py) can be slowed down to see
+that the reader keeps up while they fall behind:
+
+    python serial_bench.py --slow-history 5 --slow-live 20   # ms per reading / per publish
+    python serial_bench.py --slow-history 5 --inline         # consumers on the reader's thread
+
+which adds a line per stage
+
+    PIPELINE stage=<live|history> policy=<...> put=<n> handled=<n> coalesced=<n>
+             high_water=<n> waits=<n> wait_ms=<n>
+
+--inline runs them on the reader's thread, as before the stages.
+"""
+import argparse
+import contextlib
+import os
+import pty
+import sys
+import threading
+import time
+import tty
+
+import serial
+
+import pipeline
+import server
+
+LINK_BAUD = 230400
+MARKER_EVERY = 16           # Lines between latency markers
+END_MARKER = "BENCH END"
+
+def synthetic_capture(frames):
+    """Lines like the firmware prints them: a patrol with a fire alert (an
+    alert reading, the matrix and the distance, five times) every 20 frames"""
+    lines = []
+    for frame in range(frames):
+        position = frame * 20 % 800
+        lines.append("Removing row with extreme values: 7")
+        if frame % 20 != 19:
+            lines.append(f"Pos: {position}/800 | Max: {23 + frame % 7}.{frame % 100:02d}°C at [3][{frame % 16}]")
+            continue
+        lines.append(f"FIRE DETECTED! Temp: 65.{frame % 100:02d}°C at [7][8]")
+        lines.append("Motor stopped - FIRE ALERT MODE")
+        for reading in range(5):
+            lines.append("Removing row with extreme values: 7")
+            lines.append(f"Alert! Temp: {64 + reading}.50°C at [7][8]")
+            lines.append("")
+            lines.append("Center Matrix Data (abnormal row removed):")
+            lines.append("     " + "".join(f"{j:2d}  " for j in range(16)))
+            lines.append("    " + "----" * 16)
+            for i in range(15):
+                values = "".join(f"{65 if (i, j) == (7, 8) else 24 + (i + j) % 5:4d}" for j in range(16))
+                lines.append(f"{i:2d} | {values}")
+            lines.append(f"Distance to fire: {120 + reading}.50 cm")
+        lines.append("Fire alert mode ended")
+    return lines
+
+def load_capture(path):
+    with open(path, encoding="utf-8", errors="replace") as f:
+        return [line.rstrip("\r\n") for line in f]
+
+class BenchParser(server.SerialParser):
+    """SerialParser that also times the marker lines"""
+
+    def __init__(self, device, marker_times):
+        super().__init__(device)
+        self.marker_times = marker_times
+        self.latencies = []
+        self.done = threading.Event()
+
+    def handle_line(self, line):
+        if line.startswith("BENCH "):
+            if line == END_MARKER:
+                self.done.set()
+            else:
+                sent = self.marker_times.get(int(line.split()[1]))
+                if sent is not None:
+                    self.latencies.append(time.perf_counter() - sent)
+            return
+        super().handle_line(line)
+
+def write_capture(fd, lines, baud, marker_times):
+    """Write the lines in segments ending with a marker, paced to baud (0: unpaced)"""
+    segments = []
+    for start in range(0, len(lines), MARKER_EVERY):
+        seq = len(segments)
+        chunk = lines[start:start + MARKER_EVERY] + [f"BENCH {seq}"]
+        segments.append((seq, "".join(line + "\r\n" for line in chunk).encode("utf-8")))
+    segments.append((None, (END_MARKER + "\r\n").encode("ascii")))
+
+    started = time.perf_counter()
+    sent = 0
+    for seq, data in segments:
+        if baud:
+            # 10 bits per byte on the wire
+            due = started + sent * 10 / baud
+            delay = due - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+        if seq is not None:
+            marker_times[seq] = time.perf_counter()
+        view = memoryview(data)
+        while view:
+            view = view[os.write(fd, view):]
+        sent += len(data)
+    return sent
+
+def record_capture(path, lines, baud):
+    """Write lines as a capture, in chunks of MARKER_EVERY lines arriving at
+    the pace of the link"""
+    writer = server.CaptureWriter(path, started=0.0)
+    sent = 0
+    for start in range(0, len(lines), MARKER_EVERY):
+        data = "".join(line + "\r\n" for line in lines[start:start + MARKER_EVERY]).encode("utf-8")
+        sent += len(data)
+        # 10 bits per byte on the wire, received once the last one is in
+        writer.write(data, sent * 10 / baud)
+    writer.close()
+    return sent
+
+class ReplayParser(server.SerialParser):
+    """SerialParser that counts what it found"""
+
+    def __init__(self, device):
+        super().__init__(device)
+        self.matrices = 0
+        self.alerts = 0
+
+    def end_matrix(self):
+        self.matrices += 1
+        super().end_matrix()
+
+    def handle_line(self, line):
+        if line.startswith("FIRE DETECTED!"):
+            self.alerts += 1
+        super().handle_line(line)
+
+def replay(path, speed):
+    """Feed a capture through the server's reader loop, returns the REPLAY line"""
+    info = server.capture_info(path)
+    connection = server.ReplayConnection(path, speed)
+    parser = ReplayParser(server.Device("replay", server.REPLAY_PREFIX + path))
+    with open(os.devnull, "w") as devnull, contextlib.redirect_stdout(devnull):
+        started = time.perf_counter()
+        while not connection.finished.is_set() or connection.in_waiting:
+            chunk = server.read_available(connection)
+            if chunk:
+                parser.feed(chunk)
+        elapsed = time.perf_counter() - started
+    connection.close()
+
+    stats = parser.stats.report()
+    return (f"REPLAY speed={speed:g} seconds={elapsed:.3f} recorded_s={info['seconds']:.1f} "
+            f"bytes={info['bytes']} bytes_s={info['bytes'] / elapsed:.0f} "
+            f"lines_s={stats['lines'] / elapsed:.0f} "
+            f"x_realtime={info['seconds'] / elapsed:.1f} matrices={parser.matrices} "
+            f"alerts={parser.alerts} parse_ms_max={stats['parse_ms_max']:.3f}")
+
+def event_reader(connection, parser):
+    """The server's reader loop (read_serial_data)"""
+    while not parser.done.is_set():
+        chunk = server.read_available(connection)
+        if chunk:
+            parser.feed(chunk)
+
+def legacy_reader(connection, parser):
+    """The reader loop the server had before, for comparison"""
+    while not parser.done.is_set():
+        if connection.in_waiting:
+            line = connection.readline().decode('utf-8', errors='replace').strip()
+            parser.handle_line(line)
+        time.sleep(0.01)
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * fraction))]
+
+def slow_consumers(device, args):
+    """Make the device's history and stream publishing take the given time,
+    on their stages or (--inline) on the reader's thread"""
+    rollups, send = device.history, device.state.send
+    if args.slow_history:
+        def rollup(method, *call_args):
+            time.sleep(args.slow_history / 1000)
+            getattr(rollups, method)(*call_args)
+        device.history = type("SlowHistory", (), {
+            name: (lambda name: lambda self, *a: rollup(name, *a))(name)
+            for name in ("peak", "distance", "hotspot", "detection", "alert")})()
+        device.history.close = rollups.close
+    if args.slow_live:
+        def slow_send(*send_args):
+            time.sleep(args.slow_live / 1000)
+            send(*send_args)
+        device.state.send = slow_send
+    if args.inline:
+        device.live.close()
+        device.state.live = None
+        device.rollup = lambda method, *call_args: getattr(device.history, method)(*call_args)
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard serial reader replay benchmark")
+    parser.add_argument("--capture", help="device output to replay (default: synthetic patrol)")
+    parser.add_argument("--frames", type=int, default=2000, help="frames of synthetic patrol")
+    parser.add_argument("--baud", type=int, default=LINK_BAUD, help="pace of the replay, 0 for unpaced")
+    parser.add_argument("--legacy", action="store_true", help="use the old sleep-polling reader")
+    parser.add_argument("--timeout", type=float, default=120.0, help="give up after this many seconds")
+    parser.add_argument("--replay", help="recorded capture (.fgcap) to feed to the parser")
+    parser.add_argument("--speed", type=float, default=0.0, help="replay speed, 0 for unpaced")
+    parser.add_argument("--record", help="write the patrol (or --capture) as a .fgcap file")
+    parser.add_argument("--slow-history", type=float, default=0.0, help="ms the history takes per reading")
+    parser.add_argument("--slow-live", type=float, default=0.0, help="ms the streams take per publish")
+    parser.add_argument("--inline", action="store_true", help="run the consumers on the reader's thread")
+    args = parser.parse_args()
+
+    if args.replay:
+        print(replay(args.replay, args.speed))
+        return 0
+
+    lines = load_capture(args.capture) if args.capture else synthetic_capture(args.frames)
+    if args.record:
+        total = record_capture(args.record, lines, args.baud or LINK_BAUD)
+        print(f"Recorded {total} bytes to {args.record}")
+        return 0
+
+    master, slave = pty.openpty()
+    tty.setraw(slave)
+    connection = serial.Serial(os.ttyname(slave), LINK_BAUD, timeout=server.READ_TIMEOUT)
+
+    marker_times = {}
+    device = server.Device("bench", os.ttyname(slave))
+    slow_consumers(device, args)
+    reader = BenchParser(device, marker_times)
+    loop = legacy_reader if args.legacy else event_reader
+
+    # The parser reports alerts with print(); keep them out of the results
+    with open(os.devnull, "w") as devnull, contextlib.redirect_stdout(devnull):
+        thread = threading.Thread(target=loop, args=(connection, reader), daemon=True)
+        thread.start()
+        started = time.perf_counter()
+        total = write_capture(master, lines, args.baud, marker_times)
+        finished = reader.done.wait(args.timeout)
+        elapsed = time.perf_counter() - started
+
+    if not finished:
+        print(f"Reader did not finish within {args.timeout:.0f} s", file=sys.stderr)
+
+    offered = args.baud / 10 if args.baud else None
+    bytes_s = total / elapsed
+    line_count = len(lines) + len(marker_times) + 1
+    # Kept up when it took no longer than the link needs, plus the last marker's latency
+    kept_up = finished and (offered is None or elapsed <= total / offered + max(reader.latencies, default=0) + 0.05)
+    print(f"SERIAL reader={'legacy' if args.legacy else 'event'} baud={args.baud} bytes={total} "
+          f"bytes_s={bytes_s:.0f} lines_s={line_count / elapsed:.0f} "
+          f"x_realtime={bytes_s / (LINK_BAUD / 10):.2f} kept_up={int(bool(kept_up))} "
+          f"latency_p50_ms={percentile(reader.latencies, 0.5) * 1000:.2f} "
+          f"latency_p99_ms={percentile(reader.latencies, 0.99) * 1000:.2f} "
+          f"latency_max_ms={max(reader.latencies, default=0) * 1000:.2f}")
+    if not args.inline:
+        for name, stage in (("live", device.live), ("history", device.rollups)):
+            stage.flush(args.timeout)
+            stats = stage.stats()
+            print(f"PIPELINE stage={name} policy={stats['policy']} put={stats['put']} "
+                  f"handled={stats['handled']} coalesced={stats['coalesced']} high_water={stats['high_water']} "
+                  f"waits={stats['waits']} wait_ms={stats['wait_ms']}")
+    device.close_stages()
+    connection.close()
+    return 0 if finished else 1
+
+if __name__ == "__main__":
+    sys.exit(main())
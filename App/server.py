@@ -1,17 +1,36 @@
 import serial
 import threading
+import queue
 import time
 import json
-from flask import Flask, render_template, jsonify, request
+import os
+import signal
+import struct
+import base64
+import collections
+import gzip
+import re
+import sys
+from flask import Flask, Response, abort, g, render_template, jsonify, request
 from flask_cors import CORS
 import serial.tools.list_ports
+import thermal_core
+import frame_store
+import history
+import latency
+import metrics
+import panorama
+import pipeline
+import raw_frames
+import rate_of_rise
 
 # Flask app setup
-app = Flask(__name__, static_folder='UI/assets', template_folder='UI')
+# Assets under /assets, so the page finds them the same way when opened as a file
+app = Flask(__name__, static_folder='UI/assets', static_url_path='/assets', template_folder='UI')
 CORS(app)  # Enable CORS for all routes
 
-# Global variables to store fire detection state
-fire_data = {
+# Fire detection state as first published (see StateStore)
+INITIAL_STATE = {
     "state": "no-alert",  # Possible states: no-alert, fire-alert, extinguishing, extinguished
     "max_temp": 0.0,
     "max_temp_position": [0, 0],
@@ -20,11 +39,361 @@ fire_data = {
     "distance": 0.0,           # Distance to fire
     "last_update": time.time(),
     "connection_status": "disconnected",
-    "signal_strength": 0
+    "signal_strength": 0,
+    "boot_timing": {},         # Milliseconds from reset per boot stage
+    "profile": {},             # Per-stage timings from a PROFILE=1 firmware build
+    "hotspot": {},             # Host-side analysis of the matrix (thermal_core)
+    "reader": {},              # Serial reader throughput (ReaderStats)
+    "early_warning": None,     # Pixels warming up fast, before the firmware trips (rate_of_rise.py)
+    "version": 0               # Bumped by every published snapshot
 }
 
-# Serial connection
-serial_connection = None
+# Fields sent as "frame" events on /api/stream, the rest goes out as "status"
+FRAME_FIELDS = ("temperature_matrix", "hotspot")
+
+# Binary frames (/api/frame.bin, /api/stream?frames=binary): this header
+# (state version, time, rows, cols, decimals), then rows * cols
+# little-endian int16 pixels in row order, in 10^-decimals degrees (0 for
+# the unit's whole degrees, 2 for calibrated raw frames), frame_store.MISSING
+# for "ERR"
+FRAME_HEADER = struct.Struct("<IdBBBx")
+
+# Seconds between snapshots that only move last_update forward
+LAST_UPDATE_INTERVAL = 1.0
+
+# Pixels at or above this many centidegrees make up the hotspot blob
+HOTSPOT_THRESHOLD = 5000
+
+# Live update stream (/api/stream)
+STREAM_QUEUE_SIZE = 64      # Events a subscriber may fall behind before it is dropped
+STREAM_KEEPALIVE = 15.0     # Seconds between comments on an idle stream
+
+# Web server: "waitress" serves from a pool of threads in this one process,
+# next to the serial readers; "dev" is Flask's debug server. Never run more
+# than one process, as each would open the serial ports itself.
+HTTP_PORT = int(os.environ.get('FIREGUARD_HTTP_PORT', '3000'))
+HTTP_SERVER = os.environ.get('FIREGUARD_SERVER', 'waitress')
+HTTP_THREADS = int(os.environ.get('FIREGUARD_THREADS', '64'))
+HTTP_CONNECTION_LIMIT = 2000
+# Threads kept for requests: /api/stream holds one thread per client, so
+# beyond HTTP_THREADS - STREAM_RESERVED_THREADS streams clients are sent to
+# polling with a 503
+STREAM_RESERVED_THREADS = 16
+
+# Metrics served on /metrics (see metrics.py); per second rates are left
+# to the scraper
+SERIAL_BYTES = metrics.REGISTRY.counter(
+    "fireguard_serial_bytes_total", "Bytes read from the unit's serial port", ("device",))
+SERIAL_LINES = metrics.REGISTRY.counter(
+    "fireguard_serial_lines_total", "Lines received from the unit", ("device",))
+FRAMES_PARSED = metrics.REGISTRY.counter(
+    "fireguard_frames_parsed_total", "Temperature matrices parsed", ("device",))
+PARSE_ERRORS = metrics.REGISTRY.counter(
+    "fireguard_parse_errors_total", "Lines and pixels that could not be parsed, by type", ("device", "type"))
+PARSE_SECONDS = metrics.REGISTRY.histogram(
+    "fireguard_parse_seconds", "Time from a chunk arriving to its last line being handled", ("device",))
+FRAME_AGE = metrics.REGISTRY.histogram(
+    "fireguard_frame_age_seconds", "Time from a matrix's last chunk arriving to the matrix going out to the streams",
+    ("device",))
+LINK_CONNECTS = metrics.REGISTRY.counter(
+    "fireguard_link_connects_total", "Times the unit's port was opened", ("device",))
+LINK_ERRORS = metrics.REGISTRY.counter(
+    "fireguard_link_errors_total", "Failures to open or read the unit's port", ("device", "type"))
+FRAME_LATENCY = metrics.REGISTRY.histogram(
+    "fireguard_frame_latency_seconds", "Time a frame spent in each stage from the sensor to a page "
+    "(see latency.py)", ("device", "stage"))
+EARLY_WARNINGS = metrics.REGISTRY.counter(
+    "fireguard_early_warnings_total", "Rate of rise warnings raised", ("device",))
+HTTP_SECONDS = metrics.REGISTRY.histogram(
+    "fireguard_http_request_seconds", "Time to answer an API request", ("route", "method", "status"))
+# The series labelled with a unit, dropped when the unit is removed
+DEVICE_METRICS = (SERIAL_BYTES, SERIAL_LINES, FRAMES_PARSED, PARSE_ERRORS, PARSE_SECONDS, FRAME_AGE,
+                  LINK_CONNECTS, LINK_ERRORS, FRAME_LATENCY, EARLY_WARNINGS)
+
+# Conditional and delta status responses (/api/status)
+STATE_HISTORY = 64          # Recent snapshots kept to answer ?since=<version>&delta=1
+RESPONSE_CACHE_SIZE = 32    # Encoded responses kept per unit, shared by every poller
+COMPRESS_MIN_SIZE = 1024    # Bytes a body needs before it is gzipped
+COMPRESS_LEVEL = 6
+# Part of every ETag, so versions counted again after a restart don't match
+ETAG_PREFIX = f"{int(time.time()):x}"
+
+class Broadcaster:
+    """Fans events out to every /api/stream subscriber.
+    
+    Each event is serialised once and the same text is queued for every
+    subscriber (once more as base64 if some subscribers want it binary). A subscriber that stops reading is dropped when its queue
+    fills up; the browser reconnects and starts again from a full status."""
+    
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.subscribers = []
+    
+    def subscribe(self, binary=False):
+        """A queue of formatted events; binary subscribers get the events
+        published with a binary form as base64 instead of JSON"""
+        q = queue.Queue(maxsize=STREAM_QUEUE_SIZE)
+        q.binary = binary
+        with self.lock:
+            self.subscribers.append(q)
+        return q
+    
+    def unsubscribe(self, q):
+        with self.lock:
+            if q in self.subscribers:
+                self.subscribers.remove(q)
+    
+    def publish(self, event, data, binary=None):
+        """Queue an event for every subscriber; binary is a function that
+        returns the event as bytes, only called when someone wants them"""
+        with self.lock:
+            if not self.subscribers:
+                return
+            subscribers = list(self.subscribers)
+        message = raw_message = None
+        for q in subscribers:
+            if binary and q.binary:
+                if raw_message is None:
+                    raw_message = format_binary_event(event, binary())
+                text = raw_message
+            else:
+                if message is None:
+                    message = format_event(event, data)
+                text = message
+            try:
+                q.put_nowait(text)
+            except queue.Full:
+                self.unsubscribe(q)
+                # Wake the stream up so it notices and ends
+                try:
+                    q.get_nowait()
+                    q.put_nowait(None)
+                except (queue.Empty, queue.Full):
+                    pass
+
+def format_event(event, data):
+    return f"event: {event}\ndata: {json.dumps(data, separators=(',', ':'))}\n\n"
+
+def format_binary_event(event, data):
+    return f"event: {event}\ndata: {base64.b64encode(data).decode('ascii')}\n\n"
+
+def status_payload(snapshot):
+    """Everything in a snapshot except the matrix, which goes out as "frame" events"""
+    return {key: value for key, value in snapshot.items() if key not in FRAME_FIELDS}
+
+def frame_payload(snapshot):
+    payload = {key: snapshot[key] for key in FRAME_FIELDS}
+    payload["version"] = snapshot["version"]
+    return payload
+
+def frame_binary(snapshot):
+    """A snapshot's matrix as a binary frame (FRAME_HEADER and int16 pixels)"""
+    matrix = snapshot["temperature_matrix"]
+    rows = len(matrix)
+    cols = len(matrix[0]) if rows else 0
+    # Calibrated matrices have fractions of a degree (see raw_frames.py).
+    # Any float pixel tells, not the first one, which may be missing (None)
+    decimals = frame_store.decimals(matrix)
+    pixels = frame_store.to_pixels(matrix, 10 ** decimals)
+    if sys.byteorder != "little":
+        pixels.byteswap()
+    return FRAME_HEADER.pack(snapshot["version"], snapshot["last_update"], rows, cols, decimals) + pixels.tobytes()
+
+def state_delta(old, new, matrix=True):
+    """What changed from snapshot old to new: the fields that differ in
+    "changes" and, while the matrix keeps its size and most of it stays,
+    its changed pixels as [row, col, value] in "cells" """
+    delta = {"since": old["version"], "version": new["version"], "changes": {}}
+    changes = delta["changes"]
+    for key, value in new.items():
+        if key == "version" or key == "temperature_matrix" or old.get(key) is value:
+            continue
+        if key in FRAME_FIELDS and not matrix:
+            continue
+        if old.get(key) != value:
+            changes[key] = value
+    
+    before, after = old["temperature_matrix"], new["temperature_matrix"]
+    if not matrix or before is after or before == after:
+        return delta
+    if len(before) == len(after) and all(len(a) == len(b) for a, b in zip(before, after)):
+        cells = [[i, j, v]
+                 for i, (row_before, row_after) in enumerate(zip(before, after)) if row_before != row_after
+                 for j, (u, v) in enumerate(zip(row_before, row_after)) if u != v]
+        if 2 * len(cells) < sum(len(row) for row in after):
+            if cells:
+                delta["cells"] = cells
+            return delta
+    changes["temperature_matrix"] = after
+    return delta
+
+class ResponseCache:
+    """Encoded response bodies by key, so every dashboard polling the same
+    state shares one serialisation and compression; least recently used
+    entries go first"""
+    
+    def __init__(self, size=RESPONSE_CACHE_SIZE):
+        self.size = size
+        self.lock = threading.Lock()
+        self.entries = collections.OrderedDict()
+        self.hits = 0
+        self.misses = 0
+    
+    def get(self, key, build):
+        """(body, gzipped body or None) for key, built by build() on a miss"""
+        with self.lock:
+            entry = self.entries.get(key)
+            if entry is not None:
+                self.entries.move_to_end(key)
+                self.hits += 1
+                return entry
+        body = json.dumps(build(), separators=(',', ':')).encode()
+        compressed = gzip.compress(body, COMPRESS_LEVEL) if len(body) >= COMPRESS_MIN_SIZE else None
+        entry = (body, compressed)
+        with self.lock:
+            self.misses += 1
+            self.entries[key] = entry
+            while len(self.entries) > self.size:
+                self.entries.popitem(last=False)
+        return entry
+
+class StateStore:
+    """The fire detection state, published as immutable snapshots.
+    
+    Writers build a complete new snapshot from the current one and swap it
+    in with a single assignment, bumping "version". Readers take
+    `state.current` without locking and always see one consistent update,
+    never a new "state" with an old matrix. A published snapshot, and the
+    lists and dicts in it, is never modified again.
+    
+    Given a live stage (pipeline.Stage, latest-value-wins), the events for
+    the streams are sent from its thread, for the newest snapshot only when
+    the streams fall behind; without one, right away by the writer."""
+    
+    def __init__(self, initial, broadcaster, live=None):
+        # Serialises writers (serial thread and API requests) only
+        self.write_lock = threading.Lock()
+        self.current = dict(initial)
+        self.broadcaster = broadcaster
+        self.live = live
+        # Events owed to the streams since the last publish()
+        self.pending_status = False
+        self.pending_frame = False
+        # The last STATE_HISTORY snapshots, consecutive versions, for deltas
+        self.recent = collections.deque([self.current], maxlen=STATE_HISTORY)
+    
+    def update(self, **changes):
+        """Publish a snapshot with changes applied, returns it"""
+        with self.write_lock:
+            snapshot = dict(self.current, **changes)
+            snapshot["version"] = self.current["version"] + 1
+            if "last_update" not in changes:
+                snapshot["last_update"] = time.time()
+            self.current = snapshot
+            self.recent.append(snapshot)
+            if any(key not in FRAME_FIELDS for key in changes) or not changes:
+                self.pending_status = True
+            if any(key in FRAME_FIELDS for key in changes):
+                self.pending_frame = True
+            if self.live is None:
+                # Still under the lock, so streams get the versions in order
+                self.send(*self.take_pending())
+        if self.live is not None:
+            self.live.put(snapshot)
+        return snapshot
+    
+    def publish(self):
+        """Send the streams what changed up to the current snapshot. Called
+        by the live stage, whose single thread keeps the events in order.
+        Returns (snapshot, status sent, frame sent)."""
+        with self.write_lock:
+            pending = self.take_pending()
+        self.send(*pending)
+        return pending
+    
+    def take_pending(self):
+        pending = (self.current, self.pending_status, self.pending_frame)
+        self.pending_status = self.pending_frame = False
+        return pending
+    
+    def send(self, snapshot, status, frame):
+        if status:
+            self.broadcaster.publish("status", status_payload(snapshot))
+        if frame:
+            self.broadcaster.publish("frame", frame_payload(snapshot),
+                                     binary=lambda: frame_binary(snapshot))
+    
+    def at(self, version):
+        """The snapshot published as version, if it is still among the recent"""
+        recent = list(self.recent)
+        index = version - recent[0]["version"]
+        return recent[index] if 0 <= index < len(recent) else None
+    
+    def touch(self):
+        """Note that the device is talking; moves last_update at most once per
+        LAST_UPDATE_INTERVAL so an idle patrol doesn't bump the version per line"""
+        if time.time() - self.current["last_update"] >= LAST_UPDATE_INTERVAL:
+            self.update()
+
+# Serial reader (see SerialParser)
+READ_TIMEOUT = 0.5          # Seconds a read blocks before the port is checked again
+READER_LOG_INTERVAL = 5.0   # Seconds between reader statistics
+MAX_LINE_LENGTH = 4096      # Bytes without a line end before they are dropped
+
+# Command channel (see Firmware/src/command.c for the protocol)
+COMMAND_TIMEOUT = 1.0       # Seconds to wait for an ACK/NAK
+
+# Recorded serial streams (see CaptureWriter and ReplayConnection)
+CAPTURE_MAGIC = b"FGCAP1\n"
+CAPTURE_HEADER = struct.Struct("<d")      # Wall clock time the recording started
+CAPTURE_RECORD = struct.Struct("<IH")     # Microseconds since the previous chunk, chunk length
+CAPTURE_DIR = os.environ.get('FIREGUARD_CAPTURE_DIR',
+                             os.path.join(os.path.dirname(os.path.abspath(__file__)), 'captures'))
+CAPTURE_FLUSH_INTERVAL = 1.0              # Seconds a recorded chunk may sit in the file buffer
+REPLAY_PREFIX = "replay:"                 # Port name of a replay, "replay:<file>[@<speed>]"
+
+# Frame history (see frame_store.py), one store per unit in a subdirectory
+FRAME_DIR = os.environ.get('FIREGUARD_FRAME_DIR',
+                           os.path.join(os.path.dirname(os.path.abspath(__file__)), 'frames'))
+FRAMES_ENABLED = os.environ.get('FIREGUARD_FRAMES', '1') != '0'
+FRAME_QUERY_LIMIT = 500     # Frames /api/frames returns unless asked for more...
+FRAME_QUERY_MAX = 5000      # ...and at most
+
+# Rollups of the readings (see history.py), one directory per unit
+HISTORY_DIR = os.environ.get('FIREGUARD_HISTORY_DIR',
+                             os.path.join(os.path.dirname(os.path.abspath(__file__)), 'history'))
+HISTORY_ENABLED = os.environ.get('FIREGUARD_HISTORY', '1') != '0'
+
+# Raw frames (see raw_frames.py): units send the sensor's words and the
+# server calibrates them, on one stage for every unit, and interpolates
+# them to RAW_UPSCALE times the sensor's 24x32 (at most 7, rows and cols
+# go out as a byte). Needs numpy.
+RAW_ENABLED = os.environ.get('FIREGUARD_RAW', '0') == '1'
+RAW_UPSCALE = max(1, min(int(os.environ.get('FIREGUARD_RAW_UPSCALE', '2')), 7))
+RAW_BATCH = 64              # Frames calibrated together at most
+
+# Panorama of the patrolled arc (see panorama.py), also needs numpy: units
+# print the frame of every patrol check and the server stitches them by
+# their pan position
+PANORAMA_ENABLED = os.environ.get('FIREGUARD_PANORAMA', '0') == '1'
+PANORAMA_RESOLUTION = float(os.environ.get('FIREGUARD_PANORAMA_RESOLUTION', str(panorama.RESOLUTION)))
+PAN_DEG_PER_STEP = float(os.environ.get('FIREGUARD_PAN_DEG_PER_STEP', str(panorama.DEG_PER_STEP)))
+
+# Rate of rise early warning (see rate_of_rise.py), numpy as well; it
+# needs the frames of the patrol too
+RISE_ENABLED = os.environ.get('FIREGUARD_RISE', '0') == '1'
+RISE_RATE = float(os.environ.get('FIREGUARD_RISE_RATE', str(rate_of_rise.RISE_RATE)))
+RISE_PERSISTENCE = float(os.environ.get('FIREGUARD_RISE_PERSISTENCE', str(rate_of_rise.PERSISTENCE)))
+RISE_BATCH = 64             # Frames analysed per call of the stage at most
+
+# Device supervision (see Device)
+DEFAULT_PORT = '/dev/cu.usbserial-A101167E'
+# Ports POST /api/devices may open besides the configured ones and replays
+# of captures in CAPTURE_DIR: serial devices on Linux, macOS and Windows,
+# and pseudo terminals like the simulator's
+SERIAL_PORT_PATTERN = re.compile(r"^(/dev/(tty|cu\.|rfcomm|pts/|serial/)[\w./:+-]+|COM\d+)$")
+RECONNECT_DELAY = 5.0       # Seconds between attempts to open a port
+STAGE_FLUSH_TIMEOUT = 5.0   # Seconds stop() waits for the consumer stages to catch up
 
 def find_arduino_port():
     """Find the serial port that the Arduino is connected to"""
@@ -35,39 +404,6 @@ def find_arduino_port():
             return port.device
     return None
 
-def init_serial():
-    """Initialize serial connection to the FireGuard hardware"""
-    global serial_connection
-    try:
-        # Use the specific port instead of auto-detection
-        specific_port = '/dev/cu.usbserial-A101167E'
-        
-        print(f"Attempting to connect to port: {specific_port}")
-        serial_connection = serial.Serial(specific_port, 230400, timeout=1)
-        time.sleep(2)  # Allow time for connection to establish
-        
-        fire_data["connection_status"] = "connected"
-        print("Successfully connected to FireGuard hardware")
-        return True
-    except Exception as e:
-        print(f"Serial connection error: {e}")
-        print("Tip: Check that the device is properly connected and not in use by another program.")
-        
-        # Fallback to auto-detection if specific port fails
-        try:
-            port = find_arduino_port()
-            if port:
-                print(f"Attempting fallback connection to auto-detected port: {port}")
-                serial_connection = serial.Serial(port, 230400, timeout=1)
-                time.sleep(2)
-                fire_data["connection_status"] = "connected"
-                print("Successfully connected to FireGuard hardware via auto-detection")
-                return True
-        except Exception as fallback_error:
-            print(f"Fallback connection failed: {fallback_error}")
-        
-        return False
-
 def parse_temperature_matrix(matrix_data):
     """Parse the temperature matrix from the serial data"""
     try:
@@ -92,161 +428,1467 @@ def parse_temperature_matrix(matrix_data):
         print(f"Error parsing temperature matrix: {e}")
         return []
 
-def read_serial_data():
-    """Read and process data from the serial connection"""
-    global fire_data
+def analyze_matrix(matrix):
+    """Max, hotspot blob and centroid of a parsed matrix with the thermal core.
     
-    if serial_connection is None or not serial_connection.is_open:
-        print("No serial connection available. Waiting...")
-        time.sleep(2)
-        return
+    "ERR" pixels are filled in from their neighbours first. Returns {} when
+    the library is not built or the matrix is empty or ragged."""
+    if not thermal_core.available() or not matrix or not matrix[0]:
+        return {}
+    rows, cols = len(matrix), len(matrix[0])
+    if any(len(row) != cols for row in matrix):
+        return {}
     
-    print("Starting serial data reading loop. Waiting for data...")
-    signal_strength = 0  # Counter for received data
+    centi = [(v * 100 if v is not None else 0) for row in matrix for v in row]
+    bad = [v is None for row in matrix for v in row]
+    if any(bad):
+        centi = thermal_core.mask_bad(centi, bad, rows, cols)
     
+    return analyze_frames(centi, rows, cols)[0]
+
+def analyze_frames(centi, rows, cols):
+    """analyze_matrix() for frames in centidegrees stored back to back, e.g.
+    an int16 numpy stack, in one call; a result per frame"""
+    results = thermal_core.analyze(centi, rows, cols, threshold=HOTSPOT_THRESHOLD)
+    backend = thermal_core.backend()
+    for result in results:
+        result["backend"] = backend
+    return results
+
+def parse_boot_timing(line):
+    """Parse "Boot timing (ms): sensor=12 actuators=13 lcd=40 first_frame=420" """
+    timing = {}
+    for part in line.split(":", 1)[1].split():
+        if "=" in part:
+            stage, value = part.split("=", 1)
+            try:
+                timing[stage] = int(value)
+            except ValueError:
+                pass
+    return timing
+
+def parse_command_reply(line):
+    """Parse an "ACK #<seq> ..." or "NAK #<seq> <reason>" line from the device"""
+    parts = line.split()
+    if len(parts) < 2 or parts[0] not in ("ACK", "NAK") or not parts[1].startswith("#"):
+        return None
     try:
-        buffer = ""
-        matrix_data = ""
-        reading_matrix = False
-        last_log_time = time.time()
+        seq = int(parts[1][1:])
+    except ValueError:
+        return None
+    
+    reply = {"ok": parts[0] == "ACK", "seq": seq, "detail": " ".join(parts[2:]), "values": {}}
+    # Replies to GET/SET carry KEY=VALUE pairs
+    for part in parts[2:]:
+        if "=" in part:
+            key, value = part.split("=", 1)
+            try:
+                reply["values"][key] = int(value)
+            except ValueError:
+                reply["values"][key] = value
+    return reply
+
+class LineSplitter:
+    """Splits the byte stream from the device into lines.
+    
+    Bytes arrive in chunks of any size. The complete lines in a chunk are
+    decoded in one go and the unfinished tail waits for the next chunk."""
+    
+    def __init__(self):
+        self.pending = b""
+        # Lines dropped for length and lines with bytes that aren't UTF-8,
+        # until the parser takes the counts
+        self.overlong = 0
+        self.undecodable = 0
+    
+    def feed(self, chunk):
+        data = self.pending + chunk
+        end = data.rfind(b"\n")
+        if end < 0:
+            # No line end in sight, don't let noise on the line grow forever
+            if len(data) > MAX_LINE_LENGTH:
+                self.overlong += 1
+                data = b""
+            self.pending = data
+            return []
+        self.pending = data[end + 1:]
+        text = data[:end].decode('utf-8', errors='replace')
+        lines = [line.strip() for line in text.split("\n")]
+        if "\ufffd" in text:
+            self.undecodable += sum("\ufffd" in line for line in lines)
+        return lines
+
+class ReaderStats:
+    """Throughput and parse latency of the serial reader"""
+    
+    def __init__(self):
+        self.reset(time.perf_counter())
+    
+    def reset(self, now):
+        self.started = now
+        self.bytes = 0
+        self.lines = 0
+        self.chunks = 0
+        self.parse_time = 0.0
+        self.parse_max = 0.0
+    
+    def add(self, size, lines, parse_time):
+        self.bytes += size
+        self.lines += lines
+        self.chunks += 1
+        self.parse_time += parse_time
+        self.parse_max = max(self.parse_max, parse_time)
+    
+    def report(self):
+        """Rates since the last report, then start over"""
+        now = time.perf_counter()
+        elapsed = max(now - self.started, 1e-9)
+        report = {
+            "bytes_per_s": round(self.bytes / elapsed),
+            "lines_per_s": round(self.lines / elapsed, 1),
+            "lines": self.lines,
+            # Time from a chunk arriving to its last line being handled
+            "parse_ms_avg": round(self.parse_time / self.chunks * 1000, 3) if self.chunks else 0.0,
+            "parse_ms_max": round(self.parse_max * 1000, 3),
+        }
+        self.reset(now)
+        return report
+
+class SerialParser:
+    """Turns a device's output into updates of its state, one chunk at a time"""
+    
+    def __init__(self, device):
+        self.device = device
+        self.splitter = LineSplitter()
+        self.stats = ReaderStats()
+        self.matrix_data = ""
+        self.matrix_rows = 0
+        self.reading_matrix = False
+        self.last_line = ""
+        self.received = None    # When the chunk being parsed arrived (perf_counter)
+        # Stamp of the matrix being read (latency.parse_frame_stamp), which
+        # also says how many rows it has so it ends with its last one
+        self.frame_stamp = None
+        # Raw frame and EEPROM dump being read (raw_frames.LineAssembler),
+        # and the registers from the raw frame's header
+        self.raw = None
+        self.raw_registers = None
+        self.eeprom = None
+        self.lines_metric = SERIAL_LINES.labels(device=device.id)
+        self.parse_metric = PARSE_SECONDS.labels(device=device.id)
+    
+    def feed(self, chunk):
+        received = self.received = time.perf_counter()
+        splitter = self.splitter
+        lines = splitter.feed(chunk)
+        for line in lines:
+            self.handle_line(line)
+        if lines:
+            self.last_line = lines[-1]
+        elapsed = time.perf_counter() - received
+        self.stats.add(len(chunk), len(lines), elapsed)
+        self.lines_metric.inc(len(lines))
+        self.parse_metric.observe(elapsed)
+        if splitter.overlong or splitter.undecodable:
+            if splitter.overlong:
+                self.parse_error("line_too_long", splitter.overlong)
+            if splitter.undecodable:
+                self.parse_error("undecodable", splitter.undecodable)
+            splitter.overlong = splitter.undecodable = 0
+    
+    def parse_error(self, kind, count=1):
+        PARSE_ERRORS.inc(count, device=self.device.id, type=kind)
+    
+    def end_matrix(self):
+        self.reading_matrix = False
+        matrix = parse_temperature_matrix(self.matrix_data)
+        # Empty or ragged matrices are counted as errors, not published
+        if not matrix or not matrix[0]:
+            self.parse_error("matrix")
+            return
+        if any(len(row) != len(matrix[0]) for row in matrix):
+            self.parse_error("matrix_shape")
+            return
+        FRAMES_PARSED.inc(device=self.device.id)
+        missing = sum(v is None for row in matrix for v in row)
+        if missing:
+            self.parse_error("err_pixel", missing)
+        self.device.frame_parsed(matrix, analyze_matrix(matrix), self.frame_stamp, self.received)
+        self.device.log(f"Parsed temperature matrix with {len(matrix)} rows")
+    
+    def handle_dump_line(self, line):
+        """A line of a raw frame ("RAW <n> <base64>") or of the sensor's
+        EEPROM ("EE <n> <base64>"), see raw_frames.py"""
+        if line.startswith("EE "):
+            if self.eeprom is None:
+                self.eeprom = raw_frames.LineAssembler()
+            if not self.eeprom.add(line[3:]):
+                self.parse_error("eeprom")
+                self.eeprom = None
+            elif self.eeprom.complete():
+                self.device.raw_eeprom(self.eeprom.words())
+                self.eeprom = None
+            return
+        raw = self.raw
+        if raw is None:
+            return
+        if not raw.add(line[4:]):
+            self.parse_error("raw_frame")
+            self.raw = None
+        elif raw.complete():
+            self.raw = None
+            FRAMES_PARSED.inc(device=self.device.id)
+            frame = raw_frames.frame_words(raw.words(), *self.raw_registers)
+            self.device.raw_frame(frame, self.frame_stamp, self.received)
+    
+    def handle_line(self, line):
+        # Replies to commands sent with send_command()
+        if line.startswith("ACK #") or line.startswith("NAK #"):
+            self.device.handle_command_reply(line, self.received)
+            return
         
-        while serial_connection.is_open:
-            if serial_connection.in_waiting:
-                line = serial_connection.readline().decode('utf-8', errors='replace').strip()
-                signal_strength += 1
-                
-                # Log a sample of the data every few seconds for debugging
-                current_time = time.time()
-                if current_time - last_log_time > 5:  # Log every 5 seconds
-                    print(f"Serial signal active. Messages received: {signal_strength}")
-                    print(f"Sample line: {line[:100]}")
-                    last_log_time = current_time
-                    fire_data["signal_strength"] = signal_strength
-                    signal_strength = 0  # Reset counter
-                
-                # Check if we're starting to read the matrix data
-                if "Center Matrix Data" in line:
-                    print("Found temperature matrix data")
-                    reading_matrix = True
-                    matrix_data = line + "\n"
-                    continue
-                
-                # If we're reading the matrix, accumulate the data
-                if reading_matrix:
-                    matrix_data += line + "\n"
-                    # Check if we've reached the end of the matrix data
-                    if line == "" or line == "---":
-                        reading_matrix = False
-                        fire_data["temperature_matrix"] = parse_temperature_matrix(matrix_data)
-                        print(f"Parsed temperature matrix with {len(fire_data['temperature_matrix'])} rows")
-                        continue
-                
-                # Process regular data lines
-                if "FIRE DETECTED" in line:
-                    print("FIRE DETECTION EVENT TRIGGERED")
-                    fire_data["state"] = "fire-alert"
-                    fire_data["detection_time"] = time.strftime("%H:%M:%S")
-                    
-                    # Extract temperature and position from the message
-                    try:
-                        # Expected format: "FIRE DETECTED! Temp: 50.00°C at [5][14]"
-                        temp_part = line.split("Temp:")[1].split("at")[0].strip()
-                        pos_part = line.split("at")[1].strip()
-                        
-                        fire_data["max_temp"] = float(temp_part.replace("°C", ""))
-                        
-                        # Extract position values from [row][col] format
-                        row = int(pos_part.split('][')[0].replace('[', ''))
-                        col = int(pos_part.split('][')[1].replace(']', ''))
-                        fire_data["max_temp_position"] = [row, col]
-                        print(f"Fire detected at temp: {fire_data['max_temp']}°C, position: [{row}][{col}]")
-                    except Exception as e:
-                        print(f"Error parsing fire detection data: {e}")
+        # Profiler table from a PROFILE=1 build
+        if line.startswith("PROF "):
+            self.device.handle_profile_line(line)
+            return
+        
+        # Raw frames and the sensor's EEPROM, all of a frame's lines in a row
+        if line.startswith("RAW ") or line.startswith("EE "):
+            self.handle_dump_line(line)
+            return
+        if self.raw is not None:
+            self.parse_error("raw_frame")
+            self.raw = None
+        if line.startswith("Raw Frame Data"):
+            self.frame_stamp = latency.parse_frame_stamp(line)
+            self.raw_registers = raw_frames.parse_registers(line)
+            if self.raw_registers is None or not raw_frames.available():
+                self.parse_error("raw_frame")
+            else:
+                self.raw = raw_frames.LineAssembler()
+            return
+        
+        # Check if we're starting to read the matrix data
+        if "Center Matrix Data" in line:
+            self.device.log("Found temperature matrix data")
+            self.reading_matrix = True
+            self.matrix_data = line + "\n"
+            self.matrix_rows = 0
+            self.frame_stamp = latency.parse_frame_stamp(line)
+            return
+        
+        # If we're reading the matrix, accumulate the data. It ends with a
+        # blank line or "---", or with the first line after the data rows
+        # that isn't one (the firmware just carries on printing)
+        if self.reading_matrix:
+            if line == "" or line == "---":
+                self.end_matrix()
+                return
+            if '|' in line:
+                self.matrix_data += line + "\n"
+                self.matrix_rows += 1
+                stamp = self.frame_stamp
+                if stamp and self.matrix_rows == stamp["rows"]:
+                    self.end_matrix()
+                return
+            if self.matrix_rows == 0:
+                # Column headers and separator
+                self.matrix_data += line + "\n"
+                return
+            self.end_matrix()
+        
+        # Process regular data lines, collecting what they change
+        # into one snapshot
+        changes = {}
+        if "FIRE DETECTED" in line:
+            self.device.log("FIRE DETECTION EVENT TRIGGERED")
+            changes["state"] = "fire-alert"
+            changes["detection_time"] = time.strftime("%H:%M:%S")
+            
+            # Extract temperature and position from the message
+            try:
+                # Expected format: "FIRE DETECTED! Temp: 50.00°C at [5][14]"
+                temp_part = line.split("Temp:")[1].split("at")[0].strip()
+                pos_part = line.split("at")[1].strip()
                 
-                elif "Motor stopped - FIRE ALERT MODE" in line:
-                    print("FIRE ALERT MODE ACTIVATED")
-                    fire_data["state"] = "fire-alert"
+                changes["max_temp"] = float(temp_part.replace("°C", ""))
                 
-                elif "Alert! Temp:" in line:
-                    try:
-                        # Expected format: "Alert! Temp: 50.00°C at [5][14]"
-                        temp_part = line.split("Temp:")[1].split("at")[0].strip()
-                        pos_part = line.split("at")[1].strip()
-                        
-                        fire_data["max_temp"] = float(temp_part.replace("°C", ""))
-                        
-                        # Extract position values from [row][col] format
-                        row = int(pos_part.split('][')[0].replace('[', ''))
-                        col = int(pos_part.split('][')[1].replace(']', ''))
-                        fire_data["max_temp_position"] = [row, col]
-                    except Exception as e:
-                        print(f"Error parsing temperature alert data: {e}")
+                # Extract position values from [row][col] format
+                row = int(pos_part.split('][')[0].replace('[', ''))
+                col = int(pos_part.split('][')[1].replace(']', ''))
+                changes["max_temp_position"] = [row, col]
+                self.device.log(f"Fire detected at temp: {changes['max_temp']}°C, position: [{row}][{col}]")
+            except Exception as e:
+                self.parse_error("fire_detection")
+                self.device.log(f"Error parsing fire detection data: {e}")
+        
+        elif "Motor stopped - FIRE ALERT MODE" in line:
+            self.device.log("FIRE ALERT MODE ACTIVATED")
+            changes["state"] = "fire-alert"
+        
+        elif "Alert! Temp:" in line:
+            try:
+                # Expected format: "Alert! Temp: 50.00°C at [5][14]"
+                temp_part = line.split("Temp:")[1].split("at")[0].strip()
+                pos_part = line.split("at")[1].strip()
                 
-                elif "Distance to fire:" in line:
-                    try:
-                        # Expected format: "Distance to fire: 120.50 cm"
-                        distance_str = line.split(":")[1].split("cm")[0].strip()
-                        fire_data["distance"] = float(distance_str)
-                        print(f"Distance to fire: {fire_data['distance']} cm")
-                    except Exception as e:
-                        print(f"Error parsing distance data: {e}")
+                changes["max_temp"] = float(temp_part.replace("°C", ""))
                 
-                elif "Fire alert mode ended" in line:
-                    print("FIRE ALERT MODE ENDED")
-                    fire_data["state"] = "extinguished"
+                # Extract position values from [row][col] format
+                row = int(pos_part.split('][')[0].replace('[', ''))
+                col = int(pos_part.split('][')[1].replace(']', ''))
+                changes["max_temp_position"] = [row, col]
+            except Exception as e:
+                self.parse_error("alert")
+                self.device.log(f"Error parsing temperature alert data: {e}")
+        
+        elif "Distance to fire:" in line:
+            try:
+                # Expected format: "Distance to fire: 120.50 cm"
+                distance_str = line.split(":")[1].split("cm")[0].strip()
+                changes["distance"] = float(distance_str)
+                self.device.log(f"Distance to fire: {changes['distance']} cm")
+            except Exception as e:
+                self.parse_error("distance")
+                self.device.log(f"Error parsing distance data: {e}")
+        
+        elif line.startswith("FireGuard System Initializing"):
+            # Its tick counter starts over
+            self.device.tracer.clock.reset()
+        
+        elif line.startswith("Boot timing"):
+            changes["boot_timing"] = parse_boot_timing(line)
+            self.device.log(f"Device boot timing: {changes['boot_timing']}")
+            # Raw mode doesn't survive a reset
+            self.device.request_streams()
+        
+        elif "Fire alert mode ended" in line:
+            self.device.log("FIRE ALERT MODE ENDED")
+            changes["state"] = "extinguished"
+        
+        elif line.startswith("Pos:"):
+            # Patrol: "Pos: 20/800 | Max: 23.45°C at [3][4]", only rolled up
+            try:
+                peak = float(line.split("Max:")[1].split("°C")[0])
+                self.device.rollup("peak", time.time(), peak)
+            except (IndexError, ValueError):
+                self.parse_error("patrol")
+        
+        # Publish the changes, or just move the last update timestamp
+        if changes:
+            self.device.state.update(**changes)
+            self.record_changes(changes)
+        else:
+            self.device.state.touch()
+    
+    def record_changes(self, changes):
+        """Roll the readings of a line up into the unit's history"""
+        now = time.time()
+        device = self.device
+        if "max_temp" in changes:
+            device.rollup("peak", now, changes["max_temp"])
+        if "distance" in changes:
+            device.rollup("distance", now, changes["distance"])
+        if "detection_time" in changes:
+            device.rollup("detection", now)
+        if "state" in changes:
+            device.rollup("alert", now, changes["state"] == "fire-alert")
+
+def read_available(connection):
+    """Block until the device sends something (or READ_TIMEOUT passes), then
+    take everything that has arrived in one read"""
+    return connection.read(connection.in_waiting or 1)
+
+class CaptureWriter:
+    """Records a unit's raw serial stream with the time each chunk arrived.
+    
+    The file holds CAPTURE_MAGIC and the start time (CAPTURE_HEADER), then
+    for every chunk read from the port the microseconds since the previous
+    one and its length (CAPTURE_RECORD) followed by the bytes."""
+    
+    def __init__(self, path, started=None):
+        self.path = path
+        self.lock = threading.Lock()
+        self.file = open(path, "wb")
+        self.file.write(CAPTURE_MAGIC + CAPTURE_HEADER.pack(time.time()))
+        # Chunk times are time.monotonic() unless the caller makes up its own
+        self.last = time.monotonic() if started is None else started
+        self.last_flush = time.monotonic()
+        self.bytes = 0
+    
+    def write(self, chunk, received):
+        with self.lock:
+            if self.file is None:
+                return
+            gap = min(max(int((received - self.last) * 1e6), 0), 0xFFFFFFFF)
+            self.last = received
+            for start in range(0, len(chunk), 0xFFFF):
+                part = chunk[start:start + 0xFFFF]
+                self.file.write(CAPTURE_RECORD.pack(gap, len(part)))
+                self.file.write(part)
+                gap = 0
+            self.bytes += len(chunk)
+            # Keep what was recorded before a crash, which is the interesting part
+            if time.monotonic() - self.last_flush >= CAPTURE_FLUSH_INTERVAL:
+                self.file.flush()
+                self.last_flush = time.monotonic()
+    
+    def close(self):
+        with self.lock:
+            if self.file is not None:
+                self.file.close()
+                self.file = None
+
+def read_capture(path):
+    """The chunks of a capture as (seconds since the recording started, bytes)"""
+    with open(path, "rb") as f:
+        if f.read(len(CAPTURE_MAGIC)) != CAPTURE_MAGIC:
+            raise ValueError(f"{path} is not a FireGuard capture")
+        f.read(CAPTURE_HEADER.size)
+        offset = 0
+        while True:
+            record = f.read(CAPTURE_RECORD.size)
+            if len(record) < CAPTURE_RECORD.size:
+                return
+            gap, length = CAPTURE_RECORD.unpack(record)
+            chunk = f.read(length)
+            if len(chunk) < length:
+                # Cut off mid-chunk, e.g. the server was killed while recording
+                return
+            offset += gap
+            yield offset / 1e6, chunk
+
+def capture_info(path):
+    """Start time, length, chunks and bytes of a capture"""
+    with open(path, "rb") as f:
+        f.read(len(CAPTURE_MAGIC))
+        started, = CAPTURE_HEADER.unpack(f.read(CAPTURE_HEADER.size))
+    seconds, chunks, size = 0.0, 0, 0
+    for seconds, chunk in read_capture(path):
+        chunks += 1
+        size += len(chunk)
+    return {"started": started, "seconds": seconds, "chunks": chunks, "bytes": size}
+
+class ReplayConnection:
+    """Stands in for serial.Serial and plays a capture back, chunk by chunk,
+    at its recorded pace divided by speed (0: as fast as it is read).
+    
+    Commands written to it are dropped. At the end of the capture it stays
+    open and silent like an idle unit, with finished set."""
+    
+    def __init__(self, path, speed=1.0):
+        self.port = f"{REPLAY_PREFIX}{path}"
+        self.speed = speed
+        self.timeout = READ_TIMEOUT
+        self.is_open = True
+        self.closed = threading.Event()
+        self.finished = threading.Event()
+        self.records = read_capture(path)
+        self.started = time.monotonic()
+        self.pending = b""
+        self.next = self.load()
+    
+    def load(self):
+        """The next chunk as (time due, bytes), None at the end"""
+        record = next(self.records, None)
+        if record is None:
+            self.finished.set()
+            return None
+        offset, chunk = record
+        return (self.started + offset / self.speed if self.speed else 0.0), chunk
+    
+    @property
+    def in_waiting(self):
+        if not self.pending and self.next and self.next[0] <= time.monotonic():
+            self.pending = self.next[1]
+            self.next = self.load()
+        return len(self.pending)
+    
+    def read(self, size=1):
+        if not self.in_waiting:
+            due = self.next[0] if self.next else float("inf")
+            delay = min(due - time.monotonic(), self.timeout or 0)
+            if delay > 0:
+                self.closed.wait(delay)
+            if not self.is_open or not self.in_waiting:
+                return b""
+        data, self.pending = self.pending[:size], self.pending[size:]
+        return data
+    
+    def write(self, data):
+        return len(data)
+    
+    def reset_input_buffer(self):
+        pass
+    
+    def close(self):
+        self.is_open = False
+        self.closed.set()
+        self.records.close()
+
+def open_replay(port):
+    """ReplayConnection for a port named "replay:<file>[@<speed>]" """
+    path, speed = port[len(REPLAY_PREFIX):], 1.0
+    name, _, suffix = path.rpartition("@")
+    if name:
+        try:
+            path, speed = name, float(suffix)
+        except ValueError:
+            pass
+    return ReplayConnection(path, speed)
+
+class Device:
+    """One FireGuard unit: its serial port, state, live stream and command
+    channel, and the thread that keeps it connected and reads from it"""
+    
+    # Parser for the unit's output, replaced by the hub benchmark
+    parser_class = SerialParser
+    
+    def __init__(self, device_id, port, auto_detect=False):
+        self.id = device_id
+        self.port = port
+        # Fall back to the first board found when the port fails to open
+        self.auto_detect = auto_detect
+        self.connection = None
+        self.connect_lock = threading.Lock()
+        self.broadcaster = Broadcaster()
+        # What the reader parses is consumed on these stages' threads (see
+        # pipeline.py): the streams get the newest state, the rollups every
+        # reading. The frame history has its own writer queue.
+        self.live = pipeline.Stage(f"{device_id}_live", lambda snapshot: self.publish_state(),
+                                   pipeline.LATEST)
+        self.rollups = pipeline.Stage(f"{device_id}_history",
+                                      lambda call: getattr(self.history, call[0])(*call[1]),
+                                      pipeline.LOSSLESS)
+        self.state = StateStore(INITIAL_STATE, self.broadcaster, live=self.live)
+        # Panorama of the patrol, stitched on its own stage
+        self.panorama = self.stitcher = None
+        if PANORAMA_ENABLED and panorama.available():
+            self.panorama = panorama.Panorama(PANORAMA_RESOLUTION, PAN_DEG_PER_STEP)
+            self.stitcher = pipeline.Stage(f"{device_id}_panorama", lambda item: self.panorama.add(*item),
+                                           pipeline.LOSSLESS)
+        # Rate of rise of its pixels, on the stage shared by every unit
+        self.rise = rate_of_rise.RiseDetector(RISE_RATE, persistence=RISE_PERSISTENCE) if rise_analysis else None
+        # Link health: when the last chunk arrived (monotonic)
+        self.last_data = None
+        # Latency of the frames from the sensor to the pages, and the unit's
+        # clock they are stamped with
+        self.tracer = latency.FrameTracer()
+        self.latency_metrics = {stage: FRAME_LATENCY.labels(device=device_id, stage=stage)
+                                for stage in latency.STAGES}
+        self.responses = ResponseCache()
+        self.thread = None
+        self.stopped = threading.Event()
+        
+        self.command_lock = threading.Lock()
+        self.command_seq = 0
+        self.pending_commands = {}     # seq -> {"event": threading.Event, "reply": dict}
+        self.sequence_lock = threading.Lock()   # One send_commands() at a time
+        
+        # Profiler table being received, published on "PROF END"
+        self.profile_pending = {}
+        
+        # Recording of the raw serial stream (see start_capture)
+        self.capture = None
+        
+        # Frame history, opened by start()
+        self.frames = None
+        
+        # Rollups of the readings, kept on disk once started
+        self.history = history.History()
+    
+    def log(self, message):
+        print(f"[{self.id}] {message}")
+    
+    def is_connected(self):
+        return self.connection is not None and self.connection.is_open
+    
+    def open_port(self, port):
+        if port.startswith(REPLAY_PREFIX):
+            self.connection = open_replay(port)
+        else:
+            self.connection = serial.Serial(port, 230400, timeout=READ_TIMEOUT)
+            # The board has no auto-reset on open, so there is nothing to wait
+            # for; just drop whatever was buffered before we connected
+            self.connection.reset_input_buffer()
+        LINK_CONNECTS.inc(device=self.id)
+        self.state.update(connection_status="connected")
+    
+    def connect(self, quiet=False):
+        """Open the unit's port, returns whether it is connected"""
+        with self.connect_lock:
+            if self.is_connected():
+                return True
+            try:
+                if not quiet:
+                    self.log(f"Attempting to connect to port: {self.port}")
+                self.open_port(self.port)
+                self.log("Successfully connected to FireGuard hardware")
+                return True
+            except Exception as e:
+                LINK_ERRORS.inc(device=self.id, type="open")
+                if not quiet:
+                    self.log(f"Serial connection error: {e}")
+                    self.log("Tip: Check that the device is properly connected and not in use by another program.")
+            
+            if not self.auto_detect:
+                return False
+            
+            # Fallback to auto-detection if specific port fails
+            try:
+                port = find_arduino_port()
+                if port:
+                    self.log(f"Attempting fallback connection to auto-detected port: {port}")
+                    self.open_port(port)
+                    self.log("Successfully connected to FireGuard hardware via auto-detection")
+                    return True
+            except Exception as fallback_error:
+                self.log(f"Fallback connection failed: {fallback_error}")
+            return False
+    
+    def close(self, connection=None):
+        connection = connection or self.connection
+        if connection and connection.is_open:
+            try:
+                connection.close()
+            except Exception as e:
+                self.log(f"Error closing existing connection: {e}")
+    
+    def start(self):
+        """Start supervising the unit, if that isn't running yet"""
+        if self.thread is None or not self.thread.is_alive():
+            self.stopped.clear()
+            if os.environ.get('FIREGUARD_CAPTURE') == '1' and self.capture is None:
+                self.start_capture()
+            if FRAMES_ENABLED and self.frames is None:
+                self.frames = frame_store.FrameStore(os.path.join(FRAME_DIR, self.id))
+            if HISTORY_ENABLED and self.history.directory is None:
+                self.history = history.History(os.path.join(HISTORY_DIR, self.id))
+            self.thread = threading.Thread(target=self.run, daemon=True, name=f"serial_{self.id}")
+            self.thread.start()
+    
+    def stop(self):
+        self.stopped.set()
+        self.close()
+        self.stop_capture()
+        frames, self.frames = self.frames, None
+        if frames:
+            frames.close()
+        self.live.flush(STAGE_FLUSH_TIMEOUT)
+        self.rollups.flush(STAGE_FLUSH_TIMEOUT)
+        self.history.close()
+    
+    def close_stages(self):
+        """End the consumer threads, once the unit is stopped for good"""
+        self.live.close()
+        self.rollups.close()
+        if self.stitcher is not None:
+            self.stitcher.close()
+        if raw_calibrator is not None:
+            raw_calibrator.forget(self.id)
+    
+    def publish_state(self):
+        """The live stage's work: send the newest state to the streams and
+        time how long its matrix took to get there, sending its trace after it"""
+        snapshot, _, frame = self.state.publish()
+        if not frame:
+            return
+        now = time.perf_counter()
+        trace = self.tracer.published(snapshot["version"], now)
+        if trace is None:
+            return
+        FRAME_AGE.observe(now - trace["received"], device=self.id)
+        for stage in latency.STAGES:
+            if trace[stage] is not None:
+                self.latency_metrics[stage].observe(trace[stage])
+        self.broadcaster.publish("latency", latency.trace_payload(trace))
+    
+    def frame_rendered(self, version, seconds):
+        """A page reports it drew the frame of version seconds after it was
+        published"""
+        if self.tracer.rendered(version, seconds) is not None:
+            self.latency_metrics["render"].observe(seconds)
+    
+    def rollup(self, method, *args):
+        """Apply a reading to the history (History.<method>(*args)) on the
+        rollups stage, never on the reader's thread"""
+        self.rollups.put((method, args))
+    
+    def pipeline_stats(self):
+        """Depth, high-water mark and losses of every stage after the reader"""
+        stages = {"live": self.live.stats(), "history": self.rollups.stats()}
+        if self.stitcher is not None:
+            stages["panorama"] = self.stitcher.stats()
+        frames = self.frames
+        if frames:
+            stages["frames"] = {
+                "policy": "drop",
+                "depth": frames.queue.qsize(),
+                "capacity": frame_store.QUEUE_SIZE,
+                "handled": frames.written,
+                "dropped": frames.dropped,
+            }
+        # Shared by every unit
+        for name, stage in shared_stages().items():
+            stages[name] = stage.stats()
+        return {"reader": self.state.current["reader"], "stages": stages}
+    
+    def frame_parsed(self, matrix, hotspot, stamp, received, zoom=1):
+        """Publish a new matrix, parsed by the reader or calibrated from a
+        raw frame; stamp is its header's and received when its last line
+        arrived, for its latency trace. Frames with a pan position go to
+        the panorama, and every frame to the rate of rise analysis; zoom is
+        their cells per sensor pixel."""
+        self.tracer.parsed(stamp, received, time.perf_counter())
+        self.state.update(temperature_matrix=matrix, hotspot=hotspot)
+        self.record_frame(matrix, hotspot)
+        if self.stitcher is not None and stamp and stamp["pan"] is not None:
+            self.stitcher.put((matrix, stamp["pan"], zoom))
+        if self.rise is not None:
+            rise_analysis.put((self, matrix, stamp["pan"] if stamp else None, time.time()))
+    
+    def rise_frame(self, frame, pan, when):
+        """The rise stage's work for one of the unit's frames: publish the
+        early warning when it starts, changes or ends"""
+        was = self.state.current["early_warning"]
+        warning = self.rise.update(frame, pan, when)
+        if warning is was:
+            return
+        if warning is not None and was is None:
+            EARLY_WARNINGS.inc(device=self.id)
+            self.log(f"Early warning: {warning['pixels']} pixels rising {warning['rate']}°C/min, "
+                     f"{warning['temp']}°C at {warning['position']} pan {warning['pan']}")
+        elif warning is None:
+            self.log("Early warning ended")
+        self.state.update(early_warning=warning)
+    
+    def request_streams(self):
+        """Ask the unit for what the server's options need: its sensor's
+        EEPROM and raw frames when the server calibrates them, the frames
+        of every patrol check for the panorama and the rate of rise (or none,
+        in case an earlier run asked for them). Called from the reader, so
+        the commands go out from a thread of their own."""
+        commands = []
+        if calibration is not None:
+            commands += ["EEPROM", "RAW ON"]
+        scan = self.panorama is not None or self.rise is not None
+        commands.append("SCAN ON" if scan else "SCAN OFF")
+        threading.Thread(target=self.send_commands, args=(commands,),
+                         name=f"{self.id}-commands", daemon=True).start()
+    
+    def send_commands(self, commands):
+        """Send commands one after the other, each once the unit answered
+        the one before or it timed out: the unit only takes a few lines at
+        a time while it reads the sensor"""
+        with self.sequence_lock:
+            for command in commands:
+                if self.send_command(command) is None:
+                    self.log(f"No reply to '{command}'")
+    
+    def raw_frame(self, frame, stamp, received):
+        """A raw frame (frameData, see raw_frames.py) from the parser, handed
+        to the calibration stage"""
+        if calibration is None:
+            # The unit is still in raw mode from an earlier run
+            self.log("Raw frame received but raw frames are off, turning them off on the unit")
+            self.send_command("RAW OFF", timeout=0)
+            return
+        calibration.put((self, frame, stamp, received))
+    
+    def raw_eeprom(self, words):
+        """The sensor's EEPROM dump, to calibrate the unit's raw frames with"""
+        if raw_calibrator is None:
+            return
+        if raw_calibrator.set_eeprom(self.id, words):
+            self.log("Calibrating raw frames with the sensor's EEPROM")
+        else:
+            self.log("Sensor EEPROM is blank, raw frames get the linear conversion")
+    
+    def record_frame(self, matrix, hotspot):
+        """Keep a parsed matrix in the frame history, never waiting for the
+        disk, and count it in the rollups if it has a hotspot"""
+        if hotspot:
+            hot = hotspot["blob"] is not None
+        else:
+            # Without the thermal core
+            hot = any(v is not None and v * 100 >= HOTSPOT_THRESHOLD for row in matrix for v in row)
+        if hot:
+            self.rollup("hotspot", time.time())
+        frames = self.frames
+        if frames:
+            alert = self.state.current["state"] == "fire-alert"
+            frames.append(time.time(), matrix, frame_store.FLAG_ALERT if alert else 0)
+    
+    def start_capture(self, path=None):
+        """Start recording the raw serial stream (see CaptureWriter), by
+        default to a new file in CAPTURE_DIR. Returns the file's path."""
+        if path is None:
+            os.makedirs(CAPTURE_DIR, exist_ok=True)
+            path = os.path.join(CAPTURE_DIR, f"{self.id}-{time.strftime('%Y%m%d-%H%M%S')}.fgcap")
+        capture = CaptureWriter(path)
+        self.stop_capture()
+        self.capture = capture
+        self.log(f"Recording serial data to {path}")
+        return path
+    
+    def stop_capture(self):
+        capture, self.capture = self.capture, None
+        if capture:
+            capture.close()
+            self.log(f"Recorded {capture.bytes} bytes to {capture.path}")
+        return capture
+    
+    def run(self):
+        """Keep the unit connected and read from it until stopped"""
+        failures = 0
+        while not self.stopped.is_set():
+            # Only the first failure in a row is logged in full
+            if not self.connect(quiet=failures > 0):
+                failures += 1
+                self.stopped.wait(RECONNECT_DELAY)
+                continue
+            failures = 0
+            self.read_serial_data()
+    
+    def read_serial_data(self):
+        """Read and process data from the serial connection until it fails"""
+        connection = self.connection
+        self.log("Starting serial data reading loop. Waiting for data...")
+        parser = self.parser_class(self)
+        bytes_metric = SERIAL_BYTES.labels(device=self.id)
+        # Whatever is on the other end now, its clock hasn't been seen yet
+        clock = self.tracer.clock
+        clock.reset()
+        self.request_streams()
+        
+        try:
+            connection.timeout = READ_TIMEOUT
+            last_log_time = time.time()
+            
+            while connection.is_open and not self.stopped.is_set():
+                chunk = read_available(connection)
+                if chunk:
+                    self.last_data = time.monotonic()
+                    bytes_metric.inc(len(chunk))
+                    capture = self.capture
+                    if capture:
+                        capture.write(chunk, time.monotonic())
+                    parser.feed(chunk)
                 
-                # Update the last update timestamp
-                fire_data["last_update"] = time.time()
+                # Line the unit's clock up with ours now and then
+                if clock.due(time.perf_counter()):
+                    self.sync_clock(connection)
                 
-            time.sleep(0.01)  # Short sleep to prevent CPU hogging
-    except Exception as e:
-        print(f"Error reading serial data: {e}")
-        fire_data["connection_status"] = "disconnected"
-        # Attempt to reconnect
+                # Log a sample of the data every few seconds for debugging
+                current_time = time.time()
+                if current_time - last_log_time > READER_LOG_INTERVAL:
+                    reader = parser.stats.report()
+                    if reader["lines"]:
+                        self.log(f"Serial signal active. Messages received: {reader['lines']} "
+                                 f"({reader['bytes_per_s']} bytes/s, parse {reader['parse_ms_avg']} ms avg, "
+                                 f"{reader['parse_ms_max']} ms max)")
+                        self.log(f"Sample line: {parser.last_line[:100]}")
+                    last_log_time = current_time
+                    if reader != self.state.current["reader"]:
+                        self.state.update(signal_strength=reader["lines"], reader=reader)
+        except Exception as e:
+            # Not when stop() or reconnect() closed the port under it
+            if self.connection is connection and not self.stopped.is_set():
+                LINK_ERRORS.inc(device=self.id, type="read")
+            self.log(f"Error reading serial data: {e}")
+        
+        # Closed by reconnect() or stop(), or the port failed; run() opens it
+        # again. reconnect() may already have opened a new one.
+        self.close(connection)
+        if self.connection is connection:
+            self.state.update(connection_status="disconnected")
+    
+    def reconnect(self):
+        """Close the port and open it again right away"""
+        self.close()
+        success = self.connect()
+        self.start()
+        return success
+    
+    def handle_profile_line(self, line):
+        """Collect "PROF <stage> n=<count> min=<us> avg=<us> max=<us>" lines"""
+        parts = line.split()
+        if len(parts) < 2:
+            return
+        if parts[1] == "END":
+            self.state.update(profile=self.profile_pending)
+            self.profile_pending = {}
+            return
+        
+        stats = {}
+        for part in parts[2:]:
+            if "=" in part:
+                key, value = part.split("=", 1)
+                try:
+                    stats[key] = int(value)
+                except ValueError:
+                    pass
+        self.profile_pending[parts[1]] = stats
+    
+    def handle_command_reply(self, line, received=None):
+        """Hand a command reply to the request waiting for it; answers to
+        sync_clock() go to the clock, received is when they arrived"""
+        reply = parse_command_reply(line)
+        if reply is None:
+            return
+        if not reply["ok"] and reply["seq"] == 0 and reply["detail"] == "OVERFLOW":
+            # The unit's receive buffer ran over, a command may be lost
+            self.log("Unit dropped received bytes (NAK OVERFLOW)")
+            return
+        if received is not None:
+            ticks = reply["values"].get("tick") if reply["ok"] else None
+            if self.tracer.clock.answered(reply["seq"], ticks, received):
+                return
+        with self.command_lock:
+            pending = self.pending_commands.get(reply["seq"])
+        if pending:
+            pending["reply"] = reply
+            pending["event"].set()
+    
+    def next_command_seq(self):
+        with self.command_lock:
+            # Sequence 0 is used by the device for commands sent without one
+            self.command_seq = self.command_seq % 65535 + 1
+            return self.command_seq
+    
+    def sync_clock(self, connection):
+        """Ask the unit for its tick count (TIME) without waiting; the reader
+        hands the answer to the clock (latency.DeviceClock)"""
+        seq = self.next_command_seq()
         try:
-            if serial_connection and serial_connection.is_open:
-                print("Closing problematic connection and attempting to reconnect...")
-                serial_connection.close()
-            time.sleep(2)
-            init_serial()
-        except Exception as reconnect_error:
-            print(f"Reconnection attempt failed: {reconnect_error}")
+            sent = time.perf_counter()
+            connection.write(f"#{seq} TIME\n".encode('ascii'))
+            self.tracer.clock.sent(seq, sent)
+        except Exception as e:
+            self.log(f"Error sending TIME: {e}")
+    
+    def send_command(self, command, timeout=COMMAND_TIMEOUT):
+        """Send a command to the unit and wait for its reply.
+        
+        Returns the parsed reply, or None if there is no connection or the
+        unit did not answer in time. A timeout of 0 does not wait."""
+        connection = self.connection
+        if connection is None or not connection.is_open:
+            return None
+        
+        seq = self.next_command_seq()
+        pending = {"event": threading.Event(), "reply": None}
+        with self.command_lock:
+            self.pending_commands[seq] = pending
+        
+        try:
+            connection.write(f"#{seq} {command}\n".encode('ascii'))
+            if timeout and pending["event"].wait(timeout):
+                return pending["reply"]
+            return None
+        except Exception as e:
+            self.log(f"Error sending command '{command}': {e}")
+            return None
+        finally:
+            with self.command_lock:
+                self.pending_commands.pop(seq, None)
+
+class DeviceRegistry:
+    """The units this server supervises, by id. The first one added is the
+    default, served by the routes without a device id."""
+    
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.devices = {}
+    
+    def add(self, device_id, port, auto_detect=False):
+        with self.lock:
+            if device_id in self.devices:
+                raise ValueError(f"device {device_id} already exists")
+            device = Device(device_id, port, auto_detect)
+            self.devices[device_id] = device
+        return device
+    
+    def remove(self, device_id):
+        with self.lock:
+            device = self.devices.pop(device_id, None)
+        if device:
+            device.stop()
+            device.close_stages()
+            for metric in DEVICE_METRICS:
+                metric.remove(device=device_id)
+        return device
+    
+    def get(self, device_id):
+        return self.devices.get(device_id)
+    
+    def all(self):
+        with self.lock:
+            return list(self.devices.values())
+    
+    def default(self):
+        devices = self.all()
+        return devices[0] if devices else None
+
+devices = DeviceRegistry()
+
+def calibrate_raw_frames(items):
+    """The calibration stage's work: the raw frames every unit sent since
+    the last batch, as (device, frame, stamp, received), calibrated,
+    upscaled and analysed together, then published by their units"""
+    units = [device.id for device, _, _, _ in items]
+    frames = raw_calibrator.calibrate(units, [frame for _, frame, _, _ in items])
+    frames = raw_upsample(raw_frames.fill_missing(frames))
+    rows, cols = frames.shape[1:]
+    if thermal_core.available():
+        hotspots = analyze_frames(raw_frames.centidegrees(frames), rows, cols)
+    else:
+        hotspots = [{}] * len(items)
+    for (device, _, stamp, received), matrix, hotspot in zip(items, raw_frames.matrices(frames), hotspots):
+        device.frame_parsed(matrix, hotspot, stamp, received, RAW_UPSCALE)
+
+# Shared by every unit, so frames are calibrated many at a time
+raw_calibrator = raw_upsample = calibration = None
+if RAW_ENABLED:
+    if raw_frames.available():
+        raw_calibrator = raw_frames.Calibrator()
+        raw_upsample = raw_frames.Upsampler(RAW_UPSCALE)
+        calibration = pipeline.Stage("calibration", calibrate_raw_frames, pipeline.LOSSLESS, batch=RAW_BATCH)
+    else:
+        print("FIREGUARD_RAW=1 needs numpy (pip install -r requirements.txt), units keep sending matrices")
+if PANORAMA_ENABLED and not panorama.available():
+    print("FIREGUARD_PANORAMA=1 needs numpy (pip install -r requirements.txt), there is no panorama")
+
+def analyze_rise(items):
+    """The rise stage's work: frames of every unit since the last batch, as
+    (device, matrix, pan, time.time() parsed), each through its unit's
+    rate of rise analysis"""
+    for device, matrix, pan, when in items:
+        frame = raw_frames.frame_array(matrix)
+        if frame.ndim == 2 and frame.size:
+            device.rise_frame(frame, pan, when)
+
+rise_analysis = None
+if RISE_ENABLED:
+    if rate_of_rise.available():
+        rise_analysis = pipeline.Stage("rise", analyze_rise, pipeline.LOSSLESS, batch=RISE_BATCH)
+    else:
+        print("FIREGUARD_RISE=1 needs numpy (pip install -r requirements.txt), there is no early warning")
+
+def shared_stages():
+    """The stages serving every unit at once, by name"""
+    stages = {"calibration": calibration, "rise": rise_analysis}
+    return {name: stage for name, stage in stages.items() if stage is not None}
+
+def configure_devices():
+    """Register the units from FIREGUARD_DEVICES ("id=port,id=port"), or a
+    single one on FIREGUARD_SERIAL_PORT (e.g. the host simulator's pty, see
+    Firmware/host) with auto-detection as the fallback"""
+    spec = os.environ.get('FIREGUARD_DEVICES', '').strip()
+    if not spec:
+        port = os.environ.get('FIREGUARD_SERIAL_PORT', DEFAULT_PORT)
+        CONFIGURED_PORTS.add(port)
+        devices.add("default", port, auto_detect=True)
+        return
+    for entry in spec.split(","):
+        device_id, _, port = entry.strip().partition("=")
+        if device_id and port:
+            CONFIGURED_PORTS.add(port)
+            devices.add(device_id, port)
+
+# Ports from the environment, which can be added again after a DELETE
+CONFIGURED_PORTS = set()
+configure_devices()
+
+def allowed_port(port):
+    """The port POST /api/devices opens for port, or None when it is neither
+    configured, a serial device nor a replay of a capture in CAPTURE_DIR
+    (a replay's file is taken relative to CAPTURE_DIR)"""
+    if port in CONFIGURED_PORTS:
+        return port
+    if port.startswith(REPLAY_PREFIX):
+        path, suffix = port[len(REPLAY_PREFIX):], ""
+        name, _, speed = path.rpartition("@")
+        if name:
+            try:
+                float(speed)
+                path, suffix = name, "@" + speed
+            except ValueError:
+                pass
+        captures = os.path.realpath(CAPTURE_DIR)
+        path = os.path.realpath(os.path.join(captures, path))
+        if os.path.commonpath([captures, path]) != captures:
+            return None
+        return f"{REPLAY_PREFIX}{path}{suffix}"
+    # Links like /dev/serial/by-id/... have to lead to a serial device too
+    if SERIAL_PORT_PATTERN.match(port) and (
+            not port.startswith("/dev/") or SERIAL_PORT_PATTERN.match(os.path.realpath(port))):
+        return port
+    return None
+
+def find_device(device_id):
+    """The unit a route is for: by id, or the default without one. Aborts with 404."""
+    device = devices.get(device_id) if device_id is not None else devices.default()
+    if device is None:
+        abort(404, description=f"no device {device_id}")
+    return device
+
+# Most severe first, for the site view
+STATE_SEVERITY = ["fire-alert", "extinguishing", "extinguished", "no-alert"]
+
+def site_summary():
+    """All units at a glance: the most severe state, counts, the hottest unit"""
+    units = []
+    for device in devices.all():
+        snapshot = device.state.current
+        units.append({
+            "id": device.id,
+            "port": device.port,
+            "state": snapshot["state"],
+            "connection_status": snapshot["connection_status"],
+            "max_temp": snapshot["max_temp"],
+            "max_temp_position": snapshot["max_temp_position"],
+            "distance": snapshot["distance"],
+            "detection_time": snapshot["detection_time"],
+            "early_warning": snapshot["early_warning"],
+            "last_update": snapshot["last_update"],
+            "version": snapshot["version"],
+        })
+    
+    counts = {name: 0 for name in STATE_SEVERITY}
+    for unit in units:
+        counts[unit["state"]] = counts.get(unit["state"], 0) + 1
+    worst = next((name for name in STATE_SEVERITY if counts[name]), "no-alert")
+    hottest = max(units, key=lambda unit: unit["max_temp"], default=None)
+    
+    return {
+        "state": worst,
+        "counts": counts,
+        "connected": sum(unit["connection_status"] == "connected" for unit in units),
+        "hottest": {"id": hottest["id"], "max_temp": hottest["max_temp"]} if hottest else None,
+        # Every unit's version only grows, so neither does their sum while
+        # no unit is removed
+        "version": sum(unit["version"] for unit in units),
+        "units": units,
+    }
+
+@metrics.REGISTRY.collector
+def device_metrics():
+    """Gauges read at scrape time: link health, streams and stage queues"""
+    now = time.monotonic()
+    samples = [("fireguard_streams_open", "gauge", "Open /api/stream responses", {}, active_streams)]
+    for device in devices.all():
+        labels = {"device": device.id}
+        snapshot = device.state.current
+        samples += [
+            ("fireguard_device_connected", "gauge", "Whether the unit's port is open",
+             labels, int(snapshot["connection_status"] == "connected")),
+            ("fireguard_device_last_data_age_seconds", "gauge", "Seconds since the unit last sent anything",
+             labels, round(now - device.last_data, 3) if device.last_data is not None else -1),
+            ("fireguard_device_alert", "gauge", "Whether the unit is in fire alert",
+             labels, int(snapshot["state"] == "fire-alert")),
+            ("fireguard_device_state_updates_total", "counter", "Snapshots the unit's state has gone through",
+             labels, snapshot["version"]),
+            ("fireguard_stream_clients", "gauge", "Streams subscribed to the unit",
+             labels, len(device.broadcaster.subscribers)),
+        ]
+        clock = device.tracer.clock
+        if clock.round_trip is not None:
+            samples.append(("fireguard_clock_uncertainty_seconds", "gauge",
+                            "Half the round trip of the TIME answer the unit's clock is mapped with",
+                            labels, round(clock.round_trip / 2, 6)))
+        shared = shared_stages()
+        for stage, stats in device.pipeline_stats()["stages"].items():
+            if stage in shared:
+                continue
+            stage_labels = dict(labels, stage=stage)
+            samples += [
+                ("fireguard_stage_depth", "gauge", "Items waiting in a consumer stage", stage_labels, stats["depth"]),
+                ("fireguard_stage_handled_total", "counter", "Items a consumer stage handled",
+                 stage_labels, stats["handled"]),
+                ("fireguard_stage_lost_total", "counter",
+                 "Items a consumer stage dropped or replaced with a newer one",
+                 stage_labels, stats.get("dropped", 0) + stats.get("coalesced", 0)),
+            ]
+    for name, stage in shared_stages().items():
+        # One stage for every unit
+        stats = stage.stats()
+        stage_labels = {"device": "all", "stage": name}
+        samples += [
+            ("fireguard_stage_depth", "gauge", "Items waiting in a consumer stage", stage_labels, stats["depth"]),
+            ("fireguard_stage_handled_total", "counter", "Items a consumer stage handled",
+             stage_labels, stats["handled"]),
+        ]
+    return samples
+
+@app.before_request
+def start_timer():
+    g.started = time.perf_counter()
+
+@app.after_request
+def time_request(response):
+    started = g.get("started")
+    if started is not None:
+        route = request.url_rule.rule if request.url_rule else "unmatched"
+        HTTP_SECONDS.observe(time.perf_counter() - started, route=route,
+                             method=request.method, status=response.status_code)
+    return response
+
+@app.route('/metrics')
+def get_metrics():
+    """Counters, histograms and gauges in the Prometheus text format"""
+    return Response(metrics.REGISTRY.render(), mimetype="text/plain; version=0.0.4")
 
 @app.route('/')
 def index():
     """Serve the main web interface"""
     return render_template('FireGuard.html')
 
+def state_etag(snapshot):
+    return f'W/"{ETAG_PREFIX}-{snapshot["version"]}"'
+
+def not_modified(etag):
+    """Whether the request's If-None-Match already names etag"""
+    header = request.headers.get("If-None-Match", "")
+    return header.strip() == "*" or etag in (tag.strip() for tag in header.split(","))
+
+def cached_json(device, key, build):
+    """A JSON response from the unit's ResponseCache, gzipped when it is
+    large enough and the client takes it"""
+    body, compressed = device.responses.get(key, build)
+    response = app.response_class(mimetype="application/json")
+    if compressed is not None and "gzip" in request.headers.get("Accept-Encoding", ""):
+        response.set_data(compressed)
+        response.headers["Content-Encoding"] = "gzip"
+    else:
+        response.set_data(body)
+    if compressed is not None:
+        response.headers["Vary"] = "Accept-Encoding"
+    return response
+
 @app.route('/api/status')
-def get_status():
-    """API endpoint that returns the current fire detection status"""
-    return jsonify(fire_data)
+@app.route('/api/devices/<device_id>/status')
+def get_status(device_id=None):
+    """API endpoint that returns the current fire detection status.
+    
+    Answers 304 Not Modified when If-None-Match has the ETag of the current
+    version, and with ?since=<version> 204 No Content while the state is
+    still at that version. ?since=<version>&delta=1 returns only what changed
+    after that version (see state_delta), or the full state if it is too
+    old to tell. ?matrix=0 leaves out the matrix, for pages that get it from
+    /api/frame.bin. Full states are gzipped for clients that accept it."""
+    device = find_device(device_id)
+    snapshot = device.state.current
+    version = snapshot["version"]
+    since = request.args.get("since", type=int)
+    matrix = request.args.get("matrix") != "0"
+    etag = state_etag(snapshot)
+    
+    if not_modified(etag):
+        response = app.response_class(status=304)
+    elif since is not None and since == version:
+        response = app.response_class(status=204)
+    else:
+        old = device.state.at(since) if since is not None and request.args.get("delta") == "1" else None
+        if old is not None and since < version:
+            response = cached_json(device, ("delta", since, version, matrix),
+                                   lambda: state_delta(old, snapshot, matrix))
+        else:
+            response = cached_json(device, ("status", version, matrix),
+                                   lambda: snapshot if matrix else status_payload(snapshot))
+    response.headers["ETag"] = etag
+    response.headers["Cache-Control"] = "no-cache"
+    response.headers["X-State-Version"] = str(version)
+    return response
+
+@app.route('/api/frame.bin')
+@app.route('/api/devices/<device_id>/frame.bin')
+def get_frame_binary(device_id=None):
+    """The current matrix as a binary frame (FRAME_HEADER, then int16
+    pixels), 204 No Content with ?since=<version> while the state is still
+    at that version"""
+    snapshot = find_device(device_id).state.current
+    since = request.args.get("since", type=int)
+    if since is not None and since == snapshot["version"]:
+        response = app.response_class(status=204)
+    else:
+        response = app.response_class(frame_binary(snapshot), mimetype="application/octet-stream")
+    response.headers["X-State-Version"] = str(snapshot["version"])
+    response.headers["Cache-Control"] = "no-cache"
+    return response
+
+# Open /api/stream responses, and how many the server has threads for
+# (None: no limit, on the development server)
+stream_lock = threading.Lock()
+active_streams = 0
+stream_limit = None
+
+@app.route('/api/stream')
+@app.route('/api/devices/<device_id>/stream')
+def stream(device_id=None):
+    """Server-Sent Events: a full "status" and "frame" on connect, then
+    "status" whenever the device state changes and "frame" for every new
+    matrix, as soon as the serial thread has parsed them.
+    
+    With ?frames=binary the "frame" events carry the matrix as a base64
+    binary frame (see /api/frame.bin) instead of JSON, without the hotspot."""
+    global active_streams
+    device = find_device(device_id)
+    # Check and take the slot at once, or concurrent connects all pass
+    with stream_lock:
+        admitted = stream_limit is None or active_streams < stream_limit
+        if admitted:
+            active_streams += 1
+    if not admitted:
+        response = jsonify({"status": "error", "message": "Too many streams, poll /api/status instead"})
+        response.status_code = 503
+        response.headers["Retry-After"] = "30"
+        return response
+    binary = request.args.get("frames") == "binary"
+    # Subscribe before taking the snapshot so no update falls in between
+    q = device.broadcaster.subscribe(binary=binary)
+    snapshot = device.state.current
+    
+    def events():
+        yield format_event("status", status_payload(snapshot))
+        if binary:
+            yield format_binary_event("frame", frame_binary(snapshot))
+        else:
+            yield format_event("frame", frame_payload(snapshot))
+        while True:
+            try:
+                message = q.get(timeout=STREAM_KEEPALIVE)
+            except queue.Empty:
+                yield ": keepalive\n\n"
+                continue
+            if message is None:
+                return
+            yield message
+    
+    def release():
+        # On close of the response, even one whose body never started
+        global active_streams
+        device.broadcaster.unsubscribe(q)
+        with stream_lock:
+            active_streams -= 1
+    
+    response = Response(events(), mimetype='text/event-stream',
+                        headers={"Cache-Control": "no-cache", "X-Accel-Buffering": "no"})
+    response.call_on_close(release)
+    return response
+
+@app.route('/api/devices', methods=['GET'])
+def list_devices():
+    """The units this server supervises"""
+    return jsonify([{"id": device.id, "port": device.port,
+                     "connection_status": device.state.current["connection_status"]}
+                    for device in devices.all()])
+
+@app.route('/api/devices', methods=['POST'])
+def add_device():
+    """Start supervising another unit, e.g. {"id": "hall", "port": "/dev/ttyUSB1"}"""
+    body = request.get_json(silent=True) or {}
+    device_id, port = str(body.get("id", "")).strip(), str(body.get("port", "")).strip()
+    if not device_id or not port or "/" in device_id:
+        return jsonify({"status": "error", "error": "id and port are required"}), 400
+    port = allowed_port(port)
+    if port is None:
+        return jsonify({"status": "error", "error": "port must be a serial device or "
+                        f"{REPLAY_PREFIX}<file> of a capture in {CAPTURE_DIR}"}), 400
+    try:
+        device = devices.add(device_id, port)
+    except ValueError as e:
+        return jsonify({"status": "error", "error": str(e)}), 409
+    device.start()
+    return jsonify({"status": "success", "id": device_id})
+
+@app.route('/api/devices/<device_id>', methods=['DELETE'])
+def remove_device(device_id):
+    """Stop supervising a unit"""
+    if devices.remove(device_id) is None:
+        abort(404, description=f"no device {device_id}")
+    return jsonify({"status": "success"})
+
+@app.route('/api/site')
+def get_site():
+    """Aggregated view of every unit on the site"""
+    return jsonify(site_summary())
 
 @app.route('/api/reset', methods=['POST'])
-def reset_status():
+@app.route('/api/devices/<device_id>/reset', methods=['POST'])
+def reset_status(device_id=None):
     """Reset the system back to monitoring state"""
-    fire_data["state"] = "no-alert"
-    fire_data["max_temp"] = 0.0
-    fire_data["temperature_matrix"] = []
+    device = find_device(device_id)
+    device.state.update(state="no-alert", max_temp=0.0, temperature_matrix=[], hotspot={})
+    device.rollup("alert", time.time(), False)
     
-    # If connected to hardware, send a reset command
-    if serial_connection and serial_connection.is_open:
+    # If connected to hardware, send a reset command (the unit reboots, so
+    # don't wait for the acknowledgement)
+    device.send_command("RESET", timeout=0)
+    
+    return jsonify({"status": "success"})
+
+@app.route('/api/config', methods=['GET'])
+@app.route('/api/devices/<device_id>/config', methods=['GET'])
+def get_config(device_id=None):
+    """Read all runtime tunables from the device"""
+    reply = find_device(device_id).send_command("GET")
+    if reply is None:
+        return jsonify({"status": "error", "error": "no reply from device"}), 504
+    return jsonify({"status": "success", "config": reply["values"]})
+
+@app.route('/api/config', methods=['POST'])
+@app.route('/api/devices/<device_id>/config', methods=['POST'])
+def set_config(device_id=None):
+    """Change runtime tunables on the device, e.g. {"FIRE_THRESHOLD": 4500}"""
+    device = find_device(device_id)
+    changes = request.get_json(silent=True) or {}
+    results = {}
+    for key, value in changes.items():
         try:
-            serial_connection.write(b'RESET\n')
-        except:
-            pass
+            value = int(value)
+        except (TypeError, ValueError):
+            results[key] = "invalid value"
+            continue
+        reply = device.send_command(f"SET {key} {value}")
+        if reply is None:
+            results[key] = "timeout"
+        elif not reply["ok"]:
+            results[key] = f"rejected ({reply['detail']})"
+        else:
+            results[key] = reply["values"].get(key, value)
     
+    ok = all(not isinstance(v, str) for v in results.values())
+    return jsonify({"status": "success" if ok else "error", "results": results})
+
+@app.route('/api/mode', methods=['POST'])
+@app.route('/api/devices/<device_id>/mode', methods=['POST'])
+def set_mode(device_id=None):
+    """Switch the device between PATROL and HOLD"""
+    device = find_device(device_id)
+    mode = str((request.get_json(silent=True) or {}).get("mode", "")).upper()
+    if mode not in ("PATROL", "HOLD"):
+        return jsonify({"status": "error", "error": "mode must be PATROL or HOLD"}), 400
+    reply = device.send_command(f"MODE {mode}")
+    if reply is None or not reply["ok"]:
+        return jsonify({"status": "error", "error": "no reply from device"}), 504
+    return jsonify({"status": "success", "mode": mode})
+
+@app.route('/api/frame', methods=['POST'])
+@app.route('/api/devices/<device_id>/frame', methods=['POST'])
+def request_frame(device_id=None):
+    """Ask the device for a single temperature frame"""
+    reply = find_device(device_id).send_command("FRAME")
+    if reply is None or not reply["ok"]:
+        return jsonify({"status": "error", "error": "no reply from device"}), 504
     return jsonify({"status": "success"})
 
 @app.route('/api/test', methods=['POST'])
-def test_system():
+@app.route('/api/devices/<device_id>/test', methods=['POST'])
+def test_system(device_id=None):
     """Simulate a fire detection for testing the web interface"""
     # This is just for testing when hardware isn't connected
-    fire_data["state"] = "fire-alert"
-    fire_data["max_temp"] = 65.75
-    fire_data["max_temp_position"] = [7, 14]
-    fire_data["detection_time"] = time.strftime("%H:%M:%S")
-    fire_data["distance"] = 125.5
+    device = find_device(device_id)
     
     # Simulate a temperature matrix
     matrix = []
@@ -261,19 +1903,199 @@ def test_system():
                 row.append(25 + (i+j)%10)  # Ambient temp variation
         matrix.append(row)
     
-    fire_data["temperature_matrix"] = matrix
+    device.state.update(state="fire-alert", max_temp=65.75, max_temp_position=[7, 14],
+                        detection_time=time.strftime("%H:%M:%S"), distance=125.5,
+                        temperature_matrix=matrix, hotspot=analyze_matrix(matrix))
     
     return jsonify({"status": "success"})
 
+@app.route('/api/profile', methods=['GET'])
+@app.route('/api/devices/<device_id>/profile', methods=['GET'])
+def get_profile(device_id=None):
+    """Return the last profiler table (microseconds per stage)"""
+    return jsonify(find_device(device_id).state.current["profile"])
+
+@app.route('/api/profile', methods=['POST'])
+@app.route('/api/devices/<device_id>/profile', methods=['POST'])
+def profile_command(device_id=None):
+    """Ask the device to dump ({"action": "dump"}) or clear ({"action": "reset"}) its profiler table"""
+    action = str((request.get_json(silent=True) or {}).get("action", "dump")).lower()
+    command = "PROF RESET" if action == "reset" else "PROF"
+    reply = find_device(device_id).send_command(command)
+    if reply is None:
+        return jsonify({"status": "error", "error": "no reply from device"}), 504
+    if not reply["ok"]:
+        return jsonify({"status": "error", "error": "profiler not built in (make PROFILE=1)"}), 400
+    return jsonify({"status": "success"})
+
+@app.route('/api/frames')
+@app.route('/api/devices/<device_id>/frames')
+def get_frames(device_id=None):
+    """Stored frames between ?start= and ?end= (epoch seconds, default the
+    last hour), at most ?limit= of them spread evenly over the range"""
+    frames = find_device(device_id).frames
+    end = request.args.get("end", type=float) or time.time()
+    start = request.args.get("start", type=float) or end - 3600
+    limit = min(request.args.get("limit", FRAME_QUERY_LIMIT, type=int), FRAME_QUERY_MAX)
+    if frames is None:
+        return jsonify({"start": start, "end": end, "count": 0, "frames": []})
+    return jsonify({
+        "start": start,
+        "end": end,
+        "count": frames.count(start, end),
+        "frames": frames.range(start, end, max(limit, 1)),
+        "store": frames.stats(),
+    })
+
+@app.route('/api/history')
+@app.route('/api/devices/<device_id>/history')
+def get_history(device_id=None):
+    """Rollups between ?start= and ?end= (epoch seconds, default the last
+    day), at the finest resolution that fits the range unless
+    ?resolution=minute|hour|day is given"""
+    end = request.args.get("end", type=float) or time.time()
+    start = request.args.get("start", type=float) or end - 86400
+    result = find_device(device_id).history.query(start, end, request.args.get("resolution"))
+    result.update(start=start, end=end)
+    return jsonify(result)
+
+def find_panorama(device_id):
+    """The unit's panorama, or an error response when there is none"""
+    device = find_device(device_id)
+    if device.panorama is None:
+        response = jsonify({"status": "error", "error": "no panorama, start the server with FIREGUARD_PANORAMA=1"})
+        response.status_code = 404
+        return device, response
+    return device, None
+
+def panorama_range():
+    """?start= and ?end= (azimuth in degrees) of a tile, None for the covered arc"""
+    start = request.args.get("start", type=float)
+    end = request.args.get("end", type=float)
+    if start is None or end is None:
+        return None, None
+    return start, end if end > start else end + 360
+
+@app.route('/api/panorama')
+@app.route('/api/devices/<device_id>/panorama')
+def get_panorama(device_id=None):
+    """Where the panorama stands: frames stitched, the covered arc (start
+    azimuth and width in degrees), its size in cells, its temperature range
+    and the age of each column in seconds, for ?start=&end= or the covered
+    arc. The picture itself is /api/panorama.png."""
+    device, error = find_panorama(device_id)
+    if error is not None:
+        return error
+    values, ages, start = device.panorama.image(*panorama_range())
+    known = values[~panorama.numpy.isnan(values)]
+    result = device.panorama.stats()
+    result.update(
+        image_start=start,
+        rows=values.shape[0],
+        cols=values.shape[1],
+        min=round(float(known.min()), 2) if known.size else None,
+        max=round(float(known.max()), 2) if known.size else None,
+        ages=ages,
+    )
+    return jsonify(result)
+
+@app.route('/api/panorama.png')
+@app.route('/api/devices/<device_id>/panorama.png')
+def get_panorama_png(device_id=None):
+    """The covered arc, or the tile from azimuth ?start= to ?end= degrees,
+    one pixel per cell and coloured like the heat map from its own coldest
+    to hottest cell, or from ?min= to ?max= degrees so tiles match. Grey
+    where no frame reached. 304 with the ETag of an unchanged panorama."""
+    device, error = find_panorama(device_id)
+    if error is not None:
+        return error
+    etag = f'W/"{ETAG_PREFIX}-{device.panorama.version}-{request.query_string.decode("ascii", "replace")}"'
+    if not_modified(etag):
+        response = app.response_class(status=304)
+    else:
+        values, _, start = device.panorama.image(*panorama_range())
+        if not values.size:
+            return jsonify({"status": "error", "error": "nothing stitched in that range yet"}), 404
+        body = device.panorama.png(values, request.args.get("min", type=float), request.args.get("max", type=float))
+        response = app.response_class(body, mimetype="image/png")
+        response.headers["X-Panorama-Start"] = str(start)
+    response.headers["ETag"] = etag
+    response.headers["Cache-Control"] = "no-cache"
+    return response
+
+@app.route('/api/pipeline')
+@app.route('/api/devices/<device_id>/pipeline')
+def get_pipeline(device_id=None):
+    """Queue depth, high-water mark, waits and losses per consumer stage"""
+    return jsonify(find_device(device_id).pipeline_stats())
+
+@app.route('/api/latency', methods=['GET'])
+@app.route('/api/devices/<device_id>/latency', methods=['GET'])
+def get_latency(device_id=None):
+    """Per stage latency of the recent frames, percentiles and the state of
+    the unit's clock sync (see latency.py)"""
+    return jsonify(find_device(device_id).tracer.report())
+
+@app.route('/api/latency', methods=['POST'])
+@app.route('/api/devices/<device_id>/latency', methods=['POST'])
+def report_render(device_id=None):
+    """Render times from a page: {"frames": [[version, ms after publish], ...]}"""
+    device = find_device(device_id)
+    frames = (request.get_json(silent=True) or {}).get("frames")
+    if not isinstance(frames, list):
+        return jsonify({"status": "error", "error": "frames must be a list of [version, ms]"}), 400
+    for frame in frames[:latency.TRACE_HISTORY]:
+        try:
+            version, render_ms = int(frame[0]), float(frame[1])
+        except (TypeError, ValueError, IndexError):
+            continue
+        if 0 <= render_ms < 60000:
+            device.frame_rendered(version, render_ms / 1000)
+    return jsonify({"status": "success"})
+
+@app.route('/api/clock')
+def get_clock():
+    """The server's wall clock, for pages to line theirs up with it"""
+    return jsonify({"time": time.time()})
+
+@app.route('/api/capture', methods=['GET'])
+@app.route('/api/devices/<device_id>/capture', methods=['GET'])
+def get_capture(device_id=None):
+    """Whether the unit's serial stream is being recorded, and where"""
+    capture = find_device(device_id).capture
+    return jsonify({"recording": capture is not None,
+                    "file": capture.path if capture else None,
+                    "bytes": capture.bytes if capture else 0})
+
+@app.route('/api/capture', methods=['POST'])
+@app.route('/api/devices/<device_id>/capture', methods=['POST'])
+def capture_command(device_id=None):
+    """Start ({"action": "start"}) or stop ({"action": "stop"}) recording the
+    unit's serial stream to CAPTURE_DIR"""
+    device = find_device(device_id)
+    action = str((request.get_json(silent=True) or {}).get("action", "start")).lower()
+    if action == "stop":
+        capture = device.stop_capture()
+        return jsonify({"status": "success", "file": capture.path if capture else None,
+                        "bytes": capture.bytes if capture else 0})
+    try:
+        path = device.start_capture()
+    except OSError as e:
+        return jsonify({"status": "error", "error": str(e)}), 500
+    return jsonify({"status": "success", "file": path})
+
 @app.route('/api/connection_status')
-def get_connection_status():
+@app.route('/api/devices/<device_id>/connection_status')
+def get_connection_status(device_id=None):
     """Check and return the status of the serial connection"""
+    device = find_device(device_id)
+    snapshot = device.state.current
     status_data = {
         "connected": False,
         "port": None,
         "available_ports": [],
         "last_message_time": None,
-        "message_count": fire_data.get("signal_strength", 0)
+        "message_count": snapshot["signal_strength"]
     }
     
     # List all available ports
@@ -286,50 +2108,60 @@ def get_connection_status():
         })
     
     # Check current connection
-    if serial_connection and serial_connection.is_open:
+    connection = device.connection
+    if connection and connection.is_open:
         status_data["connected"] = True
-        status_data["port"] = serial_connection.port
-        if "last_update" in fire_data:
-            status_data["last_message_time"] = fire_data["last_update"]
+        status_data["port"] = connection.port
+        status_data["last_message_time"] = snapshot["last_update"]
     
     return jsonify(status_data)
 
 @app.route('/api/reconnect', methods=['POST'])
-def reconnect_serial():
+@app.route('/api/devices/<device_id>/reconnect', methods=['POST'])
+def reconnect_serial(device_id=None):
     """Force reconnection to the serial port"""
-    global serial_connection
-    
-    # Close existing connection if open
-    if serial_connection and serial_connection.is_open:
-        try:
-            serial_connection.close()
-        except Exception as e:
-            print(f"Error closing existing connection: {e}")
-    
-    # Try to reconnect
-    success = init_serial()
-    
-    # Start the serial reading thread if not already running
-    if success:
-        if not any(thread.name == "serial_thread" for thread in threading.enumerate()):
-            serial_thread = threading.Thread(target=read_serial_data, daemon=True, name="serial_thread")
-            serial_thread.start()
+    device = find_device(device_id)
+    success = device.reconnect()
     
     return jsonify({
         "success": success,
-        "connection_status": fire_data["connection_status"]
+        "connection_status": device.state.current["connection_status"]
     })
 
+def start_devices():
+    """Start supervising every unit; each one keeps trying to connect"""
+    for device in devices.all():
+        device.start()
+    print(f"Supervising {len(devices.all())} device(s): "
+          + ", ".join(f"{device.id} on {device.port}" for device in devices.all()))
+    print("Units that are not connected keep being retried. Use the test button to simulate fire detection.")
+
+def serve():
+    """Serve the API on HTTP_PORT with HTTP_SERVER until interrupted"""
+    global stream_limit
+    if HTTP_SERVER != 'dev':
+        try:
+            import waitress
+        except ImportError:
+            print("waitress is not installed (pip install -r requirements.txt), "
+                  "falling back to the development server")
+        else:
+            stream_limit = max(HTTP_THREADS - STREAM_RESERVED_THREADS, 1)
+            print(f"Starting web server on http://localhost:{HTTP_PORT} "
+                  f"(waitress, {HTTP_THREADS} threads, up to {stream_limit} streams)")
+            waitress.serve(app, host='0.0.0.0', port=HTTP_PORT, threads=HTTP_THREADS,
+                           connection_limit=HTTP_CONNECTION_LIMIT, ident="FireGuard")
+            return
+    print(f"Starting web server on http://localhost:{HTTP_PORT} (development server)")
+    app.run(host='0.0.0.0', port=HTTP_PORT, debug=True, use_reloader=False, threaded=True)
+
 if __name__ == '__main__':
-    # Start the serial reading thread
-    serial_connected = init_serial()
-    if serial_connected:
-        serial_thread = threading.Thread(target=read_serial_data, daemon=True, name="serial_thread")
-        serial_thread.start()
-        print(f"Serial thread started. Connected to port: {serial_connection.port}")
-    else:
-        print("Running in offline mode. Use the test button to simulate fire detection.")
+    start_devices()
     
-    # Start the Flask web server
-    print("Starting web server on http://localhost:3000")
-    app.run(host='0.0.0.0', port=3000, debug=True, use_reloader=False) 
\ No newline at end of file
+    # Write out recordings, frames and rollups on Ctrl-C or SIGTERM
+    signal.signal(signal.SIGTERM, lambda signum, frame: sys.exit(0))
+    try:
+        serve()
+    finally:
+        for device in devices.all():
+            device.stop()
@@ -0,0 +1,135 @@
+"""Benchmark of /api/status for many dashboards polling one unit.
+
+Runs the Flask app in process (test client, no serial port) with a number
+of dashboards polling once a second while the unit's state moves the way a
+real one does, and reports the bytes and server time per poll of each way
+of polling:
+
+    python status_bench.py                          # 100 dashboards, 60 s per scenario
+    python status_bench.py --dashboards 500 --seconds 30
+
+Scenarios: idle (the state never changes), patrol (only last_update
+moves, once a second, as on a talking unit with nothing to report) and
+alert (a new matrix with a few changed pixels every second). Clients:
+
+    uncached    a full GET encoded per request and not compressed, as before
+    full        a full GET, shared encoding, gzipped
+    etag        a full GET with If-None-Match, 304 while nothing changed
+    delta       ?since=<version>&delta=1 like the page, applied to its copy
+
+It prints one line per scenario and client
+
+    STATUS scenario=<idle|patrol|alert> client=<...> dashboards=<n> polls=<n>
+           bytes_per_poll=<n> server_us_per_poll=<n> cache_hit_pct=<n>
+
+bytes_per_poll counts the body as sent; server time includes the test
+client's own share of each request. The delta clients check that
+their copy ends up equal to the server's state.
+"""
+import argparse
+import gzip
+import json
+import sys
+import time
+
+import server
+
+ROWS, COLS = 15, 16
+
+def make_matrix(tick):
+    """A room with a fire whose pixels flicker a little every tick"""
+    matrix = [[22 + (i + j) % 3 for j in range(COLS)] for i in range(ROWS)]
+    for i, j in ((6, 7), (6, 8), (7, 7), (7, 8), (8, 7)):
+        matrix[i][j] = 60 + (tick + i + j) % 4
+    return matrix
+
+def apply_delta(state, delta):
+    data = dict(state, **delta["changes"])
+    data["version"] = delta["version"]
+    if "cells" in delta:
+        matrix = [row[:] for row in data["temperature_matrix"]]
+        for i, j, value in delta["cells"]:
+            matrix[i][j] = value
+        data["temperature_matrix"] = matrix
+    return data
+
+class Dashboard:
+    def __init__(self, client, mode):
+        self.client = client
+        self.mode = mode
+        self.etag = None
+        self.state = None
+        self.bytes = 0
+
+    def poll(self):
+        headers = {} if self.mode == "uncached" else {"Accept-Encoding": "gzip"}
+        url = "/api/status"
+        if self.mode == "etag" and self.etag:
+            headers["If-None-Match"] = self.etag
+        if self.mode == "delta" and self.state:
+            url += f"?since={self.state['version']}&delta=1"
+        response = self.client.get(url, headers=headers)
+        self.bytes += len(response.get_data())
+        if response.status_code == 200:
+            self.etag = response.headers.get("ETag")
+            if self.mode == "delta":
+                # The test client hands the body over as sent
+                body = response.get_data()
+                if response.headers.get("Content-Encoding") == "gzip":
+                    body = gzip.decompress(body)
+                data = json.loads(body)
+                self.state = apply_delta(self.state, data) if "since" in data else data
+
+def step(device, scenario, tick):
+    if scenario == "patrol":
+        device.state.update(last_update=time.time())
+    elif scenario == "alert":
+        matrix = make_matrix(tick)
+        device.state.update(state="fire-alert", temperature_matrix=matrix,
+                            max_temp=float(max(max(row) for row in matrix)), hotspot=server.analyze_matrix(matrix))
+
+def run(device, scenario, mode, dashboards, seconds):
+    device.state = server.StateStore(server.INITIAL_STATE, device.broadcaster)
+    device.responses = server.ResponseCache(0 if mode == "uncached" else server.RESPONSE_CACHE_SIZE)
+    step(device, "alert", 0)
+    client = server.app.test_client()
+    boards = [Dashboard(client, mode) for _ in range(dashboards)]
+    # Every dashboard has the state once before the timed polls
+    for board in boards:
+        board.poll()
+        board.bytes = 0
+
+    cpu = 0.0
+    for tick in range(1, seconds + 1):
+        step(device, scenario, tick)
+        started = time.process_time()
+        for board in boards:
+            board.poll()
+        cpu += time.process_time() - started
+
+    if mode == "delta":
+        current = json.loads(json.dumps(device.state.current))
+        if any(board.state != current for board in boards):
+            print(f"status_bench: delta copies differ from the state ({scenario})", file=sys.stderr)
+    polls = dashboards * seconds
+    cache = device.responses
+    lookups = cache.hits + cache.misses
+    print(f"STATUS scenario={scenario} client={mode} dashboards={dashboards} polls={polls} "
+          f"bytes_per_poll={sum(board.bytes for board in boards) / polls:.0f} "
+          f"server_us_per_poll={cpu / polls * 1e6:.0f} "
+          f"cache_hit_pct={100 * cache.hits / lookups if lookups else 0:.1f}")
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard status API benchmark")
+    parser.add_argument("--dashboards", type=int, default=100, help="dashboards polling once a second")
+    parser.add_argument("--seconds", type=int, default=60, help="seconds of polling per scenario")
+    args = parser.parse_args()
+
+    device = server.devices.default()
+    for scenario in ("idle", "patrol", "alert"):
+        for mode in ("uncached", "full", "etag", "delta"):
+            run(device, scenario, mode, args.dashboards, args.seconds)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
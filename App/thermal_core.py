@@ -0,0 +1,135 @@
+"""ctypes binding of the thermal core (Firmware/src/thermal.c) with its SIMD
+host backend (Firmware/host/thermal_host.c).
+
+Build the library with `make -C Firmware/host libthermal.so`, or point
+FIREGUARD_THERMAL_LIB at a copy elsewhere. Without it `lib` is None and
+available() is False; the server then just skips the host-side analysis.
+
+Frames are lists of rows (or flat sequences) in centidegrees. Anything
+with the buffer protocol holding int16 values, e.g. array('h'), is passed
+without converting it pixel by pixel.
+"""
+import ctypes
+import os
+
+INT16_MIN = -32768
+
+class Blob(ctypes.Structure):
+    _fields_ = [("count", ctypes.c_uint16),
+                ("min_row", ctypes.c_uint8),
+                ("max_row", ctypes.c_uint8),
+                ("min_col", ctypes.c_uint8),
+                ("max_col", ctypes.c_uint8),
+                ("sum_row", ctypes.c_uint32),
+                ("sum_col", ctypes.c_uint32)]
+
+class Summary(ctypes.Structure):
+    _fields_ = [("max", ctypes.c_int16),
+                ("max_index", ctypes.c_uint16),
+                ("clamped", ctypes.c_uint16),
+                ("blob", Blob)]
+
+def load_library():
+    default = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "..", "Firmware", "host", "libthermal.so")
+    path = os.environ.get("FIREGUARD_THERMAL_LIB", default)
+    try:
+        library = ctypes.CDLL(path)
+    except OSError:
+        return None
+
+    i16, u16, u8, u32 = ctypes.c_int16, ctypes.c_uint16, ctypes.c_uint8, ctypes.c_uint32
+    p_i16, p_u8 = ctypes.POINTER(i16), ctypes.POINTER(u8)
+    signatures = {
+        "thermal_host_backend": (ctypes.c_char_p, []),
+        "thermal_host_use": (ctypes.c_int, [ctypes.c_char_p]),
+        "thermal_host_mask_bad": (None, [p_i16, p_u8, u8, u8]),
+        "thermal_host_filter": (None, [p_i16, p_i16, u8, u8]),
+        "thermal_host_delta_encode": (u16, [p_i16, p_i16, u16, p_u8]),
+        "thermal_host_delta_decode": (u16, [p_i16, u16, p_u8]),
+        "thermal_host_analyze": (u32, [p_i16, u32, u8, u8, i16, i16, i16, i16,
+                                       ctypes.POINTER(Summary)]),
+    }
+    for name, (restype, argtypes) in signatures.items():
+        function = getattr(library, name)
+        function.restype = restype
+        function.argtypes = argtypes
+    return library
+
+lib = load_library()
+
+def available():
+    return lib is not None
+
+def backend():
+    """"avx2", "sse2" or "scalar", None without the library"""
+    return lib.thermal_host_backend().decode() if lib else None
+
+def use(name):
+    """Force a backend, returns False if the CPU does not have it"""
+    return lib.thermal_host_use(name.encode()) == 0
+
+def pixels(frame):
+    """A ctypes int16 array with the pixels of a frame (or frames) in row order"""
+    try:
+        view = memoryview(frame)
+        if view.itemsize == 2:
+            return (ctypes.c_int16 * (view.nbytes // 2)).from_buffer_copy(view)
+    except TypeError:
+        pass
+    flat = [v for row in frame for v in row] if frame and isinstance(frame[0], (list, tuple)) else list(frame)
+    return (ctypes.c_int16 * len(flat))(*flat)
+
+def mask_bad(frame, mask, rows, cols):
+    """Replace pixels where mask is true with the mean of their good neighbours"""
+    data = pixels(frame)
+    flags = (ctypes.c_uint8 * (rows * cols))(*[1 if m else 0 for m in mask])
+    lib.thermal_host_mask_bad(data, flags, rows, cols)
+    return list(data)
+
+def smooth(frame, rows, cols):
+    """1-2-1 filter in both directions"""
+    data = pixels(frame)
+    out = (ctypes.c_int16 * (rows * cols))()
+    lib.thermal_host_filter(data, out, rows, cols)
+    return list(out)
+
+def delta_encode(frame, previous):
+    data, base = pixels(frame), pixels(previous)
+    out = (ctypes.c_uint8 * (3 * len(data)))()
+    length = lib.thermal_host_delta_encode(data, base, len(data), out)
+    return bytes(out[:length])
+
+def delta_decode(encoded, previous):
+    data = pixels(previous)
+    raw = (ctypes.c_uint8 * len(encoded)).from_buffer_copy(encoded)
+    lib.thermal_host_delta_decode(data, len(data), raw)
+    return list(data)
+
+def analyze(frames, rows, cols, minimum=-4000, maximum=30000, limit=10000, threshold=5000):
+    """Validate, find the max below limit and the blob at or above threshold
+    for frames stored back to back (one frame or many, e.g. one per unit).
+    Returns one dict per frame."""
+    data = pixels(frames)
+    count = len(data) // (rows * cols)
+    out = (Summary * count)()
+    lib.thermal_host_analyze(data, count, rows, cols, minimum, maximum, limit, threshold, out)
+
+    results = []
+    for s in out:
+        blob = s.blob
+        result = {
+            "max": None if s.max == INT16_MIN else s.max,
+            "max_position": [s.max_index // cols, s.max_index % cols],
+            "clamped": s.clamped,
+            "blob": None,
+        }
+        if blob.count:
+            result["blob"] = {
+                "count": blob.count,
+                "rows": [blob.min_row, blob.max_row],
+                "cols": [blob.min_col, blob.max_col],
+                "centroid": [round(blob.sum_row / blob.count, 2), round(blob.sum_col / blob.count, 2)],
+            }
+        results.append(result)
+    return results
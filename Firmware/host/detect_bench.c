@@ -0,0 +1,391 @@
+/*
+  detect_bench.c - Detection latency benchmark: runs the firmware on the
+  simulator against each synthetic scene (scene.c) and measures how fast
+  and how reliably the patrol finds the fire
+
+  Usage: detect_bench [--scene NAME]... [--seconds N] [--seed N] [--direct]
+         detect_bench --list
+         detect_bench --dump NAME FILE [--pan DEG] [--seconds N]
+
+  For every scene it prints one line
+
+    DETECT name=<scene> detected=<0|1> ttd_ms=<n> ttl_ms=<n> fp=<n> frames=<n>
+           missed=<n> fp_per_1k=<n> fps_x100=<n> wall_fps=<n>
+
+  ttd_ms  fire onset to "FIRE DETECTED!" pointing at the fire (-1 if never)
+  ttl_ms  fire onset to the first "Alert!" reading still on the fire,
+          i.e. the motor stopped and locked on (-1 if never)
+  fp      detections pointing away from any burning fire
+  frames  thermal frames processed (status and alert lines)
+  missed  frame reads that failed or timed out
+  fps_x100  frames per virtual second, times 100
+  wall_fps  frames per second of host time, i.e. benchmark throughput
+
+  Compare two runs with Firmware/tools/detect_report.py.
+
+  --direct skips the patrol: the sensor is turned to each check position
+  of the sweep in turn and its frames go straight through the firmware's
+  frame processing (mlx90640_read_center_region) and fire test, without
+  stepping the motor, the alert mode or the serial output. There is no
+  lock on, so ttl_ms is -1. It measures the detection path alone, at
+  thousands of frames per second of host time.
+
+  --dump renders the scene at a fixed pan angle at 4 frames per second
+  into a file that fireguard_sim --frames can play back.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "hal.h"
+#include "I2C.h"
+#include "scene.h"
+#include "vhcsr04.h"
+#include "vmlx90640.h"
+#include "vstepper.h"
+
+#define SEED_DEFAULT 1
+#define DUMP_FPS 4
+
+// Degrees either side of the fire that still count as pointing at it:
+// one pixel column
+#define AIM_TOLERANCE (SCENE_FOV_H / VMLX90640_COLS)
+
+// Center region the firmware reports positions in (see I2C.c)
+#define CENTER_START_COL 8
+
+// The firmware's main(), renamed by the Makefile
+int firmware_main(void);
+
+struct result {
+    int detected;
+    long ttd_ms;
+    long ttl_ms;
+    unsigned fp;
+    unsigned frames;
+    unsigned missed;
+    double virtual_s;
+    double wall_s;
+};
+
+static const struct scene *scene;
+static uint32_t rng;
+static uint64_t stop_at;
+static int result_fd;
+static struct result result;
+static struct timespec started;
+static bool locked = false;
+
+// Pan in steps the --direct run points the sensor at
+static bool direct = false;
+static int32_t direct_pan = 0;
+
+static char line[160];
+static size_t line_len = 0;
+
+static double seconds(void) {
+    return (double)hal_cycles / F_CPU;
+}
+
+static double wall_seconds(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+}
+
+static float pan_degrees(void) {
+    return (direct ? direct_pan : vstepper_position()) * SCENE_DEG_PER_STEP;
+}
+
+static void render(int16_t *frame, uint64_t now) {
+    scene_render(scene, pan_degrees(), (float)now / F_CPU, &rng, frame);
+}
+
+// Whether a center region column points at a fire
+static bool column_on_fire(int center_col) {
+    float azimuth = scene_column_azimuth(pan_degrees(), (float)(center_col + CENTER_START_COL));
+    return scene_fire_at(scene, azimuth, (float)seconds(), AIM_TOLERANCE);
+}
+
+// Whether the "[row][col]" position in a firmware line points at a fire
+static bool aimed_at_fire(const char *text) {
+    const char *at = strstr(text, "][");
+    if (at == NULL) {
+        return false;
+    }
+    return column_on_fire(atoi(at + 2));
+}
+
+static long since_onset_ms(void) {
+    return (long)((seconds() - scene_first_fire(scene)) * 1000.0);
+}
+
+static void handle_line(const char *text) {
+    if (strncmp(text, "Pos: ", 5) == 0) {
+        result.frames++;
+    } else if (strncmp(text, "Alert! Temp", 11) == 0) {
+        result.frames++;
+        if (!locked && aimed_at_fire(text)) {
+            locked = true;
+            if (result.ttl_ms < 0) {
+                result.ttl_ms = since_onset_ms();
+            }
+        }
+    } else if (strncmp(text, "FIRE DETECTED!", 14) == 0) {
+        if (aimed_at_fire(text)) {
+            if (!result.detected) {
+                result.detected = 1;
+                result.ttd_ms = since_onset_ms();
+            }
+        } else {
+            result.fp++;
+        }
+    } else if (strncmp(text, "Fire alert mode ended", 21) == 0) {
+        locked = false;
+    } else if (strncmp(text, "Error reading thermal data", 26) == 0) {
+        result.missed++;
+    }
+}
+
+static void collect(uint8_t byte) {
+    if (byte == '\n' || byte == '\r') {
+        if (line_len > 0) {
+            line[line_len] = '\0';
+            handle_line(line);
+            line_len = 0;
+        }
+    } else if (line_len < sizeof(line) - 1) {
+        line[line_len++] = (char)byte;
+    }
+}
+
+static uint64_t limit_next_event(void) {
+    return stop_at;
+}
+
+// End of the run: hand the result to the parent and leave
+static void limit_event(uint64_t now) {
+    (void)now;
+    result.virtual_s = seconds();
+    result.wall_s = wall_seconds();
+    if (write(result_fd, &result, sizeof(result)) != sizeof(result)) {
+        _exit(1);
+    }
+    _exit(0);
+}
+
+static const struct hal_device limit = {
+    "limit", NULL, NULL, limit_next_event, limit_event
+};
+
+// The --direct run: the patrol's check positions and timing, each frame
+// through the firmware's processing and fire test, until limit_event()
+static int run_direct(void) {
+    hal_reset();
+    config_defaults();
+    if (mlx90640_init() != 0) {
+        return 1;
+    }
+
+    // The patrol sets off counter-clockwise, over -scan_range_steps..0
+    int32_t step = 0;
+    int32_t direction = -config.steps_per_check;
+    uint64_t between = (uint64_t)config.steps_per_check * config.motor_step_delay * (F_CPU / 1000);
+
+    for (;;) {
+        hal_delay_cycles(between);
+        if (step + direction < -config.scan_range_steps || step + direction > 0) {
+            direction = -direction;
+        }
+        step += direction;
+        direct_pan = step;
+
+        if (mlx90640_read_center_region() != 0) {
+            result.missed++;
+            continue;
+        }
+        result.frames++;
+
+        // The patrol's test (FireGuard.c)
+        if (max_temp > config.fire_threshold &&
+            max_col_pos >= config.fire_col_min && max_col_pos <= config.fire_col_max) {
+            if (!column_on_fire(max_col_pos)) {
+                result.fp++;
+            } else if (!result.detected) {
+                result.detected = 1;
+                result.ttd_ms = since_onset_ms();
+            }
+        }
+    }
+}
+
+// Start one scene in a child process, so every run starts from power-on.
+// Returns the read end of the pipe its result arrives on.
+static int start_scene(const struct scene *s, double duration, uint32_t seed, pid_t *child) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        result_fd = fds[1];
+        scene = s;
+        rng = seed;
+        stop_at = (uint64_t)(duration * F_CPU);
+        memset(&result, 0, sizeof(result));
+        result.ttd_ms = -1;
+        result.ttl_ms = -1;
+
+        hal_eeprom_open(NULL);
+        vmlx90640_init();
+        vmlx90640_set_source(render);
+        hal_add_device(&limit);
+        clock_gettime(CLOCK_MONOTONIC, &started);
+        if (direct) {
+            run_direct();
+            _exit(1);
+        }
+
+        vhcsr04_init();
+        vstepper_init();
+        hal_set_uart_tx(collect);
+        hal_run(firmware_main);
+        _exit(1);
+    }
+
+    close(fds[1]);
+    *child = pid;
+    return fds[0];
+}
+
+static int finish_scene(int fd, pid_t child, struct result *out) {
+    ssize_t n = read(fd, out, sizeof(*out));
+    close(fd);
+    waitpid(child, NULL, 0);
+    return n == sizeof(*out) ? 0 : -1;
+}
+
+static void report(const struct scene *s, const struct result *r) {
+    unsigned fps_x100 = r->virtual_s > 0 ? (unsigned)(r->frames * 100.0 / r->virtual_s) : 0;
+    unsigned wall_fps = r->wall_s > 0 ? (unsigned)(r->frames / r->wall_s) : 0;
+    unsigned fp_per_1k = r->frames ? r->fp * 1000u / r->frames : 0;
+
+    printf("DETECT name=%s detected=%d ttd_ms=%ld ttl_ms=%ld fp=%u frames=%u missed=%u "
+           "fp_per_1k=%u fps_x100=%u wall_fps=%u\n",
+           s->name, r->detected, r->ttd_ms, r->ttl_ms, r->fp, r->frames, r->missed,
+           fp_per_1k, fps_x100, wall_fps);
+}
+
+static int dump(const struct scene *s, const char *path, float pan, double duration) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return 1;
+    }
+
+    int16_t frame[VMLX90640_PIXELS];
+    uint32_t seed = SEED_DEFAULT;
+    int count = (int)(duration * DUMP_FPS);
+
+    for (int i = 0; i < count; i++) {
+        scene_render(s, pan, (float)i / DUMP_FPS, &seed, frame);
+        for (int p = 0; p < VMLX90640_PIXELS; p++) {
+            uint8_t le[2] = { (uint8_t)frame[p], (uint8_t)((uint16_t)frame[p] >> 8) };
+            fwrite(le, 1, 2, file);
+        }
+    }
+    fclose(file);
+    fprintf(stderr, "%s: %d frames of %s at pan %.1f\n", path, count, s->name, pan);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--scene NAME]... [--seconds N] [--seed N] [--direct]\n"
+            "       %s --list\n"
+            "       %s --dump NAME FILE [--pan DEG] [--seconds N]\n", name, name, name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const struct scene *selected[32];
+    uint8_t selected_count = 0;
+    double duration = 0;
+    uint32_t seed = SEED_DEFAULT;
+    const char *dump_path = NULL;
+    float pan = -90.0f;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--list") == 0) {
+            for (uint8_t s = 0; s < scene_count; s++) {
+                printf("%-20s %s\n", scenes[s].name, scenes[s].description);
+            }
+            return 0;
+        } else if ((strcmp(argv[i], "--scene") == 0 || strcmp(argv[i], "--dump") == 0) && i + 1 < argc) {
+            if (strcmp(argv[i], "--dump") == 0) {
+                if (i + 2 >= argc) {
+                    usage(argv[0]);
+                }
+                dump_path = argv[i + 2];
+            }
+            const struct scene *s = scene_find(argv[++i]);
+            if (s == NULL) {
+                fprintf(stderr, "unknown scene %s, see --list\n", argv[i]);
+                return 2;
+            }
+            if (selected_count < sizeof(selected) / sizeof(selected[0])) {
+                selected[selected_count++] = s;
+            }
+            if (dump_path) {
+                i++;
+            }
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            duration = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--pan") == 0 && i + 1 < argc) {
+            pan = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--direct") == 0) {
+            direct = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if (dump_path) {
+        return dump(selected[0], dump_path, pan, duration > 0 ? duration : selected[0]->duration);
+    }
+
+    if (selected_count == 0) {
+        for (uint8_t s = 0; s < scene_count; s++) {
+            selected[selected_count++] = &scenes[s];
+        }
+    }
+
+    // One at a time, so wall_fps is not shared with the other runs
+    printf("DETECT BEGIN seed=%u%s\n", (unsigned)seed, direct ? " direct=1" : "");
+    fflush(stdout);
+    int failed = 0;
+    for (uint8_t i = 0; i < selected_count; i++) {
+        struct result r;
+        pid_t child;
+        double length = duration > 0 ? duration : selected[i]->duration;
+        int fd = start_scene(selected[i], length, seed, &child);
+        if (fd < 0 || finish_scene(fd, child, &r) != 0) {
+            fprintf(stderr, "%s: run failed\n", selected[i]->name);
+            failed = 1;
+            continue;
+        }
+        report(selected[i], &r);
+        fflush(stdout);
+    }
+    printf("DETECT END\n");
+    return failed;
+}
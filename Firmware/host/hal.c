@@ -0,0 +1,661 @@
+/*
+  hal.c - ATmega328P simulation core: register file, virtual clock,
+  Timer0/Timer1, interrupt delivery, pin levels, USART0 and EEPROM
+
+  Virtual time advances only inside hal_delay_cycles() (called by
+  _delay_us/_delay_ms) and while the UART shifts out a character. Code in
+  between takes no time, so timings match the delays in the firmware, not
+  the instruction count. Whenever time moves the timers are updated, the
+  devices are stepped and pending interrupts are delivered.
+*/
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hal.h"
+
+// Register addresses used internally (see include/avr/io.h)
+#define REG_PINB   0x23
+#define REG_DDRB   0x24
+#define REG_PORTB  0x25
+#define REG_TIFR0  0x35
+#define REG_TIFR1  0x36
+#define REG_PCIFR  0x3B
+#define REG_TCCR0B 0x45
+#define REG_TCNT0  0x46
+#define REG_SREG   0x5F
+#define REG_PCICR  0x68
+#define REG_PCMSK2 0x6D
+#define REG_TIMSK0 0x6E
+#define REG_TIMSK1 0x6F
+#define REG_TCCR1B 0x81
+#define REG_UCSR0A 0xC0
+#define REG_UCSR0B 0xC1
+#define REG_UBRR0L 0xC4
+#define REG_UBRR0H 0xC5
+
+#define SREG_I     0x80
+#define UCSR0A_RXC 0x80
+#define UCSR0A_UDRE 0x20
+#define UCSR0B_RXCIE 0x80
+
+#define MAX_DEVICES 8
+#define EEPROM_SIZE 1024
+
+// How often the UART receiver is polled while nothing arrives
+#define UART_IDLE_POLL_CYCLES (F_CPU / 1000)
+
+volatile uint8_t hal_io[0x100];
+uint64_t hal_cycles = 0;
+
+// Interrupt handlers, defined by the firmware modules that are linked in
+void hal_vect_pcint2(void) __attribute__((weak));
+void hal_vect_timer1_ovf(void) __attribute__((weak));
+void hal_vect_timer0_ovf(void) __attribute__((weak));
+void hal_vect_usart_rx(void) __attribute__((weak));
+
+// A counter with its prescaler taken from the clock select bits
+struct hal_timer {
+    uint8_t tccrb;          // Control register B address
+    uint8_t tifr;           // Flag register address
+    uint32_t top;           // Last value before overflow
+    uint32_t count;
+    uint64_t residue;       // Cycles towards the next count
+};
+
+static struct hal_timer timer0 = { REG_TCCR0B, REG_TIFR0, 0xFF, 0, 0 };
+static struct hal_timer timer1 = { REG_TCCR1B, REG_TIFR1, 0xFFFF, 0, 0 };
+
+// TCNT1 is 16 bits wide, so it is handed out as a copy and a changed copy
+// means the firmware wrote it
+static volatile uint16_t tcnt1_copy;
+static uint16_t tcnt1_handed_out;
+
+static const struct hal_device *devices[MAX_DEVICES];
+static uint8_t device_count = 0;
+
+// Pins driven from outside the chip, and external pull-up resistors
+static uint8_t input_driven[3];
+static uint8_t input_level[3];
+static uint8_t pullups[3];
+
+// USART0 state
+static volatile uint8_t uart_rx_data;
+static volatile uint8_t uart_tx_data;
+static bool uart_tx_armed = false;
+static uint64_t uart_busy_until = 0;
+static uint64_t uart_next_poll = 0;
+static hal_uart_hook uart_tx_hook = NULL;
+static bool in_rx_isr = false;
+
+static bool in_isr = false;
+static bool in_advance = false;
+
+// Fast path of advance_to(): the registers as the devices last sampled
+// them. While the firmware changes no register, no device changes a pin
+// and nothing is due, moving time is only counting (a polling loop of 1us
+// delays, a tone's half cycles, the idle part of a bus transfer).
+static bool settled = false;
+static uint8_t sampled_io[0x100] __attribute__((aligned(8)));
+
+// Port pins some device has looked at; the others (the buzzer, the LCD
+// lines) can toggle without a pass
+static uint8_t watched_pins[3];
+
+// Real time pacing
+static bool realtime = false;
+static struct timespec realtime_origin;
+static uint64_t realtime_origin_cycles;
+
+// EEPROM contents and optional backing file
+static uint8_t eeprom[EEPROM_SIZE];
+static FILE *eeprom_file = NULL;
+
+static jmp_buf reset_point;
+
+// Firmware RAM, the Makefile moves the firmware's .data and .bss here
+extern uint8_t __start_fw_data[], __stop_fw_data[];
+extern uint8_t __start_fw_bss[], __stop_fw_bss[];
+static uint8_t *fw_data_image = NULL;
+
+// Clock select bits to prescaler, external clock sources count nothing
+static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+
+static uint32_t timer_prescaler(const struct hal_timer *timer) {
+    return prescalers[hal_io[timer->tccrb] & 0x07];
+}
+
+// Bring a timer up to the current time, setting TOV on overflow
+static void timer_update(struct hal_timer *timer, uint64_t elapsed) {
+    uint32_t prescaler = timer_prescaler(timer);
+    if (prescaler == 0) {
+        return;
+    }
+
+    uint64_t ticks = (timer->residue + elapsed) / prescaler;
+    timer->residue = (timer->residue + elapsed) % prescaler;
+
+    uint64_t count = timer->count + ticks;
+    if (count > timer->top) {
+        hal_io[timer->tifr] |= 0x01;
+        count %= (uint64_t)timer->top + 1;
+    }
+    timer->count = (uint32_t)count;
+}
+
+// Cycle at which the timer overflows next, or UINT64_MAX when stopped
+static uint64_t timer_next_overflow(const struct hal_timer *timer) {
+    uint32_t prescaler = timer_prescaler(timer);
+    if (prescaler == 0) {
+        return UINT64_MAX;
+    }
+    return hal_cycles + ((uint64_t)timer->top + 1 - timer->count) * prescaler - timer->residue;
+}
+
+// Interrupt sources in vector order, each with its flag and enable bit
+static bool irq_pending(uint8_t irq) {
+    switch (irq) {
+        case HAL_IRQ_PCINT2:
+            return (hal_io[REG_PCIFR] & 0x04) && (hal_io[REG_PCICR] & 0x04);
+        case HAL_IRQ_TIMER1_OVF:
+            return (hal_io[REG_TIFR1] & 0x01) && (hal_io[REG_TIMSK1] & 0x01);
+        case HAL_IRQ_TIMER0_OVF:
+            return (hal_io[REG_TIFR0] & 0x01) && (hal_io[REG_TIMSK0] & 0x01);
+        case HAL_IRQ_USART_RX:
+            return (hal_io[REG_UCSR0A] & UCSR0A_RXC) && (hal_io[REG_UCSR0B] & UCSR0B_RXCIE);
+        default:
+            return false;
+    }
+}
+
+// Run one interrupt handler the way the AVR does: flag cleared on entry
+// (except RXC, cleared by reading UDR0), I bit off until it returns
+static void irq_call(uint8_t irq) {
+    void (*vector)(void) = NULL;
+
+    switch (irq) {
+        case HAL_IRQ_PCINT2:
+            hal_io[REG_PCIFR] &= ~0x04;
+            vector = hal_vect_pcint2;
+            break;
+        case HAL_IRQ_TIMER1_OVF:
+            hal_io[REG_TIFR1] &= ~0x01;
+            vector = hal_vect_timer1_ovf;
+            break;
+        case HAL_IRQ_TIMER0_OVF:
+            hal_io[REG_TIFR0] &= ~0x01;
+            vector = hal_vect_timer0_ovf;
+            break;
+        case HAL_IRQ_USART_RX:
+            vector = hal_vect_usart_rx;
+            in_rx_isr = true;
+            break;
+    }
+
+    in_isr = true;
+    hal_io[REG_SREG] &= ~SREG_I;
+    if (vector) {
+        vector();
+    } else if (irq == HAL_IRQ_USART_RX) {
+        hal_io[REG_UCSR0A] &= ~UCSR0A_RXC;
+    }
+    hal_io[REG_SREG] |= SREG_I;
+    in_isr = false;
+    in_rx_isr = false;
+}
+
+static void dispatch_interrupts(void) {
+    while (!in_isr && (hal_io[REG_SREG] & SREG_I)) {
+        uint8_t irq;
+        for (irq = 0; irq < HAL_IRQ_COUNT; irq++) {
+            if (irq_pending(irq)) {
+                break;
+            }
+        }
+        if (irq == HAL_IRQ_COUNT) {
+            return;
+        }
+        irq_call(irq);
+    }
+}
+
+// Hand the last byte written to UDR0 to the receiver of the output
+static void uart_flush(void) {
+    if (!uart_tx_armed) {
+        return;
+    }
+    uart_tx_armed = false;
+
+    if (uart_tx_hook) {
+        uart_tx_hook(uart_tx_data);
+    }
+
+    // 10 bits per character at the programmed baud rate
+    uint32_t ubrr = ((uint32_t)hal_io[REG_UBRR0H] << 8) | hal_io[REG_UBRR0L];
+    uart_busy_until = hal_cycles + 10ULL * 16 * (ubrr + 1);
+}
+
+// Keep virtual time from running ahead of the wall clock
+static void realtime_pace(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double wall = (now.tv_sec - realtime_origin.tv_sec) +
+                  (now.tv_nsec - realtime_origin.tv_nsec) / 1e9;
+    double virt = (double)(hal_cycles - realtime_origin_cycles) / F_CPU;
+
+    if (virt > wall + 0.001) {
+        usleep((useconds_t)((virt - wall) * 1e6));
+    }
+}
+
+static void tcnt1_pick_up_write(void) {
+    if (tcnt1_copy != tcnt1_handed_out) {
+        timer1.count = tcnt1_copy;
+        timer1.residue = 0;
+        tcnt1_handed_out = tcnt1_copy;
+    }
+}
+
+// First cycle a timer overflows or a device needs to run
+static uint64_t next_due(void) {
+    uint64_t next = UINT64_MAX;
+    uint64_t event;
+
+    event = timer_next_overflow(&timer0);
+    if (event < next) next = event;
+    event = timer_next_overflow(&timer1);
+    if (event < next) next = event;
+    for (uint8_t i = 0; i < device_count; i++) {
+        if (devices[i]->next_event) {
+            event = devices[i]->next_event();
+            if (event < next) next = event;
+        }
+    }
+    return next;
+}
+
+// Whether the registers are as the devices last sampled them, apart from
+// port bits none of them watches
+static bool io_unchanged(void) {
+    const volatile uint64_t *now = (const volatile uint64_t *)hal_io;
+    const uint64_t *then = (const uint64_t *)sampled_io;
+
+    for (uint16_t word = 0; word < sizeof(sampled_io) / 8; word++) {
+        if (now[word] == then[word]) {
+            continue;
+        }
+        for (uint16_t reg = word * 8; reg < word * 8 + 8; reg++) {
+            uint8_t changed = sampled_io[reg] ^ hal_io[reg];
+
+            if (changed && (reg < REG_PINB || reg > REG_PINB + 8 || (reg - REG_PINB) % 3 == 0 ||
+                            (changed & watched_pins[(reg - REG_PINB) / 3]))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Move virtual time to target, stopping at every timer or device event
+static void advance_to(uint64_t target) {
+    static uint64_t last = 0;
+
+    do {
+        if (settled && !uart_tx_armed && tcnt1_copy == tcnt1_handed_out &&
+            io_unchanged() && target < next_due()) {
+            // Nothing to sample, nothing due: count the time and go
+            hal_cycles = target;
+            timer_update(&timer0, hal_cycles - last);
+            timer_update(&timer1, hal_cycles - last);
+            hal_io[REG_TCNT0] = sampled_io[REG_TCNT0] = (uint8_t)timer0.count;
+            last = hal_cycles;
+            if (realtime) {
+                realtime_pace();
+            }
+            return;
+        }
+
+        tcnt1_pick_up_write();
+
+        // Pins set by the firmware take effect now, before time moves
+        settled = true;
+        for (uint8_t i = 0; i < device_count; i++) {
+            if (devices[i]->sample) {
+                devices[i]->sample(hal_cycles);
+            }
+        }
+        memcpy(sampled_io, (const void *)hal_io, sizeof(sampled_io));
+
+        uint64_t next = next_due();
+        if (next > target) {
+            next = target;
+        }
+        if (next < hal_cycles) {
+            next = hal_cycles;
+        }
+
+        hal_cycles = next;
+        timer_update(&timer0, hal_cycles - last);
+        timer_update(&timer1, hal_cycles - last);
+        hal_io[REG_TCNT0] = sampled_io[REG_TCNT0] = (uint8_t)timer0.count;
+        last = hal_cycles;
+
+        for (uint8_t i = 0; i < device_count; i++) {
+            if (devices[i]->next_event && devices[i]->event &&
+                devices[i]->next_event() <= hal_cycles) {
+                devices[i]->event(hal_cycles);
+            }
+        }
+
+        uart_flush();
+
+        uint64_t now = hal_cycles;
+        dispatch_interrupts();
+        if (hal_cycles != now) {
+            // A handler delayed, the timers have to catch up first
+            settled = false;
+        }
+
+        if (realtime) {
+            realtime_pace();
+        }
+    } while (hal_cycles < target);
+}
+
+void hal_delay_cycles(uint64_t cycles) {
+    if (in_advance) {
+        // Delay inside an interrupt handler, time simply moves on
+        hal_cycles += cycles;
+        return;
+    }
+    in_advance = true;
+    advance_to(hal_cycles + cycles);
+    in_advance = false;
+}
+
+// Bring everything up to date without moving time
+void hal_sync(void) {
+    if (in_advance) {
+        return;
+    }
+    in_advance = true;
+    advance_to(hal_cycles);
+    in_advance = false;
+}
+
+// Pin level: our own output where DDR is set, otherwise the outside
+// world, otherwise a pull-up (internal when PORT is set, or external)
+static uint8_t pin_levels(uint8_t port) {
+    uint8_t ddr = hal_io[REG_DDRB + port * 3];
+    uint8_t out = hal_io[REG_PORTB + port * 3];
+    uint8_t undriven = out | pullups[port];
+    uint8_t outside = (input_level[port] & input_driven[port]) | (undriven & ~input_driven[port]);
+
+    return (ddr & out) | (~ddr & outside);
+}
+
+volatile uint8_t *hal_pin(uint8_t port) {
+    hal_sync();
+    hal_io[REG_PINB + port * 3] = pin_levels(port);
+    return &hal_io[REG_PINB + port * 3];
+}
+
+// Level the chip puts on a pin, released pins read as high (pulled up)
+bool hal_output_level(uint8_t port, uint8_t bit) {
+    watched_pins[port] |= (1 << bit);
+    uint8_t ddr = hal_io[REG_DDRB + port * 3];
+    uint8_t out = hal_io[REG_PORTB + port * 3];
+
+    if (ddr & (1 << bit)) {
+        return out & (1 << bit);
+    }
+    return true;
+}
+
+bool hal_is_output(uint8_t port, uint8_t bit) {
+    watched_pins[port] |= (1 << bit);
+    return hal_io[REG_DDRB + port * 3] & (1 << bit);
+}
+
+void hal_set_input(uint8_t port, uint8_t bit, bool driven, bool level) {
+    uint8_t before = pin_levels(port);
+    uint8_t driven_before = input_driven[port];
+    uint8_t level_before = input_level[port];
+
+    if (driven) {
+        input_driven[port] |= (1 << bit);
+    } else {
+        input_driven[port] &= ~(1 << bit);
+    }
+    if (level) {
+        input_level[port] |= (1 << bit);
+    } else {
+        input_level[port] &= ~(1 << bit);
+    }
+
+    if ((before ^ pin_levels(port)) & (1 << bit)) {
+        hal_pin_changed(port, bit);
+    }
+    // The other devices have to see it
+    if (input_driven[port] != driven_before || input_level[port] != level_before) {
+        settled = false;
+    }
+}
+
+void hal_set_pullup(uint8_t port, uint8_t bit) {
+    pullups[port] |= (1 << bit);
+    settled = false;
+}
+
+// Raise the pin change flag if the pin is enabled in its mask
+void hal_pin_changed(uint8_t port, uint8_t bit) {
+    if (port == HAL_PORTD && (hal_io[REG_PCMSK2] & (1 << bit))) {
+        hal_io[REG_PCIFR] |= 0x04;
+    }
+}
+
+volatile uint8_t *hal_tcnt0(void) {
+    hal_sync();
+    return &hal_io[REG_TCNT0];
+}
+
+volatile uint16_t *hal_tcnt1(void) {
+    tcnt1_pick_up_write();
+    hal_sync();
+    tcnt1_copy = (uint16_t)timer1.count;
+    tcnt1_handed_out = tcnt1_copy;
+    return &tcnt1_copy;
+}
+
+volatile uint8_t *hal_ucsr0a(void) {
+    // Transmitting the previous character takes one character time
+    if (!in_advance && uart_busy_until > hal_cycles) {
+        hal_delay_cycles(uart_busy_until - hal_cycles);
+    }
+    uart_flush();
+    hal_io[REG_UCSR0A] |= UCSR0A_UDRE;
+    return &hal_io[REG_UCSR0A];
+}
+
+// UDR0 is only read in the RX handler and only written elsewhere
+volatile uint8_t *hal_udr0(void) {
+    if (in_rx_isr) {
+        hal_io[REG_UCSR0A] &= ~UCSR0A_RXC;
+        return &uart_rx_data;
+    }
+    uart_flush();
+    uart_tx_armed = true;
+    return &uart_tx_data;
+}
+
+void hal_set_uart_tx(hal_uart_hook hook) {
+    uart_tx_hook = hook;
+}
+
+// The receiver takes a new byte once the previous one was read and a
+// character time has passed, like the wire would deliver them
+bool hal_uart_rx_ready(void) {
+    if (!(hal_io[REG_UCSR0B] & 0x10)) {
+        return false;   // RXEN0 off, bytes would be lost
+    }
+    return !(hal_io[REG_UCSR0A] & UCSR0A_RXC) && hal_cycles >= uart_next_poll;
+}
+
+void hal_uart_receive(uint8_t byte) {
+    uint32_t ubrr = ((uint32_t)hal_io[REG_UBRR0H] << 8) | hal_io[REG_UBRR0L];
+
+    uart_rx_data = byte;
+    hal_io[REG_UCSR0A] |= UCSR0A_RXC;
+    settled = false;
+    uart_next_poll = hal_cycles + 10ULL * 16 * (ubrr + 1);
+}
+
+// Host side UART pollers use this to back off while the line is idle
+uint64_t hal_uart_idle_poll(void) {
+    uart_next_poll = hal_cycles + UART_IDLE_POLL_CYCLES;
+    return uart_next_poll;
+}
+
+void hal_add_device(const struct hal_device *device) {
+    if (device_count < MAX_DEVICES) {
+        devices[device_count++] = device;
+    }
+    settled = false;
+}
+
+// Power-on values for the registers; devices only lose their bus state
+void hal_reset(void) {
+    memset((void *)hal_io, 0, sizeof(hal_io));
+    hal_io[REG_UCSR0A] = UCSR0A_UDRE;
+    timer0.count = 0;
+    timer0.residue = 0;
+    timer1.count = 0;
+    timer1.residue = 0;
+    tcnt1_copy = 0;
+    tcnt1_handed_out = 0;
+    uart_tx_armed = false;
+    in_isr = false;
+    in_rx_isr = false;
+    in_advance = false;
+    settled = false;
+    memset(watched_pins, 0, sizeof(watched_pins));
+
+    for (uint8_t i = 0; i < device_count; i++) {
+        if (devices[i]->reset) {
+            devices[i]->reset();
+        }
+    }
+}
+
+void hal_set_realtime(bool enable) {
+    realtime = enable;
+    clock_gettime(CLOCK_MONOTONIC, &realtime_origin);
+    realtime_origin_cycles = hal_cycles;
+}
+
+// Run the firmware, starting over whenever the watchdog resets it
+int hal_run(int (*entry)(void)) {
+    size_t data_size = __stop_fw_data - __start_fw_data;
+
+    if (fw_data_image == NULL) {
+        fw_data_image = malloc(data_size);
+        memcpy(fw_data_image, __start_fw_data, data_size);
+    }
+
+    if (setjmp(reset_point)) {
+        fprintf(stderr, "sim: watchdog reset at %.3f s\n", (double)hal_cycles / F_CPU);
+
+        // What the start-up code does: copy .data, clear .bss
+        memcpy(__start_fw_data, fw_data_image, data_size);
+        memset(__start_fw_bss, 0, __stop_fw_bss - __start_fw_bss);
+    }
+    hal_reset();
+    return entry();
+}
+
+void hal_watchdog_reset(void) {
+    uart_flush();
+    longjmp(reset_point, 1);
+}
+
+// Erased EEPROM, loaded from path when given
+void hal_eeprom_open(const char *path) {
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    if (path == NULL) {
+        return;
+    }
+
+    eeprom_file = fopen(path, "r+b");
+    if (eeprom_file == NULL) {
+        eeprom_file = fopen(path, "w+b");
+        if (eeprom_file == NULL) {
+            perror(path);
+            exit(1);
+        }
+        fwrite(eeprom, 1, sizeof(eeprom), eeprom_file);
+        fflush(eeprom_file);
+        return;
+    }
+
+    if (fread(eeprom, 1, sizeof(eeprom), eeprom_file) != sizeof(eeprom)) {
+        fprintf(stderr, "sim: %s is shorter than %d bytes, padded with 0xFF\n", path, EEPROM_SIZE);
+    }
+}
+
+static void eeprom_store(size_t address, uint8_t value) {
+    address %= EEPROM_SIZE;
+    if (eeprom[address] == value) {
+        return;
+    }
+    eeprom[address] = value;
+
+    // About 3.4ms per byte on the real part
+    hal_delay_cycles(F_CPU * 34 / 10000);
+
+    if (eeprom_file) {
+        fseek(eeprom_file, (long)address, SEEK_SET);
+        fputc(value, eeprom_file);
+        fflush(eeprom_file);
+    }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+    return eeprom[(uintptr_t)address % EEPROM_SIZE];
+}
+
+uint16_t eeprom_read_word(const uint16_t *address) {
+    uintptr_t a = (uintptr_t)address;
+    return eeprom[a % EEPROM_SIZE] | (eeprom[(a + 1) % EEPROM_SIZE] << 8);
+}
+
+void eeprom_read_block(void *destination, const void *source, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        ((uint8_t *)destination)[i] = eeprom[((uintptr_t)source + i) % EEPROM_SIZE];
+    }
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value) {
+    eeprom_store((uintptr_t)address, value);
+}
+
+void eeprom_update_word(uint16_t *address, uint16_t value) {
+    eeprom_store((uintptr_t)address, value & 0xFF);
+    eeprom_store((uintptr_t)address + 1, value >> 8);
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        eeprom_store((uintptr_t)destination + i, ((const uint8_t *)source)[i]);
+    }
+}
+
+// avr-libc's dtostrf on top of the host printf
+char *dtostrf(double value, signed char width, unsigned char precision, char *out) {
+    sprintf(out, "%*.*f", width, precision, value);
+    return out;
+}
@@ -0,0 +1,90 @@
+#ifndef HAL_H
+#define HAL_H
+
+/*
+  hal.h - Register level simulation of the ATmega328P for the host build
+
+  The shim headers in include/ map every register the firmware touches
+  onto hal_io[] (plain registers) or onto accessor functions (registers
+  with side effects: PINx, UDR0, UCSR0A, TCNT0, TCNT1). Virtual time only
+  moves in _delay_*() and UART transmits, which is also where the virtual
+  devices sample the pins and interrupts are delivered.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef F_CPU
+#define F_CPU 7372800UL
+#endif
+
+// Port indices for hal_pin() and the device hooks
+#define HAL_PORTB 0
+#define HAL_PORTC 1
+#define HAL_PORTD 2
+
+// Interrupt sources, lowest number is served first like on the AVR
+#define HAL_IRQ_PCINT2     0
+#define HAL_IRQ_TIMER1_OVF 1
+#define HAL_IRQ_TIMER0_OVF 2
+#define HAL_IRQ_USART_RX   3
+#define HAL_IRQ_COUNT      4
+
+// A simulated peripheral, stepped whenever virtual time moves
+struct hal_device {
+    const char *name;
+    void (*reset)(void);
+    void (*sample)(uint64_t now);        // Pins may have changed
+    uint64_t (*next_event)(void);        // Next cycle it needs to run, or UINT64_MAX
+    void (*event)(uint64_t now);
+};
+
+// Register file, indexed by data space address like on the AVR
+extern volatile uint8_t hal_io[0x100];
+
+// Current virtual time in CPU cycles
+extern uint64_t hal_cycles;
+
+// Register accessors used by the shim headers
+volatile uint8_t *hal_pin(uint8_t port);
+volatile uint8_t *hal_udr0(void);
+volatile uint8_t *hal_ucsr0a(void);
+volatile uint8_t *hal_tcnt0(void);
+volatile uint16_t *hal_tcnt1(void);
+
+// Virtual time
+void hal_delay_cycles(uint64_t cycles);
+void hal_sync(void);
+
+// Pins as seen from outside the chip
+bool hal_output_level(uint8_t port, uint8_t bit);
+bool hal_is_output(uint8_t port, uint8_t bit);
+void hal_set_input(uint8_t port, uint8_t bit, bool driven, bool level);
+void hal_set_pullup(uint8_t port, uint8_t bit);
+
+// Interrupts
+void hal_pin_changed(uint8_t port, uint8_t bit);
+
+// Devices and lifecycle
+void hal_add_device(const struct hal_device *device);
+void hal_reset(void);
+void hal_set_realtime(bool realtime);
+void hal_watchdog_reset(void) __attribute__((noreturn));
+
+// EEPROM backing file, written through on every change
+void hal_eeprom_open(const char *path);
+
+// Called for every byte the firmware sends on the UART
+typedef void (*hal_uart_hook)(uint8_t byte);
+void hal_set_uart_tx(hal_uart_hook hook);
+
+// Feed one received byte to the UART (raises the RX interrupt)
+bool hal_uart_rx_ready(void);
+void hal_uart_receive(uint8_t byte);
+uint64_t hal_uart_idle_poll(void);
+
+// Run the firmware entry point, again after every watchdog reset
+int hal_run(int (*entry)(void));
+
+#endif /* HAL_H */
@@ -0,0 +1,72 @@
+/*
+  i2c_direct.c - The firmware's MLX90640 transfers at transaction level,
+  for detect_bench
+
+  Bit-banging every clock of every transfer through the simulator is what
+  bounds the benchmark's throughput: a frame is about a thousand reads of
+  150 to 230 delays each. The Makefile links detect_bench with a copy of
+  I2C.c's object whose mlx90640_i2c_read() and mlx90640_i2c_write() are
+  weak, so these take their place. They move the words straight to and
+  from the virtual sensor and advance virtual time by exactly the delays
+  the bit-banged versions spend (5us each, see the I2C_SCL_* macros), so
+  frame timing and the benchmark's results stay those of the bus. Nothing
+  else of the firmware changes, and fireguard_sim keeps the real bus.
+*/
+
+#include <stdint.h>
+
+#include "hal.h"
+#include "vmlx90640.h"
+
+// _delay_us(5) as the host's util/delay.h rounds it
+#define BUS_DELAY ((uint64_t)(5 * (F_CPU / 1000000.0)))
+
+// Delays of the bus primitives in I2C.c
+#define START_DELAYS 4
+#define STOP_DELAYS  4
+#define BYTE_DELAYS  36          // Eight bits and the acknowledge, either way
+
+static void bus_time(unsigned delays) {
+    hal_delay_cycles(delays * BUS_DELAY);
+}
+
+int mlx90640_i2c_read(uint8_t addr, uint16_t reg, uint16_t *data, uint8_t count) {
+    for (int retries = 3; retries > 0; retries--) {
+        // Start and the write address
+        bus_time(START_DELAYS + BYTE_DELAYS);
+        if (!vmlx90640_address((uint8_t)(addr << 1))) {
+            bus_time(STOP_DELAYS);
+            continue;
+        }
+        // Register address, restart and the read address
+        bus_time(2 * BYTE_DELAYS + START_DELAYS + BYTE_DELAYS);
+        if (!vmlx90640_address((uint8_t)((addr << 1) | 0x01))) {
+            bus_time(STOP_DELAYS);
+            continue;
+        }
+        // Each word as the sensor holds it when its first bit goes out,
+        // the stop with the last one
+        for (uint8_t i = 0; i < count; i++) {
+            data[i] = vmlx90640_read_word((uint16_t)(reg + i));
+            bus_time(2 * BYTE_DELAYS + (i == count - 1 ? STOP_DELAYS : 0));
+        }
+        return 0;
+    }
+    return -1;
+}
+
+int mlx90640_i2c_write(uint8_t addr, uint16_t reg, uint16_t data) {
+    for (int retries = 3; retries > 0; retries--) {
+        bus_time(START_DELAYS + BYTE_DELAYS);
+        if (!vmlx90640_address((uint8_t)(addr << 1))) {
+            bus_time(STOP_DELAYS);
+            continue;
+        }
+        // Register address and the data, which takes effect with its last byte
+        bus_time(4 * BYTE_DELAYS);
+        vmlx90640_write_word(reg, data);
+        bus_time(STOP_DELAYS);
+        return 0;
+    }
+    return -1;
+}
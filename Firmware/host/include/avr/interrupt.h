@@ -0,0 +1,12 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+#include "hal.h"
+
+// Interrupt handlers become plain functions the simulator calls
+#define ISR(vector) void vector(void)
+
+#define sei() do { hal_io[0x5F] |= 0x80; hal_sync(); } while (0)
+#define cli() do { hal_io[0x5F] &= (uint8_t)~0x80; } while (0)
+
+#endif /* HOST_AVR_INTERRUPT_H */
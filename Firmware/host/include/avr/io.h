@@ -0,0 +1,134 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+/*
+  Host build stand-in for <avr/io.h>: ATmega328P registers mapped onto the
+  simulator in hal.c. Only the registers the firmware uses are defined.
+*/
+
+#include <stdint.h>
+#include "hal.h"
+
+#define _HAL_REG8(addr) (hal_io[(addr)])
+
+// Ports, PINx reads the simulated pin levels
+#define PINB   (*hal_pin(HAL_PORTB))
+#define DDRB   _HAL_REG8(0x24)
+#define PORTB  _HAL_REG8(0x25)
+#define PINC   (*hal_pin(HAL_PORTC))
+#define DDRC   _HAL_REG8(0x27)
+#define PORTC  _HAL_REG8(0x28)
+#define PIND   (*hal_pin(HAL_PORTD))
+#define DDRD   _HAL_REG8(0x2A)
+#define PORTD  _HAL_REG8(0x2B)
+
+// Interrupt flags and masks
+#define TIFR0  _HAL_REG8(0x35)
+#define TIFR1  _HAL_REG8(0x36)
+#define PCIFR  _HAL_REG8(0x3B)
+#define MCUSR  _HAL_REG8(0x54)
+#define SREG   _HAL_REG8(0x5F)
+#define PCICR  _HAL_REG8(0x68)
+#define PCMSK2 _HAL_REG8(0x6D)
+#define TIMSK0 _HAL_REG8(0x6E)
+#define TIMSK1 _HAL_REG8(0x6F)
+#define TIMSK2 _HAL_REG8(0x70)
+
+// Timers
+#define TCCR0A _HAL_REG8(0x44)
+#define TCCR0B _HAL_REG8(0x45)
+#define TCNT0  (*hal_tcnt0())
+#define OCR0A  _HAL_REG8(0x47)
+#define OCR0B  _HAL_REG8(0x48)
+#define TCCR1A _HAL_REG8(0x80)
+#define TCCR1B _HAL_REG8(0x81)
+#define TCNT1  (*hal_tcnt1())
+#define TCCR2A _HAL_REG8(0xB0)
+#define TCCR2B _HAL_REG8(0xB1)
+#define TCNT2  _HAL_REG8(0xB2)
+#define OCR2A  _HAL_REG8(0xB3)
+#define OCR2B  _HAL_REG8(0xB4)
+
+// USART0
+#define UCSR0A (*hal_ucsr0a())
+#define UCSR0B _HAL_REG8(0xC1)
+#define UCSR0C _HAL_REG8(0xC2)
+#define UBRR0L _HAL_REG8(0xC4)
+#define UBRR0H _HAL_REG8(0xC5)
+#define UDR0   (*hal_udr0())
+
+// Port bits
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// Timer bits
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM00 0
+#define WGM01 1
+#define TOIE0 0
+#define OCIE0A 1
+#define TOV0 0
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define TOIE1 0
+#define TOV1 0
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+
+// Pin change interrupt bits
+#define PCIE0 0
+#define PCIE1 1
+#define PCIE2 2
+#define PCINT23 7
+
+// USART bits
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+#define UCSZ00 1
+#define UCSZ01 2
+
+// Interrupt vectors, called by the simulator (see hal.c)
+#define PCINT2_vect       hal_vect_pcint2
+#define TIMER1_OVF_vect   hal_vect_timer1_ovf
+#define TIMER0_OVF_vect   hal_vect_timer0_ovf
+#define USART_RX_vect     hal_vect_usart_rx
+
+// 1 KiB of EEPROM
+#define E2END 0x3FF
+
+#endif /* HOST_AVR_IO_H */
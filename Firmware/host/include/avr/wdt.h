@@ -0,0 +1,13 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+#include "hal.h"
+
+#define WDTO_15MS 0
+
+// The firmware only arms the watchdog to restart itself, so do that now
+#define wdt_enable(timeout) hal_watchdog_reset()
+#define wdt_disable() do { } while (0)
+#define wdt_reset() do { } while (0)
+
+#endif /* HOST_AVR_WDT_H */
@@ -0,0 +1,11 @@
+#ifndef HAL_LIBC_H
+#define HAL_LIBC_H
+
+/*
+  avr-libc extensions the firmware expects from <stdlib.h>. Forced into
+  every firmware translation unit with -include by the host Makefile.
+*/
+
+char *dtostrf(double value, signed char width, unsigned char precision, char *out);
+
+#endif /* HAL_LIBC_H */
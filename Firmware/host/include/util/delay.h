@@ -0,0 +1,15 @@
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+#include "hal.h"
+
+// Delays advance virtual time, they never sleep
+static inline void _delay_us(double us) {
+    hal_delay_cycles((uint64_t)(us * (F_CPU / 1000000.0)));
+}
+
+static inline void _delay_ms(double ms) {
+    hal_delay_cycles((uint64_t)(ms * (F_CPU / 1000.0)));
+}
+
+#endif /* HOST_UTIL_DELAY_H */
@@ -0,0 +1,178 @@
+/*
+  scene.c - Synthetic thermal scenes for the simulated MLX90640
+
+  A scene is a background (ambient temperature, vertical gradient, pixel
+  noise, optionally a row of reference pixels) plus a few warm objects
+  placed by azimuth and elevation. Frames are rendered for the current pan
+  angle, so the patrol sweeps across the scene like the real unit would.
+  Objects cover pixels partially at their edges, which is what makes a
+  small or distant fire read cooler than it is.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "scene.h"
+#include "vmlx90640.h"
+
+#define COL_DEG (SCENE_FOV_H / VMLX90640_COLS)
+#define ROW_DEG (SCENE_FOV_V / VMLX90640_ROWS)
+
+// The patrol starts at position 0 and sweeps counter-clockwise, i.e. to
+// negative azimuths, over 800 steps (180 degrees)
+const struct scene scenes[] = {
+    { "ambient", "Room temperature background, no heat sources",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 0, { { 0 } } },
+    { "sun_patch", "Sunlit floor patch, warm but below the fire threshold",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_RECT, -60.0f, -15.0f, 40.0f, 15.0f, 46.0f, 0.0f, 0.0f, 0.0f, false } } },
+    { "person", "Person walking across the room",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_RECT, -170.0f, -5.0f, 6.0f, 25.0f, 34.0f, 0.0f, 0.0f, 2.0f, false } } },
+    { "hot_cart", "Hot non-fire object moving through the view",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_DISC, -170.0f, -8.0f, 8.0f, 0.0f, 65.0f, 0.0f, 0.0f, 3.0f, false } } },
+    { "fire", "Fire igniting at 5s and growing to 90C over 10s",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_DISC, -100.0f, -5.0f, 6.0f, 0.0f, 90.0f, 5.0f, 10.0f, 0.0f, true } } },
+    { "fire_slow", "Small smouldering fire growing over 40s",
+      22.0f, 3.0f, 0.3f, -1, 120.0f, 1, {
+        { SHAPE_DISC, -120.0f, -10.0f, 3.0f, 0.0f, 80.0f, 10.0f, 40.0f, 0.0f, true } } },
+    { "fire_smoulder", "Fire smouldering from 60s, warming to 65C over 8 minutes",
+      22.0f, 3.0f, 0.3f, -1, 600.0f, 1, {
+        { SHAPE_DISC, -100.0f, -5.0f, 8.0f, 0.0f, 65.0f, 60.0f, 480.0f, 0.0f, true } } },
+    { "fire_hot", "Fully developed 250C fire",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_DISC, -80.0f, -5.0f, 8.0f, 0.0f, 250.0f, 5.0f, 5.0f, 0.0f, true } } },
+    { "fire_reference_row", "Fire with a noisy sensor and a row of reference pixels",
+      22.0f, 3.0f, 0.8f, 11, 90.0f, 1, {
+        { SHAPE_DISC, -100.0f, -5.0f, 6.0f, 0.0f, 90.0f, 5.0f, 10.0f, 0.0f, true } } },
+    { "fire_and_sun", "Fire next to a sunlit patch",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 2, {
+        { SHAPE_RECT, -60.0f, -15.0f, 40.0f, 15.0f, 46.0f, 0.0f, 0.0f, 0.0f, false },
+        { SHAPE_DISC, -130.0f, -5.0f, 6.0f, 0.0f, 90.0f, 5.0f, 10.0f, 0.0f, true } } },
+    { "fire_edge", "Fire at the far end of the scan range",
+      22.0f, 3.0f, 0.3f, -1, 90.0f, 1, {
+        { SHAPE_DISC, -175.0f, -5.0f, 6.0f, 0.0f, 90.0f, 5.0f, 10.0f, 0.0f, true } } },
+};
+
+const uint8_t scene_count = sizeof(scenes) / sizeof(scenes[0]);
+
+const struct scene *scene_find(const char *name) {
+    for (uint8_t i = 0; i < scene_count; i++) {
+        if (strcmp(scenes[i].name, name) == 0) {
+            return &scenes[i];
+        }
+    }
+    return NULL;
+}
+
+float scene_column_azimuth(float pan, float col) {
+    return pan + (col - (VMLX90640_COLS - 1) / 2.0f) * COL_DEG;
+}
+
+// xorshift32 and Box-Muller, repeatable for a given seed
+static float gaussian(uint32_t *rng) {
+    float u[2];
+    for (int i = 0; i < 2; i++) {
+        *rng ^= *rng << 13;
+        *rng ^= *rng >> 17;
+        *rng ^= *rng << 5;
+        u[i] = ((*rng >> 8) + 1.0f) / 16777217.0f;
+    }
+    return sqrtf(-2.0f * logf(u[0])) * cosf(6.2831853f * u[1]);
+}
+
+static float clamp01(float x) {
+    return x < 0.0f ? 0.0f : (x > 1.0f ? 1.0f : x);
+}
+
+// How far an object has developed at t, 0 before onset
+static float progress(const struct scene_object *object, float t) {
+    if (t < object->onset) {
+        return 0.0f;
+    }
+    if (object->grow <= 0.0f) {
+        return 1.0f;
+    }
+    return clamp01((t - object->onset) / object->grow);
+}
+
+static float object_azimuth(const struct scene_object *object, float t) {
+    return object->azimuth + object->speed * (t - object->onset);
+}
+
+// Fraction of the pixel at (azimuth, elevation) the object covers
+static float coverage(const struct scene_object *object, float scale, float t,
+                      float azimuth, float elevation) {
+    float dx = fabsf(azimuth - object_azimuth(object, t));
+    float dy = fabsf(elevation - object->elevation);
+
+    if (object->shape == SHAPE_RECT) {
+        float fx = clamp01((object->width * scale / 2 - dx) / COL_DEG + 0.5f);
+        float fy = clamp01((object->height * scale / 2 - dy) / ROW_DEG + 0.5f);
+        return fx * fy;
+    }
+
+    float distance = sqrtf(dx * dx + dy * dy);
+    return clamp01((object->width * scale / 2 - distance) / ((COL_DEG + ROW_DEG) / 2) + 0.5f);
+}
+
+void scene_render(const struct scene *scene, float pan, float t, uint32_t *rng, int16_t *frame) {
+    for (uint8_t row = 0; row < VMLX90640_ROWS; row++) {
+        float elevation = ((VMLX90640_ROWS - 1) / 2.0f - row) * ROW_DEG;
+        float background = scene->ambient + scene->gradient * elevation / SCENE_FOV_V;
+
+        for (uint8_t col = 0; col < VMLX90640_COLS; col++) {
+            float azimuth = scene_column_azimuth(pan, col);
+            float temp = background;
+
+            for (uint8_t i = 0; i < scene->object_count; i++) {
+                const struct scene_object *object = &scene->objects[i];
+                float p = progress(object, t);
+                if (p <= 0.0f) {
+                    continue;
+                }
+
+                // Fires start at a quarter of their size and half their heat
+                float scale = object->fire ? 0.25f + 0.75f * p : 1.0f;
+                float heat = object->fire ? 0.5f + 0.5f * p : 1.0f;
+                float f = coverage(object, scale, t, azimuth, elevation);
+                float hot = background + (object->temp - background) * heat;
+                temp = temp * (1.0f - f) + hot * f;
+            }
+
+            if (row == scene->reference_row) {
+                temp = 200.0f + 20.0f * gaussian(rng);
+            } else {
+                temp += scene->noise * gaussian(rng);
+            }
+
+            frame[row * VMLX90640_COLS + col] = (int16_t)lrintf(temp * 100.0f);
+        }
+    }
+}
+
+bool scene_fire_at(const struct scene *scene, float azimuth, float t, float tolerance) {
+    for (uint8_t i = 0; i < scene->object_count; i++) {
+        const struct scene_object *object = &scene->objects[i];
+        if (!object->fire || t < object->onset) {
+            continue;
+        }
+        if (fabsf(azimuth - object_azimuth(object, t)) <= object->width / 2 + tolerance) {
+            return true;
+        }
+    }
+    return false;
+}
+
+float scene_first_fire(const struct scene *scene) {
+    float first = -1.0f;
+    for (uint8_t i = 0; i < scene->object_count; i++) {
+        const struct scene_object *object = &scene->objects[i];
+        if (object->fire && (first < 0.0f || object->onset < first)) {
+            first = object->onset;
+        }
+    }
+    return first;
+}
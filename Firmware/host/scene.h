@@ -0,0 +1,62 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Field of view of the MLX90640BAA and the pan geometry (EasyDriver at
+// its default eighth steps on a 1.8 degree motor)
+#define SCENE_FOV_H 110.0f
+#define SCENE_FOV_V 75.0f
+#define SCENE_DEG_PER_STEP 0.225f
+
+#define SCENE_MAX_OBJECTS 4
+
+enum scene_shape { SHAPE_DISC, SHAPE_RECT };
+
+// Something warmer than the background, positions in degrees (azimuth of
+// the pan axis, elevation from the sensor's horizon)
+struct scene_object {
+    enum scene_shape shape;
+    float azimuth;
+    float elevation;
+    float width;            // Diameter of a disc, full width of a rect
+    float height;           // Rect only
+    float temp;             // Degrees C once fully developed
+    float onset;            // Seconds into the run it appears
+    float grow;             // Seconds to reach full size and temp, 0 = at once
+    float speed;            // Degrees per second along the azimuth
+    bool fire;              // Counts as a fire for the benchmark
+};
+
+struct scene {
+    const char *name;
+    const char *description;
+    float ambient;          // Degrees C at the horizon
+    float gradient;         // Top row minus bottom row, degrees C
+    float noise;            // Per-pixel standard deviation, degrees C
+    int8_t reference_row;   // Sensor row with extreme readings, -1 for none
+    float duration;         // Default run length, seconds
+    uint8_t object_count;
+    struct scene_object objects[SCENE_MAX_OBJECTS];
+};
+
+extern const struct scene scenes[];
+extern const uint8_t scene_count;
+
+const struct scene *scene_find(const char *name);
+
+// Render one 24x32 frame (row major, centidegrees) as seen with the pan
+// at pan degrees, t seconds into the run
+void scene_render(const struct scene *scene, float pan, float t, uint32_t *rng, int16_t *frame);
+
+// Azimuth seen by a pixel column (0..31) with the pan at pan degrees
+float scene_column_azimuth(float pan, float col);
+
+// Whether azimuth is within tolerance degrees of a fire burning at t
+bool scene_fire_at(const struct scene *scene, float azimuth, float t, float tolerance);
+
+// When the first fire appears, negative if the scene has none
+float scene_first_fire(const struct scene *scene);
+
+#endif /* SCENE_H */
@@ -0,0 +1,160 @@
+/*
+  sim_main.c - Runs the FireGuard firmware on the host against the
+  simulated ATmega328P and its virtual peripherals
+
+  Usage: fireguard_sim [options]
+    --pty [LINK]      UART on a pseudo terminal (default stdin/stdout),
+                      LINK is a stable symlink to it
+    --eeprom FILE     EEPROM contents, kept across runs (default: blank)
+    --frames FILE     Thermal frames to play (24x32 int16 LE centidegrees)
+    --scene NAME      Render a detection benchmark scene (scene.c) for the
+                      pan, e.g. to watch the server's panorama fill in
+    --calibrated      Sensor with a calibration EEPROM, pixels encoded for the
+                      full calibration (default: the firmware's simplified one)
+    --word-addressing Sensor pixels at their datasheet addresses rather than
+                      where read_pixel_value() reads them (implied by
+                      --calibrated)
+    --distance CM     Ultrasonic target distance (default 120)
+    --seconds N       Stop after N seconds of virtual time
+    --realtime        Pace virtual time to the wall clock
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hal.h"
+#include "scene.h"
+#include "vhcsr04.h"
+#include "vmlx90640.h"
+#include "vstepper.h"
+#include "vuart.h"
+
+// The firmware's main(), renamed by the Makefile
+int firmware_main(void);
+
+static uint64_t stop_at = UINT64_MAX;
+static struct timespec started;
+
+// Scene rendered for the pan (--scene)
+static const struct scene *scene = NULL;
+static uint32_t scene_rng = 1;
+
+static void render_scene(int16_t *frame, uint64_t now) {
+    scene_render(scene, vstepper_position() * SCENE_DEG_PER_STEP, (float)now / F_CPU, &scene_rng, frame);
+}
+
+static void print_summary(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double wall = (now.tv_sec - started.tv_sec) + (now.tv_nsec - started.tv_nsec) / 1e9;
+    double virt = (double)hal_cycles / F_CPU;
+    const struct vmlx90640_stats *mlx = vmlx90640_stats();
+
+    fprintf(stderr, "sim: %.3f s virtual in %.3f s wall (%.1fx)\n", virt, wall,
+            wall > 0 ? virt / wall : 0.0);
+    fprintf(stderr, "sim: mlx90640 frames=%u reads=%u writes=%u control_writes=%u\n",
+            mlx->frames, mlx->reads, mlx->writes, mlx->control_writes);
+    fprintf(stderr, "sim: stepper position=%d steps=%u\n",
+            (int)vstepper_position(), vstepper_steps());
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    exit(0);
+}
+
+// Ends the run once the virtual time limit is reached
+static uint64_t limit_next_event(void) {
+    return stop_at;
+}
+
+static void limit_event(uint64_t now) {
+    (void)now;
+    exit(0);
+}
+
+static const struct hal_device limit = {
+    "limit", NULL, NULL, limit_next_event, limit_event
+};
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--pty [LINK]] [--eeprom FILE] [--frames FILE] "
+            "[--scene NAME] [--calibrated] [--word-addressing] [--distance CM] [--seconds N] [--realtime]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool pty = false;
+    bool realtime = false;
+    const char *link = NULL;
+    const char *eeprom = NULL;
+    const char *frames = NULL;
+    bool calibrated = false;
+    bool word_addressing = false;
+    float distance = 120.0f;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--pty") == 0) {
+            pty = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') {
+                link = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--eeprom") == 0 && i + 1 < argc) {
+            eeprom = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = argv[++i];
+        } else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scene = scene_find(argv[++i]);
+            if (scene == NULL) {
+                fprintf(stderr, "unknown scene %s (detect_bench --list)\n", argv[i]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--calibrated") == 0) {
+            calibrated = true;
+        } else if (strcmp(argv[i], "--word-addressing") == 0) {
+            word_addressing = true;
+        } else if (strcmp(argv[i], "--distance") == 0 && i + 1 < argc) {
+            distance = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            stop_at = (uint64_t)(strtod(argv[++i], NULL) * F_CPU);
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    hal_eeprom_open(eeprom);
+
+    vmlx90640_init();
+    if (word_addressing) {
+        vmlx90640_set_word_addressing(true);
+    }
+    if (calibrated) {
+        vmlx90640_calibrate();
+    }
+    if (frames && vmlx90640_load_frames(frames) < 0) {
+        return 1;
+    }
+    if (scene) {
+        vmlx90640_set_source(render_scene);
+    }
+    vhcsr04_init();
+    vhcsr04_set_distance(distance);
+    vstepper_init();
+    if (vuart_init(pty, link) != 0) {
+        return 1;
+    }
+    hal_add_device(&limit);
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    atexit(print_summary);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    hal_set_realtime(realtime);
+
+    return hal_run(firmware_main);
+}
@@ -0,0 +1,269 @@
+/*
+  thermal_bench.c - Checks the SIMD backends of the thermal core against
+  the scalar reference, then measures every backend's throughput
+
+  Usage: thermal_bench [--frames N] [--seed N] [--check-only]
+
+  The check runs every kernel on random frames of every size up to 24x32
+  and on edge cases (extreme values, constant frames, values around the
+  limits and thresholds), and compares against ../src/thermal.c bit for
+  bit. It prints one line per backend
+
+    THERMAL CHECK backend=<name> cases=<n> mismatches=<n>
+
+  and the throughput of each kernel over N full 24x32 frames
+
+    THERMAL backend=<name> kernel=<name> mpix_s=<n> mb_s=<n>
+
+  Exits non-zero on any mismatch.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "thermal_host.h"
+
+#define ROWS 24
+#define COLS 32
+#define PIXELS (ROWS * COLS)
+#define FRAMES_DEFAULT 20000
+#define SEED_DEFAULT 1
+
+static const char *const backend_names[] = { "avx2", "sse2", "scalar" };
+
+static uint32_t rng;
+static unsigned cases;
+static unsigned mismatches;
+
+static uint32_t next_random(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Room temperature with some hot spots, or anything at all
+static void fill(int16_t *frame, uint16_t n, uint8_t kind) {
+    for (uint16_t i = 0; i < n; i++) {
+        uint32_t r = next_random();
+        switch (kind) {
+        case 0:
+            frame[i] = (int16_t)(2200 + (int32_t)(r % 600) - 300 + (r % 97 == 0 ? 6000 : 0));
+            break;
+        case 1:
+            frame[i] = (int16_t)r;
+            break;
+        case 2:
+            frame[i] = (r & 1) ? INT16_MAX : INT16_MIN;
+            break;
+        default:
+            frame[i] = (int16_t)(10000 + (int32_t)(r % 5) - 2);
+            break;
+        }
+    }
+}
+
+static void mismatch(const char *backend, const char *kernel, uint8_t rows, uint8_t cols) {
+    if (mismatches++ < 10) {
+        fprintf(stderr, "%s: %s differs from the scalar code on a %ux%u frame\n",
+                backend, kernel, rows, cols);
+    }
+}
+
+static void check_frame(const char *backend, const int16_t *frame, const int16_t *previous,
+                        uint8_t rows, uint8_t cols) {
+    uint16_t n = (uint16_t)(rows * cols);
+    int16_t a[PIXELS], b[PIXELS];
+    uint8_t ea[THERMAL_DELTA_BOUND(PIXELS)], eb[THERMAL_DELTA_BOUND(PIXELS)];
+    int16_t limits[] = { 10000, INT16_MIN, INT16_MAX, frame[0], 2200 };
+
+    cases++;
+
+    memcpy(a, frame, n * sizeof(int16_t));
+    memcpy(b, frame, n * sizeof(int16_t));
+    if (thermal_validate(a, n, -4000, 30000) != thermal_host_validate(b, n, -4000, 30000)
+        || memcmp(a, b, n * sizeof(int16_t)) != 0) {
+        mismatch(backend, "validate", rows, cols);
+    }
+
+    for (uint8_t l = 0; l < sizeof(limits) / sizeof(limits[0]); l++) {
+        uint16_t ia, ib;
+        int16_t ma = thermal_max(frame, n, limits[l], &ia);
+        int16_t mb = thermal_host_max(frame, n, limits[l], &ib);
+        if (ma != mb || ia != ib) {
+            mismatch(backend, "max", rows, cols);
+        }
+
+        struct thermal_blob ba, bb;
+        thermal_blob(frame, rows, cols, limits[l], &ba);
+        thermal_host_blob(frame, rows, cols, limits[l], &bb);
+        if (memcmp(&ba, &bb, sizeof(ba)) != 0) {
+            mismatch(backend, "blob", rows, cols);
+        }
+    }
+
+    thermal_filter(frame, a, rows, cols);
+    thermal_host_filter(frame, b, rows, cols);
+    if (memcmp(a, b, n * sizeof(int16_t)) != 0) {
+        mismatch(backend, "filter", rows, cols);
+    }
+
+    uint16_t la = thermal_delta_encode(frame, previous, n, ea);
+    uint16_t lb = thermal_host_delta_encode(frame, previous, n, eb);
+    if (la != lb || memcmp(ea, eb, la) != 0) {
+        mismatch(backend, "delta", rows, cols);
+    }
+    memcpy(a, previous, n * sizeof(int16_t));
+    if (thermal_host_delta_decode(a, n, eb) != lb || memcmp(a, frame, n * sizeof(int16_t)) != 0) {
+        mismatch(backend, "delta round trip", rows, cols);
+    }
+}
+
+static void check(const char *backend) {
+    int16_t frame[PIXELS], previous[PIXELS];
+
+    cases = 0;
+    mismatches = 0;
+    for (uint8_t kind = 0; kind < 4; kind++) {
+        for (uint8_t rows = 1; rows <= ROWS; rows++) {
+            for (uint8_t cols = 1; cols <= COLS; cols++) {
+                uint16_t n = (uint16_t)(rows * cols);
+                fill(frame, n, kind);
+                // Mostly small changes, so both delta paths are taken
+                for (uint16_t i = 0; i < n; i++) {
+                    previous[i] = (int16_t)(frame[i] - (int16_t)(next_random() % 160) + 80);
+                }
+                check_frame(backend, frame, previous, rows, cols);
+            }
+        }
+    }
+    printf("THERMAL CHECK backend=%s cases=%u mismatches=%u\n", backend, cases, mismatches);
+}
+
+static void report(const char *backend, const char *kernel, uint32_t frames, double elapsed) {
+    double pixels = (double)frames * PIXELS;
+    printf("THERMAL backend=%s kernel=%s mpix_s=%u mb_s=%u\n", backend, kernel,
+           (unsigned)(pixels / elapsed / 1e6), (unsigned)(pixels * sizeof(int16_t) / elapsed / 1e6));
+}
+
+static void measure(const char *backend, int16_t *frames, const int16_t *source, uint32_t count) {
+    static int16_t out[PIXELS];
+    static uint8_t encoded[THERMAL_DELTA_BOUND(PIXELS)];
+    struct thermal_host_summary *summaries = malloc(count * sizeof(*summaries));
+    volatile uint32_t sink = 0;
+    double start;
+
+    memcpy(frames, source, (size_t)count * PIXELS * sizeof(int16_t));
+    start = now();
+    for (uint32_t f = 0; f < count; f++) {
+        sink += thermal_host_validate(&frames[(size_t)f * PIXELS], PIXELS, -4000, 30000);
+    }
+    report(backend, "validate", count, now() - start);
+
+    start = now();
+    for (uint32_t f = 0; f < count; f++) {
+        uint16_t index;
+        sink += (uint16_t)thermal_host_max(&frames[(size_t)f * PIXELS], PIXELS, 10000, &index);
+    }
+    report(backend, "max", count, now() - start);
+
+    start = now();
+    for (uint32_t f = 0; f < count; f++) {
+        struct thermal_blob blob;
+        thermal_host_blob(&frames[(size_t)f * PIXELS], ROWS, COLS, 5000, &blob);
+        sink += blob.count;
+    }
+    report(backend, "blob", count, now() - start);
+
+    start = now();
+    for (uint32_t f = 0; f < count; f++) {
+        thermal_host_filter(&frames[(size_t)f * PIXELS], out, ROWS, COLS);
+        sink += (uint16_t)out[f % PIXELS];
+    }
+    report(backend, "filter", count, now() - start);
+
+    start = now();
+    for (uint32_t f = 1; f < count; f++) {
+        sink += thermal_host_delta_encode(&frames[(size_t)f * PIXELS],
+                                          &frames[(size_t)(f - 1) * PIXELS], PIXELS, encoded);
+    }
+    report(backend, "delta", count - 1, now() - start);
+
+    memcpy(frames, source, (size_t)count * PIXELS * sizeof(int16_t));
+    start = now();
+    thermal_host_analyze(frames, count, ROWS, COLS, -4000, 30000, 10000, 5000, summaries);
+    report(backend, "analyze", count, now() - start);
+
+    free(summaries);
+}
+
+int main(int argc, char **argv) {
+    uint32_t count = FRAMES_DEFAULT;
+    uint32_t seed = SEED_DEFAULT;
+    bool check_only = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            count = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--check-only") == 0) {
+            check_only = true;
+        } else {
+            fprintf(stderr, "usage: %s [--frames N] [--seed N] [--check-only]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (count < 2) {
+        count = 2;
+    }
+
+    int failed = 0;
+    for (uint8_t b = 0; b < sizeof(backend_names) / sizeof(backend_names[0]); b++) {
+        if (thermal_host_use(backend_names[b]) != 0) {
+            printf("THERMAL CHECK backend=%s unsupported\n", backend_names[b]);
+            continue;
+        }
+        rng = seed;
+        check(backend_names[b]);
+        failed |= mismatches != 0;
+    }
+    if (check_only || failed) {
+        return failed;
+    }
+
+    // A room with a few warm spots, drifting a little from frame to frame
+    int16_t *source = malloc((size_t)count * PIXELS * sizeof(int16_t));
+    int16_t *frames = malloc((size_t)count * PIXELS * sizeof(int16_t));
+    if (source == NULL || frames == NULL) {
+        fprintf(stderr, "out of memory for %u frames\n", (unsigned)count);
+        return 1;
+    }
+    rng = seed;
+    fill(source, PIXELS, 0);
+    for (uint32_t f = 1; f < count; f++) {
+        for (uint16_t i = 0; i < PIXELS; i++) {
+            source[(size_t)f * PIXELS + i] = (int16_t)(source[(size_t)(f - 1) * PIXELS + i]
+                                                       + (int16_t)(next_random() % 21) - 10);
+        }
+    }
+
+    for (uint8_t b = 0; b < sizeof(backend_names) / sizeof(backend_names[0]); b++) {
+        if (thermal_host_use(backend_names[b]) == 0) {
+            measure(backend_names[b], frames, source, count);
+        }
+    }
+
+    free(source);
+    free(frames);
+    return 0;
+}
@@ -0,0 +1,483 @@
+/*
+  thermal_host.c - SIMD kernels for the thermal core on the host
+
+  Every kernel gives exactly what the scalar code in ../src/thermal.c
+  gives, which stays the reference (thermal_bench checks them against
+  it). Wide frames fall back to the scalar code where a kernel relies on
+  a row fitting in THERMAL_MAX_COLS. Bad pixel masking and delta decoding
+  are branchy per pixel and always use the scalar code.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "thermal_host.h"
+
+struct backend {
+    const char *name;
+    int (*supported)(void);
+    uint16_t (*validate)(int16_t *frame, uint16_t n, int16_t min, int16_t max);
+    int16_t (*max)(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index);
+    // Bit c set when pixel c of the row is at or above threshold (cols <= 32)
+    uint32_t (*row_mask)(const int16_t *row, uint8_t cols, int16_t threshold);
+    // out[i] = (a[i] + 2 b[i] + c[i] + 2) >> 2, out may be b or c
+    void (*smooth)(const int16_t *a, const int16_t *b, const int16_t *c, int16_t *out, uint16_t n);
+    uint16_t (*delta_encode)(const int16_t *frame, const int16_t *previous, uint16_t n,
+                             uint8_t *out);
+};
+
+static int16_t smooth1(int16_t a, int16_t b, int16_t c) {
+    return (int16_t)(((int32_t)a + 2 * (int32_t)b + c + 2) >> 2);
+}
+
+// Scalar
+
+static int scalar_supported(void) {
+    return 1;
+}
+
+static uint32_t scalar_row_mask(const int16_t *row, uint8_t cols, int16_t threshold) {
+    uint32_t mask = 0;
+    for (uint8_t c = 0; c < cols; c++) {
+        if (row[c] >= threshold) {
+            mask |= 1UL << c;
+        }
+    }
+    return mask;
+}
+
+static void scalar_smooth(const int16_t *a, const int16_t *b, const int16_t *c, int16_t *out,
+                          uint16_t n) {
+    for (uint16_t i = 0; i < n; i++) {
+        out[i] = smooth1(a[i], b[i], c[i]);
+    }
+}
+
+static const struct backend scalar = {
+    "scalar", scalar_supported, thermal_validate, thermal_max, scalar_row_mask,
+    scalar_smooth, thermal_delta_encode
+};
+
+#ifdef HAVE_X86_SIMD
+
+// SSE2, 8 pixels at a time (always there on x86-64)
+
+static int sse2_supported(void) {
+    return 1;
+}
+
+static uint16_t sse2_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max) {
+    const __m128i lo = _mm_set1_epi16(min);
+    const __m128i hi = _mm_set1_epi16(max);
+    uint32_t bits = 0;
+    uint16_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&frame[i]);
+        __m128i out = _mm_or_si128(_mm_cmplt_epi16(v, lo), _mm_cmpgt_epi16(v, hi));
+        bits += __builtin_popcount(_mm_movemask_epi8(out));
+        _mm_storeu_si128((__m128i *)&frame[i], _mm_max_epi16(_mm_min_epi16(v, hi), lo));
+    }
+    // movemask gives two bits per pixel
+    return (uint16_t)(bits / 2 + thermal_validate(&frame[i], n - i, min, max));
+}
+
+static int16_t sse2_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index) {
+    const __m128i lim = _mm_set1_epi16(limit);
+    const __m128i none = _mm_set1_epi16(INT16_MIN);
+    __m128i best = none;
+    uint16_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&frame[i]);
+        __m128i below = _mm_cmplt_epi16(v, lim);
+        best = _mm_max_epi16(best, _mm_or_si128(_mm_and_si128(below, v),
+                                                _mm_andnot_si128(below, none)));
+    }
+
+    int16_t lanes[8];
+    _mm_storeu_si128((__m128i *)lanes, best);
+    int16_t max = INT16_MIN;
+    for (uint8_t l = 0; l < 8; l++) {
+        if (lanes[l] > max) {
+            max = lanes[l];
+        }
+    }
+    for (uint16_t t = i; t < n; t++) {
+        if (frame[t] > max && frame[t] < limit) {
+            max = frame[t];
+        }
+    }
+
+    // Now the first pixel holding it, like the scalar strict > does
+    *index = 0;
+    if (max == INT16_MIN) {
+        return max;
+    }
+    const __m128i want = _mm_set1_epi16(max);
+    for (i = 0; i + 8 <= n; i += 8) {
+        int hit = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)&frame[i]), want));
+        if (hit) {
+            *index = i + __builtin_ctz(hit) / 2;
+            return max;
+        }
+    }
+    for (; frame[i] != max; i++) {
+    }
+    *index = i;
+    return max;
+}
+
+static uint32_t sse2_row_mask(const int16_t *row, uint8_t cols, int16_t threshold) {
+    const __m128i thr = _mm_set1_epi16(threshold);
+    uint32_t mask = 0;
+    uint8_t c = 0;
+
+    for (; c + 8 <= cols; c += 8) {
+        __m128i below = _mm_cmplt_epi16(_mm_loadu_si128((const __m128i *)&row[c]), thr);
+        uint32_t bits = _mm_movemask_epi8(_mm_packs_epi16(below, below)) & 0xFF;
+        mask |= (~bits & 0xFFUL) << c;
+    }
+    if (c < cols) {
+        mask |= scalar_row_mask(&row[c], cols - c, threshold) << c;
+    }
+    return mask;
+}
+
+// (a + 2b + c + 2) >> 2 == (((a + c) >> 1) + b + 1) >> 1, which stays in 16
+// bits: with the sign bit flipped the lanes are unsigned and pavgw gives
+// (x + y + 1) >> 1, less the low bit of x ^ y for the floor of a + c
+static __m128i sse2_smooth8(__m128i a, __m128i b, __m128i c) {
+    const __m128i sign = _mm_set1_epi16((short)0x8000);
+    const __m128i one = _mm_set1_epi16(1);
+    a = _mm_xor_si128(a, sign);
+    b = _mm_xor_si128(b, sign);
+    c = _mm_xor_si128(c, sign);
+    __m128i ac = _mm_sub_epi16(_mm_avg_epu16(a, c), _mm_and_si128(_mm_xor_si128(a, c), one));
+    return _mm_xor_si128(_mm_avg_epu16(ac, b), sign);
+}
+
+static void sse2_smooth(const int16_t *a, const int16_t *b, const int16_t *c, int16_t *out,
+                        uint16_t n) {
+    uint16_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i r = sse2_smooth8(_mm_loadu_si128((const __m128i *)&a[i]),
+                                 _mm_loadu_si128((const __m128i *)&b[i]),
+                                 _mm_loadu_si128((const __m128i *)&c[i]));
+        _mm_storeu_si128((__m128i *)&out[i], r);
+    }
+    scalar_smooth(&a[i], &b[i], &c[i], &out[i], n - i);
+}
+
+static uint16_t sse2_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                                  uint8_t *out) {
+    const __m128i hi = _mm_set1_epi16(THERMAL_DELTA_MAX);
+    const __m128i lo = _mm_set1_epi16(-THERMAL_DELTA_MAX);
+    uint16_t length = 0;
+    uint16_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        // Saturated differences are out of range either way
+        __m128i d = _mm_subs_epi16(_mm_loadu_si128((const __m128i *)&frame[i]),
+                                   _mm_loadu_si128((const __m128i *)&previous[i]));
+        __m128i escape = _mm_or_si128(_mm_cmpgt_epi16(d, hi), _mm_cmplt_epi16(d, lo));
+        if (_mm_movemask_epi8(escape) == 0) {
+            _mm_storel_epi64((__m128i *)&out[length], _mm_packs_epi16(d, d));
+            length += 8;
+        } else {
+            length += thermal_delta_encode(&frame[i], &previous[i], 8, &out[length]);
+        }
+    }
+    return length + thermal_delta_encode(&frame[i], &previous[i], n - i, &out[length]);
+}
+
+static const struct backend sse2 = {
+    "sse2", sse2_supported, sse2_validate, sse2_max, sse2_row_mask, sse2_smooth,
+    sse2_delta_encode
+};
+
+// AVX2, 16 pixels at a time
+
+#define AVX2 __attribute__((target("avx2")))
+
+static int avx2_supported(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+AVX2 static uint16_t avx2_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max) {
+    const __m256i lo = _mm256_set1_epi16(min);
+    const __m256i hi = _mm256_set1_epi16(max);
+    uint32_t bits = 0;
+    uint16_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&frame[i]);
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi16(lo, v), _mm256_cmpgt_epi16(v, hi));
+        bits += __builtin_popcount((uint32_t)_mm256_movemask_epi8(out));
+        _mm256_storeu_si256((__m256i *)&frame[i], _mm256_max_epi16(_mm256_min_epi16(v, hi), lo));
+    }
+    return (uint16_t)(bits / 2 + sse2_validate(&frame[i], n - i, min, max));
+}
+
+AVX2 static int16_t avx2_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index) {
+    const __m256i lim = _mm256_set1_epi16(limit);
+    const __m256i none = _mm256_set1_epi16(INT16_MIN);
+    __m256i best = none;
+    uint16_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&frame[i]);
+        __m256i below = _mm256_cmpgt_epi16(lim, v);
+        best = _mm256_max_epi16(best, _mm256_blendv_epi8(none, v, below));
+    }
+
+    int16_t lanes[16];
+    _mm256_storeu_si256((__m256i *)lanes, best);
+    int16_t max = INT16_MIN;
+    for (uint8_t l = 0; l < 16; l++) {
+        if (lanes[l] > max) {
+            max = lanes[l];
+        }
+    }
+    for (uint16_t t = i; t < n; t++) {
+        if (frame[t] > max && frame[t] < limit) {
+            max = frame[t];
+        }
+    }
+
+    *index = 0;
+    if (max == INT16_MIN) {
+        return max;
+    }
+    const __m256i want = _mm256_set1_epi16(max);
+    for (i = 0; i + 16 <= n; i += 16) {
+        uint32_t hit = (uint32_t)_mm256_movemask_epi8(
+            _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)&frame[i]), want));
+        if (hit) {
+            *index = i + __builtin_ctz(hit) / 2;
+            return max;
+        }
+    }
+    for (; frame[i] != max; i++) {
+    }
+    *index = i;
+    return max;
+}
+
+AVX2 static uint32_t avx2_row_mask(const int16_t *row, uint8_t cols, int16_t threshold) {
+    const __m256i thr = _mm256_set1_epi16(threshold);
+    uint32_t mask = 0;
+    uint8_t c = 0;
+
+    for (; c + 16 <= cols; c += 16) {
+        __m256i below = _mm256_cmpgt_epi16(thr, _mm256_loadu_si256((const __m256i *)&row[c]));
+        // Pack to bytes; the pack works per 128 bit lane, the permute
+        // puts the two halves back in order
+        __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(below, below), 0xD8);
+        uint32_t bits = (uint32_t)_mm256_movemask_epi8(bytes) & 0xFFFF;
+        mask |= (~bits & 0xFFFFUL) << c;
+    }
+    if (c < cols) {
+        mask |= sse2_row_mask(&row[c], cols - c, threshold) << c;
+    }
+    return mask;
+}
+
+AVX2 static void avx2_smooth(const int16_t *a, const int16_t *b, const int16_t *c, int16_t *out,
+                             uint16_t n) {
+    const __m256i sign = _mm256_set1_epi16((short)0x8000);
+    const __m256i one = _mm256_set1_epi16(1);
+    uint16_t i = 0;
+
+    // As sse2_smooth8, 16 pixels at a time
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&a[i]), sign);
+        __m256i vb = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&b[i]), sign);
+        __m256i vc = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&c[i]), sign);
+        __m256i ac = _mm256_sub_epi16(_mm256_avg_epu16(va, vc),
+                                      _mm256_and_si256(_mm256_xor_si256(va, vc), one));
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_xor_si256(_mm256_avg_epu16(ac, vb), sign));
+    }
+    // The rest here rather than through sse2_smooth, whose legacy SSE
+    // encoding would stall on the dirty upper halves
+    for (; i + 8 <= n; i += 8) {
+        __m128i r = sse2_smooth8(_mm_loadu_si128((const __m128i *)&a[i]),
+                                 _mm_loadu_si128((const __m128i *)&b[i]),
+                                 _mm_loadu_si128((const __m128i *)&c[i]));
+        _mm_storeu_si128((__m128i *)&out[i], r);
+    }
+    scalar_smooth(&a[i], &b[i], &c[i], &out[i], n - i);
+}
+
+AVX2 static uint16_t avx2_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                                       uint8_t *out) {
+    const __m256i hi = _mm256_set1_epi16(THERMAL_DELTA_MAX);
+    const __m256i lo = _mm256_set1_epi16(-THERMAL_DELTA_MAX);
+    uint16_t length = 0;
+    uint16_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i d = _mm256_subs_epi16(_mm256_loadu_si256((const __m256i *)&frame[i]),
+                                      _mm256_loadu_si256((const __m256i *)&previous[i]));
+        __m256i escape = _mm256_or_si256(_mm256_cmpgt_epi16(d, hi), _mm256_cmpgt_epi16(lo, d));
+        if (_mm256_testz_si256(escape, escape)) {
+            __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(d), _mm256_extracti128_si256(d, 1));
+            _mm_storeu_si128((__m128i *)&out[length], bytes);
+            length += 16;
+        } else {
+            length += sse2_delta_encode(&frame[i], &previous[i], 16, &out[length]);
+        }
+    }
+    return length + sse2_delta_encode(&frame[i], &previous[i], n - i, &out[length]);
+}
+
+static const struct backend avx2 = {
+    "avx2", avx2_supported, avx2_validate, avx2_max, avx2_row_mask, avx2_smooth,
+    avx2_delta_encode
+};
+
+#endif /* HAVE_X86_SIMD */
+
+// Best first
+static const struct backend *const backends[] = {
+#ifdef HAVE_X86_SIMD
+    &avx2, &sse2,
+#endif
+    &scalar
+};
+
+#define BACKEND_COUNT (sizeof(backends) / sizeof(backends[0]))
+
+static const struct backend *active = NULL;
+
+static const struct backend *backend(void) {
+    if (active == NULL) {
+        const char *name = getenv("FIREGUARD_THERMAL_BACKEND");
+        if (name == NULL || thermal_host_use(name) != 0) {
+            for (uint8_t i = 0; i < BACKEND_COUNT && active == NULL; i++) {
+                if (backends[i]->supported()) {
+                    active = backends[i];
+                }
+            }
+        }
+    }
+    return active;
+}
+
+const char *thermal_host_backend(void) {
+    return backend()->name;
+}
+
+int thermal_host_use(const char *name) {
+    for (uint8_t i = 0; i < BACKEND_COUNT; i++) {
+        if (strcmp(backends[i]->name, name) == 0 && backends[i]->supported()) {
+            active = backends[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+uint16_t thermal_host_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max) {
+    return backend()->validate(frame, n, min, max);
+}
+
+void thermal_host_mask_bad(int16_t *frame, const uint8_t *mask, uint8_t rows, uint8_t cols) {
+    thermal_mask_bad(frame, mask, rows, cols);
+}
+
+int16_t thermal_host_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index) {
+    return backend()->max(frame, n, limit, index);
+}
+
+void thermal_host_blob(const int16_t *frame, uint8_t rows, uint8_t cols, int16_t threshold,
+                       struct thermal_blob *blob) {
+    const struct backend *b = backend();
+    if (b == &scalar || cols > THERMAL_MAX_COLS) {
+        thermal_blob(frame, rows, cols, threshold, blob);
+        return;
+    }
+
+    memset(blob, 0, sizeof(*blob));
+    blob->min_row = 0xFF;
+    blob->min_col = 0xFF;
+
+    for (uint8_t r = 0; r < rows; r++) {
+        uint32_t mask = b->row_mask(&frame[(uint16_t)r * cols], cols, threshold);
+        if (mask == 0) {
+            continue;
+        }
+        uint8_t count = (uint8_t)__builtin_popcount(mask);
+        uint8_t first = (uint8_t)__builtin_ctz(mask);
+        uint8_t last = (uint8_t)(31 - __builtin_clz(mask));
+
+        blob->count += count;
+        blob->sum_row += (uint32_t)r * count;
+        if (r < blob->min_row) blob->min_row = r;
+        blob->max_row = r;
+        if (first < blob->min_col) blob->min_col = first;
+        if (last > blob->max_col) blob->max_col = last;
+        for (; mask; mask &= mask - 1) {
+            blob->sum_col += (uint32_t)__builtin_ctz(mask);
+        }
+    }
+}
+
+void thermal_host_filter(const int16_t *in, int16_t *out, uint8_t rows, uint8_t cols) {
+    const struct backend *b = backend();
+    // Horizontal pass of the rows around the one being written, in turn
+    int16_t passed[3][THERMAL_MAX_COLS];
+
+    if (b == &scalar || cols > THERMAL_MAX_COLS || rows == 0 || cols < 2) {
+        thermal_filter(in, out, rows, cols);
+        return;
+    }
+
+    for (uint8_t r = 0; r <= rows; r++) {
+        // Horizontal pass of row r with its edges repeated, the inner
+        // pixels read straight from the frame
+        if (r < rows) {
+            const int16_t *row = &in[(uint16_t)r * cols];
+            int16_t *dest = passed[r % 3];
+            dest[0] = smooth1(row[0], row[0], row[1]);
+            b->smooth(&row[0], &row[1], &row[2], &dest[1], cols - 2);
+            dest[cols - 1] = smooth1(row[cols - 2], row[cols - 1], row[cols - 1]);
+        }
+        // Vertical pass of row r - 1 now that the row below it is done
+        if (r > 0) {
+            uint8_t here = r - 1;
+            const int16_t *above = passed[(here > 0 ? here - 1 : here) % 3];
+            const int16_t *below = passed[(r < rows ? r : here) % 3];
+            b->smooth(above, passed[here % 3], below, &out[(uint16_t)here * cols], cols);
+        }
+    }
+}
+
+uint16_t thermal_host_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                                   uint8_t *out) {
+    return backend()->delta_encode(frame, previous, n, out);
+}
+
+uint16_t thermal_host_delta_decode(int16_t *frame, uint16_t n, const uint8_t *in) {
+    return thermal_delta_decode(frame, n, in);
+}
+
+uint32_t thermal_host_analyze(int16_t *frames, uint32_t count, uint8_t rows, uint8_t cols,
+                              int16_t min, int16_t max, int16_t limit, int16_t threshold,
+                              struct thermal_host_summary *out) {
+    uint16_t pixels = (uint16_t)(rows * cols);
+
+    for (uint32_t f = 0; f < count; f++) {
+        int16_t *frame = &frames[(size_t)f * pixels];
+        out[f].clamped = thermal_host_validate(frame, pixels, min, max);
+        out[f].max = thermal_host_max(frame, pixels, limit, &out[f].max_index);
+        thermal_host_blob(frame, rows, cols, threshold, &out[f].blob);
+    }
+    return count;
+}
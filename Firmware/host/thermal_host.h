@@ -0,0 +1,47 @@
+#ifndef THERMAL_HOST_H
+#define THERMAL_HOST_H
+
+#include <stdint.h>
+
+#include "thermal.h"
+
+/*
+  thermal_host.h - Host backend of the thermal core (../src/thermal.c)
+
+  Same operations and results as the scalar core, with AVX2 and SSE2
+  kernels picked at run time. Built into libthermal.so for the server
+  (App/thermal_core.py), so only plain C types cross the interface.
+*/
+
+// Per frame result of thermal_host_analyze
+struct thermal_host_summary {
+    int16_t max;                // thermal_max below the limit
+    uint16_t max_index;
+    uint16_t clamped;           // Pixels thermal_validate clamped
+    struct thermal_blob blob;   // Pixels at or above the threshold
+};
+
+// Backend in use: "avx2", "sse2" or "scalar". The best one the CPU
+// supports is picked on first use, FIREGUARD_THERMAL_BACKEND overrides it.
+const char *thermal_host_backend(void);
+
+// Switch backend, returns 0 or -1 if the CPU (or build) lacks it
+int thermal_host_use(const char *name);
+
+uint16_t thermal_host_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max);
+void thermal_host_mask_bad(int16_t *frame, const uint8_t *mask, uint8_t rows, uint8_t cols);
+int16_t thermal_host_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index);
+void thermal_host_blob(const int16_t *frame, uint8_t rows, uint8_t cols, int16_t threshold,
+                       struct thermal_blob *blob);
+void thermal_host_filter(const int16_t *in, int16_t *out, uint8_t rows, uint8_t cols);
+uint16_t thermal_host_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                                   uint8_t *out);
+uint16_t thermal_host_delta_decode(int16_t *frame, uint16_t n, const uint8_t *in);
+
+// Validate (in place), then find the max and the blob of count frames
+// stored back to back. Returns the number of frames processed.
+uint32_t thermal_host_analyze(int16_t *frames, uint32_t count, uint8_t rows, uint8_t cols,
+                              int16_t min, int16_t max, int16_t limit, int16_t threshold,
+                              struct thermal_host_summary *out);
+
+#endif /* THERMAL_HOST_H */
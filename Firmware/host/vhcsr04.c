@@ -0,0 +1,72 @@
+/*
+  vhcsr04.c - Virtual HC-SR04 ultrasonic ranger (PD6 = TRIG, PD7 = ECHO)
+
+  A trigger pulse of at least 10us starts a measurement: after the burst
+  the echo line goes high for the round trip time of the target distance,
+  or for 38ms when nothing is in range.
+*/
+
+#include "hal.h"
+#include "vhcsr04.h"
+
+#define TRIG_BIT 6
+#define ECHO_BIT 7
+
+#define CYCLES_PER_US (F_CPU / 1000000.0)
+#define BURST_US 250            // Eight 40kHz cycles plus processing
+#define NO_ECHO_US 38000
+#define MAX_RANGE_CM 400.0f
+#define SOUND_SPEED 0.0343f     // cm/us, matches ultrasonic.c
+
+static float distance_cm = 120.0f;
+static bool last_trig = false;
+static uint64_t trig_rose = 0;
+static uint64_t echo_rise = UINT64_MAX;
+static uint64_t echo_fall = UINT64_MAX;
+
+static void sample(uint64_t now) {
+    bool trig = hal_is_output(HAL_PORTD, TRIG_BIT) && hal_output_level(HAL_PORTD, TRIG_BIT);
+
+    if (trig && !last_trig) {
+        trig_rose = now;
+    } else if (!trig && last_trig && echo_rise == UINT64_MAX && echo_fall == UINT64_MAX &&
+               now - trig_rose >= (uint64_t)(10 * CYCLES_PER_US)) {
+        float echo_us = distance_cm < MAX_RANGE_CM ? 2.0f * distance_cm / SOUND_SPEED : NO_ECHO_US;
+        echo_rise = now + (uint64_t)(BURST_US * CYCLES_PER_US);
+        echo_fall = echo_rise + (uint64_t)(echo_us * CYCLES_PER_US);
+    }
+    last_trig = trig;
+}
+
+static uint64_t next_event(void) {
+    return echo_rise != UINT64_MAX ? echo_rise : echo_fall;
+}
+
+static void event(uint64_t now) {
+    if (echo_rise != UINT64_MAX && now >= echo_rise) {
+        echo_rise = UINT64_MAX;
+        hal_set_input(HAL_PORTD, ECHO_BIT, true, true);
+    } else if (echo_fall != UINT64_MAX && now >= echo_fall) {
+        echo_fall = UINT64_MAX;
+        hal_set_input(HAL_PORTD, ECHO_BIT, true, false);
+    }
+}
+
+static void reset(void) {
+    last_trig = false;
+    echo_rise = UINT64_MAX;
+    echo_fall = UINT64_MAX;
+    hal_set_input(HAL_PORTD, ECHO_BIT, true, false);
+}
+
+static const struct hal_device device = {
+    "hcsr04", reset, sample, next_event, event
+};
+
+void vhcsr04_init(void) {
+    hal_add_device(&device);
+}
+
+void vhcsr04_set_distance(float cm) {
+    distance_cm = cm;
+}
@@ -0,0 +1,7 @@
+#ifndef VHCSR04_H
+#define VHCSR04_H
+
+void vhcsr04_init(void);
+void vhcsr04_set_distance(float cm);
+
+#endif /* VHCSR04_H */
@@ -0,0 +1,506 @@
+/*
+  vmlx90640.c - Virtual MLX90640 on the bit-banged I2C bus (PC4 = SDA,
+  PC5 = SCL)
+
+  Decodes START/STOP and the clocked bits the way the sensor does and
+  serves EEPROM 0x2400-0x273F (device ID at 0x2407), frame RAM from
+  0x0400, status 0x8000 and control 0x800D. A new frame is latched into
+  RAM at the refresh rate set in the control register.
+
+  Pixel (row, col) is latched where the firmware's read_pixel_value()
+  reads it, 0x0400 + 2 * (row * 32 + col), so the detection path sees the
+  scene as the unit ships. The datasheet map, 0x0400 + row * 32 + col
+  with the auxiliary words from 0x0700, is served with word addressing
+  (vmlx90640_set_word_addressing), which a calibrated sensor always uses
+  as the raw frame dump needs it.
+
+  Pixels are encoded so the firmware's simplified conversion
+  (raw * 10 - 1000 centidegrees) gives back the scene temperature. A
+  calibrated sensor (vmlx90640_calibrate) has a calibration in its EEPROM
+  instead and encodes pixels through the datasheet's To equation, for a
+  host doing the full calibration (App/raw_frames.py).
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal.h"
+#include "vmlx90640.h"
+
+#define SDA_BIT 4
+#define SCL_BIT 5
+
+#define I2C_ADDRESS 0x33
+#define DEVICE_ID   0x0F2D
+
+#define RAM_BASE    0x0400
+#define RAM_SIZE    0x0600      // Two words per pixel without word addressing
+#define EE_BASE     0x2400
+#define EE_SIZE     0x0340
+#define REG_BASE    0x8000
+#define REG_SIZE    0x0020
+
+#define STATUS_REG  0x0000      // Offsets into regs[]
+#define CONTROL_REG 0x000D
+
+#define STATUS_NEW_DATA 0x0008
+#define CONTROL_DEFAULT 0x1901  // 2Hz, 18 bit, chess pattern
+
+enum bus_state { BUS_IDLE, BUS_RECEIVE, BUS_SEND };
+
+static uint16_t ram[RAM_SIZE];
+static uint16_t ee[EE_SIZE];
+static uint16_t regs[REG_SIZE];
+
+// Bit level bus state
+static enum bus_state state = BUS_IDLE;
+static bool last_sda = true;
+static bool last_scl = true;
+static bool pull_low = false;   // We are driving SDA low
+static uint8_t bits = 0;        // Clocks seen in the current byte, 9 = ACK
+static uint8_t shift = 0;
+static bool master_ack = false;
+
+// Transaction state
+static uint8_t byte_index = 0;  // Bytes received since START
+static uint16_t pointer = 0;    // Register address
+static uint16_t write_word = 0;
+static bool reading = false;
+
+// Frame production
+static uint64_t next_frame = 0;
+static vmlx90640_source source = NULL;
+static int16_t *script = NULL;
+static size_t script_frames = 0;
+static size_t script_index = 0;
+static int16_t scene[VMLX90640_PIXELS];
+
+static struct vmlx90640_stats stats;
+
+// Calibrated sensor: only offset and alpha vary per pixel, kta, kv, the
+// compensation pixel, TGC and KsTo are all zero. Chosen so the firmware's
+// simplified conversion stays within a few degrees of the scene between
+// 0 and 60C (alpha about 1e-7, offsets about 400).
+#define CAL_EMISSIVITY  0.95    // What the host assumes, like the Melexis examples
+#define CAL_TA          30.0    // Die temperature, C
+#define CAL_TA_SHIFT    8.0     // Reflected temperature is Ta - 8, the driver's open air default
+#define CAL_GAIN        6000    // EEPROM and RAM gain alike, so the gain is 1
+#define CAL_KVDD        -99     // Raw EEPROM fields: kVdd = -99 * 32
+#define CAL_VDD25       0x5D
+#define CAL_KTPTAT      336     // 42.0 * 8
+#define CAL_VPTAT25     12200
+#define CAL_ALPHA_PTAT  9       // 9 / 4 + 8 = 10.25
+#define CAL_PTAT        1500
+#define CAL_OFFSET_REF  400
+#define CAL_ALPHA_REF   27000
+#define CAL_ALPHA_SCALE 8       // alpha = ... / 2^(30 + 8)
+
+static bool calibrated = false;
+static bool word_addressing = false;
+static double cal_offset[VMLX90640_PIXELS];
+static double cal_alpha[VMLX90640_PIXELS];
+static double cal_ta_tr;        // Ambient term of the To equation, K^4
+
+static uint16_t *word_at(uint16_t address) {
+    if (address >= RAM_BASE && address < RAM_BASE + RAM_SIZE) {
+        return &ram[address - RAM_BASE];
+    }
+    if (address >= EE_BASE && address < EE_BASE + EE_SIZE) {
+        return &ee[address - EE_BASE];
+    }
+    if (address >= REG_BASE && address < REG_BASE + REG_SIZE) {
+        return &regs[address - REG_BASE];
+    }
+    return NULL;
+}
+
+static uint16_t read_word(uint16_t address) {
+    uint16_t *word = word_at(address);
+    return word ? *word : 0;
+}
+
+// Only the registers are writable over I2C, EEPROM writes need a sequence
+// the firmware never uses
+static void write_word_at(uint16_t address, uint16_t value) {
+    if (address == REG_BASE + STATUS_REG) {
+        // Only the "start of measurement" and "overwrite enable" bits stick,
+        // the new data flag is cleared by writing 0
+        regs[STATUS_REG] = (regs[STATUS_REG] & ~0x0038) | (value & 0x0030);
+        if (!(value & STATUS_NEW_DATA)) {
+            regs[STATUS_REG] &= ~STATUS_NEW_DATA;
+        }
+        return;
+    }
+    if (address >= REG_BASE && address < REG_BASE + REG_SIZE) {
+        regs[address - REG_BASE] = value;
+        if (address == REG_BASE + CONTROL_REG) {
+            stats.control_writes++;
+        }
+    }
+}
+
+// Subpage period from the refresh rate field, bits 9:7 (0.5Hz .. 64Hz)
+static uint64_t frame_period(void) {
+    uint8_t rate = (regs[CONTROL_REG] >> 7) & 0x07;
+    return (uint64_t)F_CPU * 2 / (1u << rate);
+}
+
+static int16_t clamp_raw(int32_t centi) {
+    int32_t raw = (centi + 1000) / 10;
+    if (raw > INT16_MAX) raw = INT16_MAX;
+    if (raw < INT16_MIN) raw = INT16_MIN;
+    return (int16_t)raw;
+}
+
+// The pixel word the datasheet's To equation turns back into centi, with
+// the terms that are zero here left out:
+//   To^4 = (raw * gain - offset) / emissivity / alpha + taTr
+static int16_t encode_calibrated(int pixel, int16_t centi) {
+    double t = centi / 100.0 + 273.15;
+    double raw = cal_offset[pixel] + CAL_EMISSIVITY * cal_alpha[pixel] * (t * t * t * t - cal_ta_tr);
+    if (raw > INT16_MAX) raw = INT16_MAX;
+    if (raw < INT16_MIN) raw = INT16_MIN;
+    return (int16_t)lround(raw);
+}
+
+// Latch the next frame into RAM and flag it to the firmware
+static void latch_frame(uint64_t now) {
+    if (source) {
+        source(scene, now);
+    } else if (script_frames > 0) {
+        memcpy(scene, &script[script_index * VMLX90640_PIXELS], sizeof(scene));
+        script_index = (script_index + 1) % script_frames;
+    }
+
+    int stride = word_addressing ? 1 : 2;
+    for (int i = 0; i < VMLX90640_PIXELS; i++) {
+        ram[i * stride] = (uint16_t)(calibrated ? encode_calibrated(i, scene[i]) : clamp_raw(scene[i]));
+    }
+
+    regs[STATUS_REG] ^= 0x0001;     // Subpage
+    regs[STATUS_REG] |= STATUS_NEW_DATA;
+    stats.frames++;
+}
+
+// A byte from the master finished, returns whether to ACK it
+static bool receive_byte(uint8_t byte) {
+    if (byte_index++ == 0) {
+        if ((byte >> 1) != I2C_ADDRESS) {
+            return false;
+        }
+        reading = byte & 0x01;
+        if (reading) {
+            stats.reads++;
+        }
+        return true;
+    }
+
+    switch (byte_index) {
+        case 2:
+            pointer = (uint16_t)byte << 8;
+            break;
+        case 3:
+            pointer |= byte;
+            break;
+        default:
+            // Data words, MSB first, pointer increments per word
+            if (byte_index % 2 == 0) {
+                write_word = (uint16_t)byte << 8;
+            } else {
+                write_word |= byte;
+                write_word_at(pointer++, write_word);
+                stats.writes++;
+            }
+            break;
+    }
+    return true;
+}
+
+static void drive_bit(void) {
+    uint16_t word = read_word(pointer);
+    uint8_t byte = (byte_index & 1) ? (uint8_t)word : (uint8_t)(word >> 8);
+    pull_low = !(byte & (0x80 >> bits));
+}
+
+static void on_start(void) {
+    state = BUS_RECEIVE;
+    bits = 0;
+    shift = 0;
+    byte_index = 0;
+    reading = false;
+    pull_low = false;
+}
+
+static void on_stop(void) {
+    state = BUS_IDLE;
+    pull_low = false;
+}
+
+static void on_rising(bool sda) {
+    if (state == BUS_RECEIVE) {
+        if (bits < 8) {
+            shift = (uint8_t)((shift << 1) | sda);
+        }
+        bits++;
+    } else if (state == BUS_SEND) {
+        if (bits == 8) {
+            master_ack = !sda;
+        }
+        bits++;
+    }
+}
+
+static void on_falling(void) {
+    if (state == BUS_RECEIVE) {
+        if (bits == 8) {
+            // Byte complete: acknowledge it during the ninth clock
+            if (receive_byte(shift)) {
+                pull_low = true;
+            } else {
+                state = BUS_IDLE;
+            }
+        } else if (bits == 9) {
+            pull_low = false;
+            bits = 0;
+            shift = 0;
+            if (reading) {
+                // Address with the read bit was acknowledged, start sending
+                state = BUS_SEND;
+                byte_index = 0;
+                drive_bit();
+            }
+        }
+    } else if (state == BUS_SEND) {
+        if (bits < 8) {
+            drive_bit();
+        } else if (bits == 8) {
+            pull_low = false;   // Master drives the ACK
+        } else {
+            if (!master_ack) {
+                state = BUS_IDLE;
+                return;
+            }
+            if (byte_index & 1) {
+                pointer++;
+            }
+            byte_index++;
+            bits = 0;
+            drive_bit();
+        }
+    }
+}
+
+static void sample(uint64_t now) {
+    (void)now;
+
+    // The AVR pulls a line low by making it an output, released lines
+    // are held high by the bus pull-ups
+    bool scl = hal_output_level(HAL_PORTC, SCL_BIT);
+    bool sda = hal_output_level(HAL_PORTC, SDA_BIT) && !pull_low;
+
+    if (scl && last_scl && sda != last_sda) {
+        if (sda) {
+            on_stop();
+        } else {
+            on_start();
+        }
+    } else if (scl && !last_scl) {
+        on_rising(sda);
+    } else if (!scl && last_scl) {
+        on_falling();
+    }
+
+    last_scl = scl;
+    last_sda = hal_output_level(HAL_PORTC, SDA_BIT) && !pull_low;
+    hal_set_input(HAL_PORTC, SDA_BIT, pull_low, false);
+}
+
+static uint64_t next_event(void) {
+    return next_frame;
+}
+
+static void event(uint64_t now) {
+    latch_frame(now);
+    next_frame = now + frame_period();
+}
+
+// An AVR reset leaves the sensor running, only the bus transaction is lost
+static void reset(void) {
+    state = BUS_IDLE;
+    pull_low = false;
+    last_sda = true;
+    last_scl = true;
+    hal_set_input(HAL_PORTC, SDA_BIT, false, false);
+}
+
+static const struct hal_device device = {
+    "mlx90640", reset, sample, next_event, event
+};
+
+void vmlx90640_init(void) {
+    memset(ram, 0, sizeof(ram));
+    memset(regs, 0, sizeof(regs));
+    for (int i = 0; i < EE_SIZE; i++) {
+        ee[i] = 0x0000;
+    }
+    ee[0x07] = DEVICE_ID;
+    regs[CONTROL_REG] = CONTROL_DEFAULT;
+
+    // Ambient scene until a source or a script says otherwise
+    for (int i = 0; i < VMLX90640_PIXELS; i++) {
+        scene[i] = 2200;
+    }
+
+    // First frame after one period, like after power-on
+    next_frame = hal_cycles + frame_period();
+
+    // The bus has its own pull-up resistors
+    hal_set_pullup(HAL_PORTC, SDA_BIT);
+    hal_set_pullup(HAL_PORTC, SCL_BIT);
+    hal_add_device(&device);
+}
+
+// Pack a signed field of a few bits into an EEPROM word
+static void put_field(uint16_t *word, int value, int bits, int shift) {
+    *word |= (uint16_t)(((unsigned)value & ((1u << bits) - 1)) << shift);
+}
+
+void vmlx90640_calibrate(void) {
+    int occ_row[VMLX90640_ROWS], occ_col[VMLX90640_COLS];
+    int acc_row[VMLX90640_ROWS], acc_col[VMLX90640_COLS];
+
+    // The host calibrates from the datasheet map, auxiliary words included
+    vmlx90640_set_word_addressing(true);
+
+    // EEPROM words by index from 0x2400, as the Melexis driver numbers them
+    memset(ee, 0, sizeof(ee));
+    ee[0x07] = DEVICE_ID;
+    ee[16] = (CAL_ALPHA_PTAT << 12) | (2 << 8) | (2 << 4);  // Offset row and column scales 2, remnant 0
+    ee[17] = CAL_OFFSET_REF;
+    ee[32] = (CAL_ALPHA_SCALE << 12) | (6 << 8) | (6 << 4) | 4;
+    ee[33] = CAL_ALPHA_REF;
+    for (int i = 0; i < VMLX90640_ROWS; i++) {
+        occ_row[i] = i % 7 - 3;
+        acc_row[i] = i % 5 - 2;
+        put_field(&ee[18 + i / 4], occ_row[i], 4, 4 * (i % 4));
+        put_field(&ee[34 + i / 4], acc_row[i], 4, 4 * (i % 4));
+    }
+    for (int j = 0; j < VMLX90640_COLS; j++) {
+        occ_col[j] = j % 5 - 2;
+        acc_col[j] = j % 3 - 1;
+        put_field(&ee[24 + j / 4], occ_col[j], 4, 4 * (j % 4));
+        put_field(&ee[40 + j / 4], acc_col[j], 4, 4 * (j % 4));
+    }
+    ee[48] = CAL_GAIN;
+    ee[49] = CAL_VPTAT25;
+    ee[50] = CAL_KTPTAT;
+    ee[51] = (uint16_t)(((CAL_KVDD & 0xFF) << 8) | CAL_VDD25);
+    ee[56] = 2 << 12;               // Calibrated at 18 bit, like CONTROL_DEFAULT
+
+    for (int i = 0; i < VMLX90640_ROWS; i++) {
+        for (int j = 0; j < VMLX90640_COLS; j++) {
+            int p = i * VMLX90640_COLS + j;
+            int occ = (i * 7 + j * 3) % 21 - 10;
+            // Never 0, a pixel word of 0 marks a broken pixel
+            int acc = (i + j) % 8 - 4;
+            if (acc >= 0) {
+                acc++;
+            }
+            put_field(&ee[64 + p], occ, 6, 10);
+            put_field(&ee[64 + p], acc, 6, 4);
+            cal_offset[p] = CAL_OFFSET_REF + occ_row[i] * 4 + occ_col[j] * 4 + occ;
+            cal_alpha[p] = (CAL_ALPHA_REF + acc_row[i] * 64 + acc_col[j] * 64 + acc * 16)
+                / pow(2, 30 + CAL_ALPHA_SCALE);
+        }
+    }
+
+    // Auxiliary words: supply at its 3.3V reference, PTAT and Vbe for CAL_TA
+    int vdd25 = (CAL_VDD25 - 256) * 32 - 8192;
+    double alpha_ptat = CAL_ALPHA_PTAT / 4.0 + 8;
+    double ptat_art = (CAL_TA - 25) * (CAL_KTPTAT / 8.0) + CAL_VPTAT25;
+    int vbe = (int)lround(CAL_PTAT * 262144.0 / ptat_art - CAL_PTAT * alpha_ptat);
+    ram[768] = (uint16_t)vbe;
+    ram[778] = CAL_GAIN;
+    ram[800] = CAL_PTAT;
+    ram[810] = (uint16_t)(int16_t)vdd25;
+
+    // The Ta the host gets from those words, rounding and all
+    double ta = (CAL_PTAT / (CAL_PTAT * alpha_ptat + vbe) * 262144.0 - CAL_VPTAT25) / (CAL_KTPTAT / 8.0) + 25;
+    double ta4 = pow(ta + 273.15, 4);
+    double tr4 = pow(ta - CAL_TA_SHIFT + 273.15, 4);
+    cal_ta_tr = tr4 - (tr4 - ta4) / CAL_EMISSIVITY;
+    calibrated = true;
+}
+
+void vmlx90640_set_word_addressing(bool on) {
+    word_addressing = on;
+    memset(ram, 0, sizeof(ram));
+}
+
+void vmlx90640_set_source(vmlx90640_source fn) {
+    source = fn;
+}
+
+// Frames file: consecutive 24x32 frames of little endian int16 centidegrees
+int vmlx90640_load_frames(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    size_t frame_bytes = VMLX90640_PIXELS * sizeof(int16_t);
+    script_frames = (size_t)size / frame_bytes;
+    if (script_frames == 0) {
+        fprintf(stderr, "%s: no complete %zu byte frame\n", path, frame_bytes);
+        fclose(file);
+        return -1;
+    }
+
+    free(script);
+    script = malloc(script_frames * frame_bytes);
+    if (fread(script, frame_bytes, script_frames, file) != script_frames) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    // Stored little endian, as written by the scene generator
+    for (size_t i = 0; i < script_frames * VMLX90640_PIXELS; i++) {
+        uint8_t *b = (uint8_t *)&script[i];
+        script[i] = (int16_t)(b[0] | (b[1] << 8));
+    }
+    script_index = 0;
+    return (int)script_frames;
+}
+
+// Transaction level access, for a host that replaces the bit-banged bus
+// (i2c_direct.c). Same effects as the bus transfers above.
+bool vmlx90640_address(uint8_t byte) {
+    if ((byte >> 1) != I2C_ADDRESS) {
+        return false;
+    }
+    if (byte & 0x01) {
+        stats.reads++;
+    }
+    return true;
+}
+
+uint16_t vmlx90640_read_word(uint16_t address) {
+    return read_word(address);
+}
+
+void vmlx90640_write_word(uint16_t address, uint16_t value) {
+    write_word_at(address, value);
+    stats.writes++;
+}
+
+const struct vmlx90640_stats *vmlx90640_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,37 @@
+#ifndef VMLX90640_H
+#define VMLX90640_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VMLX90640_ROWS 24
+#define VMLX90640_COLS 32
+#define VMLX90640_PIXELS (VMLX90640_ROWS * VMLX90640_COLS)
+
+// Fills the next frame (row major, centidegrees) at virtual time now
+typedef void (*vmlx90640_source)(int16_t *frame, uint64_t now);
+
+struct vmlx90640_stats {
+    uint32_t frames;            // Frames latched into RAM
+    uint32_t reads;             // Read transactions
+    uint32_t writes;            // Words written
+    uint32_t control_writes;    // Writes to the control register
+};
+
+void vmlx90640_init(void);
+// Give the sensor a calibration and encode pixels for it, after init;
+// turns word addressing on
+void vmlx90640_calibrate(void);
+// Datasheet pixel addresses instead of the firmware's (see vmlx90640.c)
+void vmlx90640_set_word_addressing(bool on);
+void vmlx90640_set_source(vmlx90640_source fn);
+int vmlx90640_load_frames(const char *path);
+const struct vmlx90640_stats *vmlx90640_stats(void);
+
+// Transaction level access (i2c_direct.c): whether the sensor acknowledges
+// an address byte, and its words by register address
+bool vmlx90640_address(uint8_t byte);
+uint16_t vmlx90640_read_word(uint16_t address);
+void vmlx90640_write_word(uint16_t address, uint16_t value);
+
+#endif /* VMLX90640_H */
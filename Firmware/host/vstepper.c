@@ -0,0 +1,48 @@
+/*
+  vstepper.c - Virtual EasyDriver for the pan stepper (PC1 = STEP of the
+  bottom motor, PC3 = DIR). Counts steps so scenes can follow the pan.
+*/
+
+#include "hal.h"
+#include "vstepper.h"
+
+#define STEP_BIT 1
+#define DIR_BIT 3
+
+static bool last_step = false;
+static int32_t position = 0;
+static uint32_t steps = 0;
+
+static void sample(uint64_t now) {
+    (void)now;
+    bool step = hal_is_output(HAL_PORTC, STEP_BIT) && hal_output_level(HAL_PORTC, STEP_BIT);
+
+    // The driver steps on the rising edge
+    if (step && !last_step) {
+        bool clockwise = hal_is_output(HAL_PORTC, DIR_BIT) && hal_output_level(HAL_PORTC, DIR_BIT);
+        position += clockwise ? 1 : -1;
+        steps++;
+    }
+    last_step = step;
+}
+
+// The motor does not move when the AVR resets
+static void reset(void) {
+    last_step = false;
+}
+
+static const struct hal_device device = {
+    "stepper", reset, sample, NULL, NULL
+};
+
+void vstepper_init(void) {
+    hal_add_device(&device);
+}
+
+int32_t vstepper_position(void) {
+    return position;
+}
+
+uint32_t vstepper_steps(void) {
+    return steps;
+}
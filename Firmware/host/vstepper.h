@@ -0,0 +1,12 @@
+#ifndef VSTEPPER_H
+#define VSTEPPER_H
+
+#include <stdint.h>
+
+void vstepper_init(void);
+
+// Pan position in steps from power-on, clockwise positive
+int32_t vstepper_position(void);
+uint32_t vstepper_steps(void);
+
+#endif /* VSTEPPER_H */
@@ -0,0 +1,102 @@
+/*
+  vuart.c - USART0 wired to the host: stdin/stdout by default, or a pseudo
+  terminal the Flask server (or a terminal program) can open like the
+  USB serial adapter.
+*/
+
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "vuart.h"
+
+static int in_fd = -1;
+static int out_fd = -1;
+static const char *link_path = NULL;
+static uint32_t dropped = 0;
+
+static void transmit(uint8_t byte) {
+    // Nobody reading the terminal is like nobody on the other end of the
+    // wire: the byte is lost
+    if (write(out_fd, &byte, 1) != 1) {
+        dropped++;
+    }
+}
+
+static void sample(uint64_t now) {
+    (void)now;
+
+    if (in_fd < 0 || !hal_uart_rx_ready()) {
+        return;
+    }
+
+    uint8_t byte;
+    ssize_t n = read(in_fd, &byte, 1);
+    if (n == 1) {
+        hal_uart_receive(byte);
+    } else {
+        if (n == 0 && in_fd == STDIN_FILENO) {
+            in_fd = -1;     // End of input
+        }
+        hal_uart_idle_poll();
+    }
+}
+
+static const struct hal_device device = {
+    "uart", NULL, sample, NULL, NULL
+};
+
+static void remove_link(void) {
+    if (link_path) {
+        unlink(link_path);
+    }
+}
+
+int vuart_init(bool pty, const char *link) {
+    if (!pty) {
+        in_fd = STDIN_FILENO;
+        out_fd = STDOUT_FILENO;
+        fcntl(in_fd, F_SETFL, fcntl(in_fd, F_GETFL) | O_NONBLOCK);
+    } else {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+            perror("sim: pty");
+            return -1;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        // Raw line discipline, the firmware sends CR LF itself
+        struct termios tio;
+        int slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+        if (slave >= 0 && tcgetattr(slave, &tio) == 0) {
+            cfmakeraw(&tio);
+            tcsetattr(slave, TCSANOW, &tio);
+        }
+
+        fprintf(stderr, "sim: UART on %s\n", ptsname(fd));
+        if (link) {
+            unlink(link);
+            if (symlink(ptsname(fd), link) != 0) {
+                perror(link);
+                return -1;
+            }
+            link_path = link;
+            atexit(remove_link);
+            fprintf(stderr, "sim: UART linked as %s\n", link);
+        }
+
+        // Keep the slave open so output is buffered until a reader attaches
+        in_fd = fd;
+        out_fd = fd;
+    }
+
+    hal_set_uart_tx(transmit);
+    hal_add_device(&device);
+    return 0;
+}
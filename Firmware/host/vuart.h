@@ -0,0 +1,8 @@
+#ifndef VUART_H
+#define VUART_H
+
+// Connect USART0 to stdin/stdout, or to a pseudo terminal when pty is set
+// (link, if given, is a symlink created to the terminal's device node)
+int vuart_init(bool pty, const char *link);
+
+#endif /* VUART_H */
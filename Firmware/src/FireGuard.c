@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <avr/wdt.h>
+#include <avr/interrupt.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -12,6 +13,11 @@
 #include "ultrasonic.h"
 #include "buzzer.h"
 #include "lcd.h"
+#include "config.h"
+#include "command.h"
+#include "tick.h"
+#include "storage.h"
+#include "prof.h"
 
 #ifndef F_CPU
 #define F_CPU 7372800UL
@@ -19,53 +25,142 @@
 
 #define BAUD_RATE 230400
 
-// Scanning motion parameters - easily changeable
-#define SCAN_RANGE_STEPS 800   // 120 degrees of motion (approximately)
-#define STEPS_PER_CHECK 20     // Check temperature every 20 steps
-#define MOTOR_STEP_DELAY 10    // Milliseconds between steps to control speed
-
-// Threshold temperature for fire detection (in centidegrees)
-#define FIRE_THRESHOLD 5000  // 50.00°C
-
-// Position constraints for fire confirmation (helps prevent false positives)
-#define FIRE_COL_MIN 13
-#define FIRE_COL_MAX 15
+// Scanning and detection tunables live in config.h and can be changed
+// at runtime with SET commands (see command.c)
 
 // Buzzer parameters for fire alert
 #define BUZZER_ON_TIME 3000   // 3 second buzz
 #define BUZZER_OFF_TIME 500   // 0.5 second silence
 
+// How often the command channel is polled while waiting
+#define COMMAND_POLL_MS 10
+
 // For reusing buffers
-char buffer[48];
+char buffer[64];   // Fits the longest line, "Pos: ..." with every field at its widest
+
+// Patrol position, restored from EEPROM on a warm start
+int16_t current_step = 0;
+bool scanning_forward = false;  // Start counter-clockwise
+
+// Patrol is paused while in hold mode (MODE HOLD command)
+bool hold_mode = false;
+
+// Record the patrol position, rate limited unless forced
+void save_state(bool force) {
+    struct warm_state state;
+    
+    state.current_step = current_step;
+    state.scanning_forward = scanning_forward;
+    state.hold_mode = hold_mode;
+    storage_save_state(&state, force);
+}
+
+// Read a frame, noting where the pan is for its header and the reference
+// row (the motor stands still until the frame is printed)
+static int read_frame(void) {
+    frame_pan = pan_position;
+    return mlx90640_read_center_region();
+}
+
+// Carry out an action requested over the command channel
+void handle_command(uint8_t action) {
+    switch (action) {
+        case CMD_FRAME:
+            if (read_frame() == 0) {
+                print_frame();
+            } else {
+                serial_println("Error reading thermal data");
+            }
+            break;
+        case CMD_MODE_PATROL:
+            hold_mode = false;
+            save_state(true);
+            break;
+        case CMD_MODE_HOLD:
+            hold_mode = true;
+            save_state(true);
+            break;
+        case CMD_RESET:
+            // Let the watchdog restart the unit, main() disables it again
+            save_state(true);
+            wdt_enable(WDTO_15MS);
+            while (1);
+        default:
+            break;
+    }
+}
+
+// Print one boot timing mark as " name=<ms>"
+void print_boot_mark(const char *name, uint32_t ticks) {
+    serial_print(name);
+    snprintf(buffer, sizeof(buffer), "%lu", TICKS_TO_US(ticks) / 1000UL);
+    serial_print(buffer);
+}
+
+// Delay for the given number of milliseconds while serving commands
+void wait_ms(uint16_t ms) {
+    for (uint16_t i = 0; i < ms; i++) {
+        if (i % COMMAND_POLL_MS == 0) {
+            handle_command(command_poll());
+            storage_service();
+            PROF_SERVICE();
+        }
+        _delay_ms(1);
+    }
+}
 
 int main(void) {
     // Disable watchdog
     MCUSR = 0;
     wdt_disable();
     
-    // Initialize UART
+    // Load the default tunables, then whatever was saved in EEPROM
+    config_defaults();
+    int config_loaded = storage_load_config();
+    
+    // Start the time base and the UART, commands are received by interrupt
+    tick_init();
     serial_init((F_CPU / 16 / BAUD_RATE) - 1);
+    sei();
     
     // Send welcome message
     serial_println("FireGuard System Initializing...");
+    serial_println(config_loaded == 0 ? "Configuration loaded from EEPROM" : "Using default configuration");
     
-    // Initialize thermal sensor
-    i2c_init();
-    _delay_ms(100);
+    // Resume the patrol where it was left
+    struct warm_state state;
+    if (storage_load_state(&state) == 0) {
+        current_step = state.current_step;
+        scanning_forward = state.scanning_forward;
+        hold_mode = state.hold_mode;
+        if (current_step < 0 || current_step >= config.scan_range_steps) {
+            current_step = 0;
+        }
+        // The patrol sets off counter-clockwise from where the unit
+        // powered up, so it sweeps pan positions -scan_range_steps..0
+        pan_position = scanning_forward ? current_step - config.scan_range_steps : -current_step;
+        
+        snprintf(buffer, sizeof(buffer), "Warm start at %d/%d, %s", current_step, config.scan_range_steps,
+                scanning_forward ? "clockwise" : "counter-clockwise");
+        serial_println(buffer);
+    }
     
+    // Bring up the thermal sensor first: once configured it integrates its
+    // first frame while the rest of the hardware is initialized
     int result = mlx90640_init();
     if (result != 0) {
-        sprintf(buffer, "Thermal sensor init failed: %d", result);
+        snprintf(buffer, sizeof(buffer), "Thermal sensor init failed: %d", result);
         serial_println(buffer);
     } else {
         serial_println("Thermal sensor initialized successfully");
     }
+    uint32_t boot_sensor = tick_now();
     
     // Initialize stepper motor
     setup_pins();
     
-    // Start with counter-clockwise direction (default)
-    set_stepper_direction(false);
+    // Start with counter-clockwise direction (default) or the restored one
+    set_stepper_direction(scanning_forward);
 
     // Initialize servo
     servo_init();
@@ -75,15 +170,34 @@ int main(void) {
     
     // Initialize buzzer
     buzzer_init();
+    uint32_t boot_actuators = tick_now();
 
-    // Initialize LCD
-    lcd_init();
+    // Initialize LCD, it has been powered for longer than its 15ms
+    // power-on wait by now (AVR start-up time plus the steps above)
+    lcd_init_warm();
     // hide the cursor
     lcd_writecommand(0x0c);
+    uint32_t boot_lcd = tick_now();
+    
+    // Wait for the first valid frame (up to one frame period at 2Hz)
+    if (result == 0) {
+        for (uint8_t tries = 0; tries < 5; tries++) {
+            if (read_frame() == 0) {
+                break;
+            }
+        }
+    }
+    uint32_t boot_frame = tick_now();
+    
+    // Boot timing breakdown, milliseconds since reset for each stage
+    serial_print("Boot timing (ms):");
+    print_boot_mark(" sensor=", boot_sensor);
+    print_boot_mark(" actuators=", boot_actuators);
+    print_boot_mark(" lcd=", boot_lcd);
+    print_boot_mark(" first_frame=", boot_frame);
+    serial_println("");
     
     // Main variables
-    int16_t current_step = 0;
-    bool scanning_forward = false;  // Start counter-clockwise
     bool fire_detected = false;
     
     serial_println("Starting fire detection patrol with scanning motion...");
@@ -92,14 +206,26 @@ int main(void) {
     while (1) {
         //patrol until fire detected
         while (!fire_detected) {
+            handle_command(command_poll());
+            storage_service();
+            PROF_SERVICE();
+            
+            // Motor stays put while holding
+            if (hold_mode) {
+                _delay_ms(COMMAND_POLL_MS);
+                continue;
+            }
+            
             // Step the motor once in current direction
+            PROF_BEGIN(PROF_PATROL_STEP);
             move_bottom_stepper_once();
-            _delay_ms(MOTOR_STEP_DELAY);
+            wait_ms(config.motor_step_delay);
+            PROF_END(PROF_PATROL_STEP);
             
             current_step++;
             
             // Check if we need to reverse direction
-            if (current_step >= SCAN_RANGE_STEPS) {
+            if (current_step >= config.scan_range_steps) {
                 // Change direction
                 scanning_forward = !scanning_forward;
                 set_stepper_direction(scanning_forward);
@@ -113,28 +239,42 @@ int main(void) {
                 } else {
                     serial_println("Changing direction: Counter-clockwise");
                 }
+                
+                // A stale direction would send the patrol the wrong way
+                save_state(true);
             }
             
             // Check temperature periodically
-            if (current_step % STEPS_PER_CHECK == 0) {
+            if (current_step % config.steps_per_check == 0) {
+                // Remember the check position in case power goes away,
+                // rate limited to spare the EEPROM (see storage.h)
+                save_state(false);
+                
                 // Read thermal data from sensor
-                result = mlx90640_read_center_region();
+                result = read_frame();
                 
                 // Process the reading if successful
                 if (result == 0) {
                     // Print status update
+                    PROF_BEGIN(PROF_STATUS_FORMAT);
                     int16_t int_part = max_temp / 100;
                     uint8_t frac_part = abs(max_temp) % 100;
                     
-                    sprintf(buffer, "Pos: %d/%d | Max: %d.%02d°C at [%d][%d]", 
-                            current_step, SCAN_RANGE_STEPS, int_part, frac_part, 
+                    snprintf(buffer, sizeof(buffer), "Pos: %d/%d | Max: %d.%02d°C at [%d][%d]", 
+                            current_step, config.scan_range_steps, int_part, frac_part, 
                             max_row_pos, max_col_pos);
                     serial_println(buffer);
+                    PROF_END(PROF_STATUS_FORMAT);
+                    
+                    // Every checked frame for the server's panorama (SCAN ON)
+                    if (scan_stream) {
+                        print_frame();
+                    }
 
                     // If max temp is greater than threshold set the btm stepper to move towards
-                    if (max_temp > FIRE_THRESHOLD) {
+                    if (max_temp > config.fire_threshold) {
                         // Move the stepper left or right so that the col pos is about 0-3
-                        if (max_col_pos < FIRE_COL_MIN) {
+                        if (max_col_pos < config.fire_col_min) {
                             // we always want it to move counter clockwise
                             // first check if the current direction is counter clockwise
                             if (!scanning_forward) { // If the stepper is moving counter clockwise meaning the device is moving clockwise
@@ -152,13 +292,13 @@ int main(void) {
 
 
                     // Check if fire detected (temp > threshold and in target columns)
-                    if (max_temp > FIRE_THRESHOLD && 
-                        max_col_pos >= FIRE_COL_MIN && max_col_pos <= FIRE_COL_MAX) {
+                    if (max_temp > config.fire_threshold && 
+                        max_col_pos >= config.fire_col_min && max_col_pos <= config.fire_col_max) {
                         
                         fire_detected = true;
                         
                         // Detailed fire detection message
-                        sprintf(buffer, "FIRE DETECTED! Temp: %d.%02d°C at [%d][%d]", 
+                        snprintf(buffer, sizeof(buffer), "FIRE DETECTED! Temp: %d.%02d°C at [%d][%d]", 
                                 int_part, frac_part, max_row_pos, max_col_pos);
                         serial_println(buffer);
                     }
@@ -173,6 +313,7 @@ int main(void) {
         }
         
         // Fire alert mode - motor stopped, monitoring continues
+        save_state(true);
         serial_println("Motor stopped - FIRE ALERT MODE");
         lcd_moveto(0, 0);
         // clear the screen
@@ -181,13 +322,14 @@ int main(void) {
         
         // Keep monitoring in alert mode if fire is detected
         while (fire_detected) {
-            result = mlx90640_read_center_region();
+            PROF_BEGIN(PROF_ALERT_CYCLE);
+            result = read_frame();
             
             if (result == 0) {
                 int16_t int_part = max_temp / 100;
                 uint8_t frac_part = abs(max_temp) % 100;
                 
-                sprintf(buffer, "Alert! Temp: %d.%02d°C at [%d][%d]", 
+                snprintf(buffer, sizeof(buffer), "Alert! Temp: %d.%02d°C at [%d][%d]", 
                         int_part, frac_part, max_row_pos, max_col_pos);
                 serial_println(buffer);
 
@@ -197,8 +339,9 @@ int main(void) {
                 lcd_stringout("Alert! Temp: ");
                 lcd_stringout(buffer);
                 // print out the whole arrat of temp values in a matrix form
-                // use the print_center_matrix function to print the array
-                print_center_matrix();
+                // use the print_frame function to print the array (or
+                // the raw frame, when the server asked for those)
+                print_frame();
 
                 // Measure distance with ultrasonic sensor
                 float distance = measure_distance();
@@ -220,14 +363,14 @@ int main(void) {
 
                 // Set servo to 0 and 105 degrees
                 set_servo_degree(0);
-                _delay_ms(1000);
+                wait_ms(1000);
                 set_servo_degree(105);
-                _delay_ms(1000);
+                wait_ms(1000);
             }
 
             // Check if fire is detected
-            if (max_temp > FIRE_THRESHOLD && 
-                max_col_pos >= FIRE_COL_MIN && max_col_pos <= FIRE_COL_MAX) {
+            if (max_temp > config.fire_threshold && 
+                max_col_pos >= config.fire_col_min && max_col_pos <= config.fire_col_max) {
                 fire_detected = true;
             } else {
                 fire_detected = false;
@@ -239,7 +382,8 @@ int main(void) {
             }
             
             // Update at 1Hz in alert mode
-            _delay_ms(1000);
+            wait_ms(1000);
+            PROF_END(PROF_ALERT_CYCLE);
         }
     }
     
@@ -4,11 +4,16 @@
 #include <stdio.h>
 #include <string.h>
 #include <avr/wdt.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include <math.h>
 #include <stdint.h>
 
 // Include our header
 #include "I2C.h"
+#include "prof.h"
+#include "thermal.h"
+#include "tick.h"
 
 #ifndef F_CPU
 #define F_CPU 7372800UL
@@ -49,15 +54,75 @@ int16_t center_data[CENTER_SIZE][CENTER_SIZE]; // Keep this for the 8x8 matrix
 int16_t max_temp;
 uint8_t max_row_pos;  // Position of max temperature
 uint8_t max_col_pos;
+// Row of the center region holding reference pixels, skipped in frames
+// where no row reads extreme. RAM only, learned again after every reset
+// (see read_center_region), row 7 as in the sample until then.
+uint8_t reference_row = 7;
+// Pan steps a row has to stay extreme over before it is taken for the
+// reference row: further than the center region sees (55 degrees, about
+// 245 steps), so a fire, which stays put in the room, has left the view
+#define REFERENCE_ROW_SPAN 400
+static int8_t reference_candidate = -1;    // Row extreme in every frame since...
+static int16_t reference_candidate_pan;    // ...the frame read at this pan
+// Frames read since reset and when the newest one was ready (ticks), printed
+// with the matrix so the server can tell how old it is
+uint16_t frame_seq = 0;
+uint32_t frame_ticks = 0;
+// Frames go out as the sensor's own words for the server to calibrate
+// (RAW ON, see print_raw_frame) instead of the converted matrix. Not kept
+// across a reset; the server turns it on again when it sees the unit start.
+uint8_t raw_stream = 0;
+// Frames of every patrol check are printed too (SCAN ON), for the server
+// to stitch into a panorama by their pan position. RAM only like raw_stream.
+uint8_t scan_stream = 0;
+// Pan position (stepper.h) the newest frame was read at, set by the
+// caller before reading it, printed in the header as "pan=<steps>"
+int16_t frame_pan = 0;
 uint8_t i2c_initialized = 0;
 // Shared buffer for string operations
 char string_buffer[8]; 
 
+// UART receive ring buffer, filled by the RX complete interrupt. Commands
+// are only taken out between sensor reads, which take up to ~560 ms, so it
+// holds a few full command lines (COMMAND_LINE_MAX).
+#define SERIAL_RX_SIZE 128  // Must be a power of two, at most 256
+#define SERIAL_RX_MASK (SERIAL_RX_SIZE - 1)
+volatile char serial_rx_buf[SERIAL_RX_SIZE];
+volatile uint8_t serial_rx_head = 0;   // Written by the ISR only
+volatile uint8_t serial_rx_tail = 0;   // Written by the main loop only
+volatile uint8_t serial_rx_overflow = 0;   // Bytes dropped, SERIAL_RX_LOST not queued yet
+
+// RX complete interrupt - store the byte. While the buffer is full bytes
+// are dropped; the first one stored after that is preceded by
+// SERIAL_RX_LOST, so the reader knows where the gap is.
+ISR(USART_RX_vect) {
+    char ch = UDR0;
+    uint8_t next = (serial_rx_head + 1) & SERIAL_RX_MASK;
+    
+    if (serial_rx_overflow) {
+        if (next == serial_rx_tail) {
+            return;
+        }
+        serial_rx_buf[serial_rx_head] = SERIAL_RX_LOST;
+        serial_rx_head = next;
+        serial_rx_overflow = 0;
+        next = (serial_rx_head + 1) & SERIAL_RX_MASK;
+    }
+    
+    if (next == serial_rx_tail) {
+        serial_rx_overflow = 1;
+        return;
+    }
+    
+    serial_rx_buf[serial_rx_head] = ch;
+    serial_rx_head = next;
+}
+
 // Serial communication functions
 void serial_init(unsigned short ubrr) {
     UBRR0H = (unsigned char)(ubrr >> 8); 
     UBRR0L = (unsigned char)ubrr;        
-    UCSR0B = (1 << TXEN0) | (1 << RXEN0); 
+    UCSR0B = (1 << TXEN0) | (1 << RXEN0) | (1 << RXCIE0); 
     UCSR0C = (3 << UCSZ00);              
 }
 
@@ -66,9 +131,30 @@ void serial_out(char ch) {
     UDR0 = ch; 
 }
 
+// Number of received bytes waiting in the ring buffer
+uint8_t serial_available(void) {
+    return (serial_rx_head - serial_rx_tail) & SERIAL_RX_MASK;
+}
+
+// Whether bytes were dropped after everything read so far and nothing
+// arrived since, which SERIAL_RX_LOST cannot mark yet; clears it
+uint8_t serial_rx_lost(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t lost = serial_rx_overflow && serial_rx_head == serial_rx_tail;
+    if (lost) {
+        serial_rx_overflow = 0;
+    }
+    SREG = sreg;
+    return lost;
+}
+
+// Blocking read of the next received byte (needs interrupts enabled)
 char serial_in() {
-    while (!(UCSR0A & (1 << RXC0))); 
-    return UDR0; 
+    while (serial_rx_head == serial_rx_tail); 
+    char ch = serial_rx_buf[serial_rx_tail];
+    serial_rx_tail = (serial_rx_tail + 1) & SERIAL_RX_MASK;
+    return ch; 
 }
 
 void serial_print(const char *str) {
@@ -99,10 +185,11 @@ void i2c_stop(void);  // Forward declaration
 void i2c_init() {
     if (i2c_initialized) return;
     
-    // Set SDA and SCL as inputs with pull-ups enabled
+    // Set SDA and SCL as inputs with pull-ups enabled, the lines settle
+    // within microseconds
     DDRC &= ~((1 << PC4) | (1 << PC5));
     PORTC |= (1 << PC4) | (1 << PC5);
-    _delay_ms(10);
+    _delay_us(10);
     
     // Send a stop condition to reset the bus
     i2c_stop();
@@ -274,7 +361,11 @@ int mlx90640_check_data_ready() {
     return -1;  // Timeout
 }
 
-// Read a single pixel value directly
+// Read a single pixel value directly. The datasheet gives one word per
+// pixel (0x0400 + row * 32 + col), which the raw frame dump uses; this
+// read keeps the addressing the unit ships with, which the extreme row
+// and row 9 filters were tuned on. Changing it needs checking them on a
+// real sensor first.
 int16_t read_pixel_value(uint8_t row, uint8_t col) {
     uint16_t pixelAddr = 0x0400 + ((row * MLX90640_WIDTH + col) * 2);
     uint16_t rawValue;
@@ -313,62 +404,52 @@ int16_t validate_temp(int16_t raw_value, uint8_t row, uint8_t col) {
     return raw_value;
 }
 
-// Set refresh rate
-int mlx90640_set_refresh_rate(uint8_t rate) {
-    uint16_t controlReg;
-    
-    if (mlx90640_i2c_read(MLX90640_I2CADDR, 0x800D, &controlReg, 1) != 0) {
-        return -1;
-    }
-    
-    // Clear and set refresh rate bits (7:5)
-    controlReg &= ~(0x07 << 7);
-    controlReg |= (rate & 0x07) << 7;
-    
-    return mlx90640_i2c_write(MLX90640_I2CADDR, 0x800D, controlReg);
-}
+// Control register 0x800D fields we configure
+#define MLX90640_CTRL_REFRESH_MASK (0x07 << 7)   // Refresh rate, bits 9:7
+#define MLX90640_CTRL_RES_MASK     (0x03 << 10)  // ADC resolution, bits 11:10
+#define MLX90640_CTRL_CHESS        (1 << 12)     // Chess pattern mode
 
-// Set resolution
-int mlx90640_set_resolution(uint8_t resolution) {
+// Set refresh rate, resolution and chess mode with a single read of the
+// control register, and only write it back if something has to change.
+// After a warm restart of the AVR the sensor usually needs no write at all.
+int mlx90640_configure(uint8_t rate, uint8_t resolution) {
     uint16_t controlReg;
     
     if (mlx90640_i2c_read(MLX90640_I2CADDR, 0x800D, &controlReg, 1) != 0) {
-        return -1;
+        return -2;
     }
     
-    // Clear and set resolution bits (11:10)
-    controlReg &= ~(0x03 << 10);
-    controlReg |= (resolution & 0x03) << 10;
-    
-    return mlx90640_i2c_write(MLX90640_I2CADDR, 0x800D, controlReg);
-}
-
-// Set chess mode
-int mlx90640_set_chess_mode() {
-    uint16_t controlReg;
+    uint16_t wanted = controlReg;
+    wanted &= ~(MLX90640_CTRL_REFRESH_MASK | MLX90640_CTRL_RES_MASK);
+    wanted |= (uint16_t)(rate & 0x07) << 7;
+    wanted |= (uint16_t)(resolution & 0x03) << 10;
+    wanted |= MLX90640_CTRL_CHESS;
     
-    if (mlx90640_i2c_read(MLX90640_I2CADDR, 0x800D, &controlReg, 1) != 0) {
-        return -1;
+    if (wanted == controlReg) {
+        return 1;  // Already configured
     }
     
-    // Set chess mode bit (12)
-    controlReg |= (1 << 12);
-    
-    return mlx90640_i2c_write(MLX90640_I2CADDR, 0x800D, controlReg);
+    if (mlx90640_i2c_write(MLX90640_I2CADDR, 0x800D, wanted) != 0) {
+        return -3;
+    }
+    return 0;
 }
 
 // Initialize MLX90640
 int mlx90640_init() {
     uint16_t id;
+    uint8_t tries = 10;
     
     // Initialize I2C
     i2c_init();
-    _delay_ms(50);
     
-    // Check device ID
-    if (mlx90640_i2c_read(MLX90640_I2CADDR, 0x2407, &id, 1) != 0) {
-        serial_println("Failed to read device ID");
-        return -1;
+    // Check device ID, retrying while the sensor finishes its power-on
+    while (mlx90640_i2c_read(MLX90640_I2CADDR, 0x2407, &id, 1) != 0) {
+        if (--tries == 0) {
+            serial_println("Failed to read device ID");
+            return -1;
+        }
+        _delay_ms(5);
     }
     
     serial_print("Device ID: 0x");
@@ -376,46 +457,36 @@ int mlx90640_init() {
     sprintf(buffer, "%04X", id);
     serial_println(buffer);
     
-    // Configure sensor
-    if (mlx90640_set_refresh_rate(0x03) != 0) { // 4Hz
-        serial_println("Failed to set refresh rate");
-        return -2;
-    }
-    
-    if (mlx90640_set_resolution(0x02) != 0) { // 18-bit
-        serial_println("Failed to set resolution");
-        return -3;
-    }
-    
-    if (mlx90640_set_chess_mode() != 0) {
-        serial_println("Failed to set chess mode");
-        return -4;
+    // Configure sensor: 4Hz, 18-bit, chess mode
+    int result = mlx90640_configure(0x03, 0x02);
+    if (result < 0) {
+        serial_println("Failed to configure sensor");
+        return result;
     }
     
-    serial_println("MLX90640 configured successfully");
+    serial_println(result > 0 ? "MLX90640 already configured" : "MLX90640 configured successfully");
     return 0;
 }
 
 // Read and process center region
-int mlx90640_read_center_region() {
+static int read_center_region(void) {
     // Reset max value to a very low temperature to ensure any valid reading will be higher
     max_temp = -32768;
     max_row_pos = 0;
     max_col_pos = 0;
     int valid_readings = 0;
-    int row_to_skip = -1; // Initialize to invalid row
-    int max_row = 0;  // Track location of max temperature
-    int max_col = 0;
+    int8_t row_to_skip = -1; // Initialize to invalid row
     
     // Wait for data ready
     if (mlx90640_check_data_ready() != 0) {
         serial_println("Timeout waiting for data");
         return -1;
     }
+    frame_ticks = tick_now();
+    frame_seq++;
     
     // Process one row at a time to save memory
     for (uint8_t i = 0; i < CENTER_SIZE; i++) {
-        int16_t row_buffer[CENTER_SIZE];
         int row_has_extreme = 0;
         
         // Read a row of data
@@ -427,9 +498,6 @@ int mlx90640_read_center_region() {
             // Read pixel
             int16_t value = read_pixel_value(row, col);
             
-            // Store temporarily
-            row_buffer[j] = value;
-            
             // Check if this is an extreme value (like reference pixel)
             if (value > 14000) { // 140°C is extreme for this application
                 row_has_extreme = 1;
@@ -442,18 +510,24 @@ int mlx90640_read_center_region() {
         }
     }
     
-    // If no extreme row found, default to row 7 (which contained extreme value in sample)
+    // A row that stays extreme while the pan moves further than the
+    // sensor sees is the reference pixels, not something in the room
+    if (row_to_skip == -1 || row_to_skip != reference_candidate) {
+        reference_candidate = row_to_skip;
+        reference_candidate_pan = frame_pan;
+    } else if (abs(frame_pan - reference_candidate_pan) >= REFERENCE_ROW_SPAN) {
+        reference_row = row_to_skip;
+    }
+    
+    // If no extreme row found, fall back to the reference row
     if (row_to_skip == -1) {
-        row_to_skip = 7;
+        row_to_skip = reference_row;
     }
     
     serial_print("Removing row with extreme values: ");
-    sprintf(string_buffer, "%d", row_to_skip);
+    snprintf(string_buffer, sizeof(string_buffer), "%d", row_to_skip);
     serial_println(string_buffer);
     
-    // Reset max_temp AGAIN before second pass to ensure we only consider valid readings
-    max_temp = -32768;
-    
     // Second pass: process row by row and fill center_data, skipping the extreme row
     uint8_t dest_row = 0; // Keep track of destination row after skipping
     
@@ -472,22 +546,17 @@ int mlx90640_read_center_region() {
             // Store the validated value
             center_data[dest_row][j] = validated_value;
             valid_readings++;
-            
-            // Update max temp (ensure we're looking for actual highest value)
-            // Only consider reasonably valid temperatures (not extreme outliers)
-            if (validated_value > max_temp && validated_value < 10000) { // 100°C as reasonable max
-                max_temp = validated_value;
-                max_row = dest_row;
-                max_col = j;
-            }
         }
         
         dest_row++; // Move to next destination row
     }
     
-    // Store max location in global variables for printing
-    max_row_pos = max_row;
-    max_col_pos = max_col;
+    // Find the max temp over the rows kept, only considering reasonably
+    // valid temperatures (100°C as reasonable max, not extreme outliers)
+    uint16_t max_index;
+    max_temp = thermal_max(&center_data[0][0], dest_row * CENTER_SIZE, 10000, &max_index);
+    max_row_pos = max_index / CENTER_SIZE;
+    max_col_pos = max_index % CENTER_SIZE;
     
     // Return error if no valid readings
     if (valid_readings == 0) {
@@ -497,9 +566,35 @@ int mlx90640_read_center_region() {
     return 0;
 }
 
+int mlx90640_read_center_region() {
+    PROF_BEGIN(PROF_MLX_READ);
+    int result = read_center_region();
+    PROF_END(PROF_MLX_READ);
+    return result;
+}
+
 // Print center matrix data
 void print_center_matrix() {
-    serial_println("\nCenter Matrix Data (abnormal row removed):");
+    PROF_BEGIN(PROF_MATRIX_PRINT);
+    uint32_t sent = tick_now();
+    char stamp[12];
+    
+    // Header, stamped for latency tracing: "seq=<frame> acquired=<ticks>
+    // sent=<ticks> rows=<n>", ticks of the data being ready and of this
+    // line, and with "pan=<steps>" where the sensor was pointing
+    serial_print("\nCenter Matrix Data (abnormal row removed):");
+    sprintf(stamp, " seq=%u", frame_seq);
+    serial_print(stamp);
+    sprintf(stamp, "%lu", (unsigned long)frame_ticks);
+    serial_print(" acquired=");
+    serial_print(stamp);
+    sprintf(stamp, "%lu", (unsigned long)sent);
+    serial_print(" sent=");
+    serial_print(stamp);
+    sprintf(stamp, " rows=%u", CENTER_SIZE - 1);
+    serial_print(stamp);
+    sprintf(stamp, " pan=%d", frame_pan);
+    serial_println(stamp);
     
     // Column headers
     serial_print("     ");
@@ -534,6 +629,111 @@ void print_center_matrix() {
         }
         serial_println("");
     }
+    PROF_END(PROF_MATRIX_PRINT);
+}
+
+// Words per line of a raw dump: one row of pixels, read in one transaction
+#define RAW_LINE_WORDS 32
+#define RAM_LINES 26        // Frame RAM 0x0400-0x073F, pixels and the auxiliary data
+#define EEPROM_LINES 26     // Calibration EEPROM 0x2400-0x273F
+
+static const char base64_digits[64] PROGMEM =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Print words in base64, each big endian as it came off the bus
+static void print_base64_words(const uint16_t *words, uint8_t count) {
+    uint8_t bytes[3];
+    uint8_t n = 0;
+    char out[5];
+    
+    out[4] = '\0';
+    for (uint8_t i = 0; i < count * 2; i++) {
+        bytes[n++] = (i & 1) ? (uint8_t)words[i / 2] : (uint8_t)(words[i / 2] >> 8);
+        if (n < 3 && i < count * 2 - 1) {
+            continue;
+        }
+        out[0] = pgm_read_byte(&base64_digits[bytes[0] >> 2]);
+        out[1] = pgm_read_byte(&base64_digits[((bytes[0] & 0x03) << 4) | (n > 1 ? bytes[1] >> 4 : 0)]);
+        out[2] = n > 1 ? pgm_read_byte(&base64_digits[((bytes[1] & 0x0F) << 2) | (n > 2 ? bytes[2] >> 6 : 0)]) : '=';
+        out[3] = n > 2 ? pgm_read_byte(&base64_digits[bytes[2] & 0x3F]) : '=';
+        serial_print(out);
+        n = 0;
+    }
+}
+
+// Print "<tag> <line> <base64>" for each RAW_LINE_WORDS words from address,
+// "<tag> <line> ERR" for a line that could not be read
+static void print_sensor_words(const char *tag, uint16_t address, uint8_t lines) {
+    uint16_t words[RAW_LINE_WORDS];
+    char buffer[8];
+    
+    for (uint8_t line = 0; line < lines; line++) {
+        serial_print(tag);
+        sprintf(buffer, " %u ", line);
+        serial_print(buffer);
+        if (mlx90640_i2c_read(MLX90640_I2CADDR, address + line * RAW_LINE_WORDS,
+                              words, RAW_LINE_WORDS) != 0) {
+            serial_println("ERR");
+            continue;
+        }
+        print_base64_words(words, RAW_LINE_WORDS);
+        serial_println("");
+    }
+}
+
+// Print the sensor's whole frame RAM for the server to calibrate, with
+// none of the per pixel conversion or formatting of the matrix. The header
+// is stamped like the matrix's and carries the status and control
+// registers the calibration needs:
+//   Raw Frame Data: seq=12 acquired=316072 sent=379858 rows=26 pan=-120 status=0009 control=1901
+// then "RAW <line> <base64>" lines of 32 words. The RAM is read as it is
+// now, which may be a subpage newer than the frame just analysed; status
+// says which one it holds.
+void print_raw_frame(void) {
+    PROF_BEGIN(PROF_MATRIX_PRINT);
+    uint16_t status = 0;
+    uint16_t control = 0;
+    char stamp[16];
+    
+    mlx90640_i2c_read(MLX90640_I2CADDR, 0x8000, &status, 1);
+    mlx90640_i2c_read(MLX90640_I2CADDR, 0x800D, &control, 1);
+    uint32_t sent = tick_now();
+    
+    serial_print("\nRaw Frame Data:");
+    sprintf(stamp, " seq=%u", frame_seq);
+    serial_print(stamp);
+    sprintf(stamp, "%lu", (unsigned long)frame_ticks);
+    serial_print(" acquired=");
+    serial_print(stamp);
+    sprintf(stamp, "%lu", (unsigned long)sent);
+    serial_print(" sent=");
+    serial_print(stamp);
+    sprintf(stamp, " rows=%u", RAM_LINES);
+    serial_print(stamp);
+    sprintf(stamp, " pan=%d", frame_pan);
+    serial_print(stamp);
+    sprintf(stamp, " status=%04X", status);
+    serial_print(stamp);
+    sprintf(stamp, " control=%04X", control);
+    serial_println(stamp);
+    
+    print_sensor_words("RAW", 0x0400, RAM_LINES);
+    PROF_END(PROF_MATRIX_PRINT);
+}
+
+// Print the sensor's calibration EEPROM as "EE <line> <base64>" lines, for
+// the server to calibrate raw frames with
+void mlx90640_print_eeprom(void) {
+    print_sensor_words("EE", 0x2400, EEPROM_LINES);
+}
+
+// Print the frame just read, raw or as the matrix (RAW ON|OFF)
+void print_frame(void) {
+    if (raw_stream) {
+        print_raw_frame();
+    } else {
+        print_center_matrix();
+    }
 }
 
 // Test I2C communication
@@ -575,11 +775,7 @@ int main() {
     serial_println("ATmega328P with MLX90640 - Real Sensor Reading");
     serial_println("Thermal Camera (55 degree FoV, 24x32 sensors)");
     
-    // Initialize I2C
-    i2c_init();
-    _delay_ms(100);
-    
-    // Initialize MLX90640
+    // Initialize MLX90640 (also brings up I2C)
     int result = mlx90640_init();
     if (result != 0) {
         serial_print("Initialization failed: ");
@@ -11,9 +11,21 @@ extern int16_t center_data[CENTER_SIZE][CENTER_SIZE];
 extern int16_t max_temp;
 extern uint8_t max_row_pos;
 extern uint8_t max_col_pos;
+extern uint8_t reference_row;
+extern uint16_t frame_seq;
+extern uint32_t frame_ticks;
+extern uint8_t raw_stream;
+extern uint8_t scan_stream;
+extern int16_t frame_pan;
+
+// Read from the receive buffer where received bytes had to be dropped
+#define SERIAL_RX_LOST '\0'
 
 // Serial communication functions
 void serial_init(unsigned short ubrr);
+uint8_t serial_available(void);
+uint8_t serial_rx_lost(void);
+char serial_in(void);
 void serial_print(const char *str);
 void serial_println(const char *str);
 void print_temp(int16_t value);
@@ -27,7 +39,11 @@ uint8_t i2c_read(uint8_t ack);
 
 // MLX90640 sensor functions
 int mlx90640_init(void);
+int mlx90640_configure(uint8_t rate, uint8_t resolution);
 int mlx90640_read_center_region(void);
 void print_center_matrix(void);
+void print_raw_frame(void);
+void print_frame(void);
+void mlx90640_print_eeprom(void);
 
 #endif /* I2C_H */ 
\ No newline at end of file
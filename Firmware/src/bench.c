@@ -0,0 +1,310 @@
+/*
+  bench.c - On-target microbenchmarks for the driver primitives
+
+  Built with "make bench" and flashed with "make flash-bench". Prints a
+  report that tools/bench_report.py can parse and compare:
+
+      BENCH BEGIN f_cpu=7372800 overhead=<cycles>
+      BENCH name=<name> iters=<n> min=<cycles> avg=<cycles> max=<cycles> avg_us=<us> timer=<timer> overflows=<n>
+      BENCH END
+
+  Short operations are timed with Timer1 at the full CPU clock (exact
+  cycles, minus the measured timer overhead). overhead is that cost of
+  starting and stopping Timer1 with nothing in between, already taken
+  off every timer1 result. The Timer0 and serial RX interrupts are masked
+  meanwhile, so their handlers do not land in the counts; a tick overflow
+  or a received byte is served as soon as they are unmasked. Operations
+  longer than one Timer1 period (8.9ms) are timed with the Timer0 tick,
+  64 cycles per tick. overflows counts the runs that still overran Timer1;
+  they are left out of iters and the statistics.
+*/
+
+#include <avr/io.h>
+#include <avr/wdt.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "I2C.h"
+#include "ultrasonic.h"
+#include "lcd.h"
+#include "tick.h"
+
+#ifndef F_CPU
+#define F_CPU 7372800UL
+#endif
+
+#define BAUD_RATE 230400
+
+#define MLX90640_I2CADDR 0x33
+
+#define TIMER_CYCLES 0   // Timer1, exact cycle counts
+#define TIMER_TICKS  1   // Timer0 tick, 64 cycle resolution
+
+#define CYCLES_OVERFLOW 0xFFFFFFFFUL    // cycles_stop() result when Timer1 overflowed
+
+struct bench_result {
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+    uint16_t iters;
+    uint16_t overflows;     // Runs too long for Timer1, not in the above
+};
+
+char buffer[64];
+uint16_t timer1_overhead = 0;
+
+// Timer1 runs at the CPU clock between cycles_start() and cycles_stop().
+// Its overflow interrupt (used by the ultrasonic driver) is masked meanwhile,
+// and so are the Timer0 tick and serial RX interrupts until cycles_stop().
+static void cycles_start(void) {
+    TIMSK0 &= ~(1 << TOIE0);
+    UCSR0B &= ~(1 << RXCIE0);
+    TIMSK1 = 0;
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    TIFR1 = (1 << TOV1);
+    TCCR1B = (1 << CS10);
+}
+
+// Returns the elapsed cycles, or CYCLES_OVERFLOW if Timer1 overflowed
+static uint32_t cycles_stop(void) {
+    uint16_t count = TCNT1;
+    TCCR1B = 0;
+    TIMSK0 |= (1 << TOIE0);
+    UCSR0B |= (1 << RXCIE0);
+    
+    if (TIFR1 & (1 << TOV1)) {
+        return CYCLES_OVERFLOW;
+    }
+    return count > timer1_overhead ? count - timer1_overhead : 0;
+}
+
+static void result_reset(struct bench_result *result) {
+    result->min = 0xFFFFFFFFUL;
+    result->max = 0;
+    result->total = 0;
+    result->iters = 0;
+    result->overflows = 0;
+}
+
+static void result_add(struct bench_result *result, uint32_t cycles) {
+    if (cycles == CYCLES_OVERFLOW) {
+        result->overflows++;
+        return;
+    }
+    if (cycles < result->min) result->min = cycles;
+    if (cycles > result->max) result->max = cycles;
+    result->total += cycles;
+    result->iters++;
+}
+
+static void result_print(const char *name, struct bench_result *result, uint8_t timer) {
+    uint32_t avg = result->iters ? result->total / result->iters : 0;
+    uint32_t min = result->iters ? result->min : 0;
+    
+    serial_print("BENCH name=");
+    serial_print(name);
+    sprintf(buffer, " iters=%u min=%lu avg=%lu max=%lu", result->iters,
+            (unsigned long)min, (unsigned long)avg, (unsigned long)result->max);
+    serial_print(buffer);
+    // Cycles to microseconds: cycles * 1e6 / F_CPU = cycles * 625 / 4608,
+    // whole units of 4608 first as cycles * 625 wraps past 0.93 s
+    sprintf(buffer, " avg_us=%lu timer=%s",
+            (unsigned long)(avg / 4608UL * 625UL + avg % 4608UL * 625UL / 4608UL),
+            timer == TIMER_CYCLES ? "timer1" : "tick");
+    serial_print(buffer);
+    sprintf(buffer, " overflows=%u", result->overflows);
+    serial_println(buffer);
+}
+
+// Address the sensor for reading register reg, leaves the bus mid transfer
+static uint8_t start_read(uint16_t reg) {
+    i2c_start();
+    if (i2c_write(MLX90640_I2CADDR << 1) ||
+        i2c_write(reg >> 8) || i2c_write(reg & 0xFF)) {
+        return 1;
+    }
+    i2c_start();
+    return i2c_write((MLX90640_I2CADDR << 1) | 0x01);
+}
+
+static void bench_i2c_write(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    for (uint8_t i = 0; i < 32; i++) {
+        i2c_start();
+        cycles_start();
+        i2c_write(MLX90640_I2CADDR << 1);
+        result_add(&result, cycles_stop());
+        i2c_stop();
+    }
+    result_print("i2c_write", &result, TIMER_CYCLES);
+}
+
+static void bench_i2c_read(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    for (uint8_t i = 0; i < 32; i++) {
+        if (start_read(0x2407) != 0) {
+            i2c_stop();
+            continue;
+        }
+        cycles_start();
+        i2c_read(1);
+        result_add(&result, cycles_stop());
+        i2c_read(0);
+        i2c_stop();
+    }
+    result_print("i2c_read", &result, TIMER_CYCLES);
+}
+
+static void bench_frame(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        uint32_t start = tick_now();
+        int status = mlx90640_read_center_region();
+        uint32_t ticks = tick_now() - start;
+        if (status == 0) {
+            result_add(&result, ticks * 64);
+        }
+    }
+    result_print("frame_acquire", &result, TIMER_TICKS);
+}
+
+static void bench_matrix_print(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        uint32_t start = tick_now();
+        print_center_matrix();
+        result_add(&result, (tick_now() - start) * 64);
+    }
+    result_print("matrix_print", &result, TIMER_TICKS);
+}
+
+static void bench_lcd_string(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    for (uint8_t i = 0; i < 8; i++) {
+        lcd_moveto(0, 0);
+        uint32_t start = tick_now();
+        lcd_stringout("FireGuard bench!");
+        result_add(&result, (tick_now() - start) * 64);
+    }
+    result_print("lcd_string16", &result, TIMER_TICKS);
+}
+
+static void bench_distance(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    // Give Timer1 back to the ultrasonic driver
+    ultrasonic_init();
+    for (uint8_t i = 0; i < 8; i++) {
+        uint32_t start = tick_now();
+        measure_distance();
+        result_add(&result, (tick_now() - start) * 64);
+        _delay_ms(60);  // Let echoes die down between pings
+    }
+    result_print("distance", &result, TIMER_TICKS);
+}
+
+static void bench_formatting(void) {
+    struct bench_result status, cell, distance, temp;
+    char line[48];
+    result_reset(&status);
+    result_reset(&cell);
+    result_reset(&distance);
+    result_reset(&temp);
+    
+    for (uint8_t i = 0; i < 32; i++) {
+        int16_t value = 2512 + i * 37;
+        
+        // Status line as printed by the patrol loop
+        cycles_start();
+        sprintf(line, "Pos: %d/%d | Max: %d.%02d°C at [%d][%d]",
+                i * 20, 800, value / 100, abs(value) % 100, 7, 14);
+        result_add(&status, cycles_stop());
+        
+        // One cell of the center matrix
+        cycles_start();
+        sprintf(line, "%4d", value / 100);
+        result_add(&cell, cycles_stop());
+        
+        // Distance as printed in alert mode
+        cycles_start();
+        dtostrf(123.45 + i, 6, 2, line);
+        result_add(&distance, cycles_stop());
+        
+        // Fixed point temperature, as in print_temp()
+        cycles_start();
+        sprintf(line, "%d.%02d", value / 100, (uint8_t)(abs(value) % 100));
+        result_add(&temp, cycles_stop());
+    }
+    result_print("fmt_status_line", &status, TIMER_CYCLES);
+    result_print("fmt_matrix_cell", &cell, TIMER_CYCLES);
+    result_print("fmt_distance", &distance, TIMER_CYCLES);
+    result_print("fmt_temp", &temp, TIMER_CYCLES);
+}
+
+static void bench_serial_line(void) {
+    struct bench_result result;
+    result_reset(&result);
+    
+    // 40 characters plus CR LF, bounded by the 230400 baud line rate
+    for (uint8_t i = 0; i < 8; i++) {
+        uint32_t start = tick_now();
+        serial_println("0123456789012345678901234567890123456789");
+        result_add(&result, (tick_now() - start) * 64);
+    }
+    result_print("serial_line40", &result, TIMER_TICKS);
+}
+
+int main(void) {
+    // Disable watchdog
+    MCUSR = 0;
+    wdt_disable();
+    
+    tick_init();
+    serial_init((F_CPU / 16 / BAUD_RATE) - 1);
+    sei();
+    
+    lcd_init();
+    int sensor = mlx90640_init();
+    
+    // Cost of starting and stopping Timer1 with nothing in between
+    timer1_overhead = 0;
+    cycles_start();
+    timer1_overhead = (uint16_t)cycles_stop();
+    
+    sprintf(buffer, "BENCH BEGIN f_cpu=%lu overhead=%u", (unsigned long)F_CPU, timer1_overhead);
+    serial_println(buffer);
+    
+    bench_formatting();
+    bench_serial_line();
+    bench_lcd_string();
+    if (sensor == 0) {
+        bench_i2c_write();
+        bench_i2c_read();
+        bench_frame();
+        bench_matrix_print();
+    } else {
+        serial_println("BENCH skip=sensor");
+    }
+    bench_distance();
+    
+    serial_println("BENCH END");
+    
+    while (1);
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <util/delay.h>
 #include <stdint.h>
 #include "buzzer.h"
+#include "prof.h"
 
 // Buzzer connected to PD5
 #define BUZZER_PIN PD5
@@ -68,9 +69,11 @@ void buzzer_silent(uint16_t duration_ms) {
 }
 
 void buzzer_warning(void) {
+    PROF_BEGIN(PROF_BUZZER);
     for (int i = 0; i < 12; i++) {
         buzzer_sound(BUZZ_DURATION_MS);
         buzzer_silent(SILENT_DURATION_MS);
         _delay_us(10);
     }
+    PROF_END(PROF_BUZZER);
 }
\ No newline at end of file
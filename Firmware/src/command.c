@@ -0,0 +1,314 @@
+/*
+  command.c - Line based command channel on the UART
+
+  Commands are ASCII lines terminated by '\n', optionally prefixed with a
+  sequence number that is echoed in the reply:
+
+      [#<seq>] GET [<key>]
+      [#<seq>] SET <key> <value>
+      [#<seq>] DEFAULTS
+      [#<seq>] MODE PATROL|HOLD
+      [#<seq>] FRAME
+      [#<seq>] TIME              (tick count, for clock sync)
+      [#<seq>] RAW ON|OFF        (frames as the sensor's words, see print_raw_frame)
+      [#<seq>] EEPROM            (the sensor's calibration data)
+      [#<seq>] SCAN ON|OFF       (print the frame of every patrol check)
+      [#<seq>] RESET
+      [#<seq>] PROF [RESET]      (profiler builds only)
+
+  Every command is answered with "ACK #<seq> ..." or "NAK #<seq> <reason>".
+  Lines without a sequence number are answered with #0. When the receive
+  buffer overflowed the line it cut into is dropped and answered with
+  "NAK #0 OVERFLOW": whoever sent it has to send it again.
+*/
+
+#include <avr/io.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "I2C.h"
+#include "config.h"
+#include "command.h"
+#include "prof.h"
+#include "tick.h"
+
+// Line being assembled from the RX ring buffer
+static char line[COMMAND_LINE_MAX];
+static uint8_t line_len = 0;
+static uint8_t line_overflow = 0;   // LINE_LOST or LINE_LONG when it is not run
+
+#define LINE_LOST 1     // Bytes of it were dropped, answered already
+#define LINE_LONG 2     // Longer than COMMAND_LINE_MAX
+
+static void reply(const char *status, uint16_t seq, const char *detail) {
+    char buffer[12];    // " #65535 "
+    
+    serial_print(status);
+    snprintf(buffer, sizeof(buffer), " #%u ", seq);
+    serial_print(buffer);
+    serial_println(detail);
+}
+
+// Print "<key>=<value>" for one tunable
+static void print_key(uint8_t index) {
+    char name[17];
+    char buffer[8];     // "=-32768"
+    
+    config_name(index, name);
+    serial_print(name);
+    snprintf(buffer, sizeof(buffer), "=%d", config_get(index));
+    serial_print(buffer);
+}
+
+static void reply_key(uint16_t seq, const char *verb, uint8_t index) {
+    char buffer[12];    // "ACK #65535 "
+    
+    snprintf(buffer, sizeof(buffer), "ACK #%u ", seq);
+    serial_print(buffer);
+    serial_print(verb);
+    serial_print(" ");
+    print_key(index);
+    serial_println("");
+}
+
+// Parse a decimal integer, returns -1 if the token is not a valid int16_t
+static int parse_int(const char *token, int16_t *value) {
+    char *end;
+    long parsed;
+    
+    if (token == NULL || *token == '\0') {
+        return -1;
+    }
+    
+    parsed = strtol(token, &end, 10);
+    if (*end != '\0' || parsed < -32768 || parsed > 32767) {
+        return -1;
+    }
+    
+    *value = (int16_t)parsed;
+    return 0;
+}
+
+static uint8_t execute(char *cmd) {
+    uint16_t seq = 0;
+    char *verb = strtok(cmd, " ");
+    
+    if (verb == NULL) {
+        return CMD_NONE;  // Blank line
+    }
+    
+    // Optional sequence number prefix
+    if (verb[0] == '#') {
+        seq = (uint16_t)strtoul(verb + 1, NULL, 10);
+        verb = strtok(NULL, " ");
+        if (verb == NULL) {
+            reply("NAK", seq, "EMPTY");
+            return CMD_NONE;
+        }
+    }
+    
+    char *arg1 = strtok(NULL, " ");
+    char *arg2 = strtok(NULL, " ");
+    
+    if (strcmp(verb, "GET") == 0) {
+        if (arg1 == NULL) {
+            // Dump every tunable on one line
+            char buffer[16];    // "ACK #65535 GET"
+            snprintf(buffer, sizeof(buffer), "ACK #%u GET", seq);
+            serial_print(buffer);
+            for (uint8_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+                serial_print(" ");
+                print_key(i);
+            }
+            serial_println("");
+            return CMD_NONE;
+        }
+        
+        int8_t index = config_find(arg1);
+        if (index < 0) {
+            reply("NAK", seq, "KEY");
+            return CMD_NONE;
+        }
+        reply_key(seq, "GET", index);
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "SET") == 0) {
+        int16_t value;
+        int8_t index = (arg1 != NULL) ? config_find(arg1) : -1;
+        
+        if (index < 0) {
+            reply("NAK", seq, "KEY");
+            return CMD_NONE;
+        }
+        if (parse_int(arg2, &value) != 0) {
+            reply("NAK", seq, "VALUE");
+            return CMD_NONE;
+        }
+        int result = config_set(index, value);
+        if (result != 0) {
+            // Out of its range, or an empty FIRE_COL_MIN..FIRE_COL_MAX
+            reply("NAK", seq, result == -2 ? "CONFLICT" : "VALUE");
+            return CMD_NONE;
+        }
+        reply_key(seq, "SET", index);
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "DEFAULTS") == 0) {
+        // Back to the compile-time values, saved like any other change
+        config_defaults();
+        config_dirty = 1;
+        reply("ACK", seq, "DEFAULTS");
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "MODE") == 0) {
+        if (arg1 != NULL && strcmp(arg1, "PATROL") == 0) {
+            reply("ACK", seq, "MODE PATROL");
+            return CMD_MODE_PATROL;
+        }
+        if (arg1 != NULL && strcmp(arg1, "HOLD") == 0) {
+            reply("ACK", seq, "MODE HOLD");
+            return CMD_MODE_HOLD;
+        }
+        reply("NAK", seq, "MODE");
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "FRAME") == 0) {
+        reply("ACK", seq, "FRAME");
+        return CMD_FRAME;
+    }
+    
+    if (strcmp(verb, "TIME") == 0) {
+        // The tick count now, for the server to line the unit's clock up
+        // with its own (the frame stamps are in ticks)
+        char buffer[24];    // "ACK #65535 TIME tick=", then "4294967295"
+        snprintf(buffer, sizeof(buffer), "ACK #%u TIME tick=", seq);
+        serial_print(buffer);
+        snprintf(buffer, sizeof(buffer), "%lu", (unsigned long)tick_now());
+        serial_println(buffer);
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "RAW") == 0) {
+        if (arg1 != NULL && strcmp(arg1, "ON") == 0) {
+            raw_stream = 1;
+            reply("ACK", seq, "RAW ON");
+            return CMD_NONE;
+        }
+        if (arg1 != NULL && strcmp(arg1, "OFF") == 0) {
+            raw_stream = 0;
+            reply("ACK", seq, "RAW OFF");
+            return CMD_NONE;
+        }
+        reply("NAK", seq, "RAW");
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "SCAN") == 0) {
+        if (arg1 != NULL && strcmp(arg1, "ON") == 0) {
+            scan_stream = 1;
+            reply("ACK", seq, "SCAN ON");
+            return CMD_NONE;
+        }
+        if (arg1 != NULL && strcmp(arg1, "OFF") == 0) {
+            scan_stream = 0;
+            reply("ACK", seq, "SCAN OFF");
+            return CMD_NONE;
+        }
+        reply("NAK", seq, "SCAN");
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "EEPROM") == 0) {
+        // The ACK goes first, then the "EE <line> <base64>" dump
+        reply("ACK", seq, "EEPROM");
+        mlx90640_print_eeprom();
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "PROF") == 0) {
+#ifdef PROFILE
+        if (arg1 != NULL && strcmp(arg1, "RESET") == 0) {
+            prof_reset();
+            reply("ACK", seq, "PROF RESET");
+            return CMD_NONE;
+        }
+        reply("ACK", seq, "PROF");
+        prof_dump();
+#else
+        reply("NAK", seq, "DISABLED");
+#endif
+        return CMD_NONE;
+    }
+    
+    if (strcmp(verb, "RESET") == 0) {
+        reply("ACK", seq, "RESET");
+        return CMD_RESET;
+    }
+    
+    reply("NAK", seq, "CMD");
+    return CMD_NONE;
+}
+
+// The receive buffer overflowed: the line being assembled is not the one
+// that was sent, skip to the next one
+static void line_lost(void) {
+    line_len = 0;
+    line_overflow = LINE_LOST;
+    serial_println("NAK #0 OVERFLOW");
+}
+
+/*
+  command_poll - Consume received bytes and run at most one complete
+  command. Never blocks, so it can be called from every loop iteration.
+*/
+uint8_t command_poll(void) {
+    while (serial_available()) {
+        char ch = serial_in();
+        
+        if (ch == SERIAL_RX_LOST) {
+            line_lost();
+            continue;
+        }
+        
+        if (ch == '\r') {
+            continue;
+        }
+        
+        if (ch != '\n') {
+            if (line_len < COMMAND_LINE_MAX - 1) {
+                line[line_len++] = ch;
+            } else if (!line_overflow) {
+                line_overflow = LINE_LONG;
+            }
+            continue;
+        }
+        
+        // End of line - run the command unless it was truncated
+        line[line_len] = '\0';
+        line_len = 0;
+        
+        if (line_overflow) {
+            if (line_overflow == LINE_LONG) {
+                reply("NAK", 0, "LONG");
+            }
+            line_overflow = 0;
+            continue;
+        }
+        
+        PROF_BEGIN(PROF_COMMAND);
+        uint8_t action = execute(line);
+        PROF_END(PROF_COMMAND);
+        return action;
+    }
+    
+    if (serial_rx_lost()) {
+        line_lost();
+    }
+    return CMD_NONE;
+}
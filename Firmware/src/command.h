@@ -0,0 +1,19 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+// Longest command line accepted, including the optional "#<seq> " prefix
+#define COMMAND_LINE_MAX 40
+
+// Actions the main loop has to carry out after command_poll()
+#define CMD_NONE        0
+#define CMD_FRAME       1   // Acquire and print a single frame
+#define CMD_MODE_PATROL 2   // Resume the scanning patrol
+#define CMD_MODE_HOLD   3   // Stop the motor, keep serving commands
+#define CMD_RESET       4   // Restart the unit
+
+// Command channel functions
+uint8_t command_poll(void);
+
+#endif /* COMMAND_H */
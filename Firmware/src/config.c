@@ -0,0 +1,114 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "config.h"
+
+// Live configuration used by the patrol and alert loops
+struct fireguard_config config;
+uint8_t config_dirty = 0;
+
+// Tunable table, kept in flash to save RAM
+struct config_key {
+    char name[17];
+    uint8_t offset;     // Offset of the field inside struct fireguard_config
+    int16_t min;
+    int16_t max;
+};
+
+#define CONFIG_FIELD(field) ((uint8_t)offsetof(struct fireguard_config, field))
+
+static const struct config_key config_keys[CONFIG_KEY_COUNT] PROGMEM = {
+    { "FIRE_THRESHOLD",   CONFIG_FIELD(fire_threshold),   0, 30000 },
+    { "SCAN_RANGE_STEPS", CONFIG_FIELD(scan_range_steps), 1, 4000 },
+    { "STEPS_PER_CHECK",  CONFIG_FIELD(steps_per_check),  1, 1000 },
+    { "MOTOR_STEP_DELAY", CONFIG_FIELD(motor_step_delay), 0, 1000 },
+    { "FIRE_COL_MIN",     CONFIG_FIELD(fire_col_min),     0, 15 },
+    { "FIRE_COL_MAX",     CONFIG_FIELD(fire_col_max),     0, 15 },
+};
+
+// Load the compile-time defaults
+void config_defaults(void) {
+    config.fire_threshold = FIRE_THRESHOLD;
+    config.scan_range_steps = SCAN_RANGE_STEPS;
+    config.steps_per_check = STEPS_PER_CHECK;
+    config.motor_step_delay = MOTOR_STEP_DELAY;
+    config.fire_col_min = FIRE_COL_MIN;
+    config.fire_col_max = FIRE_COL_MAX;
+}
+
+// Look up a tunable by name, returns its index or -1 if unknown
+int8_t config_find(const char *name) {
+    for (uint8_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        if (strcmp_P(name, config_keys[i].name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Copy the name of a tunable into name (at least 17 bytes)
+void config_name(uint8_t index, char *name) {
+    strcpy_P(name, config_keys[index].name);
+}
+
+static int16_t *config_field(const struct fireguard_config *source, uint8_t index) {
+    uint8_t offset = pgm_read_byte(&config_keys[index].offset);
+    return (int16_t *)((uint8_t *)source + offset);
+}
+
+static int config_in_range(uint8_t index, int16_t value) {
+    int16_t min = (int16_t)pgm_read_word(&config_keys[index].min);
+    int16_t max = (int16_t)pgm_read_word(&config_keys[index].max);
+    
+    return value >= min && value <= max;
+}
+
+// Whether the fields make sense together: the fire column range must not
+// be empty
+static int config_consistent(const struct fireguard_config *candidate) {
+    return candidate->fire_col_min <= candidate->fire_col_max;
+}
+
+int16_t config_get(uint8_t index) {
+    return *config_field(&config, index);
+}
+
+// Set a tunable, returns -1 if the value is out of range and -2 if it
+// conflicts with another tunable (FIRE_COL_MIN above FIRE_COL_MAX)
+int config_set(uint8_t index, int16_t value) {
+    if (!config_in_range(index, value)) {
+        return -1;
+    }
+    
+    struct fireguard_config candidate = config;
+    *config_field(&candidate, index) = value;
+    if (!config_consistent(&candidate)) {
+        return -2;
+    }
+    
+    int16_t *field = config_field(&config, index);
+    if (*field != value) {
+        *field = value;
+        config_dirty = 1;
+    }
+    return 0;
+}
+
+// Take over every in-range field of a stored configuration, keeping the
+// current values if the result would not be consistent
+void config_load(const struct fireguard_config *source) {
+    struct fireguard_config candidate = config;
+    
+    for (uint8_t i = 0; i < CONFIG_KEY_COUNT; i++) {
+        int16_t value = *config_field(source, i);
+        if (config_in_range(i, value)) {
+            *config_field(&candidate, i) = value;
+        }
+    }
+    if (config_consistent(&candidate)) {
+        config = candidate;
+    }
+}
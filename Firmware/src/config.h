@@ -0,0 +1,44 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+// Scanning motion parameters - defaults, changeable at runtime over serial
+#define SCAN_RANGE_STEPS 800   // 120 degrees of motion (approximately)
+#define STEPS_PER_CHECK 20     // Check temperature every 20 steps
+#define MOTOR_STEP_DELAY 10    // Milliseconds between steps to control speed
+
+// Threshold temperature for fire detection (in centidegrees)
+#define FIRE_THRESHOLD 5000  // 50.00°C
+
+// Position constraints for fire confirmation (helps prevent false positives)
+#define FIRE_COL_MIN 13
+#define FIRE_COL_MAX 15
+
+// Runtime tunables, all stored as int16_t so they share one get/set path
+struct fireguard_config {
+    int16_t fire_threshold;
+    int16_t scan_range_steps;
+    int16_t steps_per_check;
+    int16_t motor_step_delay;
+    int16_t fire_col_min;
+    int16_t fire_col_max;
+};
+
+extern struct fireguard_config config;
+
+// Set whenever config_set() changes a value, cleared by the storage code
+extern uint8_t config_dirty;
+
+// Number of entries in the tunable table
+#define CONFIG_KEY_COUNT 6
+
+// Configuration functions
+void config_defaults(void);
+int8_t config_find(const char *name);
+void config_name(uint8_t index, char *name);
+int16_t config_get(uint8_t index);
+int config_set(uint8_t index, int16_t value);
+void config_load(const struct fireguard_config *source);
+
+#endif /* CONFIG_H */
@@ -6,6 +6,7 @@
 #include <util/delay.h>
 
 #include "lcd.h"                // Declarations of the LCD functions
+#include "prof.h"               // Stage timing when built with PROFILE
 
 /* This function not declared in lcd.h since
    should only be used by the routines in this file. */
@@ -23,13 +24,22 @@ void lcd_writenibble(unsigned char);
 */
 void lcd_init(void)
 {
-  
+    _delay_ms(15);              // Delay at least 15ms
+
+    lcd_init_warm();
+}
+
+/*
+  lcd_init_warm - Same as lcd_init, without the 15ms power-on wait. Only
+  use it once the display has had power for at least 15ms, e.g. later in
+  the boot sequence (the AVR start-up time alone is 65ms).
+*/
+void lcd_init_warm(void)
+{
     DDRB |= (CTRL_BITS | (1 << PB7) | (1 << PB1) | (1 << PB2)); // Set the DDR register bits for port B      
     DDRD |= ((1 << PD2) | ENABLE_BIT);                          // Set the DDR register bits for port D
          // Take care not to affect any unnecessary bits
 
-    _delay_ms(15);              // Delay at least 15ms
-
     lcd_writenibble(0x30);      // Use lcd_writenibble to send 0b0011
     _delay_ms(5);               // Delay at least 4msec
 
@@ -68,11 +78,13 @@ void lcd_moveto(unsigned char row, unsigned char col)
 */
 void lcd_stringout(char *str)
 {
+    PROF_BEGIN(PROF_LCD_STRING);
     int i = 0;
     while (str[i] != '\0') {    // Loop until next charater is NULL byte
         lcd_writedata(str[i]);  // Send the character
         i++;
     }
+    PROF_END(PROF_LCD_STRING);
 }
 
 /*
@@ -80,6 +92,7 @@ void lcd_stringout(char *str)
 */
 void lcd_writecommand(unsigned char cmd)
 {
+  PROF_BEGIN(PROF_LCD_COMMAND);
     /* Clear PB0 to 0 for a command transfer */
   PORTB &= ~(1 << PB0);
     /* Call lcd_writenibble to send UPPER four bits of "cmd" argument */
@@ -88,6 +101,7 @@ void lcd_writecommand(unsigned char cmd)
   lcd_writenibble(cmd << 4);
     /* Delay 2ms */
   _delay_ms(2);
+  PROF_END(PROF_LCD_COMMAND);
 }
 
 /*
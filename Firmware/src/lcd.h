@@ -1,4 +1,5 @@
 void lcd_init(void);
+void lcd_init_warm(void);
 void lcd_moveto(unsigned char, unsigned char);
 void lcd_stringout(char *);
 void lcd_writecommand(unsigned char);
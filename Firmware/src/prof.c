@@ -0,0 +1,106 @@
+/*
+  prof.c - Hot path profiler
+
+  Build with "make PROFILE=1" to enable. Stages are timed with the Timer0
+  time base and collected in a fixed table of count/min/max/total ticks.
+  The table is printed every PROF_DUMP_INTERVAL_MS and on the PROF
+  command, one line per stage that has run:
+
+      PROF <stage> n=<count> min=<us> avg=<us> max=<us>
+      PROF END
+
+  The total saturates rather than wraps, so once a stage has run for
+  2^32 ticks (10 hours) in one table, avg is a lower bound.
+*/
+
+#ifdef PROFILE
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "I2C.h"
+#include "tick.h"
+#include "prof.h"
+
+struct prof_stage {
+    uint32_t total;   // Sum of all durations, in ticks, saturated
+    uint32_t min;
+    uint32_t max;
+    uint16_t count;
+};
+
+static struct prof_stage prof_table[PROF_STAGE_COUNT];
+static uint32_t prof_dumped_ms = 0;
+
+// Stage names, same order as the PROF_* numbers
+static const char prof_names[PROF_STAGE_COUNT][14] PROGMEM = {
+    "patrol_step",
+    "status_format",
+    "mlx_read",
+    "matrix_print",
+    "distance",
+    "buzzer",
+    "lcd_string",
+    "lcd_command",
+    "alert_cycle",
+    "command",
+};
+
+void prof_record(uint8_t stage, uint32_t ticks) {
+    struct prof_stage *entry = &prof_table[stage];
+    
+    // Start over rather than let the average overflow
+    if (entry->count == 0xFFFF) {
+        memset(entry, 0, sizeof(*entry));
+    }
+    
+    if (entry->count == 0 || ticks < entry->min) {
+        entry->min = ticks;
+    }
+    if (ticks > entry->max) {
+        entry->max = ticks;
+    }
+    entry->total = entry->total > UINT32_MAX - ticks ? UINT32_MAX : entry->total + ticks;
+    entry->count++;
+}
+
+void prof_reset(void) {
+    memset(prof_table, 0, sizeof(prof_table));
+}
+
+void prof_dump(void) {
+    char name[14];
+    char buffer[56];   // " n=65535" and three " xxx=4294967295", 54 with the NUL
+    
+    for (uint8_t i = 0; i < PROF_STAGE_COUNT; i++) {
+        struct prof_stage *entry = &prof_table[i];
+        if (entry->count == 0) {
+            continue;
+        }
+        
+        strcpy_P(name, prof_names[i]);
+        serial_print("PROF ");
+        serial_print(name);
+        snprintf(buffer, sizeof(buffer), " n=%u min=%lu avg=%lu max=%lu", entry->count,
+                 (unsigned long)TICKS_TO_US(entry->min),
+                 (unsigned long)TICKS_TO_US(entry->total / entry->count),
+                 (unsigned long)TICKS_TO_US(entry->max));
+        serial_println(buffer);
+    }
+    serial_println("PROF END");
+    
+    prof_dumped_ms = tick_millis();
+}
+
+// Dump the table every PROF_DUMP_INTERVAL_MS, call from the main loop
+void prof_service(void) {
+    if (tick_millis() - prof_dumped_ms >= PROF_DUMP_INTERVAL_MS) {
+        prof_dump();
+    }
+}
+
+#endif /* PROFILE */
@@ -0,0 +1,45 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+// Profiled stages, one row each in the statistics table
+#define PROF_PATROL_STEP   0   // One motor step including the step delay
+#define PROF_STATUS_FORMAT 1   // Formatting and sending the status line
+#define PROF_MLX_READ      2   // mlx90640_read_center_region()
+#define PROF_MATRIX_PRINT  3   // print_center_matrix()
+#define PROF_DISTANCE      4   // measure_distance()
+#define PROF_BUZZER        5   // buzzer_warning()
+#define PROF_LCD_STRING    6   // lcd_stringout()
+#define PROF_LCD_COMMAND   7   // lcd_writecommand()
+#define PROF_ALERT_CYCLE   8   // One pass of the alert loop
+#define PROF_COMMAND       9   // Running one serial command
+#define PROF_STAGE_COUNT   10
+
+// How often the table is dumped on its own
+#define PROF_DUMP_INTERVAL_MS 10000
+
+#ifdef PROFILE
+
+#include "tick.h"
+
+// Mark the start and end of a stage inside one function
+#define PROF_BEGIN(stage) uint32_t prof_start_##stage = tick_now()
+#define PROF_END(stage) prof_record(stage, tick_now() - prof_start_##stage)
+#define PROF_SERVICE() prof_service()
+
+void prof_record(uint8_t stage, uint32_t ticks);
+void prof_service(void);
+void prof_dump(void);
+void prof_reset(void);
+
+#else
+
+// Compiled out: no code, no RAM
+#define PROF_BEGIN(stage)
+#define PROF_END(stage)
+#define PROF_SERVICE()
+
+#endif /* PROFILE */
+
+#endif /* PROF_H */
@@ -20,12 +20,17 @@
 // Define delay as a constant for _delay_us to work properly
 #define STEP_DELAY_US 2000
 
+int16_t pan_position = 0;
+// Direction the bottom motor steps in, for pan_position
+static bool stepping_clockwise = false;
+
 void setup_pins() {
     // Configure only the pins we control in software as outputs
     DDRC |= (1 << STEP_PIN_BTM) | (1 << STEP_PIN_TOP) | (1 << DIR_PIN);
 }
 
 void set_stepper_direction(bool move_clockwise) {
+    stepping_clockwise = move_clockwise;
     if (move_clockwise) {
         PORTC |= (1 << DIR_PIN);
     } else {
@@ -52,6 +57,7 @@ void move_bottom_stepper_once() {
     _delay_us(STEP_DELAY_US);
     PORTC &= ~(1 << STEP_PIN_BTM);  // Step LOW
     _delay_us(STEP_DELAY_US);
+    pan_position += stepping_clockwise ? 1 : -1;
 }
 
 // Main function - only include when not compiled as a library
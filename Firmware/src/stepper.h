@@ -2,6 +2,7 @@
 #define STEPPER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 // EasyDriver pin mappings
 #define STEP_PIN_BTM    PC1
@@ -9,6 +10,11 @@
 #define DIR_PIN         PC3
 #define STEP_DELAY_US   2000
 
+// Pan position in steps, clockwise positive, counted by
+// move_bottom_stepper_once() from where the unit powered up (or from the
+// position restored on a warm start)
+extern int16_t pan_position;
+
 // Stepper motor functions
 void setup_pins(void);
 void set_stepper_direction(bool move_clockwise);
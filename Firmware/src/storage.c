@@ -0,0 +1,217 @@
+/*
+  storage.c - Configuration and warm start state in the AVR EEPROM
+
+  EEPROM layout:
+    0x000  Configuration block: magic, version, payload size, the
+           fireguard_config payload and a CRC-16 over all of it
+    0x040  Ring of warm state records, each with an 8-bit sequence
+           number and a CRC-8. A new record goes to the slot after the
+           newest one, so every cell sees only 1/STATE_SLOTS of the writes.
+
+  All writes use eeprom_update_*, which skips bytes that did not change.
+*/
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "config.h"
+#include "tick.h"
+#include "storage.h"
+
+#define CONFIG_MAGIC 0x4647   // "FG"
+#define CONFIG_ADDR  0x000
+#define STATE_ADDR   0x040
+
+struct config_header {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t size;      // Payload size, must match for the version too
+};
+
+struct state_record {
+    int16_t current_step;
+    uint8_t seq;
+    uint8_t flags;
+    uint8_t reserved;      // Was the reference row, which is not kept any more
+    uint8_t crc;
+};
+
+#define STATE_FLAG_FORWARD 0x01
+#define STATE_FLAG_HOLD    0x02
+
+#define STATE_SLOTS ((E2END + 1 - STATE_ADDR) / sizeof(struct state_record))
+
+static uint32_t config_changed_ms = 0;
+static bool config_pending = false;
+
+static uint8_t state_next_slot = 0;
+static uint8_t state_next_seq = 0;
+static uint32_t state_saved_ms = 0;
+static struct state_record state_saved;
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        crc = _crc_ccitt_update(crc, data[i]);
+    }
+    return crc;
+}
+
+static uint8_t crc8(const uint8_t *data, uint8_t length) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < length; i++) {
+        crc = _crc8_ccitt_update(crc, data[i]);
+    }
+    return crc;
+}
+
+static struct state_record *state_addr(uint8_t slot) {
+    return (struct state_record *)(STATE_ADDR + slot * sizeof(struct state_record));
+}
+
+static bool state_read(uint8_t slot, struct state_record *record) {
+    eeprom_read_block(record, state_addr(slot), sizeof(*record));
+    return crc8((const uint8_t *)record, sizeof(*record) - 1) == record->crc;
+}
+
+/*
+  storage_load_config - Replace the defaults in config with the stored
+  block. Returns 0 on success, -1 if there is no valid block or it was
+  written with another layout (STORAGE_CONFIG_VERSION), in which case the
+  defaults stay and the next change overwrites it.
+*/
+int storage_load_config(void) {
+    struct config_header header;
+    struct fireguard_config stored;
+    uint16_t crc;
+    
+    eeprom_read_block(&header, (const void *)CONFIG_ADDR, sizeof(header));
+    if (header.magic != CONFIG_MAGIC || header.version != STORAGE_CONFIG_VERSION ||
+        header.size != sizeof(stored)) {
+        return -1;
+    }
+    
+    eeprom_read_block(&stored, (const void *)(CONFIG_ADDR + sizeof(header)), header.size);
+    eeprom_read_block(&crc, (const void *)(CONFIG_ADDR + sizeof(header) + header.size), sizeof(crc));
+    
+    uint16_t expected = crc16(0xFFFF, (const uint8_t *)&header, sizeof(header));
+    expected = crc16(expected, (const uint8_t *)&stored, header.size);
+    if (crc != expected) {
+        return -1;
+    }
+    
+    // Out of range fields keep their defaults
+    config_load(&stored);
+    return 0;
+}
+
+static void storage_save_config(void) {
+    struct config_header header = { CONFIG_MAGIC, STORAGE_CONFIG_VERSION, sizeof(config) };
+    
+    uint16_t crc = crc16(0xFFFF, (const uint8_t *)&header, sizeof(header));
+    crc = crc16(crc, (const uint8_t *)&config, sizeof(config));
+    
+    eeprom_update_block(&header, (void *)CONFIG_ADDR, sizeof(header));
+    eeprom_update_block(&config, (void *)(CONFIG_ADDR + sizeof(header)), sizeof(config));
+    eeprom_update_block(&crc, (void *)(CONFIG_ADDR + sizeof(header) + sizeof(config)), sizeof(crc));
+}
+
+/*
+  storage_service - Write the configuration once it has been left alone
+  for STORAGE_CONFIG_DELAY_MS. Call regularly from the main loop.
+*/
+void storage_service(void) {
+    uint32_t now = tick_millis();
+    
+    if (config_dirty) {
+        config_dirty = 0;
+        config_pending = true;
+        config_changed_ms = now;
+    }
+    
+    if (config_pending && now - config_changed_ms >= STORAGE_CONFIG_DELAY_MS) {
+        config_pending = false;
+        storage_save_config();
+    }
+}
+
+/*
+  storage_load_state - Find the newest valid warm state record. The valid
+  records form one run of consecutive sequence numbers, the newest is the
+  one whose successor slot breaks the run. Returns -1 if there is none.
+*/
+int storage_load_state(struct warm_state *state) {
+    struct state_record record, next;
+    int16_t newest = -1;
+    bool valid = state_read(0, &record);
+    bool first_valid = valid;
+    struct state_record first = record;
+    
+    for (uint8_t slot = 0; slot < STATE_SLOTS; slot++) {
+        bool next_valid;
+        
+        if (slot + 1 < STATE_SLOTS) {
+            next_valid = state_read(slot + 1, &next);
+        } else {
+            next_valid = first_valid;
+            next = first;
+        }
+        
+        if (valid && (!next_valid || next.seq != (uint8_t)(record.seq + 1))) {
+            newest = slot;
+            break;
+        }
+        
+        valid = next_valid;
+        record = next;
+    }
+    
+    if (newest < 0) {
+        return -1;
+    }
+    
+    state_next_slot = (newest + 1) % STATE_SLOTS;
+    state_next_seq = record.seq + 1;
+    state_saved = record;
+    
+    state->current_step = record.current_step;
+    state->scanning_forward = (record.flags & STATE_FLAG_FORWARD) != 0;
+    state->hold_mode = (record.flags & STATE_FLAG_HOLD) != 0;
+    return 0;
+}
+
+/*
+  storage_save_state - Append a warm state record if the state changed
+  and STORAGE_STATE_INTERVAL_MS has passed since the last one, or right
+  away when force is set (mode changes, alerts, resets).
+*/
+void storage_save_state(const struct warm_state *state, bool force) {
+    uint32_t now = tick_millis();
+    struct state_record record;
+    
+    if (!force && now - state_saved_ms < STORAGE_STATE_INTERVAL_MS) {
+        return;
+    }
+    
+    record.current_step = state->current_step;
+    record.flags = (state->scanning_forward ? STATE_FLAG_FORWARD : 0) |
+                   (state->hold_mode ? STATE_FLAG_HOLD : 0);
+    record.reserved = 0;
+    
+    // Nothing new to record
+    if (record.current_step == state_saved.current_step &&
+        record.flags == state_saved.flags) {
+        return;
+    }
+    
+    record.seq = state_next_seq;
+    record.crc = crc8((const uint8_t *)&record, sizeof(record) - 1);
+    eeprom_update_block(&record, state_addr(state_next_slot), sizeof(record));
+    
+    state_saved = record;
+    state_saved_ms = now;
+    state_next_seq++;
+    state_next_slot = (state_next_slot + 1) % STATE_SLOTS;
+}
@@ -0,0 +1,37 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Layout version of the configuration block, bump when fields change
+#define STORAGE_CONFIG_VERSION 1
+
+// Delay before a changed configuration is written, so that a burst of
+// SET commands ends up as a single EEPROM write
+#define STORAGE_CONFIG_DELAY_MS 2000
+
+// Minimum time between two periodic warm state records. They are taken
+// at check positions and at every reversal, so a warm start resumes at a
+// check position in the right direction, but up to one interval of patrol
+// behind where the motor stopped: about 6 checks, 120 of the 800 steps,
+// with the default tunables. There is no home switch to correct it. A
+// record at every check (~0.86 s) would wear out the ring's cells
+// (100k writes each, 160 slots) within half a year; at 5 s it lasts
+// about two and a half years of continuous patrol.
+#define STORAGE_STATE_INTERVAL_MS 5000
+
+// Warm start state, saved as a small record in a wear levelled ring
+struct warm_state {
+    int16_t current_step;
+    bool scanning_forward;
+    bool hold_mode;
+};
+
+// EEPROM storage functions
+int storage_load_config(void);
+void storage_service(void);
+int storage_load_state(struct warm_state *state);
+void storage_save_state(const struct warm_state *state, bool force);
+
+#endif /* STORAGE_H */
@@ -0,0 +1,154 @@
+/*
+  thermal.c - Scalar frame processing, the reference implementation
+
+  Written for the AVR (no allocation, 16 bit indices) and compiled as is
+  into the host library, where the SIMD kernels are checked against it.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "thermal.h"
+
+uint16_t thermal_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max) {
+    uint16_t clamped = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        if (frame[i] < min) {
+            frame[i] = min;
+            clamped++;
+        } else if (frame[i] > max) {
+            frame[i] = max;
+            clamped++;
+        }
+    }
+    return clamped;
+}
+
+void thermal_mask_bad(int16_t *frame, const uint8_t *mask, uint8_t rows, uint8_t cols) {
+    for (uint8_t r = 0; r < rows; r++) {
+        for (uint8_t c = 0; c < cols; c++) {
+            uint16_t i = (uint16_t)r * cols + c;
+            if (!mask[i]) {
+                continue;
+            }
+
+            int32_t sum = 0;
+            int8_t count = 0;
+            if (r > 0 && !mask[i - cols]) { sum += frame[i - cols]; count++; }
+            if (r + 1 < rows && !mask[i + cols]) { sum += frame[i + cols]; count++; }
+            if (c > 0 && !mask[i - 1]) { sum += frame[i - 1]; count++; }
+            if (c + 1 < cols && !mask[i + 1]) { sum += frame[i + 1]; count++; }
+
+            if (count > 0) {
+                frame[i] = (int16_t)(sum / count);
+            }
+        }
+    }
+}
+
+int16_t thermal_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index) {
+    int16_t max = INT16_MIN;
+    uint16_t at = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        if (frame[i] > max && frame[i] < limit) {
+            max = frame[i];
+            at = i;
+        }
+    }
+
+    *index = at;
+    return max;
+}
+
+void thermal_blob(const int16_t *frame, uint8_t rows, uint8_t cols, int16_t threshold,
+                  struct thermal_blob *blob) {
+    memset(blob, 0, sizeof(*blob));
+    blob->min_row = 0xFF;
+    blob->min_col = 0xFF;
+
+    for (uint8_t r = 0; r < rows; r++) {
+        for (uint8_t c = 0; c < cols; c++) {
+            if (frame[(uint16_t)r * cols + c] < threshold) {
+                continue;
+            }
+            blob->count++;
+            blob->sum_row += r;
+            blob->sum_col += c;
+            if (r < blob->min_row) blob->min_row = r;
+            if (r > blob->max_row) blob->max_row = r;
+            if (c < blob->min_col) blob->min_col = c;
+            if (c > blob->max_col) blob->max_col = c;
+        }
+    }
+}
+
+// (a + 2b + c + 2) >> 2 in 32 bits, so no sum can overflow
+static int16_t smooth(int16_t a, int16_t b, int16_t c) {
+    return (int16_t)(((int32_t)a + 2 * (int32_t)b + c + 2) >> 2);
+}
+
+void thermal_filter(const int16_t *in, int16_t *out, uint8_t rows, uint8_t cols) {
+    int16_t above[THERMAL_MAX_COLS];
+    int16_t here[THERMAL_MAX_COLS];
+
+    if (cols > THERMAL_MAX_COLS || rows == 0 || cols == 0) {
+        return;
+    }
+
+    // Horizontal pass into out
+    for (uint8_t r = 0; r < rows; r++) {
+        const int16_t *row = &in[(uint16_t)r * cols];
+        int16_t *dest = &out[(uint16_t)r * cols];
+        for (uint8_t c = 0; c < cols; c++) {
+            int16_t left = row[c > 0 ? c - 1 : 0];
+            int16_t right = row[c + 1 < cols ? c + 1 : cols - 1];
+            dest[c] = smooth(left, row[c], right);
+        }
+    }
+
+    // Vertical pass in place, keeping the unfiltered row above
+    memcpy(above, out, cols * sizeof(int16_t));
+    for (uint8_t r = 0; r < rows; r++) {
+        int16_t *row = &out[(uint16_t)r * cols];
+        const int16_t *below = &out[(uint16_t)(r + 1 < rows ? r + 1 : r) * cols];
+        memcpy(here, row, cols * sizeof(int16_t));
+        for (uint8_t c = 0; c < cols; c++) {
+            row[c] = smooth(above[c], here[c], below[c]);
+        }
+        memcpy(above, here, cols * sizeof(int16_t));
+    }
+}
+
+uint16_t thermal_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                              uint8_t *out) {
+    uint16_t length = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        int32_t delta = (int32_t)frame[i] - previous[i];
+        if (delta >= -THERMAL_DELTA_MAX && delta <= THERMAL_DELTA_MAX) {
+            out[length++] = (uint8_t)(int8_t)delta;
+        } else {
+            out[length++] = (uint8_t)THERMAL_DELTA_ESCAPE;
+            out[length++] = (uint8_t)frame[i];
+            out[length++] = (uint8_t)((uint16_t)frame[i] >> 8);
+        }
+    }
+    return length;
+}
+
+uint16_t thermal_delta_decode(int16_t *frame, uint16_t n, const uint8_t *in) {
+    uint16_t length = 0;
+
+    for (uint16_t i = 0; i < n; i++) {
+        int8_t delta = (int8_t)in[length++];
+        if (delta == THERMAL_DELTA_ESCAPE) {
+            frame[i] = (int16_t)(in[length] | ((uint16_t)in[length + 1] << 8));
+            length += 2;
+        } else {
+            frame[i] = (int16_t)(frame[i] + delta);
+        }
+    }
+    return length;
+}
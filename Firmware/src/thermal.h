@@ -0,0 +1,61 @@
+#ifndef THERMAL_H
+#define THERMAL_H
+
+#include <stdint.h>
+
+/*
+  thermal.h - Frame processing core shared by the firmware and the host
+
+  Frames are row major int16_t in centidegrees. This scalar code is the
+  reference: the host backend (Firmware/host/thermal_host.c) must give
+  bit-identical results.
+*/
+
+// Widest frame the filter handles (the full sensor is 32 columns)
+#define THERMAL_MAX_COLS 32
+
+// Delta encoding: one signed byte per pixel, or this escape byte followed
+// by the absolute value as two little-endian bytes
+#define THERMAL_DELTA_ESCAPE ((int8_t)-128)
+#define THERMAL_DELTA_MAX 127
+
+// Worst case size of a delta encoded frame of n pixels
+#define THERMAL_DELTA_BOUND(n) ((n) * 3)
+
+// Pixels at or above a threshold: count, bounding box and centroid sums
+struct thermal_blob {
+    uint16_t count;
+    uint8_t min_row;
+    uint8_t max_row;
+    uint8_t min_col;
+    uint8_t max_col;
+    uint32_t sum_row;       // Centroid row = sum_row / count
+    uint32_t sum_col;
+};
+
+// Clamp every pixel into [min, max], returns how many were out of range
+uint16_t thermal_validate(int16_t *frame, uint16_t n, int16_t min, int16_t max);
+
+// Replace pixels whose mask byte is set with the mean of their unmasked
+// 4-neighbours (truncated), left as is when they have none
+void thermal_mask_bad(int16_t *frame, const uint8_t *mask, uint8_t rows, uint8_t cols);
+
+// Largest pixel strictly below limit, first one in row major order.
+// Returns INT16_MIN with index 0 when there is none.
+int16_t thermal_max(const int16_t *frame, uint16_t n, int16_t limit, uint16_t *index);
+
+// Statistics of the pixels at or above threshold
+void thermal_blob(const int16_t *frame, uint8_t rows, uint8_t cols, int16_t threshold,
+                  struct thermal_blob *blob);
+
+// 1-2-1 smoothing in both directions, edges repeated, rounded half up
+void thermal_filter(const int16_t *in, int16_t *out, uint8_t rows, uint8_t cols);
+
+// Encode frame against previous, returns the number of bytes written
+uint16_t thermal_delta_encode(const int16_t *frame, const int16_t *previous, uint16_t n,
+                              uint8_t *out);
+
+// Decode into frame (holding the previous frame), returns bytes consumed
+uint16_t thermal_delta_decode(int16_t *frame, uint16_t n, const uint8_t *in);
+
+#endif /* THERMAL_H */
@@ -0,0 +1,61 @@
+/*
+  tick.c - Free running time base on Timer0
+
+  Timer1 is used by the ultrasonic echo capture and Timer2 drives the
+  servo PWM, so Timer0 is left to count time for everything else.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#include "tick.h"
+
+volatile uint32_t tick_overflows = 0;   // Timer0 overflows since tick_init()
+volatile uint32_t tick_ms = 0;          // Milliseconds since tick_init()
+volatile uint8_t tick_frac = 0;         // Ninths of a millisecond
+
+// Timer0 overflow - every 256 ticks, i.e. 2 2/9 milliseconds
+ISR(TIMER0_OVF_vect) {
+    tick_overflows++;
+    tick_ms += 2;
+    tick_frac += 2;
+    if (tick_frac >= 9) {
+        tick_frac -= 9;
+        tick_ms++;
+    }
+}
+
+void tick_init(void) {
+    // Normal mode, prescaler 64, overflow interrupt on
+    TCCR0A = 0;
+    TCCR0B = (1 << CS01) | (1 << CS00);
+    TCNT0 = 0;
+    TIMSK0 |= (1 << TOIE0);
+}
+
+// Current time in ticks, wraps after about ten hours
+uint32_t tick_now(void) {
+    uint8_t sreg = SREG;
+    cli();
+    
+    uint32_t overflows = tick_overflows;
+    uint8_t count = TCNT0;
+    
+    // Account for an overflow that happened while interrupts were off
+    if ((TIFR0 & (1 << TOV0)) && count < 255) {
+        overflows++;
+    }
+    
+    SREG = sreg;
+    return (overflows << 8) | count;
+}
+
+// Current time in milliseconds
+uint32_t tick_millis(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint32_t ms = tick_ms;
+    SREG = sreg;
+    return ms;
+}
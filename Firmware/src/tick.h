@@ -0,0 +1,20 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include <stdint.h>
+
+// Timer0 runs free with a prescaler of 64: one tick is 64 CPU cycles,
+// 8.68us at 7.3728MHz, and the counter overflows every 20/9 ms
+#define TICK_PRESCALER 64
+
+// Convert a tick count to microseconds (625/72 us per tick). Whole units
+// of 72 ticks first, so nothing overflows below 2^32 us (71 minutes);
+// t * 625 alone would wrap past 59 seconds. t is evaluated twice.
+#define TICKS_TO_US(t) ((uint32_t)((uint32_t)(t) / 72UL * 625UL + (uint32_t)(t) % 72UL * 625UL / 72UL))
+
+// Time base functions
+void tick_init(void);
+uint32_t tick_now(void);
+uint32_t tick_millis(void);
+
+#endif /* TICK_H */
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <avr/interrupt.h>
 #include "ultrasonic.h"
+#include "prof.h"
 
 #ifndef F_CPU
 #define F_CPU 7372800UL 
@@ -160,6 +161,9 @@ void trigger_measurement(void) {
 
 // Measure distance with ultrasonic sensor
 float measure_distance(void) {
+    PROF_BEGIN(PROF_DISTANCE);
+    float distance;
+    
     // Reset flags
     echo_complete = 0;
     timeout = 0;
@@ -176,10 +180,13 @@ float measure_distance(void) {
     
     // Calculate distance based on pulse width
     if (timeout || timeout_counter >= 30000) {
-        return MAX_DISTANCE;
+        distance = MAX_DISTANCE;
     } else {
-        return calculate_distance(pulse_width);
+        distance = calculate_distance(pulse_width);
     }
+    
+    PROF_END(PROF_DISTANCE);
+    return distance;
 }
 
 
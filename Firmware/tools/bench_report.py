@@ -0,0 +1,65 @@
+"""Summarise and compare reports printed by the bench firmware (make bench).
+
+Capture the serial output of a bench run to a file, then:
+
+    python bench_report.py after.log                     # print the report
+    python bench_report.py after.log --baseline before.log   # show the change per benchmark
+
+Lines that do not start with "BENCH name=" (matrix dumps, sensor messages)
+are ignored, so the raw serial capture can be used as is.
+"""
+import argparse
+import sys
+
+def parse_report(lines):
+    """Return {name: {field: value}} for every BENCH result line"""
+    results = {}
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("BENCH name="):
+            continue
+        fields = {}
+        for part in line.split()[1:]:
+            key, _, value = part.partition("=")
+            try:
+                fields[key] = int(value)
+            except ValueError:
+                fields[key] = value
+        results[fields.pop("name")] = fields
+    return results
+
+def load(path):
+    if path == "-":
+        return parse_report(sys.stdin)
+    with open(path, encoding="utf-8", errors="replace") as f:
+        return parse_report(f)
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard on-target benchmark report")
+    parser.add_argument("report", help="captured serial output of the bench firmware ('-' for stdin)")
+    parser.add_argument("--baseline", help="earlier capture to compare against")
+    args = parser.parse_args()
+
+    current = load(args.report)
+    baseline = load(args.baseline) if args.baseline else {}
+    if not current:
+        print("No BENCH lines found", file=sys.stderr)
+        return 1
+
+    header = f"{'benchmark':<18} {'iters':>5} {'min':>10} {'avg':>10} {'max':>10} {'avg us':>9}"
+    if baseline:
+        header += f" {'base avg':>10} {'change':>8}"
+    print(header)
+    for name, r in current.items():
+        row = f"{name:<18} {r['iters']:>5} {r['min']:>10} {r['avg']:>10} {r['max']:>10} {r['avg_us']:>9}"
+        base = baseline.get(name)
+        if base and base.get("avg"):
+            change = (r["avg"] - base["avg"]) * 100.0 / base["avg"]
+            row += f" {base['avg']:>10} {change:>+7.1f}%"
+        if r.get("overflows"):
+            row += f"  ({r['overflows']} runs overflowed Timer1, left out)"
+        print(row)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
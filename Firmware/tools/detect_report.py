@@ -0,0 +1,90 @@
+"""Summarise and compare detection benchmark runs (Firmware/host/detect_bench).
+
+Save the output of a run to a file, then:
+
+    python detect_report.py after.log                        # print the report
+    python detect_report.py after.log --baseline before.log  # show the change per scene
+
+Times are from fire onset in the scene. Scenes without a fire only count
+towards the false positives and frame rates.
+"""
+import argparse
+import sys
+
+def parse_report(lines):
+    """Return {scene: {field: value}} for every DETECT result line"""
+    results = {}
+    for line in lines:
+        line = line.strip()
+        if not line.startswith("DETECT name="):
+            continue
+        fields = {}
+        for part in line.split()[1:]:
+            key, _, value = part.partition("=")
+            try:
+                fields[key] = int(value)
+            except ValueError:
+                fields[key] = value
+        results[fields.pop("name")] = fields
+    return results
+
+def load(path):
+    if path == "-":
+        return parse_report(sys.stdin)
+    with open(path, encoding="utf-8", errors="replace") as f:
+        return parse_report(f)
+
+def seconds(ms):
+    return "-" if ms < 0 else f"{ms / 1000:.1f}"
+
+def summary(results):
+    """Detection rate, mean times over detected fires, false positives and frame rates"""
+    ttd = [r["ttd_ms"] for r in results.values() if r["ttd_ms"] >= 0]
+    ttl = [r["ttl_ms"] for r in results.values() if r["ttl_ms"] >= 0]
+    frames = sum(r["frames"] for r in results.values())
+    return {
+        "detected": sum(r["detected"] for r in results.values()),
+        "ttd": sum(ttd) / len(ttd) if ttd else -1,
+        "ttl": sum(ttl) / len(ttl) if ttl else -1,
+        "fp": sum(r["fp"] for r in results.values()),
+        "fp_per_1k": sum(r["fp"] for r in results.values()) * 1000 / frames if frames else 0,
+        "fps": sum(r["fps_x100"] for r in results.values()) / 100 / len(results),
+    }
+
+def main():
+    parser = argparse.ArgumentParser(description="FireGuard detection benchmark report")
+    parser.add_argument("report", help="output of detect_bench ('-' for stdin)")
+    parser.add_argument("--baseline", help="earlier run to compare against")
+    args = parser.parse_args()
+
+    current = load(args.report)
+    baseline = load(args.baseline) if args.baseline else {}
+    if not current:
+        print("No DETECT lines found", file=sys.stderr)
+        return 1
+
+    header = f"{'scene':<20} {'found':>5} {'ttd s':>7} {'ttl s':>7} {'fp':>4} {'frames':>6} {'fps':>6}"
+    if baseline:
+        header += f" {'base ttd':>8} {'base fp':>7}"
+    print(header)
+    for name, r in current.items():
+        row = (f"{name:<20} {'yes' if r['detected'] else 'no':>5} {seconds(r['ttd_ms']):>7} "
+               f"{seconds(r['ttl_ms']):>7} {r['fp']:>4} {r['frames']:>6} {r['fps_x100'] / 100:>6.2f}")
+        base = baseline.get(name)
+        if base:
+            row += f" {seconds(base['ttd_ms']):>8} {base['fp']:>7}"
+        print(row)
+
+    s = summary(current)
+    print(f"\ndetected {s['detected']}, mean time to detect {seconds(s['ttd'])} s, "
+          f"to lock {seconds(s['ttl'])} s, {s['fp']} false positives "
+          f"({s['fp_per_1k']:.1f} per 1000 frames), {s['fps']:.2f} frames/s")
+    if baseline:
+        b = summary(baseline)
+        print(f"baseline: detected {b['detected']}, mean time to detect {seconds(b['ttd'])} s, "
+              f"to lock {seconds(b['ttl'])} s, {b['fp']} false positives "
+              f"({b['fp_per_1k']:.1f} per 1000 frames), {b['fps']:.2f} frames/s")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())